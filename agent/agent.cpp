@@ -0,0 +1,292 @@
+#include "../include/agent.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+namespace {
+
+auto register_value(const agent_registers *regs, std::int32_t index) noexcept
+    -> std::uint64_t {
+  if (index == agent_base_rsp) {
+    return reinterpret_cast<std::uint64_t>(regs + 1) + agent_red_zone;
+  }
+  return reinterpret_cast<const std::uint64_t *>(regs)[index];
+}
+
+// Reads memory that may not be mapped, with a raw system call
+auto read_checked(std::int32_t pid, std::uint64_t address, void *buffer,
+                  std::size_t size) noexcept -> bool {
+  iovec local{buffer, size};
+  iovec remote{reinterpret_cast<void *>(address), size};
+  long result;
+  register iovec *remote_iov asm("r10") = &remote;
+  register long remote_count asm("r8") = 1;
+  register long flags asm("r9") = 0;
+  asm volatile("syscall"
+               : "=a"(result)
+               : "0"(long{SYS_process_vm_readv}), "D"(long{pid}), "S"(&local),
+                 "d"(1L), "r"(remote_iov), "r"(remote_count), "r"(flags)
+               : "rcx", "r11", "memory");
+  return result == static_cast<long>(size);
+}
+
+auto collect(const agent_site *site, const agent_registers *regs,
+             agent_record &record) noexcept -> void {
+  std::size_t size = 0;
+  record.unreadable = 0;
+  for (std::uint32_t i = 0; i < site->collects; ++i) {
+    const auto &range = site->collect[i];
+    auto address = static_cast<std::uint64_t>(range.offset);
+    auto count = range.size < agent_record_data - size
+                     ? range.size
+                     : agent_record_data - size;
+
+    // An absolute range may have been unmapped since it was checked, so it
+    // is read with a call that fails rather than faults
+    if (range.base < 0) {
+      if (!read_checked(site->pid, address, record.data + size, count)) {
+        record.unreadable |= 1u << i;
+      }
+      size += count;
+      continue;
+    }
+
+    address += register_value(regs, range.base);
+    auto from = reinterpret_cast<const std::uint8_t *>(address);
+    for (std::size_t j = 0; j < count; ++j) {
+      record.data[size++] = from[j];
+    }
+  }
+  record.size = static_cast<std::uint32_t>(size);
+}
+
+auto extend(std::uint64_t value, std::uint8_t size, bool is_signed) noexcept
+    -> std::uint64_t {
+  if (size >= 8) {
+    return value;
+  }
+  auto bits = size * 8u;
+  auto mask = (std::uint64_t{1} << bits) - 1;
+  value &= mask;
+  if (is_signed && (value >> (bits - 1)) != 0) {
+    value |= ~mask;
+  }
+  return value;
+}
+
+auto compare(const agent_insn &insn, std::uint64_t lhs,
+             std::uint64_t rhs) noexcept -> bool {
+  auto slhs = static_cast<std::int64_t>(lhs);
+  auto srhs = static_cast<std::int64_t>(rhs);
+  switch (insn.op) {
+  case agent_op::eq:
+    return lhs == rhs;
+  case agent_op::ne:
+    return lhs != rhs;
+  case agent_op::lt:
+    return insn.is_signed ? slhs < srhs : lhs < rhs;
+  case agent_op::le:
+    return insn.is_signed ? slhs <= srhs : lhs <= rhs;
+  case agent_op::gt:
+    return insn.is_signed ? slhs > srhs : lhs > rhs;
+  default:
+    return insn.is_signed ? slhs >= srhs : lhs >= rhs;
+  }
+}
+
+// Runs the condition of a site. Conditions that fail, by dividing by zero or
+// reading unmapped memory, hold so that the debugger sees the error.
+auto condition_holds(const agent_site *site,
+                     const agent_registers *regs) noexcept -> bool {
+  std::uint64_t stack[agent_max_stack];
+  std::size_t depth = 0;
+  for (std::uint32_t pc = 0; pc < site->insns; ++pc) {
+    const auto &insn = site->condition[pc];
+    if (insn.op == agent_op::end) {
+      break;
+    }
+
+    switch (insn.op) {
+    case agent_op::constant:
+    case agent_op::reg:
+      if (depth == agent_max_stack) {
+        return true;
+      }
+      stack[depth++] =
+          insn.op == agent_op::constant
+              ? static_cast<std::uint64_t>(insn.arg)
+              : register_value(regs, static_cast<std::int32_t>(insn.arg));
+      continue;
+    case agent_op::and_jump:
+    case agent_op::or_jump: {
+      if (depth == 0) {
+        return true;
+      }
+      auto taken = (stack[depth - 1] != 0) == (insn.op == agent_op::or_jump);
+      if (taken) {
+        stack[depth - 1] = insn.op == agent_op::or_jump ? 1 : 0;
+        pc = static_cast<std::uint32_t>(insn.arg) - 1;
+      } else {
+        --depth;
+      }
+      continue;
+    }
+    default:
+      break;
+    }
+
+    if (depth == 0) {
+      return true;
+    }
+    auto &top = stack[depth - 1];
+    switch (insn.op) {
+    case agent_op::load:
+    case agent_op::load_checked: {
+      std::uint64_t value = 0;
+      auto size = insn.size > 8 ? 8 : insn.size;
+      if (insn.op == agent_op::load_checked) {
+        if (!read_checked(site->pid, top, &value, size)) {
+          return true;
+        }
+      } else {
+        auto from = reinterpret_cast<const std::uint8_t *>(top);
+        for (std::uint8_t i = 0; i < size; ++i) {
+          value |= std::uint64_t{from[i]} << (i * 8);
+        }
+      }
+      top = extend(value, size, insn.is_signed);
+      continue;
+    }
+    case agent_op::extend:
+      top = extend(top, insn.size, insn.is_signed);
+      continue;
+    case agent_op::negate:
+      top = extend(0 - top, insn.size, insn.is_signed);
+      continue;
+    case agent_op::bit_not:
+      top = extend(~top, insn.size, insn.is_signed);
+      continue;
+    case agent_op::logical_not:
+      top = top == 0 ? 1 : 0;
+      continue;
+    case agent_op::to_bool:
+      top = top != 0 ? 1 : 0;
+      continue;
+    default:
+      break;
+    }
+
+    if (depth < 2) {
+      return true;
+    }
+    auto rhs = stack[--depth];
+    auto &lhs = stack[depth - 1];
+    auto slhs = static_cast<std::int64_t>(lhs);
+    auto srhs = static_cast<std::int64_t>(rhs);
+    switch (insn.op) {
+    case agent_op::add:
+      lhs += rhs;
+      break;
+    case agent_op::sub:
+      lhs -= rhs;
+      break;
+    case agent_op::mul:
+      lhs *= rhs;
+      break;
+    case agent_op::div:
+    case agent_op::mod:
+      if (rhs == 0) {
+        return true;
+      }
+      if (insn.is_signed && srhs == -1 && slhs == INT64_MIN) {
+        lhs = insn.op == agent_op::div ? lhs : 0;
+      } else if (insn.op == agent_op::div) {
+        lhs = insn.is_signed ? static_cast<std::uint64_t>(slhs / srhs)
+                             : lhs / rhs;
+      } else {
+        lhs = insn.is_signed ? static_cast<std::uint64_t>(slhs % srhs)
+                             : lhs % rhs;
+      }
+      break;
+    case agent_op::shl:
+      lhs <<= rhs & 63;
+      break;
+    case agent_op::shr:
+      lhs = insn.is_signed ? static_cast<std::uint64_t>(slhs >> (rhs & 63))
+                           : lhs >> (rhs & 63);
+      break;
+    case agent_op::bit_and:
+      lhs &= rhs;
+      break;
+    case agent_op::bit_or:
+      lhs |= rhs;
+      break;
+    case agent_op::bit_xor:
+      lhs ^= rhs;
+      break;
+    case agent_op::eq:
+    case agent_op::ne:
+    case agent_op::lt:
+    case agent_op::le:
+    case agent_op::gt:
+    case agent_op::ge:
+      lhs = compare(insn, lhs, rhs) ? 1 : 0;
+      break;
+    default:
+      return true;
+    }
+    lhs = extend(lhs, insn.size, insn.is_signed);
+  }
+  return depth == 0 || stack[depth - 1] != 0;
+}
+
+} // namespace
+
+/**
+ * @brief Records a hit of a fast tracepoint.
+ *
+ * Hits for which the condition of the site is false are ignored.
+ * Runs on the stack of the thread that reached the tracepoint, possibly in a
+ * signal handler that interrupted another hit, so nothing here waits.
+ * Nothing here may call into libc: the trampoline saves the general purpose
+ * and SSE registers but not the upper halves of the AVX registers, which
+ * its optimized string functions use.
+ *
+ * @param site The tracepoint
+ * @param regs The registers saved by the trampoline
+ * @return Nonzero to stop the program at the tracepoint
+ */
+extern "C" __attribute__((visibility("default"))) auto
+cdb_agent_hit(agent_site *site, agent_registers *regs) noexcept -> int {
+  site->hits.fetch_add(1, std::memory_order_relaxed);
+  if (site->insns != 0 && !condition_holds(site, regs)) {
+    return 0;
+  }
+  auto stop = (site->flags & agent_site_stop) != 0 ? 1 : 0;
+  if ((site->flags & agent_site_record) == 0) {
+    return stop;
+  }
+
+  // The slot is reserved before it is written, and published after
+  auto ring = reinterpret_cast<agent_ring *>(site->ring);
+  auto head = ring->head.load(std::memory_order_relaxed);
+  do {
+    if (head - ring->tail.load(std::memory_order_acquire) >= ring->capacity) {
+      ring->dropped.fetch_add(1, std::memory_order_relaxed);
+      return stop;
+    }
+  } while (!ring->head.compare_exchange_weak(head, head + 1,
+                                             std::memory_order_relaxed));
+
+  auto &record = ring->slot(head);
+  record.site = site->number;
+  record.rip = site->address;
+  record.rsp = register_value(regs, agent_base_rsp);
+  record.regs = *regs;
+  collect(site, regs, record);
+  __atomic_store_n(&record.sequence, head + 1, __ATOMIC_RELEASE);
+  return stop;
+}
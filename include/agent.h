@@ -0,0 +1,191 @@
+/**
+ * @file agent.h
+ * @brief Data shared between the debugger and the in-process agent.
+ *
+ * This file describes the layout of the memory through which the debugger
+ * and the agent library, preloaded into the debugged program, talk to each
+ * other. It is included by both, and only holds plain structures that live
+ * in the shared arena.
+ *
+ * A fast tracepoint replaces the instructions at its address with a jump to
+ * a trampoline the debugger writes into the arena. The trampoline saves the
+ * registers and calls cdb_agent_hit with the site of the tracepoint, which
+ * appends a record to a ring buffer in the arena and returns. Records are
+ * produced by the program and consumed by the debugger, which reads them
+ * through its own mapping of the arena whenever the program stops.
+ *
+ * A site may have a condition, compiled by the debugger to a small stack
+ * bytecode the agent runs before anything else. Hits whose condition is
+ * false return to the program at once, and sites that stop the program
+ * only trap to the debugger when their condition holds.
+ */
+
+#ifndef AGENT_H_
+#define AGENT_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/// Name of the function of the agent that trampolines call
+constexpr const char *agent_hit_symbol = "cdb_agent_hit";
+
+/// Bytes of memory a record can hold after the registers
+constexpr std::size_t agent_record_data = 256;
+
+/// Most memory ranges a site collects
+constexpr std::size_t agent_max_collect = 4;
+
+/// Most instructions in the condition of a site
+constexpr std::size_t agent_max_insns = 64;
+
+/// Most values on the stack of a condition
+constexpr std::size_t agent_max_stack = 16;
+
+/// Flag of sites that append a record to the ring
+constexpr std::uint32_t agent_site_record = 1;
+
+/// Flag of sites that stop the program
+constexpr std::uint32_t agent_site_stop = 2;
+
+/**
+ * @struct agent_registers
+ * @brief The registers a trampoline saves, in the order they are on its stack.
+ */
+struct agent_registers {
+  std::uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+  std::uint64_t rdi, rsi, rbp, rdx, rcx, rbx, rax;
+  std::uint64_t eflags;
+};
+
+/// Bytes of the red zone a trampoline skips before saving registers
+constexpr std::uint64_t agent_red_zone = 128;
+
+/// Base of a collected range that is relative to the stack pointer
+constexpr std::int32_t agent_base_rsp = sizeof(agent_registers) / 8;
+
+/// Index in agent_registers of each DWARF register from rax to r15
+constexpr std::int32_t agent_dwarf_registers[] = {
+    14, 11, 12, 13, 9, 8, 10, agent_base_rsp, 7, 6, 5, 4, 3, 2, 1, 0};
+
+/**
+ * @struct agent_collect
+ * @brief A range of memory a site copies into its records.
+ */
+struct agent_collect {
+  std::int32_t base = -1;  ///< Index in agent_registers, or -1 if none
+  std::uint32_t size = 0;  ///< Number of bytes
+  std::int64_t offset = 0; ///< Offset from the register, or the address
+};
+
+/**
+ * @enum agent_op
+ * @brief Operations of condition bytecode.
+ *
+ * Operations work on a stack of 64-bit values. Values of types narrower
+ * than 64 bits are kept sign or zero extended, as extend leaves them, and
+ * every operation extends its result from its size. A condition that
+ * divides by zero or loads from unmapped memory holds.
+ */
+enum class agent_op : std::uint8_t {
+  end,          ///< Ends the condition, which holds if the top is not zero
+  constant,     ///< Pushes arg
+  reg,          ///< Pushes the register at index arg of agent_registers
+  load,         ///< Replaces an address by the size bytes at it
+  load_checked, ///< Like load, for addresses that may not be mapped
+  extend,       ///< Sign or zero extends the low size bytes
+  add,          ///< Addition
+  sub,          ///< Subtraction
+  mul,          ///< Multiplication
+  div,          ///< Division, signed if is_signed
+  mod,          ///< Remainder, signed if is_signed
+  shl,          ///< Left shift
+  shr,          ///< Right shift, arithmetic if is_signed
+  bit_and,      ///< Bitwise and
+  bit_or,       ///< Bitwise or
+  bit_xor,      ///< Bitwise exclusive or
+  negate,       ///< Arithmetic negation
+  bit_not,      ///< Bitwise complement
+  logical_not,  ///< 1 if the top is zero, 0 otherwise
+  to_bool,      ///< 0 if the top is zero, 1 otherwise
+  eq,           ///< Equality, yielding 0 or 1
+  ne,           ///< Inequality
+  lt,           ///< Less than, signed if is_signed
+  le,           ///< Less than or equal
+  gt,           ///< Greater than
+  ge,           ///< Greater than or equal
+  and_jump,     ///< Pops a value, jumps to arg yielding 0 if it is zero
+  or_jump       ///< Pops a value, jumps to arg yielding 1 if it is not zero
+};
+
+/**
+ * @struct agent_insn
+ * @brief An operation of condition bytecode.
+ */
+struct agent_insn {
+  agent_op op = agent_op::end; ///< The operation
+  std::uint8_t size = 8;       ///< Size the result is extended from
+  bool is_signed = false;      ///< Whether the operands are signed
+  std::int64_t arg = 0;        ///< Operand of constant, reg and jumps
+};
+
+/**
+ * @struct agent_site
+ * @brief A fast tracepoint, as seen by the agent.
+ */
+struct agent_site {
+  std::uint64_t address = 0;               ///< Address of the tracepoint
+  std::uint64_t ring = 0;                  ///< Address of its ring
+  std::uint32_t number = 0;                ///< Number of the tracepoint
+  std::uint32_t flags = agent_site_record; ///< What a hit does
+  std::int32_t pid = 0;                    ///< Process ID, for checked loads
+  std::uint32_t collects = 0;              ///< Number of ranges in collect
+  agent_collect collect[agent_max_collect]; ///< Memory copied into records
+  std::uint32_t insns = 0;               ///< Length of condition, 0 if none
+  agent_insn condition[agent_max_insns]; ///< Condition of the hits
+  std::atomic<std::uint64_t> hits{0};    ///< Times it was reached
+};
+
+/**
+ * @struct agent_record
+ * @brief The state of the program at one hit of a site.
+ */
+struct agent_record {
+  std::uint64_t sequence = 0;   ///< Position in the ring plus 1, once written
+  std::uint32_t site = 0;       ///< Number of the tracepoint
+  std::uint32_t size = 0;       ///< Bytes of data in use
+  std::uint32_t unreadable = 0; ///< Bit i set if range i was unmapped
+  std::uint64_t rip = 0;        ///< Address of the tracepoint
+  std::uint64_t rsp = 0;        ///< Stack pointer at the tracepoint
+  agent_registers regs{};       ///< Other registers at the tracepoint
+  std::uint8_t data[agent_record_data]; ///< Collected ranges in order
+};
+
+/**
+ * @struct agent_ring
+ * @brief A ring of records written by any thread and read by the debugger.
+ *
+ * A thread reserves a slot by advancing head with a compare-and-swap, then
+ * publishes the record by storing its position plus 1 in its sequence. The
+ * debugger reads records up to the first that is not published yet and
+ * advances tail past them. No thread waits for another, so a signal
+ * handler reaching a tracepoint cannot block on the thread it interrupted.
+ * Records that find the ring full are dropped rather than blocking the
+ * program. The records follow the header.
+ */
+struct agent_ring {
+  alignas(64) std::atomic<std::uint64_t> head{0}; ///< Next slot to reserve
+  alignas(64) std::atomic<std::uint64_t> tail{0}; ///< Next record to read
+  alignas(64) std::uint64_t capacity = 0; ///< Records, a power of two
+  std::atomic<std::uint64_t> dropped{0};  ///< Records lost to a full ring
+
+  /**
+   * @brief Gets the slot of a position in the ring.
+   */
+  auto slot(std::uint64_t position) noexcept -> agent_record & {
+    auto records = reinterpret_cast<agent_record *>(this + 1);
+    return records[position & (capacity - 1)];
+  }
+};
+
+#endif // AGENT_H_
@@ -0,0 +1,69 @@
+/**
+ * @file agent_compiler.h
+ * @brief Translation of compiled expressions to the bytecode of the agent.
+ *
+ * This file contains compile_agent_condition, which turns a breakpoint
+ * condition that has already been parsed and type checked into the stack
+ * bytecode the in-process agent runs at a fast tracepoint. The DWARF
+ * locations of the variables the condition uses are resolved for the
+ * address of the site at compile time, so the agent only reads registers
+ * and memory. Conditions the agent cannot evaluate, such as those using
+ * floating point values or bitfields, are rejected, and the debugger falls
+ * back to evaluating them itself.
+ *
+ * Objects collected by tracepoints are translated to ranges the agent
+ * copies in the same way, when their address is fixed or a register plus a
+ * constant.
+ */
+
+#ifndef AGENT_COMPILER_H_
+#define AGENT_COMPILER_H_
+
+#include "agent.h"
+#include "cfi.h"
+#include "dwarf_expr.h"
+#include "expression.h"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Translates a condition to bytecode for the agent.
+ *
+ * The bytecode leaves the same value on its stack as expression::test
+ * computes, except that errors such as division by zero make it hold.
+ *
+ * @param condition The condition, compiled for the function of the site
+ * @param pc Link-time address of the site
+ * @param load_address Difference between runtime and link-time addresses
+ * @param locations Cache of decoded location attributes
+ * @param cfi Call frame information of the program
+ * @return The bytecode, at most agent_max_insns operations long
+ * @throws std::invalid_argument if the agent cannot evaluate the condition
+ */
+auto compile_agent_condition(const expression &condition, std::uint64_t pc,
+                             std::uint64_t load_address,
+                             location_cache &locations, cfi_table &cfi)
+    -> std::vector<agent_insn>;
+
+/**
+ * @brief Translates a collected object to a range the agent copies.
+ *
+ * Only variables and their members are supported, such as locals,
+ * parameters and globals living in memory.
+ *
+ * @param object Expression designating the object, compiled for the
+ * function of the site
+ * @param pc Link-time address of the site
+ * @param load_address Difference between runtime and link-time addresses
+ * @param locations Cache of decoded location attributes
+ * @param cfi Call frame information of the program
+ * @return The range
+ * @throws std::invalid_argument if the agent cannot find the object
+ */
+auto compile_agent_collect(const expression &object, std::uint64_t pc,
+                           std::uint64_t load_address,
+                           location_cache &locations, cfi_table &cfi)
+    -> agent_collect;
+
+#endif // AGENT_COMPILER_H_
@@ -0,0 +1,150 @@
+/**
+ * @file arena.h
+ * @brief Memory shared between the debugger and the debugged process.
+ *
+ * This file contains the shared_arena class, which maps one memfd region
+ * into both processes. The memfd is created, sized and mapped by system
+ * calls injected into the process, and the debugger maps the same file
+ * through /proc/<pid>/fd. Buffers the debugger places in the region, such
+ * as those of tracepoint agents or displaced steps, are then written with
+ * plain stores, and data the program produces in them is read directly
+ * without ptrace or process_vm_readv calls.
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include "inject.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+/**
+ * @class shared_arena
+ * @brief A region mapped into both the debugger and the debugged process.
+ */
+class shared_arena {
+public:
+  /**
+   * @brief Creates an arena that is not mapped yet.
+   *
+   * @param pid Process ID of the program being debugged
+   * @param injector Makes the system calls that map the region
+   */
+  shared_arena(pid_t pid, syscall_injector &injector) noexcept
+      : m_pid{pid}, m_injector{injector} {}
+
+  shared_arena(const shared_arena &) = delete;
+  auto operator=(const shared_arena &) -> shared_arena & = delete;
+
+  /**
+   * @brief Unmaps the region from the debugger.
+   */
+  ~shared_arena();
+
+  /**
+   * @brief Maps the region into both processes.
+   *
+   * Does nothing if the region is already mapped. The process must be
+   * stopped. The process may also execute code in the region, so that it
+   * can hold trampolines.
+   *
+   * @param size Size of the region in bytes, rounded up to whole pages
+   * @param hint Preferred address of the region in the process, or 0
+   * @throws std::out_of_range if the region cannot be created or mapped
+   */
+  auto map(std::size_t size, std::uint64_t hint = 0) -> void;
+
+  /**
+   * @brief Checks whether the region is mapped.
+   */
+  auto mapped() const noexcept -> bool { return m_local != nullptr; }
+
+  /**
+   * @brief Gets the address of the region in the process.
+   */
+  auto address() const noexcept -> std::uint64_t { return m_address; }
+
+  /**
+   * @brief Gets the size of the region in bytes.
+   */
+  auto size() const noexcept -> std::size_t { return m_size; }
+
+  /**
+   * @brief Gets the number of bytes handed out by allocate.
+   */
+  auto used() const noexcept -> std::size_t { return m_used; }
+
+  /**
+   * @brief Checks whether a range of the process lies in the region.
+   *
+   * @param address Address in the process
+   * @param size Size of the range in bytes
+   */
+  auto contains(std::uint64_t address, std::size_t size) const noexcept
+      -> bool;
+
+  /**
+   * @brief Translates an address in the process to the debugger's mapping.
+   *
+   * @param address Address in the region
+   * @return Pointer to the same byte in the debugger
+   */
+  auto local(std::uint64_t address) const noexcept -> std::uint8_t * {
+    return m_local + (address - m_address);
+  }
+
+  /**
+   * @brief Reserves space in the region.
+   *
+   * Space is never given back; the region is meant for buffers that live as
+   * long as the debugging session.
+   *
+   * @param size Size of the space in bytes
+   * @param alignment Alignment of the space, a power of two
+   * @return Address of the space in the process
+   * @throws std::out_of_range if the region is not mapped or is full
+   */
+  auto allocate(std::size_t size, std::size_t alignment = 16)
+      -> std::uint64_t;
+
+  /**
+   * @brief Copies memory of the process out of the region.
+   *
+   * @param address Address in the process
+   * @param buffer Receives the bytes
+   * @param size Number of bytes to copy
+   * @return false if the range is not entirely in the region
+   */
+  auto read(std::uint64_t address, void *buffer, std::size_t size) const
+      noexcept -> bool;
+
+  /**
+   * @brief Uses the region of another process, a copy of the first made by
+   * fork, which inherits the shared mapping.
+   *
+   * @param pid Process ID of the copy
+   */
+  auto set_pid(pid_t pid) noexcept -> void { m_pid = pid; }
+
+private:
+  /**
+   * @brief Creates the memfd in the process.
+   *
+   * Its name is written below the red zone of the stack for the call, and
+   * the stack is restored afterwards.
+   *
+   * @return The file descriptor of the memfd in the process
+   */
+  auto create_memfd() -> int;
+
+  pid_t m_pid;                     ///< Process ID of the debugged program
+  syscall_injector &m_injector;    ///< Makes calls in the process
+  std::uint64_t m_address = 0;     ///< Address of the region in the process
+  std::uint8_t *m_local = nullptr; ///< Address of the region in the debugger
+  std::size_t m_size = 0;          ///< Size of the region in bytes
+  std::size_t m_used = 0;          ///< Bytes handed out by allocate
+};
+
+#endif // ARENA_H_
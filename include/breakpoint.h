@@ -62,6 +62,16 @@ public:
    */
   auto is_enabled() const noexcept -> bool;
 
+  /**
+   * @brief Moves the breakpoint to another process with the same code.
+   *
+   * Nothing is written, so the breakpoint should be disabled first and
+   * enabled again after.
+   *
+   * @param pid The process ID the breakpoint now applies to.
+   */
+  auto set_pid(pid_t pid) noexcept -> void { m_pid = pid; }
+
 private:
   pid_t m_pid;          ///< The process ID this breakpoint applies to
   std::intptr_t m_addr; ///< The memory address of this breakpoint
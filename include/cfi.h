@@ -0,0 +1,184 @@
+/**
+ * @file cfi.h
+ * @brief DWARF call frame information used to unwind the stack.
+ *
+ * This file contains a reader for the call frame information found in the
+ * .eh_frame and .debug_frame sections. FDEs are located with the binary
+ * search table of .eh_frame_hdr when it is present, and the decoded rows of
+ * the CFI table are cached per PC range so that unwinding the same code
+ * repeatedly does not parse any CIE or FDE twice.
+ */
+
+#ifndef CFI_H_
+#define CFI_H_
+
+#include "registers.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @struct section_view
+ * @brief A read-only view of the contents of an ELF section.
+ */
+struct section_view {
+  const std::uint8_t *data = nullptr; ///< Section contents
+  std::size_t size = 0;               ///< Size of the contents in bytes
+  std::uint64_t addr = 0;             ///< Link-time address of the section
+
+  /**
+   * @brief Checks whether the view refers to any data.
+   */
+  auto valid() const noexcept -> bool { return data != nullptr && size != 0; }
+};
+
+/**
+ * @struct register_rule
+ * @brief How to recover the value a register had in the calling frame.
+ */
+struct register_rule {
+  enum class kind {
+    undefined,     ///< The value cannot be recovered
+    same_value,    ///< The register is not modified by the callee
+    offset,        ///< Saved at CFA + offset
+    val_offset,    ///< The value is CFA + offset
+    reg,           ///< Saved in another register
+    expression,    ///< Saved at the address computed by a DWARF expression
+    val_expression ///< The value is computed by a DWARF expression
+  };
+
+  kind rule = kind::undefined;     ///< Kind of the rule
+  std::int64_t offset = 0;         ///< Offset from the CFA
+  unsigned reg = 0;                ///< Register holding the value
+  const std::uint8_t *expr = nullptr; ///< DWARF expression bytes
+  std::size_t expr_size = 0;       ///< Size of the expression in bytes
+};
+
+/**
+ * @struct cfi_row
+ * @brief A decoded row of the CFI table.
+ *
+ * A row describes how to compute the canonical frame address (CFA) and the
+ * caller's registers for every PC in [low_pc, high_pc).
+ */
+struct cfi_row {
+  std::uint64_t low_pc = 0;  ///< First link-time PC covered by the row
+  std::uint64_t high_pc = 0; ///< End (exclusive) of the covered PC range
+  unsigned cfa_reg = 0;      ///< Register the CFA is relative to
+  std::int64_t cfa_offset = 0; ///< Offset added to the CFA register
+  const std::uint8_t *cfa_expr = nullptr; ///< CFA expression, if any
+  std::size_t cfa_expr_size = 0;          ///< Size of the CFA expression
+  std::array<register_rule, n_dwarf_registers> regs{}; ///< Register rules
+  unsigned return_address_register = dwarf_return_address_register;
+  bool signal_frame = false; ///< Set for signal trampolines ('S' augmentation)
+};
+
+/**
+ * @class cfi_table
+ * @brief Looks up and caches CFI rows for link-time program counters.
+ */
+class cfi_table {
+public:
+  /**
+   * @brief Default constructor, creates a table without any CFI.
+   */
+  cfi_table() = default;
+
+  /**
+   * @brief Creates a table over the CFI sections of an object.
+   *
+   * Any of the views may be invalid if the object lacks the section.
+   *
+   * @param eh_frame_hdr The .eh_frame_hdr section
+   * @param eh_frame The .eh_frame section
+   * @param debug_frame The .debug_frame section
+   */
+  cfi_table(section_view eh_frame_hdr, section_view eh_frame,
+            section_view debug_frame) noexcept
+      : m_eh_frame_hdr{eh_frame_hdr}, m_eh_frame{eh_frame},
+        m_debug_frame{debug_frame} {}
+
+  /**
+   * @brief Finds the CFI row that covers a link-time program counter.
+   *
+   * Rows are decoded on first use and cached for their whole PC range.
+   *
+   * @param pc The link-time program counter
+   * @return The row covering @p pc, or nullptr if there is no CFI for it
+   */
+  auto find_row(std::uint64_t pc) -> const cfi_row *;
+
+  /**
+   * @brief Finds the start address of the FDE covering a program counter.
+   *
+   * @param pc The link-time program counter
+   * @param start Receives the initial location of the FDE
+   * @return true if an FDE covers @p pc
+   */
+  auto find_function_start(std::uint64_t pc, std::uint64_t &start) -> bool;
+
+private:
+  /**
+   * @struct cie
+   * @brief A decoded common information entry.
+   */
+  struct cie {
+    std::uint64_t code_alignment = 1;
+    std::int64_t data_alignment = 1;
+    unsigned return_address_register = dwarf_return_address_register;
+    std::uint8_t fde_encoding = 0;
+    std::uint8_t address_size = 8;
+    bool has_augmentation_data = false;
+    bool signal_frame = false;
+    const std::uint8_t *instructions = nullptr;
+    const std::uint8_t *instructions_end = nullptr;
+  };
+
+  /**
+   * @struct fde
+   * @brief A decoded frame description entry.
+   */
+  struct fde {
+    std::uint64_t pc_begin = 0;
+    std::uint64_t pc_end = 0;
+    const cie *owner = nullptr;
+    const std::uint8_t *instructions = nullptr;
+    const std::uint8_t *instructions_end = nullptr;
+  };
+
+  /**
+   * @struct fde_entry
+   * @brief An entry of the sorted FDE index built for unindexed sections.
+   */
+  struct fde_entry {
+    std::uint64_t pc_begin;
+    std::uint64_t pc_end;
+    bool debug_frame;
+    std::size_t offset;
+  };
+
+  auto find_fde(std::uint64_t pc, fde &out) -> bool;
+  auto search_eh_frame_hdr(std::uint64_t pc, fde &out) -> bool;
+  auto search_fde_index(std::uint64_t pc, fde &out) -> bool;
+  auto build_fde_index() -> void;
+  auto decode_fde(const section_view &section, std::size_t offset, fde &out)
+      -> bool;
+  auto decode_cie(const section_view &section, std::size_t offset)
+      -> const cie *;
+  auto execute(const fde &f, std::uint64_t pc, cfi_row &row) const -> void;
+
+  section_view m_eh_frame_hdr; ///< Binary search table for .eh_frame
+  section_view m_eh_frame;     ///< Runtime unwind tables
+  section_view m_debug_frame;  ///< Unwind tables emitted with debug info
+  std::unordered_map<const std::uint8_t *, cie>
+      m_cies;                          ///< Decoded CIEs by address
+  std::vector<fde_entry> m_fde_index;  ///< Sorted FDEs without a hdr table
+  bool m_fde_index_built = false;      ///< Whether m_fde_index is populated
+  std::map<std::uint64_t, cfi_row> m_rows; ///< Decoded rows by low PC
+};
+
+#endif // CFI_H_
@@ -0,0 +1,102 @@
+/**
+ * @file checkpoint.h
+ * @brief Snapshots of the debugged process kept as stopped forks.
+ *
+ * This file contains the checkpoint_table class. A checkpoint is a copy of
+ * the process made by a clone system call injected into it, which shares
+ * all of its pages copy-on-write and is kept stopped, so taking one costs
+ * about as much as a fork of the process. The copy is traced by the
+ * debugger from its first instruction, because the call is made with
+ * CLONE_PTRACE, and exits with the debugger.
+ *
+ * Restarting from a checkpoint makes a copy of the snapshot in the same
+ * way, so that the snapshot itself never runs and can be restarted from
+ * any number of times. Only the thread that was stopped is copied.
+ */
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * @struct checkpoint
+ * @brief A stopped copy of the process.
+ */
+struct checkpoint {
+  unsigned number = 0;  ///< Number identifying the checkpoint
+  pid_t pid = 0;        ///< Process ID of the copy
+  std::uint64_t pc = 0; ///< Where the process was stopped
+};
+
+/**
+ * @class checkpoint_table
+ * @brief The checkpoints of a debugging session.
+ */
+class checkpoint_table {
+public:
+  checkpoint_table() noexcept = default;
+  checkpoint_table(const checkpoint_table &) = delete;
+  auto operator=(const checkpoint_table &) -> checkpoint_table & = delete;
+
+  /**
+   * @brief Kills the copies.
+   */
+  ~checkpoint_table();
+
+  /**
+   * @brief Copies a stopped process into a new checkpoint.
+   *
+   * @param pid Process ID of the process
+   * @param scratch Scratch location for system calls in the process
+   * @param pc Where the process is stopped, as reported to the user
+   * @return The new checkpoint
+   * @throws std::out_of_range if the process cannot be copied
+   */
+  auto add(pid_t pid, std::uint64_t scratch, std::uint64_t pc)
+      -> const checkpoint &;
+
+  /**
+   * @brief Makes a process in the state of a checkpoint.
+   *
+   * The process is stopped and traced, with the registers of the
+   * checkpoint.
+   *
+   * @param number Number of the checkpoint
+   * @param scratch Scratch location for system calls in the process
+   * @return Process ID of the new process
+   * @throws std::out_of_range if there is no such checkpoint or it cannot
+   * be copied
+   */
+  auto spawn(unsigned number, std::uint64_t scratch) -> pid_t;
+
+  /**
+   * @brief Kills the copy of a checkpoint.
+   *
+   * @param number Number of the checkpoint
+   * @return false if there is no such checkpoint
+   */
+  auto remove(unsigned number) -> bool;
+
+  /**
+   * @brief Gets the checkpoints, in the order they were taken.
+   */
+  auto checkpoints() const noexcept -> const std::vector<checkpoint> & {
+    return m_checkpoints;
+  }
+
+private:
+  std::vector<checkpoint> m_checkpoints; ///< Checkpoints by number
+  unsigned m_next_number = 1;            ///< Number of the next one
+};
+
+/**
+ * @brief Kills a traced process and waits for it to exit.
+ *
+ * @param pid Process ID of the process
+ */
+auto kill_process(pid_t pid) noexcept -> void;
+
+#endif // CHECKPOINT_H_
@@ -11,15 +11,41 @@
 #ifndef DEBUGGER_H_
 #define DEBUGGER_H_
 
+#include "arena.h"
 #include "breakpoint.h"
+#include "cfi.h"
+#include "checkpoint.h"
+#include "display.h"
 #include "dwarf/dwarf++.hh"
+#include "dwarf_expr.h"
 #include "elf/elf++.hh"
+#include "expression.h"
+#include "fast_tracepoint.h"
+#include "frame_context.h"
+#include "inject.h"
+#include "globals.h"
+#include "journal.h"
+#include "pretty_printers.h"
+#include "record.h"
+#include "scopes.h"
+#include "shared_objects.h"
+#include "symbols.h"
+#include "syscall_latency.h"
+#include "syscall_log.h"
+#include "syscall_trace.h"
+#include "trace.h"
+#include "types.h"
+#include "unwinder.h"
+#include "vdso.h"
+#include "watchpoint.h"
 #include <fcntl.h>
 #include <linux/types.h>
 #include <string>
 #include <sys/stat.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
 /**
  * @class debugger
@@ -48,6 +74,8 @@ public:
     auto fd = open(m_prog_name.c_str(), O_RDONLY);
     m_elf = elf::elf{elf::create_mmap_loader(fd)};
     m_dwarf = dwarf::dwarf{dwarf::elf::create_loader(m_elf)};
+    m_globals = global_index{m_dwarf};
+    initialise_cfi();
   };
 
   /**
@@ -70,9 +98,58 @@ private:
   pid_t m_pid;                   ///< Process ID of the program being debugged
   std::unordered_map<std::intptr_t, breakpoint>
       m_breakpoints;            ///< Map of active breakpoints
+  std::unordered_map<std::intptr_t, expression>
+      m_conditions;             ///< Conditions of conditional breakpoints
+  std::unordered_set<std::intptr_t>
+      m_slow_conditions;        ///< Conditions the agent cannot test
   dwarf::dwarf m_dwarf;         ///< DWARF debug information for the program
   elf::elf m_elf;               ///< ELF information for the program
-  std::uint64_t m_load_address; ///< Base load address of the program in memory
+  std::uint64_t m_load_address = 0; ///< Base load address of the program
+  cfi_table m_cfi;                  ///< Call frame information of the program
+  symbol_index m_symbols;           ///< Function symbols of the program
+  symbol_index m_objects;           ///< Data object symbols of the program
+  unwinder m_unwinder{m_pid, m_cfi, m_symbols}; ///< Stack unwinder
+  vdso m_vdso;                      ///< vDSO of the debugged process
+  shared_object_table m_shared_objects; ///< Libraries of the process
+  bool m_shared_objects_current = false; ///< Whether loaded since the stop
+  std::vector<frame> m_frames;      ///< Unwound frames of the stopped process
+  std::size_t m_selected_frame = 0; ///< Index of the selected frame
+  location_cache m_locations;       ///< Decoded DWARF location attributes
+  type_index m_types;               ///< Decoded DWARF types
+  scope_index m_scopes{m_types, m_locations}; ///< Variables of each function
+  global_index m_globals;           ///< Global variables by name
+  tls_cache m_tls{m_pid};           ///< Thread-local storage blocks
+  std::vector<display> m_displays;  ///< Expressions displayed at each stop
+  unsigned m_next_display = 1;      ///< Number of the next display
+  std::vector<const global_variable *>
+      m_watched_globals; ///< Globals snapshotted at each stop
+  syscall_injector m_injector{m_pid}; ///< Makes calls in the process
+  watchpoint_table m_watchpoints{m_pid, m_injector}; ///< Watched objects
+  std::unordered_map<unsigned, expression>
+      m_watch_expressions; ///< Expressions of the watchpoints
+  std::vector<watch_hit> m_watch_hits; ///< Changes not yet reported
+  shared_arena m_arena{m_pid, m_injector}; ///< Memory shared with the process
+  fast_tracepoint_table m_fast_tracepoints{m_pid, m_arena}; ///< Agent sites
+  std::vector<agent_record> m_agent_records; ///< Records of fast tracepoints
+  std::uint64_t m_agent_records_dropped = 0; ///< Records past the limit
+  std::vector<tracepoint> m_tracepoints; ///< Tracepoints of trace, by number
+  unsigned m_next_tracepoint = 1;        ///< Number of the next tracepoint
+  trace_buffer m_trace{1 << 16};         ///< Frames collected by tracepoints
+  std::uint64_t m_trace_frame = 0;       ///< Number of the selected frame
+  bool m_trace_selected = false;         ///< Whether tfind selected a frame
+  journal_writer m_journal;              ///< Journal of the stops, if any
+  bool m_journal_registers = false;      ///< Whether stops record registers
+  std::uint64_t m_journal_address = 0;   ///< Memory each stop records
+  std::size_t m_journal_bytes = 0;       ///< Bytes each stop records
+  execution_recorder m_recorder{m_pid};  ///< Undo log of recorded execution
+  checkpoint_table m_checkpoints;        ///< Stopped copies of the process
+  syscall_recorder m_syscalls{m_pid};    ///< Log of outside input, if any
+  syscall_timer m_latencies;             ///< Times of system calls, if any
+  syscall_catch_table m_syscall_catches{m_pid, m_injector}; ///< Catchpoints
+  unsigned m_caught = 0;                 ///< Catchpoint of a call made again
+  std::uint64_t m_caught_pc = 0;         ///< Address after its instruction
+  bool m_caught_entered = false;         ///< Whether it was made again
+  std::unordered_set<pid_t> m_tasks;     ///< Tasks the program started
 
   /**
    * @brief Processes a command entered by the user.
@@ -89,6 +166,421 @@ private:
    */
   auto continue_execution() noexcept -> void;
 
+  /**
+   * @brief Sets a breakpoint that only stops when a condition holds.
+   *
+   * The condition is compiled once, in the scope of the function containing
+   * the breakpoint, and evaluated each time the breakpoint is hit.
+   *
+   * @param addr The memory address where the breakpoint should be placed
+   * @param condition Source of the condition expression
+   */
+  auto set_conditional_breakpoint(std::intptr_t addr,
+                                  const std::string &condition) -> void;
+
+  /**
+   * @brief Sets a conditional breakpoint whose condition the agent tests.
+   *
+   * The condition is compiled to the bytecode of the agent and a fast
+   * tracepoint that stops the program is patched in at the address, so
+   * that hits for which the condition is false never trap. Stops are
+   * checked against the condition again by the debugger.
+   *
+   * @param addr The memory address where the breakpoint should be placed
+   * @param condition The compiled condition
+   * @return false if the agent is not loaded or cannot test the condition
+   * there, in which case nothing is set
+   */
+  auto set_fast_conditional_breakpoint(std::intptr_t addr,
+                                       const expression &condition) -> bool;
+
+  /**
+   * @brief Replaces a hit conditional breakpoint by a fast one.
+   *
+   * Breakpoints set before the agent library was loaded trap until they
+   * are first hit after it is. The process resumes in the instructions
+   * displaced by the jump, so the hit is not tested twice.
+   *
+   * @param addr Address of the breakpoint the process stopped at
+   * @return true if the breakpoint was replaced
+   */
+  auto move_condition_to_agent(std::intptr_t addr) -> bool;
+
+  /**
+   * @brief Checks whether the process should stay stopped.
+   *
+   * @return false if the process stopped at a conditional breakpoint whose
+   * condition does not hold, true otherwise
+   */
+  auto breakpoint_condition_holds() noexcept -> bool;
+
+  /**
+   * @brief Checks whether a stop should be reported to the user.
+   *
+   * @return false if the process stopped at a conditional breakpoint whose
+   * condition does not hold, at a tracepoint, or because a watched object
+   * was written without its value changing
+   */
+  auto should_stop() noexcept -> bool;
+
+  /**
+   * @brief Appends a record of the last stop to the journal, if one is open.
+   *
+   * @param reported Whether the stop is reported to the user rather than
+   * resumed from
+   */
+  auto journal_stop(bool reported) noexcept -> void;
+
+  /**
+   * @brief Starts, stops or prints journals, as the journal command.
+   *
+   * @param args Arguments of the command: none, off, show followed by a
+   * path, a first record or @ and a time in seconds, and a count, or a path
+   * followed by what stops record, regs and mem with an address and a size
+   */
+  auto handle_journal(const std::vector<std::string> &args) -> void;
+
+  /**
+   * @brief Handles the record command.
+   *
+   * @param args Arguments after the command: nothing or a size to start
+   * recording, "stop" or "status"
+   */
+  auto handle_record(const std::vector<std::string> &args) -> void;
+
+  /**
+   * @brief Handles the syscalls command.
+   *
+   * @param args Arguments after the command: nothing, "record" or "replay"
+   * followed by the path of a log, or "stop"
+   */
+  auto handle_syscalls(const std::vector<std::string> &args) -> void;
+
+  /**
+   * @brief Makes the stopped process ready to be run an instruction at a
+   * time.
+   *
+   * Moves a thread stopped past the int3 of a breakpoint back to its
+   * address, and out of a fast tracepoint it landed at. When recording,
+   * changes made since the last step, such as by writing registers, are
+   * logged so that they are undone too.
+   */
+  auto prepare_instruction_step() -> void;
+
+  /**
+   * @brief Executes one instruction, recording it if the recorder is on.
+   *
+   * Breakpoints are stepped over, and those reached are tested the way a
+   * continued process tests them, including tracepoints and watchpoints.
+   *
+   * @return true if the step ended at a stop that is reported to the user
+   */
+  auto step_instruction() -> bool;
+
+  /**
+   * @brief Continues the process an instruction at a time while recording.
+   */
+  auto continue_recorded() -> void;
+
+  /**
+   * @brief Runs the process backwards by undoing recorded instructions.
+   *
+   * @param mode How far to go back
+   */
+  auto reverse_execute(reverse_mode mode) -> void;
+
+  /**
+   * @brief Reports where an instruction step stopped.
+   *
+   * A thread at an enabled breakpoint is left as if its int3 had run, so
+   * that continuing steps over it.
+   */
+  auto report_instruction_stop() -> void;
+
+  /**
+   * @brief Computes the canonical frame address of the innermost frame.
+   *
+   * @param regs Registers of the thread
+   * @return The address, or 0 if the CFI of the pc does not give it
+   */
+  auto get_frame_cfa(const user_regs_struct &regs) -> std::uint64_t;
+
+  /**
+   * @brief Gets the source line of a runtime address.
+   *
+   * @return The line, or 0 if there is no line information for it
+   */
+  auto get_line_from_pc(std::uint64_t pc) noexcept -> unsigned;
+
+  /**
+   * @brief Copies the stopped process into a new checkpoint.
+   *
+   * The copy is made without the int3s of breakpoints and the jumps of
+   * fast tracepoints in its code, which are written into a process when it
+   * is restarted from the copy, so that it gets those set at that time.
+   *
+   * @throws std::out_of_range if the process cannot be copied
+   */
+  auto take_checkpoint() -> void;
+
+  /**
+   * @brief Replaces the process with a new copy of a checkpoint.
+   *
+   * The debugger moves its breakpoints, tracepoints and watchpoints to the
+   * new process and keeps everything it loaded from the program. The
+   * process that was being debugged is killed.
+   *
+   * @param number Number of the checkpoint
+   * @throws std::out_of_range if there is no such checkpoint or it cannot
+   * be copied
+   */
+  auto restart_checkpoint(unsigned number) -> void;
+
+  /**
+   * @brief Lists the checkpoints.
+   */
+  auto print_checkpoints() -> void;
+
+  /**
+   * @brief Adds a catchpoint at system calls, as the catch syscall command.
+   *
+   * @param args Names or numbers of the calls, alone or separated by
+   * commas, or nothing for all calls
+   */
+  auto catch_syscalls(const std::vector<std::string> &args) -> void;
+
+  /**
+   * @brief Lists the system call catchpoints.
+   */
+  auto print_catchpoints() -> void;
+
+  /**
+   * @brief Reports that the process stopped at a caught system call.
+   *
+   * @param catchpoint The catchpoint
+   * @param returning Whether the call is returning rather than being made
+   */
+  auto report_syscall_catch(const syscall_catchpoint &catchpoint,
+                            bool returning) -> void;
+
+  /**
+   * @brief Checks whether a watchpoint write-protects pages, which a
+   * checkpoint cannot be taken or restarted with.
+   */
+  auto protects_pages() const noexcept -> bool;
+
+  /**
+   * @brief Checks whether the process stopped because of a watchpoint.
+   *
+   * Changed objects are added to m_watch_hits.
+   *
+   * @return true if a watchpoint caused the stop
+   */
+  auto check_watchpoints() noexcept -> bool;
+
+  /**
+   * @brief Watches the object an expression designates.
+   *
+   * The expression is evaluated once in the selected frame, and the object
+   * at the resulting address is watched from then on. An object that
+   * would be watched by write-protecting its pages is refused if they hold
+   * anything else, which the kernel could then not write.
+   *
+   * @param text Source of the expression
+   */
+  auto add_watchpoint(const std::string &text) -> void;
+
+  /**
+   * @brief Finds what else lives on the pages of an object.
+   *
+   * Objects of the program are told apart with its data symbols. The rest
+   * of a page of the stack, the heap or a library is assumed to be in use.
+   *
+   * @param address Address of the object
+   * @param size Size of the object in bytes
+   * @return A description of another object on its pages, or an empty
+   * string if its pages hold nothing else
+   */
+  auto page_neighbour(std::uint64_t address, std::size_t size)
+      -> std::string;
+
+  /**
+   * @brief Removes a watchpoint.
+   *
+   * @param number Number of the watchpoint
+   */
+  auto remove_watchpoint(unsigned number) -> void;
+
+  /**
+   * @brief Lists the watchpoints.
+   */
+  auto print_watchpoints() -> void;
+
+  /**
+   * @brief Prints the old and new values of the changed watched objects.
+   */
+  auto report_watch_hits() noexcept -> void;
+
+  /**
+   * @brief Measures the round-trip latency of injected system calls.
+   *
+   * @param count Number of getpid calls to inject
+   */
+  auto benchmark_injection(std::size_t count) -> void;
+
+  /**
+   * @brief Maps the shared arena into the process if it is not mapped yet.
+   *
+   * @return The arena
+   * @throws std::out_of_range if the arena cannot be mapped
+   */
+  auto get_arena() -> shared_arena &;
+
+  /**
+   * @brief Patches a fast tracepoint into the function at an address.
+   *
+   * @param address Runtime address of an instruction of the program
+   * @param flags What a hit does, as in agent_site
+   * @param condition Bytecode of the condition of the hits, if any
+   * @return The new tracepoint
+   * @throws std::out_of_range if the address is not in a function, a
+   * breakpoint, a branch target or the program counter is in the way, or
+   * the tracepoint cannot be added
+   */
+  auto add_fast_site(std::uint64_t address, std::uint32_t flags,
+                     const std::vector<agent_insn> &condition)
+      -> const fast_tracepoint &;
+
+  /**
+   * @brief Checks whether a range of code holds places branches may jump
+   * to.
+   *
+   * Functions and the lines of the line table are taken as the targets, as
+   * the debugger does not analyse the control flow of the program.
+   *
+   * @param low Start of the range
+   * @param high End (exclusive) of the range
+   * @return true if a function or line starts in the range
+   */
+  auto branch_target_within(std::uint64_t low, std::uint64_t high) -> bool;
+
+  /**
+   * @brief Adds a fast tracepoint.
+   *
+   * @param address Runtime address of an instruction of the program
+   */
+  auto add_fast_tracepoint(std::uint64_t address) -> void;
+
+  /**
+   * @brief Removes a fast tracepoint, with the condition it stops on.
+   *
+   * @param number Number of the tracepoint
+   */
+  auto remove_fast_tracepoint(unsigned number) -> void;
+
+  /**
+   * @brief Prints the fast tracepoints and what they have recorded.
+   */
+  auto print_fast_tracepoints() -> void;
+
+  /**
+   * @brief Moves the records of the agent out of the shared arena.
+   *
+   * Records of sites that belong to tracepoints become trace frames, and
+   * the others are kept in m_agent_records, up to a limit.
+   */
+  auto drain_agent_records() -> void;
+
+  /**
+   * @brief Finds a tracepoint by number.
+   *
+   * @param number Number of the tracepoint
+   * @return The tracepoint, or nullptr if there is none
+   */
+  auto find_tracepoint(unsigned number) noexcept -> tracepoint *;
+
+  /**
+   * @brief Checks whether a tracepoint traps at an address.
+   *
+   * @param address Runtime address of an instruction of the program
+   */
+  auto traps_to_tracepoint(std::uint64_t address) const noexcept -> bool;
+
+  /**
+   * @brief Adds a tracepoint, which only collects the registers until
+   * actions are added.
+   *
+   * @param address Runtime address of an instruction of the program
+   */
+  auto add_tracepoint(std::uint64_t address) -> void;
+
+  /**
+   * @brief Removes a tracepoint, keeping the frames it collected.
+   *
+   * @param number Number of the tracepoint
+   */
+  auto remove_tracepoint(unsigned number) -> void;
+
+  /**
+   * @brief Adds a collect action to a tracepoint.
+   *
+   * @param number Number of the tracepoint
+   * @param text $regs, mem followed by an address and a size, or an
+   * expression
+   */
+  auto add_collect_action(unsigned number, const std::string &text) -> void;
+
+  /**
+   * @brief Patches a tracepoint into the program, as a fast tracepoint if
+   * the agent can carry out its actions and as an int3 otherwise.
+   *
+   * Whatever the tracepoint was patched in as before is removed first.
+   *
+   * @param t The tracepoint
+   */
+  auto install_tracepoint(tracepoint &t) -> void;
+
+  /**
+   * @brief Collects a frame if the process stopped at an int3 tracepoint.
+   *
+   * A tracepoint that the agent has been loaded for since it was installed
+   * is moved to the agent, and the process resumes in its displaced
+   * instructions.
+   *
+   * @return true if the stop was a tracepoint hit
+   */
+  auto collect_trace_frame() noexcept -> bool;
+
+  /**
+   * @brief Prints the tracepoints and their actions.
+   */
+  auto print_tracepoints() -> void;
+
+  /**
+   * @brief Selects a trace frame, as the tfind command.
+   *
+   * @param args Arguments of the command: none or next, prev, start, end,
+   * a frame number, or tracepoint and a tracepoint number
+   */
+  auto find_trace_frame(const std::vector<std::string> &args) -> void;
+
+  /**
+   * @brief Prints what the selected trace frame collected.
+   */
+  auto dump_trace_frame() -> void;
+
+  /**
+   * @brief Prints how many frames have been collected and lost.
+   */
+  auto print_trace_status() -> void;
+
+  /**
+   * @brief Prints the memory mappings of the process.
+   *
+   * The mapping of the shared arena is marked.
+   */
+  auto print_mappings() -> void;
+
   /**
    * @brief Displays the values of CPU registers.
    *
@@ -111,7 +603,7 @@ private:
    * @param address The memory address to write to
    * @param value The 64-bit value to write
    */
-  auto write_memory(std::uint16_t address, std::uint64_t value) const noexcept
+  auto write_memory(std::uint64_t address, std::uint64_t value) const noexcept
       -> void;
 
   /**
@@ -140,9 +632,25 @@ private:
    * @brief Waits for a signal from the debugged program.
    *
    * This function blocks until the debugged program sends a signal,
-   * such as when it hits a breakpoint or terminates.
+   * such as when it hits a breakpoint or terminates. The threads and
+   * children of the program, traced for the filters they inherit, are let
+   * go on from the stops they make meanwhile.
+   *
+   * @return The wait status of the program
    */
-  auto wait_for_signal() const noexcept -> void;
+  auto wait_for_signal() noexcept -> int;
+
+  /**
+   * @brief Resumes the program until it stops for the debugger.
+   *
+   * While system calls are recorded or replayed, the program also stops
+   * at each of them, which is handled here without reporting it, as are
+   * stops at calls the filters of catchpoints trace but none catches.
+   *
+   * @return false if the program stopped at a system call, because it was
+   * caught or recording or replaying ended
+   */
+  auto resume() noexcept -> bool;
 
   /**
    * @brief Initializes the load address of the debugged program.
@@ -152,6 +660,209 @@ private:
    */
   auto initialise_load_address() noexcept -> void;
 
+  /**
+   * @brief Loads the information needed to unwind the program's stack.
+   *
+   * Sets up the CFI table over the .eh_frame_hdr, .eh_frame and .debug_frame
+   * sections of the program's ELF file, and indexes its function symbols and
+   * code for frame pointer unwinding.
+   */
+  auto initialise_cfi() noexcept -> void;
+
+  /**
+   * @brief Loads the vDSO of the debugged process.
+   *
+   * Copies the vDSO out of the process and registers it with the unwinder,
+   * so that backtraces can continue through vDSO functions.
+   */
+  auto initialise_vdso() -> void;
+
+  /**
+   * @brief Registers the shared objects mapped since the last update with
+   * the unwinder.
+   *
+   * The dynamic loader maps libraries while the program runs, so this is
+   * done before the stack is unwound, at most once per stop.
+   */
+  auto update_shared_objects() -> void;
+
+  /**
+   * @brief Prints a backtrace of the current call stack.
+   *
+   * Each frame is printed with its program counter and, when debug
+   * information is available, the name of its function.
+   */
+  auto print_backtrace() -> void;
+
+  /**
+   * @brief Gets the registers of the innermost frame.
+   *
+   * When the process is stopped at a breakpoint, the program counter is
+   * reported as the breakpoint address rather than the byte after the int3.
+   *
+   * @return The register set of the innermost frame
+   */
+  auto get_stop_registers() noexcept -> dwarf_register_set;
+
+  /**
+   * @brief Gets the frames of the stopped process.
+   *
+   * The stack is unwound with full register reconstruction the first time
+   * the frames are needed after the process stopped, and the result is kept
+   * until the process resumes.
+   *
+   * @return The frames of the stack, innermost first
+   */
+  auto get_frames() -> const std::vector<frame> &;
+
+  /**
+   * @brief Discards the frames of the process and selects the innermost one.
+   *
+   * Must be called whenever the process runs or its state is modified.
+   */
+  auto forget_frames() noexcept -> void;
+
+  /**
+   * @brief Selects a frame and prints it.
+   *
+   * @param index Index of the frame to select, 0 being the innermost
+   */
+  auto select_frame(std::size_t index) -> void;
+
+  /**
+   * @brief Prints a single frame.
+   *
+   * @param index Index of the frame, 0 being the innermost
+   * @param f The frame to print
+   */
+  auto print_frame(std::size_t index, const frame &f) -> void;
+
+  /**
+   * @brief Gets the value a register has in the selected frame.
+   *
+   * Registers of outer frames are taken from the register set reconstructed
+   * by the unwinder. Registers the unwinder does not track, such as the
+   * segment registers, are read from the process.
+   *
+   * @param r Register to read
+   * @return The value of the register in the selected frame
+   * @throws std::out_of_range if the register was not saved by the frame
+   */
+  auto get_frame_register_value(reg r) -> std::uint64_t;
+
+  /**
+   * @brief Prints the variables and parameters of the selected frame.
+   *
+   * Each location is evaluated in the selected frame, so values are shown
+   * as that frame sees them.
+   */
+  auto read_variables() -> void;
+
+  /**
+   * @brief Prints the value of an expression in the selected frame.
+   *
+   * Names are resolved in the scope of the selected frame. The resulting
+   * object is fetched from the process with a single read and formatted
+   * according to its DWARF type.
+   *
+   * @param text Source of the expression
+   */
+  auto print_expression(const std::string &text) -> void;
+
+  /**
+   * @brief Prints the locals or the parameters of the selected frame.
+   *
+   * Locals are those of every block in scope at the frame's PC, innermost
+   * first. The values of all variables held in memory are fetched with a
+   * single vectored read.
+   *
+   * @param parameters Whether to print the parameters instead of the locals
+   */
+  auto print_frame_variables(bool parameters) -> void;
+
+  /**
+   * @brief Adds an expression to display at every stop, and displays it.
+   *
+   * @param text Source of the expression, compiled in the scope of the
+   * selected frame
+   */
+  auto add_display(const std::string &text) -> void;
+
+  /**
+   * @brief Removes a display.
+   *
+   * @param number Number of the display
+   */
+  auto remove_display(unsigned number) -> void;
+
+  /**
+   * @brief Displays the expressions in scope at the current stop.
+   *
+   * Expressions are shown if they only use globals or were compiled in the
+   * function of the innermost frame. Their memory is fetched in batches and
+   * the output is written with a single write.
+   */
+  auto show_displays() noexcept -> void;
+
+  /**
+   * @brief Adds globals to snapshot at every stop, and snapshots them.
+   *
+   * If any of the names is unknown, none of the globals is added.
+   *
+   * @param names Names of the globals, qualified if they are in a namespace
+   */
+  auto watch_globals(const std::vector<std::string> &names) -> void;
+
+  /**
+   * @brief Prints the watched globals.
+   *
+   * All of the globals are fetched with a single vectored read and printed
+   * with a single write. Pointers are not followed, so that the snapshot
+   * needs no further reads.
+   */
+  auto show_watched_globals() noexcept -> void;
+
+  /**
+   * @brief Unwinds the innermost frame and its caller.
+   *
+   * This is all that is needed to evaluate expressions in the innermost
+   * frame, including the entry values of its parameters, and is cheaper
+   * than unwinding the whole stack at every stop.
+   *
+   * @param caller Receives the caller's function, or an invalid DIE
+   * @return The innermost frames
+   */
+  auto get_innermost_frames(dwarf::die &caller) -> std::vector<frame>;
+
+  /**
+   * @brief Gets the functions of the selected frame and of its caller.
+   *
+   * Prints a message if the selected frame has no debug information.
+   *
+   * @param function Receives the function of the selected frame
+   * @param caller Receives the caller's function, or an invalid DIE
+   * @return true if the function of the selected frame is known
+   */
+  auto get_selected_functions(dwarf::die &function, dwarf::die &caller)
+      -> bool;
+
+  /**
+   * @brief Gets the function a frame is executing.
+   *
+   * @param f The frame to look up
+   * @return The DWARF debugging information for the function
+   * @throws std::out_of_range if the function has no debug information
+   */
+  auto get_frame_function(const frame &f) -> dwarf::die;
+
+  /**
+   * @brief Gets the name of the function a frame is executing.
+   *
+   * @param f The frame to look up
+   * @return The function name, or "??" if it is unknown
+   */
+  auto get_frame_function_name(const frame &f) -> std::string;
+
   /**
    * @brief Gets the function containing a specific program counter value.
    *
@@ -0,0 +1,62 @@
+/**
+ * @file display.h
+ * @brief Expressions displayed automatically whenever the program stops.
+ *
+ * This file contains the display type and format_displays, which evaluates
+ * a list of compiled expressions in a frame. The expressions are evaluated
+ * together in rounds: each round records the memory the expressions still
+ * need, and all of it is then fetched with one vectored read. Displays of
+ * locals and their members cost a single read per stop however many of
+ * them there are, the elements of displayed containers are fetched in the
+ * same rounds, and the output is returned as one string so that it can be
+ * written at once.
+ */
+
+#ifndef DISPLAY_H_
+#define DISPLAY_H_
+
+#include "dwarf/dwarf++.hh"
+#include "dwarf_expr.h"
+#include "expression.h"
+#include "tls.h"
+#include "unwinder.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * @struct display
+ * @brief An expression displayed at every stop.
+ */
+struct display {
+  unsigned number; ///< Number identifying the display
+  expression expr; ///< The compiled expression
+};
+
+/**
+ * @brief Evaluates and formats displays in a frame.
+ *
+ * Each display is formatted on its own line as `number: text = value`.
+ *
+ * @param displays The displays to evaluate
+ * @param pid Process ID of the program being debugged
+ * @param frames Frames of the stack, innermost first
+ * @param index Index of the frame to evaluate in
+ * @param caller Function of the frame's caller, or an invalid DIE
+ * @param locations Cache of decoded location attributes
+ * @param load_address Base load address of the program
+ * @param tls Thread-local storage blocks of the program
+ * @param max_elements Elements of a container printed before the rest are
+ * elided
+ * @return The formatted displays
+ */
+auto format_displays(const std::vector<const display *> &displays, pid_t pid,
+                     const std::vector<frame> &frames, std::size_t index,
+                     const dwarf::die &caller, location_cache &locations,
+                     std::uint64_t load_address, tls_cache *tls,
+                     std::size_t max_elements) -> std::string;
+
+#endif // DISPLAY_H_
@@ -0,0 +1,335 @@
+/**
+ * @file dwarf_expr.h
+ * @brief Evaluator for DWARF expressions and location descriptions.
+ *
+ * This file contains a small virtual machine for DWARF expressions, as used
+ * by DW_AT_location, DW_AT_frame_base and call frame information. Each
+ * expression is decoded once into a compact array of operations, and the
+ * decoded locations are cached per DIE, so locations that are evaluated at
+ * every stop never parse the DWARF bytes again. Location lists are read from
+ * the .debug_loc section.
+ */
+
+#ifndef DWARF_EXPR_H_
+#define DWARF_EXPR_H_
+
+#include "cfi.h"
+#include "dwarf/dwarf++.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * @struct dwarf_op
+ * @brief A decoded DWARF operation.
+ */
+struct dwarf_op {
+  std::uint8_t code = 0;  ///< DW_OP opcode
+  std::uint64_t arg1 = 0; ///< First operand, or the target of a branch
+  std::uint64_t arg2 = 0; ///< Second operand
+};
+
+/**
+ * @class dwarf_program
+ * @brief A DWARF expression decoded into an array of operations.
+ *
+ * Operands are decoded ahead of time and branch offsets are resolved to
+ * operation indices. The operations of the expression nested in
+ * DW_OP_entry_value directly follow it, and its first operand holds their
+ * count.
+ */
+class dwarf_program {
+public:
+  /**
+   * @brief Default constructor, creates an empty expression.
+   */
+  dwarf_program() = default;
+
+  /**
+   * @brief Decodes a DWARF expression.
+   *
+   * @param expr The bytes of the expression
+   * @param size Size of the expression in bytes
+   * @throws std::invalid_argument if the expression is malformed or uses an
+   * unsupported operation
+   */
+  dwarf_program(const std::uint8_t *expr, std::size_t size);
+
+  /**
+   * @brief Gets the decoded operations.
+   */
+  auto ops() const noexcept -> const std::vector<dwarf_op> & { return m_ops; }
+
+  /**
+   * @brief Gets the bytes referenced by DW_OP_implicit_value operations.
+   */
+  auto data() const noexcept -> const std::vector<std::uint8_t> & {
+    return m_data;
+  }
+
+  /**
+   * @brief Checks whether the expression has no operations.
+   */
+  auto empty() const noexcept -> bool { return m_ops.empty(); }
+
+private:
+  /**
+   * @brief Decodes an expression and appends its operations.
+   *
+   * @param expr The bytes of the expression
+   * @param size Size of the expression in bytes
+   */
+  auto decode(const std::uint8_t *expr, std::size_t size) -> void;
+
+  std::vector<dwarf_op> m_ops;      ///< Decoded operations
+  std::vector<std::uint8_t> m_data; ///< Contents of implicit values
+};
+
+/**
+ * @struct location_piece
+ * @brief Where one piece of an object lives.
+ */
+struct location_piece {
+  enum class kind {
+    memory,   ///< In memory, at the address in value
+    reg,      ///< In the DWARF register numbered value
+    value,    ///< Not stored anywhere, value is its contents
+    implicit, ///< Not stored anywhere, data points at its contents
+    undefined ///< Optimized out
+  };
+
+  kind type = kind::undefined;        ///< Kind of the location
+  std::uint64_t value = 0;            ///< Address, register or value
+  const std::uint8_t *data = nullptr; ///< Contents of an implicit value
+  std::uint64_t bit_size = 0;         ///< Size in bits, 0 for the whole object
+  std::uint64_t bit_offset = 0;       ///< Bit offset within the location
+};
+
+/**
+ * @struct dwarf_location
+ * @brief The result of evaluating a location description.
+ */
+struct dwarf_location {
+  std::vector<location_piece> pieces; ///< Pieces of the object, in order
+};
+
+/**
+ * @class dwarf_expr_context
+ * @brief The program state a DWARF expression is evaluated against.
+ *
+ * Implementations throw std::out_of_range when a register or memory
+ * location is not available.
+ */
+class dwarf_expr_context {
+public:
+  virtual ~dwarf_expr_context() = default;
+
+  /**
+   * @brief Gets the value of a register.
+   *
+   * @param regnum DWARF register number
+   * @return The value of the register
+   */
+  virtual auto reg(unsigned regnum) -> std::uint64_t = 0;
+
+  /**
+   * @brief Reads memory of the program.
+   *
+   * @param address Address to read from
+   * @param buffer Destination buffer of at least @p size bytes
+   * @param size Number of bytes to read
+   */
+  virtual auto read_memory(std::uint64_t address, void *buffer,
+                           std::size_t size) -> void = 0;
+
+  /**
+   * @brief Gets the frame base of the current function, for DW_OP_fbreg.
+   */
+  virtual auto frame_base() -> std::uint64_t {
+    throw std::out_of_range{"No frame base"};
+  }
+
+  /**
+   * @brief Gets the canonical frame address, for DW_OP_call_frame_cfa.
+   */
+  virtual auto call_frame_cfa() -> std::uint64_t {
+    throw std::out_of_range{"No call frame address"};
+  }
+
+  /**
+   * @brief Gets the address of a thread-local variable of the program.
+   *
+   * Used by DW_OP_form_tls_address and DW_OP_GNU_push_tls_address.
+   *
+   * @param offset Offset of the variable in the thread-local storage block
+   * of the program
+   */
+  virtual auto tls_address(std::uint64_t /*offset*/) -> std::uint64_t {
+    throw std::out_of_range{"No thread-local storage"};
+  }
+
+  /**
+   * @brief Converts a link-time address from DW_OP_addr to a runtime one.
+   */
+  virtual auto relocate(std::uint64_t address) -> std::uint64_t {
+    return address;
+  }
+
+  /**
+   * @brief Gets the state at entry to the current function.
+   *
+   * The context is used to evaluate the expressions of DW_OP_entry_value.
+   */
+  virtual auto entry_context() -> dwarf_expr_context & {
+    throw std::out_of_range{"Entry values are not available"};
+  }
+};
+
+/**
+ * @brief Evaluates a location description.
+ *
+ * @param program The decoded expression
+ * @param context The program state to evaluate against
+ * @param initial Value pushed on the stack before evaluation, if any
+ * @return The location of the described object
+ * @throws std::out_of_range if the state the expression needs is unavailable
+ * @throws std::invalid_argument if the expression is malformed
+ */
+auto evaluate_location(const dwarf_program &program,
+                       dwarf_expr_context &context,
+                       const std::uint64_t *initial = nullptr)
+    -> dwarf_location;
+
+/**
+ * @brief Evaluates an expression that computes an address or a value.
+ *
+ * A register location yields the contents of the register, as required for
+ * DW_AT_frame_base.
+ *
+ * @param program The decoded expression
+ * @param context The program state to evaluate against
+ * @param initial Value pushed on the stack before evaluation, if any
+ * @return The computed value
+ * @throws std::out_of_range if the value cannot be computed
+ */
+auto evaluate_value(const dwarf_program &program, dwarf_expr_context &context,
+                    const std::uint64_t *initial = nullptr) -> std::uint64_t;
+
+/**
+ * @brief Reads the contents of an object from its location.
+ *
+ * Each piece that lives in memory is fetched with a single bulk read.
+ *
+ * @param location The location of the object
+ * @param size Size of the object in bytes
+ * @param context The program state the location was evaluated against
+ * @return The bytes of the object
+ * @throws std::out_of_range if a piece is optimized out or unreadable
+ */
+auto read_location(const dwarf_location &location, std::size_t size,
+                   dwarf_expr_context &context) -> std::vector<std::uint8_t>;
+
+/**
+ * @struct location_entry
+ * @brief An expression together with the PC range it is valid for.
+ */
+struct location_entry {
+  std::uint64_t low_pc = 0;  ///< Link-time start of the range
+  std::uint64_t high_pc = 0; ///< Link-time end (exclusive) of the range
+  dwarf_program program;     ///< Expression valid in the range
+};
+
+/**
+ * @class compiled_location
+ * @brief The decoded form of a location attribute.
+ *
+ * Holds either a single expression valid everywhere, or the entries of a
+ * location list.
+ */
+class compiled_location {
+public:
+  /**
+   * @brief Default constructor, creates a location valid nowhere.
+   */
+  compiled_location() = default;
+
+  /**
+   * @brief Creates a location from a single expression.
+   *
+   * @param program The expression, valid at every PC
+   */
+  explicit compiled_location(dwarf_program program);
+
+  /**
+   * @brief Creates a location from the entries of a location list.
+   *
+   * @param entries The entries of the list
+   */
+  explicit compiled_location(std::vector<location_entry> entries) noexcept
+      : m_entries{std::move(entries)} {}
+
+  /**
+   * @brief Finds the expression valid at a program counter.
+   *
+   * @param pc Link-time program counter
+   * @return The expression, or nullptr if the object is optimized out at
+   * @p pc
+   */
+  auto find(std::uint64_t pc) const noexcept -> const dwarf_program *;
+
+private:
+  std::vector<location_entry> m_entries; ///< Expressions by PC range
+};
+
+/**
+ * @class location_cache
+ * @brief Decoded location attributes, cached by DIE.
+ */
+class location_cache {
+public:
+  /**
+   * @brief Default constructor, creates a cache without location lists.
+   */
+  location_cache() = default;
+
+  /**
+   * @brief Creates a cache that reads location lists from a section.
+   *
+   * @param debug_loc The .debug_loc section of the program
+   */
+  explicit location_cache(section_view debug_loc) noexcept
+      : m_debug_loc{debug_loc} {}
+
+  /**
+   * @brief Gets the decoded form of a location attribute of a DIE.
+   *
+   * @param die The DIE owning the attribute
+   * @param attr The attribute, such as DW_AT_location
+   * @return The decoded location
+   * @throws std::out_of_range if the DIE does not have the attribute
+   * @throws std::invalid_argument if an expression cannot be decoded
+   */
+  auto get(const dwarf::die &die, dwarf::DW_AT attr)
+      -> const compiled_location &;
+
+private:
+  /**
+   * @brief Decodes a location list of .debug_loc.
+   *
+   * @param offset Offset of the list in the section
+   * @param base Base address of the compilation unit
+   * @return The entries of the list
+   */
+  auto decode_list(std::uint64_t offset, std::uint64_t base) const
+      -> std::vector<location_entry>;
+
+  section_view m_debug_loc; ///< Section holding the location lists
+  std::unordered_map<std::uint64_t, compiled_location>
+      m_locations; ///< Decoded locations by DIE offset and attribute
+};
+
+#endif // DWARF_EXPR_H_
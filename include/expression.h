@@ -0,0 +1,199 @@
+/**
+ * @file expression.h
+ * @brief Compiler and evaluator for C-like expressions over program state.
+ *
+ * This file contains the expression class, which parses expressions such as
+ * `a->b[i].c + 4` once and compiles them into a small typed intermediate
+ * representation. Names are resolved against the DWARF scope of a program
+ * counter and types are checked while compiling, so evaluating the compiled
+ * expression at a later stop only evaluates variable locations and reads
+ * memory. print, display and breakpoint conditions share the compiled form.
+ */
+
+#ifndef EXPRESSION_H_
+#define EXPRESSION_H_
+
+#include "dwarf/dwarf++.hh"
+#include "dwarf_expr.h"
+#include "frame_context.h"
+#include "globals.h"
+#include "types.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @enum expr_opcode
+ * @brief Operations of compiled expressions.
+ *
+ * Operations work on a stack of values. Arithmetic is carried out in the
+ * type of the operation, to which the operands are converted.
+ */
+enum class expr_opcode {
+  constant,    ///< Pushes the value held in arg1
+  variable,    ///< Pushes the object described by location
+  reg,         ///< Pushes the DWARF register numbered arg1
+  member,      ///< Replaces an object by its member at offset arg1
+  bitfield,    ///< Replaces an object by arg2 bits at bit offset arg1
+  deref,       ///< Replaces a pointer by the object it points at
+  address,     ///< Replaces an object in memory by its address
+  convert,     ///< Converts a scalar to type
+  negate,      ///< Arithmetic negation
+  bit_not,     ///< Bitwise complement
+  logical_not, ///< Logical negation, yielding an int
+  add,         ///< Addition
+  sub,         ///< Subtraction
+  mul,         ///< Multiplication
+  div,         ///< Division
+  mod,         ///< Remainder
+  shl,         ///< Left shift
+  shr,         ///< Right shift
+  bit_and,     ///< Bitwise and
+  bit_or,      ///< Bitwise or
+  bit_xor,     ///< Bitwise exclusive or
+  eq,          ///< Equality, compared in type and yielding an int
+  ne,          ///< Inequality
+  lt,          ///< Less than
+  le,          ///< Less than or equal
+  gt,          ///< Greater than
+  ge,          ///< Greater than or equal
+  ptr_add,     ///< Adds an integer times arg1 to a pointer
+  ptr_sub,     ///< Subtracts an integer times arg1 from a pointer
+  ptr_diff,    ///< Number of arg1-sized elements between two pointers
+  and_jump,    ///< Pops a value, jumps to arg1 yielding 0 if it is zero
+  or_jump,     ///< Pops a value, jumps to arg1 yielding 1 if it is not zero
+  to_bool      ///< Replaces a scalar by the int 0 or 1
+};
+
+/**
+ * @struct expr_insn
+ * @brief An operation of a compiled expression.
+ */
+struct expr_insn {
+  expr_opcode op = expr_opcode::constant;      ///< The operation
+  const type_desc *type = nullptr;             ///< Type of the result
+  std::uint64_t arg1 = 0;                      ///< First operand
+  std::uint64_t arg2 = 0;                      ///< Second operand
+  const compiled_location *location = nullptr; ///< Location of a variable
+};
+
+/**
+ * @struct expr_value
+ * @brief The result of evaluating an expression.
+ *
+ * Objects in memory are not read until their contents are needed, so that
+ * the caller can fetch large results, or the results of many expressions,
+ * in bulk.
+ */
+struct expr_value {
+  const type_desc *type = nullptr; ///< Type of the value
+  bool in_memory = false;          ///< Whether the object is at address
+  std::uint64_t address = 0;       ///< Address of an object in memory
+  std::vector<std::uint8_t> bytes; ///< Contents of a value not in memory
+};
+
+/**
+ * @class expression
+ * @brief A C-like expression compiled against a DWARF scope.
+ *
+ * Supports variables, enumerators, registers ($rax), integer, floating and
+ * character literals, member access, indexing, address-of, dereference,
+ * casts, arithmetic, comparisons and logical operators. The compiled form
+ * only holds types and locations, so it can be evaluated at any stop in
+ * the scope it was compiled for.
+ */
+class expression {
+public:
+  /**
+   * @brief Compiles an expression.
+   *
+   * @param text Source of the expression
+   * @param function Function whose scope names are resolved in
+   * @param pc Link-time program counter selecting the lexical blocks
+   * @param types Type descriptions of the program
+   * @param locations Cache of decoded location attributes
+   * @param globals Global variables of the program
+   * @throws std::invalid_argument if the expression is malformed, ill-typed
+   * or refers to unknown names
+   */
+  expression(std::string text, const dwarf::die &function, std::uint64_t pc,
+             type_index &types, location_cache &locations,
+             const global_index &globals);
+
+  /**
+   * @brief Evaluates the expression in a frame.
+   *
+   * @param frame The frame of the function the expression was compiled for
+   * @return The value, which is left in memory if it is an object there
+   * @throws std::out_of_range if a variable is optimized out or memory
+   * cannot be read
+   * @throws std::invalid_argument on errors such as division by zero
+   */
+  auto evaluate(frame_context &frame) const -> expr_value;
+
+  /**
+   * @brief Evaluates the expression as a condition.
+   *
+   * @param frame The frame of the function the expression was compiled for
+   * @return true if the value is not zero
+   */
+  auto test(frame_context &frame) const -> bool;
+
+  /**
+   * @brief Gets the source of the expression.
+   */
+  auto text() const noexcept -> const std::string & { return m_text; }
+
+  /**
+   * @brief Gets the type of the value of the expression.
+   */
+  auto type() const noexcept -> const type_desc & { return *m_type; }
+
+  /**
+   * @brief Gets the function the expression was compiled for.
+   */
+  auto function() const noexcept -> const dwarf::die & { return m_function; }
+
+  /**
+   * @brief Checks whether the expression uses locals or registers.
+   *
+   * Expressions that only use globals can be evaluated in any frame.
+   */
+  auto needs_frame() const noexcept -> bool { return m_needs_frame; }
+
+  /**
+   * @brief Gets the compiled operations.
+   */
+  auto insns() const noexcept -> const std::vector<expr_insn> & {
+    return m_insns;
+  }
+
+private:
+  friend class expr_compiler;
+
+  std::string m_text;                ///< Source of the expression
+  dwarf::die m_function;             ///< Scope names were resolved in
+  std::vector<expr_insn> m_insns;    ///< Compiled operations
+  const type_desc *m_type = nullptr; ///< Type of the result
+  bool m_needs_frame = false;        ///< Whether locals or registers are used
+  std::vector<std::unique_ptr<type_desc>>
+      m_derived; ///< Pointer and array types made up while compiling
+};
+
+/**
+ * @brief Gets the contents of a value.
+ *
+ * An object in memory is fetched with a single read.
+ *
+ * @param value The value
+ * @param context The program state the value was computed in
+ * @return The bytes of the value, type->size of them
+ * @throws std::out_of_range if the memory cannot be read
+ */
+auto read_value(const expr_value &value, dwarf_expr_context &context)
+    -> std::vector<std::uint8_t>;
+
+#endif // EXPRESSION_H_
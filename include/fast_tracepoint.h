@@ -0,0 +1,263 @@
+/**
+ * @file fast_tracepoint.h
+ * @brief Tracepoints that are handled inside the debugged process.
+ *
+ * This file contains the fast_tracepoint_table class, which patches jumps to
+ * trampolines in the shared arena over the instructions at a tracepoint. A
+ * trampoline calls the agent library preloaded into the program, which
+ * records the registers and collected memory into a ring buffer in the
+ * arena, then runs the displaced instructions and jumps back. A hit costs a
+ * function call instead of a trap and two context switches, and the
+ * debugger collects the records when the program next stops.
+ *
+ * A tracepoint may also stop the program, when the agent finds its
+ * condition holds. The trampoline then traps with the saved registers on
+ * the stack, and the debugger moves the thread back to the tracepoint as if
+ * it had hit a breakpoint there.
+ *
+ * A jump is five bytes long, so the instructions it overwrites must fit in
+ * the function, must not be relative branches, and must not be the target
+ * of branches themselves. The arena must be within 2 GiB of the tracepoint.
+ */
+
+#ifndef FAST_TRACEPOINT_H_
+#define FAST_TRACEPOINT_H_
+
+#include "agent.h"
+#include "arena.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * @struct fast_tracepoint
+ * @brief A tracepoint patched with a jump to a trampoline.
+ */
+struct fast_tracepoint {
+  unsigned number = 0;                ///< Number identifying the tracepoint
+  std::uint64_t address = 0;          ///< Address of the tracepoint
+  std::uint64_t site = 0;             ///< Address of its agent_site
+  std::uint64_t trampoline = 0;       ///< Address of its trampoline
+  std::uint64_t trap = 0;             ///< Address of the int3 that stops
+  std::uint64_t displaced = 0;        ///< Address of the moved instructions
+  std::vector<std::uint8_t> original; ///< Bytes the jump replaced
+};
+
+/**
+ * @class fast_tracepoint_table
+ * @brief The fast tracepoints of a process.
+ */
+class fast_tracepoint_table {
+public:
+  /**
+   * @brief Creates a table without tracepoints.
+   *
+   * @param pid Process ID of the program being debugged
+   * @param arena Memory shared with the process, which must be mapped
+   * before tracepoints are added
+   */
+  fast_tracepoint_table(pid_t pid, shared_arena &arena) noexcept
+      : m_pid{pid}, m_arena{arena} {}
+
+  /**
+   * @brief Adds a tracepoint.
+   *
+   * The agent is looked up in the process the first time.
+   *
+   * @param address Address of an instruction
+   * @param limit End of the function containing the instruction
+   * @param flags What a hit does, a combination of agent_site_record and
+   * agent_site_stop
+   * @param condition Bytecode of the condition of the hits, empty if the
+   * tracepoint has none
+   * @return The new tracepoint
+   * @throws std::out_of_range if the agent is not loaded, the instructions
+   * cannot be moved or the trampoline cannot be reached
+   * @throws std::invalid_argument if the condition is too long
+   */
+  auto add(std::uint64_t address, std::uint64_t limit,
+           std::uint32_t flags = agent_site_record,
+           const std::vector<agent_insn> &condition = {})
+      -> const fast_tracepoint &;
+
+  /**
+   * @brief Gets the number of bytes the jump of a tracepoint would replace.
+   *
+   * The bytes are those of every instruction the jump overlaps, which must
+   * all be checked before the tracepoint is added: none but the first may
+   * be the target of a branch or the next instruction of a thread.
+   *
+   * @param address Address of an instruction
+   * @param limit End of the function containing the instruction
+   * @return Length of the replaced instructions
+   * @throws std::out_of_range if the instructions cannot be read or decoded
+   */
+  auto patch_length(std::uint64_t address, std::uint64_t limit) const
+      -> std::size_t;
+
+  /**
+   * @brief Removes a tracepoint, restoring its instructions.
+   *
+   * @param number Number of the tracepoint
+   * @return false if there is no such tracepoint
+   */
+  auto remove(unsigned number) -> bool;
+
+  /**
+   * @brief Gets the tracepoints, in the order they were added.
+   */
+  auto tracepoints() const noexcept -> const std::vector<fast_tracepoint> & {
+    return m_tracepoints;
+  }
+
+  /**
+   * @brief Gets the view of a tracepoint shared with the agent.
+   *
+   * @param t The tracepoint
+   */
+  auto site(const fast_tracepoint &t) const noexcept -> agent_site & {
+    return *reinterpret_cast<agent_site *>(m_arena.local(t.site));
+  }
+
+  /**
+   * @brief Moves the records in the ring out of the shared arena.
+   *
+   * @param records Receives the records, oldest first
+   * @return Number of records moved
+   */
+  auto drain(std::vector<agent_record> &records) -> std::size_t;
+
+  /**
+   * @brief Gets the number of records lost because the ring was full.
+   */
+  auto dropped() const noexcept -> std::uint64_t;
+
+  /**
+   * @brief Checks whether an address is covered by a tracepoint's jump.
+   *
+   * @param address Address in the process
+   */
+  auto covers(std::uint64_t address) const noexcept -> bool;
+
+  /**
+   * @brief Finds the tracepoint at an address.
+   *
+   * @param address Address in the process
+   * @return The tracepoint, or nullptr if none starts at @p address
+   */
+  auto find(std::uint64_t address) const noexcept -> const fast_tracepoint *;
+
+  /**
+   * @brief Checks whether the agent library is loaded in the process.
+   */
+  auto agent_loaded() const -> bool;
+
+  /**
+   * @brief Moves a thread that trapped in a trampoline to its tracepoint.
+   *
+   * Restores the registers the trampoline saved and sets the program
+   * counter to the address of the tracepoint, where the thread appears to
+   * be stopped at a breakpoint.
+   *
+   * @return The tracepoint, or nullptr if the thread did not trap in a
+   * trampoline
+   */
+  auto land() -> const fast_tracepoint *;
+
+  /**
+   * @brief Gets the address of the tracepoint the thread landed at.
+   *
+   * @return The address, or 0 if the thread has not landed at one
+   */
+  auto landed() const noexcept -> std::uint64_t { return m_landed; }
+
+  /**
+   * @brief Lets a thread that landed at a tracepoint resume past it.
+   *
+   * A thread still at the tracepoint is moved to the displaced
+   * instructions, so that it does not hit the tracepoint again.
+   */
+  auto leave() -> void;
+
+  /**
+   * @brief Restores the instructions of all tracepoints in the process,
+   * keeping the tracepoints.
+   *
+   * @throws std::out_of_range if the text cannot be written
+   */
+  auto unpatch() -> void;
+
+  /**
+   * @brief Writes the jumps of all tracepoints into the process again.
+   *
+   * @throws std::out_of_range if the text cannot be written
+   */
+  auto patch() -> void;
+
+  /**
+   * @brief Traces another process from now on, a copy of the first made by
+   * fork, which shares the arena with it.
+   *
+   * The jumps are not written; patch() does that once the copy is the
+   * process being debugged.
+   *
+   * @param pid Process ID of the copy
+   */
+  auto set_pid(pid_t pid) noexcept -> void;
+
+private:
+  /**
+   * @brief Finds the agent library in the mappings of the process.
+   *
+   * @param path Receives the path of the library
+   * @return Address the library is loaded at, or 0 if it is not loaded
+   */
+  auto find_agent(std::string &path) const -> std::uint64_t;
+
+  /**
+   * @brief Finds cdb_agent_hit in the process and creates the ring.
+   *
+   * @throws std::out_of_range if the agent library is not loaded
+   */
+  auto load_agent() -> void;
+
+  /**
+   * @brief Reads the instructions a jump at a tracepoint could replace.
+   *
+   * @param address Address of the tracepoint
+   * @param limit End of the function containing it
+   * @param code Receives the bytes, room for the jump and a whole
+   * instruction
+   * @return Number of bytes read, which all belong to the function
+   * @throws std::out_of_range if the instructions cannot be read
+   */
+  auto read_instructions(std::uint64_t address, std::uint64_t limit,
+                         std::uint8_t *code) const -> std::size_t;
+
+  /**
+   * @brief Writes the trampoline of a tracepoint into the arena.
+   *
+   * @param t The tracepoint, whose address and original bytes are set
+   * @param code The instructions at the tracepoint
+   * @param size Number of bytes at @p code that belong to the function
+   * @throws std::out_of_range if the instructions cannot be moved
+   */
+  auto build_trampoline(fast_tracepoint &t, const std::uint8_t *code,
+                        std::size_t size) -> void;
+
+  pid_t m_pid;                                ///< Process ID of the program
+  shared_arena &m_arena;                      ///< Holds sites and trampolines
+  std::uint64_t m_hit_function = 0;           ///< Address of cdb_agent_hit
+  agent_ring *m_ring = nullptr;               ///< The ring in the arena
+  std::uint64_t m_ring_address = 0;           ///< The ring in the process
+  std::uint64_t m_code_page = 0;              ///< Page trampolines are put in
+  std::size_t m_code_used = 0;                ///< Bytes used in the page
+  std::vector<fast_tracepoint> m_tracepoints; ///< Tracepoints by number
+  unsigned m_next_number = 1;                 ///< Number of the next one
+  std::uint64_t m_landed = 0;                 ///< Tracepoint landed at
+};
+
+#endif // FAST_TRACEPOINT_H_
@@ -0,0 +1,108 @@
+/**
+ * @file frame_context.h
+ * @brief Evaluates DWARF location expressions in a frame of a backtrace.
+ *
+ * This file contains the frame_context class, which supplies the registers,
+ * memory, frame base and CFA of one unwound frame to the DWARF expression
+ * evaluator. Values that a callee received in registers it has since
+ * clobbered are recovered for DW_OP_entry_value from the caller's frame,
+ * either from callee-saved registers or from the call-site parameters the
+ * compiler describes for the call.
+ */
+
+#ifndef FRAME_CONTEXT_H_
+#define FRAME_CONTEXT_H_
+
+#include "dwarf/dwarf++.hh"
+#include "dwarf_expr.h"
+#include "tls.h"
+#include "unwinder.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * @class frame_context
+ * @brief The state of one frame of a backtrace, for DWARF expressions.
+ */
+class frame_context : public dwarf_expr_context {
+public:
+  /**
+   * @brief Creates the context of a frame.
+   *
+   * @param pid Process ID of the program being debugged
+   * @param frames Frames of the backtrace, innermost first
+   * @param index Index of the frame in @p frames
+   * @param function DIE of the function executing in the frame
+   * @param caller DIE of the function of the next outer frame, or an
+   * invalid DIE if it is unknown
+   * @param locations Cache of decoded location attributes
+   * @param load_address Base load address of the program
+   * @param tls Thread-local storage blocks of the program, if thread-locals
+   * are to be resolved
+   */
+  frame_context(pid_t pid, const std::vector<frame> &frames, std::size_t index,
+                dwarf::die function, dwarf::die caller,
+                location_cache &locations, std::uint64_t load_address,
+                tls_cache *tls = nullptr);
+
+  /**
+   * @brief Gets the link-time PC used to select location list entries.
+   *
+   * For frames other than the innermost this is inside the call
+   * instruction, as the return address may lie past the end of a range.
+   */
+  auto link_pc() const noexcept -> std::uint64_t;
+
+  auto reg(unsigned regnum) -> std::uint64_t override;
+  auto read_memory(std::uint64_t address, void *buffer, std::size_t size)
+      -> void override;
+  auto frame_base() -> std::uint64_t override;
+  auto call_frame_cfa() -> std::uint64_t override;
+  auto tls_address(std::uint64_t offset) -> std::uint64_t override;
+  auto relocate(std::uint64_t address) -> std::uint64_t override;
+  auto entry_context() -> dwarf_expr_context & override;
+
+private:
+  /**
+   * @class entry_state
+   * @brief The registers of a frame as they were at entry to its function.
+   */
+  class entry_state : public dwarf_expr_context {
+  public:
+    explicit entry_state(frame_context &frame) noexcept : m_frame{frame} {}
+
+    auto reg(unsigned regnum) -> std::uint64_t override;
+    auto read_memory(std::uint64_t address, void *buffer, std::size_t size)
+        -> void override;
+
+  private:
+    frame_context &m_frame; ///< Frame whose entry state is described
+  };
+
+  /**
+   * @brief Finds the value passed in a register by the call into this frame.
+   *
+   * @param regnum DWARF register number of the parameter
+   * @return The value computed by the matching call-site parameter
+   * @throws std::out_of_range if the call site does not describe it
+   */
+  auto call_site_value(unsigned regnum) -> std::uint64_t;
+
+  pid_t m_pid;                          ///< Process ID of the debugged program
+  const std::vector<frame> &m_frames;   ///< Frames of the backtrace
+  std::size_t m_index;                  ///< Index of this frame
+  dwarf::die m_function;                ///< Function executing in the frame
+  dwarf::die m_caller;                  ///< Function of the calling frame
+  location_cache &m_locations;          ///< Decoded location attributes
+  std::uint64_t m_load_address;         ///< Base load address of the program
+  bool m_has_frame_base = false;        ///< Whether m_frame_base is computed
+  std::uint64_t m_frame_base = 0;       ///< Memoized DW_AT_frame_base
+  std::unique_ptr<entry_state> m_entry; ///< State at function entry
+  tls_cache *m_tls;                     ///< Thread-local storage blocks
+};
+
+#endif // FRAME_CONTEXT_H_
@@ -0,0 +1,105 @@
+/**
+ * @file globals.h
+ * @brief Name index of the global and static variables of a program.
+ *
+ * This file contains the global_index class, which collects the variables
+ * defined at compilation unit and namespace scope once, so that names in
+ * expressions are resolved with a hash lookup rather than a walk over the
+ * DIEs of every unit. Variables at fixed addresses also record their
+ * link-time address, which only needs the load address of the program added
+ * to be read, and thread-locals their offset in the thread-local storage
+ * block of the program.
+ */
+
+#ifndef GLOBALS_H_
+#define GLOBALS_H_
+
+#include "dwarf/dwarf++.hh"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @struct global_variable
+ * @brief A variable defined at compilation unit or namespace scope.
+ */
+struct global_variable {
+  std::string name;          ///< Name, qualified by namespaces and classes
+  dwarf::die die;            ///< DIE holding the location of the variable
+  std::uint64_t address = 0; ///< Link-time address, or offset if tls
+  bool fixed = false;        ///< Whether the variable is at address
+  bool tls = false;          ///< Whether address is a thread-local offset
+};
+
+/**
+ * @class global_index
+ * @brief Looks up global and static variables by name.
+ */
+class global_index {
+public:
+  /**
+   * @brief Default constructor, creates an empty index.
+   */
+  global_index() = default;
+
+  /**
+   * @brief Indexes the variables of every compilation unit.
+   *
+   * Definitions of static data members and of variables declared earlier
+   * are named after their declaration.
+   *
+   * @param dw The DWARF data of the program
+   */
+  explicit global_index(const dwarf::dwarf &dw);
+
+  /**
+   * @brief Finds a variable by name.
+   *
+   * Static variables of different units may share a name, in which case
+   * the one defined in @p unit is preferred.
+   *
+   * @param name The name of the variable, qualified if it is in a namespace
+   * @param unit The unit the name is used in
+   * @return The variable, or nullptr if there is none
+   */
+  auto find(const std::string &name, const dwarf::unit &unit) const noexcept
+      -> const global_variable *;
+
+  /**
+   * @brief Finds a variable by name in any unit.
+   *
+   * @param name The name of the variable, qualified if it is in a namespace
+   * @return The first variable of that name, or nullptr if there is none
+   */
+  auto find(const std::string &name) const noexcept
+      -> const global_variable *;
+
+private:
+  /**
+   * @brief Indexes the variables of a scope and of the scopes nested in it.
+   *
+   * @param scope The unit, namespace or class DIE
+   * @param prefix Qualifier of names in the scope, including the final `::`
+   * @param declarations Receives the names of declarations by DIE offset
+   * @param definitions Receives the definitions named by a declaration
+   */
+  auto index_scope(
+      const dwarf::die &scope, const std::string &prefix,
+      std::unordered_map<dwarf::section_offset, std::string> &declarations,
+      std::vector<dwarf::die> &definitions) -> void;
+
+  /**
+   * @brief Adds a variable definition to the index.
+   *
+   * @param name Qualified name of the variable
+   * @param die The DIE holding its location
+   */
+  auto add(const std::string &name, const dwarf::die &die) -> void;
+
+  std::unordered_map<std::string, std::vector<global_variable>>
+      m_variables; ///< Definitions by qualified name
+};
+
+#endif // GLOBALS_H_
@@ -0,0 +1,75 @@
+/**
+ * @file inject.h
+ * @brief System calls made by the debugged process on the debugger's behalf.
+ *
+ * This file contains the syscall_injector class, which runs a system call
+ * inside the stopped process, for operations that can only be done from
+ * within it, such as changing the protection of its pages or mapping memory
+ * into it. Each call saves the registers, writes a `syscall` instruction to
+ * a scratch location in the text of the program, its entry point, points
+ * the PC at it with the arguments in registers, steps once, and restores
+ * the text and the registers. The entry point is thus intact when calls are
+ * made before the program has started.
+ */
+
+#ifndef INJECT_H_
+#define INJECT_H_
+
+#include <cstdint>
+#include <initializer_list>
+#include <sys/types.h>
+
+/**
+ * @class syscall_injector
+ * @brief Makes system calls in a stopped process.
+ */
+class syscall_injector {
+public:
+  /**
+   * @brief Creates an injector without a scratch location.
+   *
+   * @param pid Process ID of the program being debugged
+   */
+  explicit syscall_injector(pid_t pid) noexcept : m_pid{pid} {}
+
+  /**
+   * @brief Sets where the syscall instruction is placed.
+   *
+   * @param address Runtime address of code the process no longer executes
+   */
+  auto set_scratch_address(std::uint64_t address) noexcept -> void;
+
+  /**
+   * @brief Gets where the syscall instruction is placed, 0 if not set.
+   */
+  auto scratch_address() const noexcept -> std::uint64_t { return m_scratch; }
+
+  /**
+   * @brief Makes calls in another process, a copy of the first.
+   *
+   * @param pid Process ID of the copy
+   */
+  auto set_pid(pid_t pid) noexcept -> void { m_pid = pid; }
+
+  /**
+   * @brief Makes a system call in the process.
+   *
+   * The process must be stopped. Its registers and text are left as they
+   * were. Signals that arrive before the call is made are sent again after
+   * it, to be delivered when the process next runs.
+   *
+   * @param number Number of the system call
+   * @param args Up to six arguments
+   * @return The result of the call, a negated errno value on failure
+   * @throws std::out_of_range if the process cannot be made to run the call
+   * @throws std::invalid_argument if there are more than six arguments
+   */
+  auto call(long number, std::initializer_list<std::uint64_t> args)
+      -> std::int64_t;
+
+private:
+  pid_t m_pid;                 ///< Process ID of the debugged program
+  std::uint64_t m_scratch = 0; ///< Address of the syscall instruction
+};
+
+#endif // INJECT_H_
@@ -0,0 +1,218 @@
+/**
+ * @file journal.h
+ * @brief A binary journal of the stops of the debugged process.
+ *
+ * This file contains the journal_writer and journal_reader classes. The
+ * debugger appends a record to the journal each time the process stops,
+ * including stops it resumes from without reporting them, such as hits of
+ * conditional breakpoints whose condition is false. Records have a fixed
+ * size and follow a short header, so a journal is read by mapping it and
+ * indexing it like an array, and can be analysed after the target is gone.
+ *
+ * Records are written with a single write on a file opened for appending,
+ * so a journal that is cut short by a crash only loses its last record.
+ */
+
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include "registers.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/// Bytes of memory a record can hold
+constexpr std::size_t journal_memory_size = 256;
+
+/// Version of the layout of journal records
+constexpr std::uint32_t journal_version = 1;
+
+/// Flag of records of stops the debugger resumed from without reporting
+constexpr std::uint32_t journal_resumed = 1;
+
+/// Flag of records holding a snapshot of the registers
+constexpr std::uint32_t journal_registers = 2;
+
+/// Flag of records holding collected memory
+constexpr std::uint32_t journal_memory = 4;
+
+/**
+ * @enum journal_reason
+ * @brief Why the process stopped.
+ */
+enum class journal_reason : std::uint32_t {
+  trap,       ///< A breakpoint, tracepoint or single step
+  watchpoint, ///< A watched object changed
+  signal,     ///< A signal other than SIGTRAP
+  exited      ///< The process is gone
+};
+
+/**
+ * @struct journal_header
+ * @brief The start of a journal file.
+ */
+struct journal_header {
+  char magic[8];             ///< "CDBJRNL" and a terminating zero
+  std::uint32_t version;     ///< journal_version
+  std::uint32_t record_size; ///< sizeof(journal_record)
+  std::uint64_t reserved[2]; ///< Zero
+};
+
+/**
+ * @struct journal_record
+ * @brief One stop of the process.
+ */
+struct journal_record {
+  std::uint64_t sequence = 0;                   ///< Position in the journal
+  std::uint64_t timestamp = 0;                  ///< Nanoseconds since the epoch
+  std::int32_t thread = 0;                      ///< Thread that stopped
+  journal_reason reason = journal_reason::trap; ///< Why it stopped
+  std::uint32_t signal = 0;                     ///< Signal number, if any
+  std::uint32_t flags = 0;                      ///< Set of journal flags
+  std::uint64_t pc = 0;                         ///< Where the thread stopped
+  std::uint64_t regs[n_dwarf_registers] = {};   ///< DWARF registers 0 to 16
+  std::uint64_t eflags = 0;                     ///< Flags register
+  std::uint64_t memory_address = 0;             ///< Start of collected memory
+  std::uint32_t memory_bytes = 0;               ///< Bytes of memory in use
+  std::uint32_t reserved = 0;                   ///< Zero
+  std::uint8_t memory[journal_memory_size];     ///< Collected memory
+};
+
+/**
+ * @class journal_writer
+ * @brief Appends records to a journal file.
+ */
+class journal_writer {
+public:
+  journal_writer() noexcept = default;
+  journal_writer(const journal_writer &) = delete;
+  auto operator=(const journal_writer &) -> journal_writer & = delete;
+
+  /**
+   * @brief Closes the journal.
+   */
+  ~journal_writer();
+
+  /**
+   * @brief Opens a journal, creating it if it does not exist.
+   *
+   * Records are appended after those already in the file. Any journal
+   * already open is closed first.
+   *
+   * @param path Path of the file
+   * @throws std::out_of_range if the file cannot be opened
+   * @throws std::invalid_argument if the file is not a journal of this
+   * version
+   */
+  auto open(const std::string &path) -> void;
+
+  /**
+   * @brief Closes the journal, if one is open.
+   */
+  auto close() noexcept -> void;
+
+  /**
+   * @brief Checks whether a journal is open.
+   */
+  auto is_open() const noexcept -> bool { return m_fd != -1; }
+
+  /**
+   * @brief Gets the path of the open journal.
+   */
+  auto path() const noexcept -> const std::string & { return m_path; }
+
+  /**
+   * @brief Gets the number of records in the journal.
+   */
+  auto size() const noexcept -> std::uint64_t { return m_records; }
+
+  /**
+   * @brief Appends a record, numbering it.
+   *
+   * @param record The record, whose sequence is set
+   * @return false if the record could not be written
+   */
+  auto append(journal_record &record) noexcept -> bool;
+
+private:
+  int m_fd = -1;               ///< The open file, or -1
+  std::string m_path;          ///< Path of the open file
+  std::uint64_t m_records = 0; ///< Records in the file
+};
+
+/**
+ * @class journal_reader
+ * @brief Gives access to the records of a journal file.
+ */
+class journal_reader {
+public:
+  /**
+   * @brief Maps a journal.
+   *
+   * @param path Path of the file
+   * @throws std::out_of_range if the file cannot be mapped
+   * @throws std::invalid_argument if the file is not a journal of this
+   * version
+   */
+  explicit journal_reader(const std::string &path);
+
+  journal_reader(const journal_reader &) = delete;
+  auto operator=(const journal_reader &) -> journal_reader & = delete;
+
+  /**
+   * @brief Unmaps the journal.
+   */
+  ~journal_reader();
+
+  /**
+   * @brief Gets the number of whole records in the journal.
+   */
+  auto size() const noexcept -> std::uint64_t { return m_records; }
+
+  /**
+   * @brief Gets a record.
+   *
+   * @param index Position of the record
+   * @throws std::out_of_range if there is no such record
+   */
+  auto at(std::uint64_t index) const -> const journal_record &;
+
+  /**
+   * @brief Finds the first record at or after a time.
+   *
+   * @param timestamp Nanoseconds since the epoch
+   * @return Position of the record, or size() if all records are older
+   */
+  auto seek(std::uint64_t timestamp) const noexcept -> std::uint64_t;
+
+private:
+  void *m_map = nullptr;                   ///< Mapping of the whole file
+  std::size_t m_size = 0;                  ///< Size of the mapping
+  const journal_record *m_first = nullptr; ///< First record
+  std::uint64_t m_records = 0;             ///< Number of whole records
+};
+
+/**
+ * @brief Prints a record on one line, with its registers and memory
+ * indented below it.
+ *
+ * @param record The record
+ * @param out Stream to print to
+ */
+auto print_journal_record(const journal_record &record, std::ostream &out)
+    -> void;
+
+/**
+ * @brief Prints a range of the records of a journal and their total.
+ *
+ * @param reader The journal
+ * @param first Position of the first record printed
+ * @param count Most records printed
+ * @param out Stream to print to
+ */
+auto print_journal(const journal_reader &reader, std::uint64_t first,
+                   std::uint64_t count, std::ostream &out) -> void;
+
+#endif // JOURNAL_H_
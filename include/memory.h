@@ -0,0 +1,203 @@
+/**
+ * @file memory.h
+ * @brief Bulk access to the memory of the debugged process.
+ *
+ * This file contains helpers for reading ranges of inferior memory with as
+ * few system calls as possible, a snapshot type that serves repeated small
+ * reads (such as the ones performed while unwinding) from one bulk read of
+ * a memory region, and a batch type that collects the reads of several
+ * independent computations so that they are satisfied together.
+ */
+
+#ifndef MEMORY_H_
+#define MEMORY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * @brief Reads a range of memory from a process.
+ *
+ * Uses process_vm_readv, so the whole range is transferred with a single
+ * system call regardless of its size.
+ *
+ * @param pid Process ID of the target process
+ * @param address Start address of the range
+ * @param buffer Destination buffer of at least @p size bytes
+ * @param size Number of bytes to read
+ * @return true if the whole range was read
+ */
+auto read_memory_block(pid_t pid, std::uint64_t address, void *buffer,
+                       std::size_t size) noexcept -> bool;
+
+/**
+ * @brief Writes a range of memory of a process.
+ *
+ * Uses process_vm_writev, so the range must be writable by the process.
+ *
+ * @param pid Process ID of the target process
+ * @param address Start address of the range
+ * @param buffer Source buffer of at least @p size bytes
+ * @param size Number of bytes to write
+ * @return true if the whole range was written
+ */
+auto write_memory_block(pid_t pid, std::uint64_t address, const void *buffer,
+                        std::size_t size) noexcept -> bool;
+
+/**
+ * @brief Writes to the code of a process.
+ *
+ * Uses PTRACE_POKETEXT a word at a time, which can write read-only pages
+ * that process_vm_writev cannot.
+ *
+ * @param pid Process ID of the target process
+ * @param address Start address of the range
+ * @param bytes Source buffer of at least @p size bytes
+ * @param size Number of bytes to write
+ * @throws std::out_of_range if the range cannot be written
+ */
+auto write_text(pid_t pid, std::uint64_t address, const std::uint8_t *bytes,
+                std::size_t size) -> void;
+
+/**
+ * @struct memory_range
+ * @brief A range of inferior memory and the local buffer it is read into.
+ */
+struct memory_range {
+  std::uint64_t address; ///< Start address of the range in the process
+  void *buffer;          ///< Destination buffer of at least size bytes
+  std::size_t size;      ///< Number of bytes to read
+};
+
+/**
+ * @brief Reads several ranges of memory from a process.
+ *
+ * The ranges are gathered into the iovecs of a single process_vm_readv
+ * call, or of one call per IOV_MAX ranges when there are more.
+ *
+ * @param pid Process ID of the target process
+ * @param ranges The ranges to read
+ * @return true if every range was read in full
+ */
+auto read_memory_ranges(pid_t pid,
+                        const std::vector<memory_range> &ranges) noexcept
+    -> bool;
+
+/**
+ * @class memory_snapshot
+ * @brief A local copy of a range of inferior memory.
+ *
+ * The snapshot is taken with one bulk read. Reads that fall inside the
+ * captured range are served locally; reads outside of it go to the process.
+ */
+class memory_snapshot {
+public:
+  /**
+   * @brief Default constructor, creates an empty snapshot.
+   */
+  memory_snapshot() = default;
+
+  /**
+   * @brief Captures a range of memory of a process.
+   *
+   * If the range cannot be read completely, the snapshot is truncated to
+   * the readable prefix.
+   *
+   * @param pid Process ID of the target process
+   * @param low Start address of the range
+   * @param high End address (exclusive) of the range
+   */
+  memory_snapshot(pid_t pid, std::uint64_t low, std::uint64_t high);
+
+  /**
+   * @brief Reads a 64-bit value.
+   *
+   * @param address Address to read from
+   * @param value Receives the value that was read
+   * @return true if the value could be read
+   */
+  auto read(std::uint64_t address, std::uint64_t &value) const noexcept
+      -> bool;
+
+  /**
+   * @brief Checks whether a range lies inside the captured memory.
+   *
+   * @param address Start address of the range
+   * @param size Size of the range in bytes
+   * @return true if the whole range is served locally
+   */
+  auto contains(std::uint64_t address, std::size_t size) const noexcept
+      -> bool;
+
+  /**
+   * @brief Gets the start address of the captured range.
+   */
+  auto low() const noexcept -> std::uint64_t { return m_low; }
+
+  /**
+   * @brief Gets the end address (exclusive) of the captured range.
+   */
+  auto high() const noexcept -> std::uint64_t { return m_low + m_data.size(); }
+
+private:
+  pid_t m_pid = 0;                 ///< Process the snapshot was taken from
+  std::uint64_t m_low = 0;         ///< Start address of the captured range
+  std::vector<std::uint8_t> m_data; ///< Captured memory contents
+};
+
+/**
+ * @class memory_batch
+ * @brief Memory reads deferred and satisfied together.
+ *
+ * A read of memory that has not been fetched yet is recorded rather than
+ * performed. Once every computation sharing the batch has recorded what it
+ * needs, fetch() reads all recorded ranges with one vectored read, and the
+ * computations are run again against the fetched memory.
+ */
+class memory_batch {
+public:
+  /**
+   * @brief Creates an empty batch reading from a process.
+   *
+   * @param pid Process ID of the target process
+   */
+  explicit memory_batch(pid_t pid) noexcept : m_pid{pid} {}
+
+  /**
+   * @brief Reads a range from the fetched memory.
+   *
+   * @param address Start address of the range
+   * @param buffer Destination buffer of at least @p size bytes
+   * @param size Number of bytes to read
+   * @return true if the range was read, false if it was recorded to be
+   * fetched
+   * @throws std::out_of_range if the range was fetched but is unreadable
+   */
+  auto read(std::uint64_t address, void *buffer, std::size_t size) -> bool;
+
+  /**
+   * @brief Fetches every recorded range.
+   *
+   * @return false if there was nothing to fetch
+   */
+  auto fetch() -> bool;
+
+private:
+  /**
+   * @struct block
+   * @brief A fetched or recorded range of memory.
+   */
+  struct block {
+    std::uint64_t address;          ///< Start address of the range
+    std::vector<std::uint8_t> data; ///< Contents of the range
+    bool readable;                  ///< Whether the range could be read
+  };
+
+  pid_t m_pid;                  ///< Process the memory is read from
+  std::vector<block> m_blocks;  ///< Fetched ranges
+  std::vector<block> m_pending; ///< Ranges recorded since the last fetch
+};
+
+#endif // MEMORY_H_
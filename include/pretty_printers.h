@@ -0,0 +1,128 @@
+/**
+ * @file pretty_printers.h
+ * @brief Built-in formatters for libstdc++ containers and utilities.
+ *
+ * This file contains the libstdcxx_printer class, which recognises common
+ * standard library types by name and prints their contents rather than
+ * their internal representation. The printers follow the libstdc++ layout
+ * on x86-64. Elements are fetched in batches, with one vectored read per
+ * level of a red-black tree or per step along the hash bucket chains, and
+ * printing stops after a configurable number of elements so that huge
+ * containers stay cheap to display.
+ */
+
+#ifndef PRETTY_PRINTERS_H_
+#define PRETTY_PRINTERS_H_
+
+#include "memory.h"
+#include "types.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * @class libstdcxx_printer
+ * @brief Formats std::string, std::vector, std::map, std::unordered_map,
+ * std::deque, std::shared_ptr and std::optional.
+ */
+class libstdcxx_printer : public value_formatter {
+public:
+  /**
+   * @brief Creates a printer reading from a process.
+   *
+   * @param pid Process ID of the program being debugged
+   * @param max_elements Elements of a container printed before the rest
+   * are elided
+   */
+  libstdcxx_printer(pid_t pid, std::size_t max_elements) noexcept
+      : m_pid{pid}, m_max_elements{max_elements} {}
+
+  auto format(const type_desc &type, const std::uint8_t *data,
+              std::ostream &out) -> bool override;
+
+protected:
+  /**
+   * @brief Reads a range of memory of the process.
+   *
+   * @param address Start address of the range
+   * @param buffer Destination buffer of at least @p size bytes
+   * @param size Number of bytes to read
+   * @return true if the range was read, false if it is unreadable
+   */
+  virtual auto read_block(std::uint64_t address, void *buffer,
+                          std::size_t size) -> bool;
+
+  /**
+   * @brief Reads several ranges of memory of the process together.
+   *
+   * @param ranges The ranges and the buffers to read them into
+   * @return true if every range was read, false if one is unreadable
+   */
+  virtual auto read_ranges(const std::vector<memory_range> &ranges) -> bool;
+
+private:
+  /**
+   * @brief Prints a std::string, reading its characters with one read.
+   */
+  auto print_string(const std::uint8_t *data, std::ostream &out) -> void;
+
+  /**
+   * @brief Prints a std::vector, reading its elements with one read.
+   */
+  auto print_vector(const type_desc &element, const std::uint8_t *data,
+                    std::ostream &out) -> void;
+
+  /**
+   * @brief Prints a std::deque.
+   *
+   * The map of buffers is read first, then the printed part of every
+   * buffer with one vectored read.
+   */
+  auto print_deque(const type_desc &element, const std::uint8_t *data,
+                   std::ostream &out) -> void;
+
+  /**
+   * @brief Prints a std::map.
+   *
+   * The tree is fetched one level per read. Only the subtrees that can hold
+   * one of the first max_elements entries in key order are followed.
+   */
+  auto print_map(const type_desc &key, const type_desc &value,
+                 const std::uint8_t *data, std::ostream &out) -> void;
+
+  /**
+   * @brief Prints a std::unordered_map, bucket by bucket.
+   *
+   * The chains of many buckets are followed together, with one read per
+   * step that takes the next node of every chain.
+   */
+  auto print_unordered_map(const type_desc &key, const type_desc &value,
+                           const std::uint8_t *data, std::ostream &out)
+      -> void;
+
+  /**
+   * @brief Prints a std::shared_ptr with the counts of its control block.
+   */
+  auto print_shared_ptr(const type_desc &type, const std::uint8_t *data,
+                        std::ostream &out) -> void;
+
+  /**
+   * @brief Prints a std::optional and its value, if it has one.
+   */
+  auto print_optional(const type_desc &type, const std::uint8_t *data,
+                      std::ostream &out) -> void;
+
+  /**
+   * @brief Prints a key and value pair as an entry of a map.
+   */
+  auto print_entry(const type_desc &key, const type_desc &value,
+                   const std::uint8_t *pair, std::ostream &out) -> void;
+
+  pid_t m_pid;                ///< Process ID of the debugged program
+  std::size_t m_max_elements; ///< Elements printed per container
+};
+
+#endif // PRETTY_PRINTERS_H_
@@ -0,0 +1,343 @@
+/**
+ * @file record.h
+ * @brief Recording of executed instructions, so that they can be undone.
+ *
+ * This file contains the execution_recorder class, which runs the debugged
+ * process one instruction at a time and logs, for each instruction, the
+ * previous values of the registers and memory it changed. Undoing the
+ * newest entry of the log puts the process back in the state it was in
+ * before the instruction, which is how the debugger executes in reverse.
+ *
+ * The memory an instruction may write is found by decoding it: its memory
+ * operand, the stack slots below rsp it pushes to, and the destination of
+ * string stores. Those windows are read before and after the step, and only
+ * the bytes that differ are logged, so most entries hold a few registers.
+ * Memory written by the kernel on behalf of system calls is not seen.
+ *
+ * Entries are kept in a delta_log, a ring of bytes with a fixed capacity
+ * that drops its oldest entries when it is full, so recording can run for
+ * any time with bounded memory, at the cost of how far back it can go.
+ * Going forward again after undoing executes the instructions again rather
+ * than replaying them, and records them anew.
+ */
+
+#ifndef RECORD_H_
+#define RECORD_H_
+
+#include "x86_decode.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <sys/types.h>
+#include <sys/user.h>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @enum reverse_mode
+ * @brief How far reverse execution goes back.
+ */
+enum class reverse_mode {
+  instruction, ///< One instruction
+  line,        ///< To the start of the previous line, over calls
+  breakpoint   ///< To the previous hit of a breakpoint
+};
+
+/**
+ * @class delta_log
+ * @brief A ring of variable size entries that drops the oldest when full.
+ *
+ * Each entry is framed by its size on both sides, so that the ring can be
+ * walked from either end.
+ */
+class delta_log {
+public:
+  /**
+   * @brief Creates an empty log.
+   *
+   * @param capacity Bytes the log may use, including framing
+   */
+  explicit delta_log(std::size_t capacity = 0) : m_data(capacity) {}
+
+  /**
+   * @brief Appends an entry, dropping the oldest ones to make room.
+   *
+   * @param data Contents of the entry
+   * @param size Size of the entry
+   * @return false if the entry is larger than the whole log
+   */
+  auto push(const std::uint8_t *data, std::size_t size) -> bool;
+
+  /**
+   * @brief Copies the newest entry.
+   *
+   * @param data Receives the contents of the entry
+   * @return false if the log is empty
+   */
+  auto newest(std::vector<std::uint8_t> &data) const -> bool;
+
+  /**
+   * @brief Gets the position where the newest entry ends, from which
+   * entry_before() walks the log.
+   */
+  auto end() const noexcept -> std::size_t { return m_head; }
+
+  /**
+   * @brief Copies the entry that ends at a position.
+   *
+   * Only entries() entries can be walked back from end().
+   *
+   * @param at Where the entry ends; receives where the entry before it ends
+   * @param data Receives the contents of the entry
+   */
+  auto entry_before(std::size_t &at, std::vector<std::uint8_t> &data) const
+      -> void;
+
+  /**
+   * @brief Removes the newest entry.
+   */
+  auto pop() noexcept -> void;
+
+  /**
+   * @brief Removes all entries.
+   */
+  auto clear() noexcept -> void;
+
+  /**
+   * @brief Gets the number of entries.
+   */
+  auto entries() const noexcept -> std::size_t { return m_entries; }
+
+  /**
+   * @brief Gets the number of bytes in use.
+   */
+  auto used() const noexcept -> std::size_t { return m_used; }
+
+  /**
+   * @brief Gets the number of bytes the log may use.
+   */
+  auto capacity() const noexcept -> std::size_t { return m_data.size(); }
+
+  /**
+   * @brief Gets the number of entries dropped to make room for others.
+   */
+  auto dropped() const noexcept -> std::uint64_t { return m_dropped; }
+
+private:
+  /**
+   * @brief Copies bytes into the ring, wrapping around its end.
+   */
+  auto write(std::size_t at, const void *data, std::size_t size) noexcept
+      -> void;
+
+  /**
+   * @brief Copies bytes out of the ring, wrapping around its end.
+   */
+  auto read(std::size_t at, void *data, std::size_t size) const noexcept
+      -> void;
+
+  std::vector<std::uint8_t> m_data; ///< The ring
+  std::size_t m_head = 0;           ///< Where the next entry goes
+  std::size_t m_used = 0;           ///< Bytes in use before m_head
+  std::size_t m_entries = 0;        ///< Number of entries
+  std::uint64_t m_dropped = 0;      ///< Entries dropped so far
+};
+
+/**
+ * @class execution_recorder
+ * @brief Steps a process while logging how to undo each instruction.
+ *
+ * The recorder keeps a copy of the registers of the process, which is
+ * current as long as only the recorder runs or changes it. Anything else
+ * that does must be followed by sync().
+ */
+class execution_recorder {
+public:
+  /**
+   * @brief Creates a recorder that is not recording.
+   *
+   * @param pid Process ID of the program being debugged
+   */
+  explicit execution_recorder(pid_t pid) noexcept : m_pid{pid} {}
+
+  /**
+   * @brief Starts recording, discarding any previous log.
+   *
+   * @param capacity Bytes the log may use
+   * @throws std::invalid_argument if the log cannot hold the largest entry
+   * a step logs
+   * @throws std::out_of_range if the registers cannot be read
+   */
+  auto start(std::size_t capacity) -> void;
+
+  /**
+   * @brief Stops recording and frees the log.
+   */
+  auto stop() noexcept -> void;
+
+  /**
+   * @brief Records another process from now on, stopping any recording of
+   * the previous one.
+   *
+   * @param pid Process ID of the program being debugged
+   */
+  auto set_pid(pid_t pid) noexcept -> void {
+    stop();
+    m_pid = pid;
+  }
+
+  /**
+   * @brief Checks whether the recorder is recording.
+   */
+  auto recording() const noexcept -> bool { return m_recording; }
+
+  /**
+   * @brief Reads the registers of the process again.
+   *
+   * @throws std::out_of_range if the registers cannot be read
+   */
+  auto sync() -> void;
+
+  /**
+   * @brief Executes one instruction and logs how to undo it.
+   *
+   * The instruction must not be covered by a breakpoint.
+   *
+   * @return The wait status of the process after the step
+   * @throws std::out_of_range if the step could not be logged, which stops
+   * recording
+   */
+  auto step() -> int;
+
+  /**
+   * @brief Reads the memory the current instruction may write, for a step
+   * made by someone else that after_step() then logs.
+   */
+  auto before_step() -> void;
+
+  /**
+   * @brief Logs how to undo the changes made since the last step.
+   *
+   * Without a call to before_step(), only registers are compared, which
+   * logs changes the debugger made to them itself. Nothing is logged if
+   * nothing changed.
+   *
+   * @throws std::out_of_range if the registers cannot be read, or the
+   * changes could not be logged, which stops recording
+   */
+  auto after_step() -> void;
+
+  /**
+   * @brief Drops decoded instructions, after the debugger patched code.
+   */
+  auto forget_code() noexcept -> void { m_decoded.clear(); }
+
+  /**
+   * @brief Undoes the newest logged instruction.
+   *
+   * @return false if the log is empty
+   * @throws std::out_of_range if the state cannot be restored
+   */
+  auto undo() -> bool;
+
+  /**
+   * @brief Walks back through the registers of the recorded past, without
+   * undoing anything.
+   *
+   * @param visit Called with the registers as they were before each logged
+   * instruction, newest first, and returns false to end the walk
+   * @return Number of calls of @p visit
+   */
+  auto walk_back(const std::function<bool(const user_regs_struct &)> &visit)
+      const -> std::size_t;
+
+  /**
+   * @brief Gets the current registers of the process.
+   */
+  auto registers() const noexcept -> const user_regs_struct & {
+    return m_regs;
+  }
+
+  /**
+   * @brief Gets the log of undo entries.
+   */
+  auto log() const noexcept -> const delta_log & { return m_log; }
+
+  /**
+   * @brief Gets the number of instructions recorded since start().
+   */
+  auto instructions() const noexcept -> std::uint64_t {
+    return m_instructions;
+  }
+
+  /**
+   * @brief Gets the time spent stepping since start().
+   */
+  auto elapsed() const noexcept -> std::chrono::nanoseconds {
+    return m_elapsed;
+  }
+
+private:
+  /// Bytes watched around the memory an instruction may write
+  static constexpr std::size_t window_size = 64;
+
+  /// Most windows an instruction writes through
+  static constexpr std::size_t max_windows = 3;
+
+  /// Decoded instructions by address
+  using decode_cache = std::unordered_map<std::uint64_t, x86_instruction>;
+
+  /**
+   * @struct window
+   * @brief Memory an instruction may write, read before it runs.
+   */
+  struct window {
+    std::uint64_t address = 0;                     ///< Start of the window
+    std::size_t size = 0;                          ///< Bytes readable
+    std::array<std::uint8_t, window_size> bytes{}; ///< Contents before
+  };
+
+  /**
+   * @brief Decodes the instruction at an address, with a cache.
+   *
+   * @return The layout, or nullptr if the instruction cannot be decoded
+   */
+  auto decode(std::uint64_t address) -> const x86_instruction *;
+
+  /**
+   * @brief Logs the changes from the cached state to a new one.
+   *
+   * @param regs Registers after the step
+   * @param fpregs FPU and SSE registers after the step
+   * @return false if nothing changed
+   * @throws std::out_of_range if the entry does not fit in the log, which
+   * stops recording
+   */
+  auto log_changes(const user_regs_struct &regs,
+                   const user_fpregs_struct &fpregs) -> bool;
+
+  /**
+   * @brief Applies the register part of an entry to a copy of registers.
+   *
+   * @return Offset of the rest of the entry
+   */
+  auto apply_registers(const std::vector<std::uint8_t> &entry,
+                       user_regs_struct &regs) const -> std::size_t;
+
+  pid_t m_pid;                               ///< Process ID of the program
+  bool m_recording = false;                  ///< Whether steps are recorded
+  delta_log m_log;                           ///< Undo entries, newest last
+  user_regs_struct m_regs{};                 ///< Current registers
+  user_fpregs_struct m_fpregs{};             ///< Current FPU and SSE registers
+  std::array<window, max_windows> m_windows; ///< Memory the step may write
+  std::size_t m_window_count = 0;            ///< Windows read for the step
+  decode_cache m_decoded;                    ///< Instructions by address
+  std::vector<std::uint8_t> m_entry;         ///< Entry being built or undone
+  std::uint64_t m_instructions = 0;          ///< Instructions recorded
+  std::chrono::nanoseconds m_elapsed{0};     ///< Time spent stepping
+};
+
+#endif // RECORD_H_
@@ -15,6 +15,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <string>
+#include <sys/user.h>
 
 /**
  * @enum reg
@@ -111,6 +112,71 @@ const std::array<reg_descriptor, n_registers> g_register_descriptors{{
     {reg::gs, 55, "gs"},
 }};
 
+/**
+ * @brief Number of DWARF registers tracked while unwinding.
+ *
+ * Covers DWARF registers 0-15 (the general purpose registers) and 16, the
+ * return address column, which holds the instruction pointer of a frame.
+ */
+constexpr std::size_t n_dwarf_registers = 17;
+
+/**
+ * @brief DWARF register number of the return address column (rip).
+ */
+constexpr unsigned dwarf_return_address_register = 16;
+
+/**
+ * @struct dwarf_register_set
+ * @brief A snapshot of the DWARF-numbered registers of a single frame.
+ *
+ * Register sets are filled in from one PTRACE_GETREGS call for the innermost
+ * frame and reconstructed by the unwinder for outer frames, where only some
+ * registers may be recoverable.
+ */
+struct dwarf_register_set {
+  std::array<std::uint64_t, n_dwarf_registers> values{}; ///< Register values
+  std::uint32_t valid = 0; ///< Bit mask of registers whose value is known
+  std::uint64_t fs_base = 0; ///< Thread pointer, set in the innermost frame
+
+  /**
+   * @brief Checks whether the value of a register is known.
+   *
+   * @param regnum DWARF register number
+   * @return true if the register holds a known value
+   */
+  auto has(unsigned regnum) const noexcept -> bool {
+    return regnum < n_dwarf_registers && (valid & (1u << regnum));
+  }
+
+  /**
+   * @brief Stores a known register value.
+   *
+   * @param regnum DWARF register number
+   * @param value Value of the register
+   */
+  auto set(unsigned regnum, std::uint64_t value) noexcept -> void {
+    values[regnum] = value;
+    valid |= 1u << regnum;
+  }
+};
+
+/**
+ * @brief Reads all DWARF registers of a process with a single ptrace call.
+ *
+ * @param pid Process ID of the target process
+ * @return The register set of the innermost frame
+ */
+auto get_dwarf_register_set(pid_t pid) noexcept -> dwarf_register_set;
+
+/**
+ * @brief Converts registers read with PTRACE_GETREGS to DWARF registers.
+ *
+ * @param regs The registers
+ * @return The register set of the innermost frame
+ */
+auto to_dwarf_register_set(const user_regs_struct &regs) noexcept
+    -> dwarf_register_set;
+
 /**
  * @brief Gets the value of a specific register for a process.
  *
@@ -134,6 +200,20 @@ auto get_register_value(pid_t pid, reg r) noexcept -> std::uint64_t;
 auto get_register_value_from_dwarf_register(pid_t pid, unsigned regnum)
     -> std::uint64_t;
 
+/**
+ * @brief Gets a register value of a frame based on its DWARF register number.
+ *
+ * Reads the register from a register set reconstructed by the unwinder, so
+ * registers of outer frames are available without accessing the process.
+ *
+ * @param regs Registers of the frame
+ * @param regnum DWARF register number
+ * @return The value the register has in the frame
+ * @throws std::out_of_range if the register is not known in the frame
+ */
+auto get_register_value_from_dwarf_register(const dwarf_register_set &regs,
+                                            unsigned regnum) -> std::uint64_t;
+
 /**
  * @brief Gets the string name of a register.
  *
@@ -142,6 +222,15 @@ auto get_register_value_from_dwarf_register(pid_t pid, unsigned regnum)
  */
 auto get_register_name(reg r) noexcept -> std::string;
 
+/**
+ * @brief Gets the string name of a register from its DWARF register number.
+ *
+ * @param regnum DWARF register number
+ * @return String representation of the register name, or the number itself
+ * if no register has it
+ */
+auto get_dwarf_register_name(unsigned regnum) -> std::string;
+
 /**
  * @brief Gets a register enum value from its string name.
  *
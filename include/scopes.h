@@ -0,0 +1,138 @@
+/**
+ * @file scopes.h
+ * @brief Per-function tables of the variables visible at each PC.
+ *
+ * This file contains the function_scopes class, which turns the DIE tree of
+ * a function into a compact tree of lexical blocks. Each block holds its
+ * variables with their types and decoded locations, and the address ranges
+ * of its nested blocks sorted for binary search. Finding the variables in
+ * scope at a PC is then a descent through the blocks containing it rather
+ * than a walk over DIEs. The tables are built on first use and cached per
+ * function by scope_index.
+ */
+
+#ifndef SCOPES_H_
+#define SCOPES_H_
+
+#include "dwarf/dwarf++.hh"
+#include "dwarf_expr.h"
+#include "types.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @struct scope_variable
+ * @brief A variable or parameter declared in a block.
+ */
+struct scope_variable {
+  std::string name;                            ///< Name of the variable
+  const type_desc *type = nullptr;             ///< Type of the variable
+  const compiled_location *location = nullptr; ///< Location, if it has one
+  bool is_parameter = false;                   ///< Whether it is a parameter
+};
+
+/**
+ * @struct scope_range
+ * @brief An address range covered by a nested block.
+ */
+struct scope_range {
+  std::uint64_t low = 0;  ///< Link-time start of the range
+  std::uint64_t high = 0; ///< Link-time end (exclusive) of the range
+  std::size_t block = 0;  ///< Index of the block covering the range
+};
+
+/**
+ * @struct scope_block
+ * @brief A function body or lexical block.
+ */
+struct scope_block {
+  std::vector<scope_variable> variables; ///< Variables in declaration order
+  std::vector<scope_range>
+      children; ///< Ranges of nested blocks, sorted by address
+};
+
+/**
+ * @class function_scopes
+ * @brief The tree of blocks of a function.
+ */
+class function_scopes {
+public:
+  /**
+   * @brief Builds the blocks of a function.
+   *
+   * Inlined subroutines are not descended into, as their variables belong
+   * to the inlined function.
+   *
+   * @param function The subprogram DIE
+   * @param types Type descriptions of the program
+   * @param locations Cache of decoded location attributes
+   */
+  function_scopes(const dwarf::die &function, type_index &types,
+                  location_cache &locations);
+
+  /**
+   * @brief Gets the blocks in scope at a PC.
+   *
+   * @param pc Link-time program counter
+   * @return The blocks containing @p pc, innermost first and ending with
+   * the function body
+   */
+  auto visible(std::uint64_t pc) const -> std::vector<const scope_block *>;
+
+  /**
+   * @brief Gets the parameters of the function.
+   */
+  auto parameters() const -> std::vector<const scope_variable *>;
+
+private:
+  /**
+   * @brief Adds the variables and nested blocks of a DIE to a block.
+   *
+   * Nested blocks without addresses are merged into the enclosing one.
+   *
+   * @param die The function or lexical block DIE
+   * @param block Index of the block to add to
+   * @param types Type descriptions of the program
+   * @param locations Cache of decoded location attributes
+   */
+  auto build(const dwarf::die &die, std::size_t block, type_index &types,
+             location_cache &locations) -> void;
+
+  std::vector<scope_block> m_blocks; ///< Blocks, the function body first
+};
+
+/**
+ * @class scope_index
+ * @brief The block trees of the functions of a program, built on demand.
+ */
+class scope_index {
+public:
+  /**
+   * @brief Creates an empty index.
+   *
+   * @param types Type descriptions of the program
+   * @param locations Cache of decoded location attributes
+   */
+  scope_index(type_index &types, location_cache &locations) noexcept
+      : m_types{types}, m_locations{locations} {}
+
+  /**
+   * @brief Gets the block tree of a function.
+   *
+   * @param function The subprogram DIE
+   * @return The tree, which lives as long as the index
+   */
+  auto get(const dwarf::die &function) -> const function_scopes &;
+
+private:
+  type_index &m_types;         ///< Type descriptions of the program
+  location_cache &m_locations; ///< Decoded location attributes
+  std::unordered_map<dwarf::section_offset, function_scopes>
+      m_functions; ///< Block trees by DIE offset of their function
+};
+
+#endif // SCOPES_H_
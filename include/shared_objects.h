@@ -0,0 +1,62 @@
+/**
+ * @file shared_objects.h
+ * @brief Loads the shared objects of the debugged process for unwinding.
+ *
+ * This file contains the shared_object_table class, which finds the shared
+ * libraries mapped into the debugged process through /proc/pid/maps and
+ * reads their symbols and call frame information from their files, so that
+ * backtraces continue through libc, for instance through its signal return
+ * trampoline or its clock_gettime wrapper. Libraries are mapped by the
+ * dynamic loader after the program starts, so the table is brought up to
+ * date before the stack is unwound, and each library is only loaded once.
+ */
+
+#ifndef SHARED_OBJECTS_H_
+#define SHARED_OBJECTS_H_
+
+#include "cfi.h"
+#include "elf/elf++.hh"
+#include "symbols.h"
+#include "unwinder.h"
+
+#include <memory>
+#include <set>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * @class shared_object_table
+ * @brief The shared objects of a process and the unwind information they
+ * hold.
+ */
+class shared_object_table {
+public:
+  /**
+   * @brief Loads the objects mapped into a process since the last update.
+   *
+   * Objects whose file cannot be read are skipped, and not tried again.
+   *
+   * @param pid Process ID of the program being debugged
+   * @return The code modules of the objects loaded by this call, which
+   * refer to this table
+   */
+  auto update(pid_t pid) -> std::vector<code_module>;
+
+private:
+  /**
+   * @struct object
+   * @brief A shared object and the indexes built over its file.
+   */
+  struct object {
+    elf::elf elf;         ///< ELF file of the object
+    cfi_table cfi;        ///< Call frame information of the object
+    symbol_index symbols; ///< Function symbols of the object
+    code_module module;   ///< Where the object is mapped
+  };
+
+  std::vector<std::unique_ptr<object>> m_objects; ///< Objects loaded
+  std::set<std::string> m_paths; ///< Files seen, loaded or not
+};
+
+#endif // SHARED_OBJECTS_H_
@@ -0,0 +1,86 @@
+/**
+ * @file symbols.h
+ * @brief Address-ordered index of the function symbols of an ELF object.
+ *
+ * This file contains the symbol_index class, which maps program counters
+ * to the function symbols that contain them. It is used to find function
+ * entry points for prologue analysis and to name frames that have no
+ * DWARF debug information. An index of the data object symbols tells which
+ * objects share a page of memory.
+ */
+
+#ifndef SYMBOLS_H_
+#define SYMBOLS_H_
+
+#include "elf/elf++.hh"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @struct symbol
+ * @brief A function or data object symbol of an ELF object.
+ */
+struct symbol {
+  std::uint64_t addr; ///< Link-time start address of the symbol
+  std::uint64_t size; ///< Size of the symbol in bytes, 0 if unknown
+  std::string name;   ///< Name of the symbol as found in the symbol table
+};
+
+/**
+ * @class symbol_index
+ * @brief Looks up the function symbol covering a link-time address.
+ */
+class symbol_index {
+public:
+  /**
+   * @brief Default constructor, creates an empty index.
+   */
+  symbol_index() = default;
+
+  /**
+   * @brief Indexes the symbols of one type of an ELF object.
+   *
+   * Uses .symtab when present and falls back to .dynsym otherwise.
+   *
+   * @param f The ELF object to index
+   * @param type Type of the symbols to index, functions by default
+   */
+  explicit symbol_index(const elf::elf &f, elf::stt type = elf::stt::func);
+
+  /**
+   * @brief Finds the function symbol containing an address.
+   *
+   * Symbols without a size are assumed to extend up to the next symbol.
+   *
+   * @param addr The link-time address to look up
+   * @return The containing symbol, or nullptr if there is none
+   */
+  auto find(std::uint64_t addr) const noexcept -> const symbol *;
+
+  /**
+   * @brief Finds a function symbol by name.
+   *
+   * @param name The name of the symbol
+   * @return The symbol, or nullptr if there is none
+   */
+  auto find_by_name(const std::string &name) const noexcept -> const symbol *;
+
+  /**
+   * @brief Finds the symbols that overlap a range of addresses.
+   *
+   * Symbols without a size are taken to be one byte long.
+   *
+   * @param low Link-time start of the range
+   * @param high Link-time end (exclusive) of the range
+   * @return The overlapping symbols, by address
+   */
+  auto find_overlapping(std::uint64_t low, std::uint64_t high) const
+      -> std::vector<const symbol *>;
+
+private:
+  std::vector<symbol> m_symbols; ///< Symbols sorted by address
+};
+
+#endif // SYMBOLS_H_
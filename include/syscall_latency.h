@@ -0,0 +1,198 @@
+/**
+ * @file syscall_latency.h
+ * @brief Histograms of how long the system calls of a process take.
+ *
+ * This file contains the latency_histogram and syscall_timer classes. The
+ * time of a call runs from the stop at its entry to the stop at its exit,
+ * so it includes the round trip through the tracer, a few microseconds,
+ * which hides nothing of a slow fsync or a long futex wait.
+ *
+ * Histograms are laid out like HDR histograms: values below 64 ns have a
+ * bucket each, and every power of two above is split in 32 buckets, so
+ * that any value is known within about 3% over a range from nanoseconds to
+ * a minute with a fixed array of counts. The histograms of all the timed
+ * calls are allocated when timing starts, so recording a call only
+ * increments counts.
+ */
+
+#ifndef SYSCALL_LATENCY_H_
+#define SYSCALL_LATENCY_H_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @class latency_histogram
+ * @brief Counts of durations in buckets of logarithmic size.
+ */
+class latency_histogram {
+public:
+  /// Bits of a duration kept by its bucket, past the highest set bit
+  static constexpr unsigned sub_bucket_bits = 5;
+
+  /// Bits of the longest duration told apart, longer ones share its bucket
+  static constexpr unsigned max_bits = 36;
+
+  /// Number of buckets
+  static constexpr std::size_t bucket_count =
+      (max_bits - sub_bucket_bits + 1) << sub_bucket_bits;
+
+  /**
+   * @brief Counts a duration.
+   *
+   * @param ns The duration in nanoseconds
+   */
+  auto record(std::uint64_t ns) noexcept -> void;
+
+  /**
+   * @brief Forgets all the durations counted.
+   */
+  auto clear() noexcept -> void;
+
+  /**
+   * @brief Gets the number of durations counted.
+   */
+  auto count() const noexcept -> std::uint64_t { return m_count; }
+
+  /**
+   * @brief Gets the sum of the durations, in nanoseconds.
+   */
+  auto total() const noexcept -> std::uint64_t { return m_total; }
+
+  /**
+   * @brief Gets the shortest duration, in nanoseconds.
+   */
+  auto min() const noexcept -> std::uint64_t { return m_count ? m_min : 0; }
+
+  /**
+   * @brief Gets the longest duration, in nanoseconds.
+   */
+  auto max() const noexcept -> std::uint64_t { return m_max; }
+
+  /**
+   * @brief Gets a duration that a share of the durations do not exceed.
+   *
+   * @param percent The share, from 0 to 100
+   * @return The highest duration of the bucket the share ends in, in
+   * nanoseconds, or 0 if none was counted
+   */
+  auto percentile(double percent) const noexcept -> std::uint64_t;
+
+  /**
+   * @brief Prints the number of durations between each power of two, with
+   * a bar.
+   *
+   * @param out Stream to print to
+   */
+  auto print(std::ostream &out) const -> void;
+
+private:
+  std::array<std::uint32_t, bucket_count> m_counts{}; ///< Counts by bucket
+  std::uint64_t m_count = 0;                          ///< Durations counted
+  std::uint64_t m_total = 0;                          ///< Their sum
+  std::uint64_t m_min = 0;                            ///< The shortest
+  std::uint64_t m_max = 0;                            ///< The longest
+};
+
+/**
+ * @brief Formats a duration with three significant digits and a unit.
+ *
+ * @param ns The duration in nanoseconds
+ * @return The duration, such as 812ns, 12.3us, 4.56ms or 1.02s
+ */
+auto format_duration(std::uint64_t ns) -> std::string;
+
+/**
+ * @class syscall_timer
+ * @brief Times the system calls of a process, by call.
+ */
+class syscall_timer {
+public:
+  /**
+   * @brief Starts timing some calls, forgetting any earlier times.
+   *
+   * @param syscalls Numbers of the calls
+   */
+  auto start(const std::vector<long> &syscalls) -> void;
+
+  /**
+   * @brief Stops timing, keeping the times.
+   */
+  auto stop() noexcept -> void {
+    m_active = false;
+    m_inside = false;
+  }
+
+  /**
+   * @brief Checks whether calls are being timed.
+   */
+  auto active() const noexcept -> bool { return m_active; }
+
+  /**
+   * @brief Checks whether the process is in a call being timed.
+   */
+  auto inside() const noexcept -> bool { return m_inside; }
+
+  /**
+   * @brief Handles the entry of the process into a call.
+   *
+   * @param syscall Number of the call
+   */
+  auto enter(long syscall) noexcept -> void;
+
+  /**
+   * @brief Handles the exit of the process from the call it entered,
+   * counting its time if it is timed.
+   */
+  auto leave() noexcept -> void;
+
+  /**
+   * @brief Notes that the debugger took the process out of the call it was
+   * making, to make it again.
+   */
+  auto forget_call() noexcept -> void { m_inside = false; }
+
+  /**
+   * @brief Counts the time of a call timed by the caller, such as one made
+   * by another task of the process.
+   *
+   * @param syscall Number of the call
+   * @param ns How long it took, in nanoseconds
+   */
+  auto record(long syscall, std::uint64_t ns) noexcept -> void;
+
+  /**
+   * @brief Prints a line of figures for each call made, slowest in total
+   * first.
+   *
+   * @param out Stream to print to
+   */
+  auto print(std::ostream &out) const -> void;
+
+  /**
+   * @brief Prints the figures and histogram of one call.
+   *
+   * @param out Stream to print to
+   * @param syscall Number of the call
+   * @throws std::invalid_argument if the call is not timed
+   */
+  auto print(std::ostream &out, long syscall) const -> void;
+
+private:
+  /// Slot of the calls that are not timed
+  static constexpr std::uint16_t untimed = 0xffff;
+
+  std::vector<latency_histogram> m_histograms;   ///< Times by slot
+  std::vector<long> m_syscalls;                  ///< Calls by slot
+  std::vector<std::uint16_t> m_slots;            ///< Slots by call number
+  bool m_active = false;                         ///< Whether calls are timed
+  bool m_inside = false;                         ///< Whether one was entered
+  std::uint16_t m_slot = untimed;                ///< Slot of the call entered
+  std::chrono::steady_clock::time_point m_entry; ///< When it was entered
+};
+
+#endif // SYSCALL_LATENCY_H_
@@ -0,0 +1,303 @@
+/**
+ * @file syscall_log.h
+ * @brief Recording and replay of the system calls of the debugged process.
+ *
+ * This file contains the syscall_log_writer, syscall_log_reader and
+ * syscall_recorder classes. While system calls are recorded, the process is
+ * resumed with PTRACE_SYSCALL, and the calls whose outcome depends on the
+ * world outside the process, such as read, recvfrom, accept, clock_gettime
+ * and getrandom, are logged with their result and the bytes they wrote into its
+ * memory. A replay skips those calls and writes back what was logged, so
+ * the program sees the same input as in the recorded run without its
+ * files, network peers or clock.
+ *
+ * A log is a short header followed by one event per call, whose numbers are
+ * LEB128 encoded. Events are written with a single write each and read in
+ * order, so a log cut short by a crash only loses its last event.
+ */
+
+#ifndef SYSCALL_LOG_H_
+#define SYSCALL_LOG_H_
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <cstdint>
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+
+/// Version of the layout of syscall logs
+constexpr std::uint32_t syscall_log_version = 1;
+
+/**
+ * @struct syscall_region
+ * @brief Memory written by a system call.
+ */
+struct syscall_region {
+  std::uint64_t address = 0;       ///< Start of the memory
+  std::vector<std::uint8_t> bytes; ///< What the call wrote there
+};
+
+/**
+ * @struct syscall_event
+ * @brief The outcome of a system call.
+ */
+struct syscall_event {
+  std::uint64_t number = 0;            ///< System call number
+  std::int64_t result = 0;             ///< Value returned in rax
+  std::vector<syscall_region> regions; ///< Memory written by the call
+};
+
+/**
+ * @class syscall_log_writer
+ * @brief Writes events to a syscall log.
+ */
+class syscall_log_writer {
+public:
+  syscall_log_writer() noexcept = default;
+  syscall_log_writer(const syscall_log_writer &) = delete;
+  auto operator=(const syscall_log_writer &) -> syscall_log_writer & = delete;
+
+  /**
+   * @brief Closes the log.
+   */
+  ~syscall_log_writer();
+
+  /**
+   * @brief Creates a log, replacing any file at the path.
+   *
+   * @param path Path of the file
+   * @throws std::out_of_range if the file cannot be written
+   */
+  auto open(const std::string &path) -> void;
+
+  /**
+   * @brief Closes the log, if one is open.
+   */
+  auto close() noexcept -> void;
+
+  /**
+   * @brief Gets the number of events in the log.
+   */
+  auto size() const noexcept -> std::uint64_t { return m_events; }
+
+  /**
+   * @brief Appends an event.
+   *
+   * @param event The event
+   * @return false if the event could not be written
+   */
+  auto append(const syscall_event &event) noexcept -> bool;
+
+private:
+  int m_fd = -1;                     ///< The open file, or -1
+  std::uint64_t m_events = 0;        ///< Events in the file
+  std::vector<std::uint8_t> m_bytes; ///< Encoding of the event being written
+};
+
+/**
+ * @class syscall_log_reader
+ * @brief Reads the events of a syscall log in order.
+ */
+class syscall_log_reader {
+public:
+  /**
+   * @brief Opens a log at its first event.
+   *
+   * Any log already open is closed first.
+   *
+   * @param path Path of the file
+   * @throws std::out_of_range if the file cannot be opened
+   * @throws std::invalid_argument if the file is not a syscall log of this
+   * version
+   */
+  auto open(const std::string &path) -> void;
+
+  /**
+   * @brief Closes the log, if one is open.
+   */
+  auto close() noexcept -> void;
+
+  /**
+   * @brief Gets the number of events read.
+   */
+  auto position() const noexcept -> std::uint64_t { return m_events; }
+
+  /**
+   * @brief Reads the next event.
+   *
+   * @param event Receives the event
+   * @return false at the end of the log, or of its last whole event
+   */
+  auto next(syscall_event &event) -> bool;
+
+private:
+  std::ifstream m_file;       ///< The open file
+  std::uint64_t m_events = 0; ///< Events read
+};
+
+/**
+ * @enum syscall_mode
+ * @brief What is done with the system calls of the process.
+ */
+enum class syscall_mode {
+  off,    ///< They run untraced
+  record, ///< Their outcome is logged
+  replay  ///< Their outcome is taken from a log
+};
+
+/**
+ * @class syscall_recorder
+ * @brief Records and replays the system calls of the process.
+ *
+ * Calls that read files, sockets, the clock or the random generator are
+ * logged. Once a socket has been passed to connect, calls that connect,
+ * write to or shut it down are logged as well, so that a replayed program
+ * can talk to a peer that is not there.
+ */
+class syscall_recorder {
+public:
+  /**
+   * @brief Creates a recorder of a process, which is off.
+   *
+   * @param pid Process ID of the process
+   */
+  explicit syscall_recorder(pid_t pid) noexcept : m_pid{pid} {}
+
+  /**
+   * @brief Starts logging the system calls of the process to a new log.
+   *
+   * @param path Path of the log
+   * @throws std::out_of_range if the log cannot be written
+   */
+  auto record(const std::string &path) -> void;
+
+  /**
+   * @brief Starts replaying the system calls of the process from a log.
+   *
+   * @param path Path of the log
+   * @throws std::out_of_range if the log cannot be opened
+   * @throws std::invalid_argument if the file is not a syscall log of this
+   * version
+   */
+  auto replay(const std::string &path) -> void;
+
+  /**
+   * @brief Stops recording or replaying, closing the log.
+   */
+  auto stop() noexcept -> void;
+
+  /**
+   * @brief Makes the recorder follow another process, which stops it.
+   *
+   * The log would not follow the process back to where it was copied.
+   *
+   * @param pid Process ID of the process
+   */
+  auto set_pid(pid_t pid) noexcept -> void {
+    stop();
+    m_pid = pid;
+  }
+
+  /**
+   * @brief Gets what is done with the system calls of the process.
+   */
+  auto mode() const noexcept -> syscall_mode { return m_mode; }
+
+  /**
+   * @brief Gets the path of the log.
+   */
+  auto path() const noexcept -> const std::string & { return m_path; }
+
+  /**
+   * @brief Gets the number of events recorded or replayed, by the last
+   * recording or replay.
+   */
+  auto events() const noexcept -> std::uint64_t { return m_events; }
+
+  /**
+   * @brief Gets why the last replay or recording ended on its own.
+   */
+  auto message() const noexcept -> const std::string & { return m_message; }
+
+  /**
+   * @brief Handles a stop of the process at the entry or exit of a
+   * system call.
+   *
+   * Entries and exits alternate, starting with an entry.
+   *
+   * @return false if recording or replaying ended at the exit of the call,
+   * which message() explains
+   */
+  auto syscall_stop() noexcept -> bool;
+
+  /**
+   * @brief Notes that the debugger took the process out of the call it was
+   * making, to make it again.
+   */
+  auto forget_call() noexcept -> void { m_inside = false; }
+
+private:
+  /**
+   * @brief Handles the entry of a call.
+   */
+  auto enter() noexcept -> void;
+
+  /**
+   * @brief Handles the exit of a call.
+   *
+   * @return false if recording or replaying ended
+   */
+  auto leave() noexcept -> bool;
+
+  /**
+   * @brief Checks whether the outcome of a call is logged.
+   */
+  auto logged(const user_regs_struct &regs) const noexcept -> bool;
+
+  /**
+   * @brief Reads the memory a call wrote into the event of the call.
+   *
+   * @param result What the call returned
+   * @return false if the memory could not be read
+   */
+  auto read_regions(std::int64_t result) -> bool;
+
+  /**
+   * @brief Notes the socket a call connected or accepted, if it did, so
+   * that what the program sends through it is logged.
+   *
+   * @param result What the call returned
+   */
+  auto add_socket(std::int64_t result) noexcept -> void;
+
+  /**
+   * @brief Ends recording or replaying, saying why.
+   *
+   * @param message Why it ended
+   * @return false
+   */
+  auto end(const std::string &message) noexcept -> bool;
+
+  pid_t m_pid;                             ///< Process whose calls are traced
+  syscall_mode m_mode = syscall_mode::off; ///< What is done with the calls
+  std::string m_path;                      ///< Path of the log
+  syscall_log_writer m_writer;             ///< Log being recorded
+  syscall_log_reader m_reader;             ///< Log being replayed
+  std::uint64_t m_events = 0;              ///< Events recorded or replayed
+  std::string m_message;                   ///< Why it ended on its own
+  bool m_inside = false;                   ///< Whether the next stop is an exit
+  bool m_logged = false;                   ///< Whether the call is logged
+  bool m_diverged = false;                 ///< Whether the log expected another
+  user_regs_struct m_entry{};              ///< Registers at the entry
+  socklen_t m_address_length = 0;          ///< Room for a sender address
+  msghdr m_header{};                       ///< Message header at the entry
+  std::vector<mmsghdr> m_messages;         ///< Message headers at the entry
+  syscall_event m_event;                   ///< Event of the call
+  std::set<std::uint64_t> m_sockets;       ///< Sockets connected or accepted
+};
+
+#endif // SYSCALL_LOG_H_
@@ -0,0 +1,260 @@
+/**
+ * @file syscall_trace.h
+ * @brief Tracing of chosen system calls, filtered in the kernel.
+ *
+ * This file contains the syscall_catch_table class, behind catch syscall,
+ * and the functions of the --strace mode. Rather than stopping the process
+ * at every system call with PTRACE_SYSCALL, a seccomp-bpf filter installed
+ * in the process returns SECCOMP_RET_TRACE for the traced calls only, so
+ * that the other calls run without a stop. The filter of --strace is
+ * installed at launch; those of catchpoints are installed by injected
+ * system calls. Filters cannot be removed from a process, so a call that
+ * is no longer traced still stops once and is resumed straight away.
+ *
+ * The tasks a process starts inherit its filters, and a traced call fails
+ * with ENOSYS in a task no tracer follows, so the threads and children of
+ * the process are traced as well: --strace prints their calls, and the
+ * debugger lets them go on from each of their stops.
+ *
+ * Arguments are decoded from one read of the registers, and the strings and
+ * buffers they point to are fetched with one vectored read.
+ */
+
+#ifndef SYSCALL_TRACE_H_
+#define SYSCALL_TRACE_H_
+
+#include "inject.h"
+#include "syscall_latency.h"
+
+#include <linux/filter.h>
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <cstdint>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Finds the number of a system call.
+ *
+ * @param name Name of the call, such as openat
+ * @return The number, or -1 if there is no such call
+ */
+auto syscall_number(const std::string &name) noexcept -> long;
+
+/**
+ * @brief Gets the name of a system call.
+ *
+ * @param number Number of the call
+ * @return The name, or syscall_ and the number if the call is unknown
+ */
+auto syscall_name(long number) -> std::string;
+
+/**
+ * @brief Parses a comma-separated list of system call names or numbers.
+ *
+ * @param list The list, or "all"
+ * @return The numbers of the calls, none for all of them
+ * @throws std::invalid_argument if a call is unknown
+ */
+auto parse_syscalls(const std::string &list) -> std::vector<long>;
+
+/**
+ * @brief Gets the numbers of all the system calls known by name.
+ */
+auto known_syscalls() -> std::vector<long>;
+
+/**
+ * @brief Checks whether a wait status is a stop for a seccomp filter.
+ */
+auto is_seccomp_stop(int status) noexcept -> bool;
+
+/**
+ * @brief Checks whether a wait status is a stop for a task the process
+ * started with fork, vfork or clone.
+ */
+auto is_fork_stop(int status) noexcept -> bool;
+
+/**
+ * @brief Lets a task started by the debugged process go on from a stop.
+ *
+ * Such tasks are traced only for the filters they inherit, so their calls
+ * are made and their signals passed on. The SIGSTOP a task starts with is
+ * dropped, and exec is made to stop it with an event rather than a SIGTRAP.
+ *
+ * @param pid Task ID of the task
+ * @param status Wait status of the stop
+ * @param first Whether it is the first stop of the task
+ */
+auto resume_task(pid_t pid, int status, bool first) noexcept -> void;
+
+/**
+ * @brief Builds a seccomp filter tracing some system calls.
+ *
+ * @param syscalls Numbers of the traced calls, none for all of them
+ * @param untraced_pc Address after a syscall instruction whose calls are
+ * never traced, or 0
+ * @return The instructions of the filter
+ * @throws std::invalid_argument if there are too many calls for a filter
+ */
+auto make_syscall_filter(const std::vector<long> &syscalls,
+                         std::uint64_t untraced_pc)
+    -> std::vector<sock_filter>;
+
+/**
+ * @brief Installs a seccomp filter in the calling process.
+ *
+ * The process can no longer gain privileges through exec afterwards, which
+ * installing a filter without CAP_SYS_ADMIN requires.
+ *
+ * @param filter The instructions of the filter
+ * @return false if the filter could not be installed
+ */
+auto install_syscall_filter(const std::vector<sock_filter> &filter) noexcept
+    -> bool;
+
+/**
+ * @brief Formats the call a process stopped at the entry of.
+ *
+ * @param pid Process ID of the process
+ * @param regs Registers of the process
+ * @return The name and decoded arguments of the call, as name(args)
+ */
+auto format_syscall(pid_t pid, const user_regs_struct &regs) -> std::string;
+
+/**
+ * @brief Formats the result of the call a process stopped at the exit of.
+ *
+ * @param regs Registers of the process
+ * @return The result, with the name and message of the error if it failed
+ */
+auto format_syscall_result(const user_regs_struct &regs) -> std::string;
+
+/**
+ * @brief Backs a process stopped by a filter out of the call it is making,
+ * so that it makes the call again when resumed.
+ *
+ * The call is skipped, and the process is left stopped at the exit of the
+ * kernel with its program counter on the syscall instruction, where calls
+ * can be injected into it as at any other stop.
+ *
+ * @param pid Process ID of the process
+ * @param regs Registers of the process at the stop
+ * @return false if the process did not stop at the exit of the call
+ */
+auto restart_syscall(pid_t pid, user_regs_struct regs) noexcept -> bool;
+
+/**
+ * @brief Prints the traced system calls of a process until it ends.
+ *
+ * The process must be traced and stopped by a SIGSTOP it raised before
+ * installing its filter, so that the tracer can ask for the stops of the
+ * filter before any of them happens. The threads and children of the
+ * process are followed too, and their lines start with their task ID. Each
+ * call is printed on one line once it returns, unless the calls are timed,
+ * in which case their times are printed when the process and all the tasks
+ * it started have ended. Signals the tasks receive are passed on to them.
+ *
+ * @param pid Process ID of the process
+ * @param out Stream to print to
+ * @param timer Times the calls instead of printing them, or nullptr
+ * @return The exit status of the process, or 128 and the number of the
+ * signal that killed it
+ * @throws std::out_of_range if the process cannot be traced
+ */
+auto trace_syscalls(pid_t pid, std::ostream &out,
+                    syscall_timer *timer = nullptr) -> int;
+
+/**
+ * @struct syscall_catchpoint
+ * @brief A catchpoint stopping the process at some system calls.
+ */
+struct syscall_catchpoint {
+  unsigned number = 0;        ///< Number identifying the catchpoint
+  std::vector<long> syscalls; ///< Numbers of the calls, none for all
+};
+
+/**
+ * @class syscall_catch_table
+ * @brief The system call catchpoints of a process and the filters that
+ * make the kernel stop it for them.
+ */
+class syscall_catch_table {
+public:
+  /**
+   * @brief Creates an empty table.
+   *
+   * @param pid Process ID of the program being debugged
+   * @param injector Makes the calls that install the filters
+   */
+  syscall_catch_table(pid_t pid, syscall_injector &injector) noexcept
+      : m_pid{pid}, m_injector{injector} {}
+
+  /**
+   * @brief Adds a catchpoint, tracing the calls it catches.
+   *
+   * The process must be stopped.
+   *
+   * @param syscalls Numbers of the calls, none for all of them
+   * @return The new catchpoint
+   * @throws std::out_of_range if the filter cannot be installed
+   * @throws std::invalid_argument if there are too many calls for a filter
+   */
+  auto add(const std::vector<long> &syscalls) -> const syscall_catchpoint &;
+
+  /**
+   * @brief Removes a catchpoint.
+   *
+   * @param number Number of the catchpoint
+   * @return false if there is no such catchpoint
+   */
+  auto remove(unsigned number) -> bool;
+
+  /**
+   * @brief Finds the first catchpoint catching a call.
+   *
+   * @param syscall Number of the call
+   * @return The catchpoint, or nullptr if none catches the call
+   */
+  auto find(long syscall) const noexcept -> const syscall_catchpoint *;
+
+  /**
+   * @brief Gets the catchpoints, in the order they were added.
+   */
+  auto catchpoints() const noexcept
+      -> const std::vector<syscall_catchpoint> & {
+    return m_catchpoints;
+  }
+
+  /**
+   * @brief Traces the calls of the catchpoints in another process, a copy
+   * of the first.
+   *
+   * The copy may have been made before some of the filters were installed,
+   * so they are all installed again.
+   *
+   * @param pid Process ID of the copy
+   * @throws std::out_of_range if the filter cannot be installed
+   */
+  auto set_pid(pid_t pid) -> void;
+
+private:
+  /**
+   * @brief Makes the kernel stop the process at calls not traced yet.
+   *
+   * @param syscalls Numbers of the calls, none for all of them
+   */
+  auto trace(const std::vector<long> &syscalls) -> void;
+
+  pid_t m_pid;                                   ///< Process being debugged
+  syscall_injector &m_injector;                  ///< Installs the filters
+  std::vector<syscall_catchpoint> m_catchpoints; ///< Catchpoints by number
+  unsigned m_next_number = 1;                    ///< Number of the next one
+  std::set<long> m_traced;                       ///< Calls the filters trace
+  bool m_all_traced = false;                     ///< Whether all are traced
+  bool m_no_new_privs = false;                   ///< Whether filters work
+};
+
+#endif // SYSCALL_TRACE_H_
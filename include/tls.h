@@ -0,0 +1,93 @@
+/**
+ * @file tls.h
+ * @brief Addresses of the thread-local storage blocks of a process.
+ *
+ * This file contains the tls_cache class, which finds the thread-local
+ * storage block of a module in a thread by walking the dynamic thread
+ * vector (DTV) of glibc on x86-64. The thread pointer in fs_base points at
+ * the thread control block, whose second word points at the DTV. The DTV
+ * holds the generation it was last updated for, its length just before it,
+ * and then one 16-byte entry per module whose first word is the address of
+ * the module's block.
+ *
+ * Block addresses are cached per thread and kept across stops for as long
+ * as the DTV of the thread and its generation are unchanged, so looking up
+ * thread-locals again after the program ran costs one small read.
+ */
+
+#ifndef TLS_H_
+#define TLS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief TLS module ID of the executable, which is always the first module.
+ */
+constexpr std::size_t executable_tls_module = 1;
+
+/**
+ * @class tls_cache
+ * @brief Finds and caches the thread-local storage blocks of threads.
+ */
+class tls_cache {
+public:
+  /**
+   * @brief Creates an empty cache.
+   *
+   * @param pid Process ID of the program being debugged
+   */
+  explicit tls_cache(pid_t pid) noexcept : m_pid{pid} {}
+
+  /**
+   * @brief Gets the address of the thread-local storage block of a module.
+   *
+   * @param thread_pointer fs_base of the thread
+   * @param module TLS module ID
+   * @return The address of the module's block in the thread
+   * @throws std::out_of_range if the DTV cannot be read or the block has not
+   * been allocated yet
+   */
+  auto block_address(std::uint64_t thread_pointer, std::size_t module)
+      -> std::uint64_t;
+
+  /**
+   * @brief Requires the cached DTVs to be checked again before use.
+   *
+   * Called whenever the program has run, as it may have loaded modules or
+   * started threads.
+   */
+  auto invalidate() noexcept -> void;
+
+  /**
+   * @brief Reads the DTVs of another process, forgetting those cached.
+   *
+   * @param pid Process ID of the program being debugged
+   */
+  auto set_pid(pid_t pid) noexcept -> void {
+    m_pid = pid;
+    m_threads.clear();
+  }
+
+private:
+  /**
+   * @struct thread_dtv
+   * @brief What is known about the DTV of a thread.
+   */
+  struct thread_dtv {
+    std::uint64_t address = 0;         ///< Address of the DTV
+    std::uint64_t length = 0;          ///< Highest module ID it covers
+    std::uint64_t generation = 0;      ///< Generation the blocks belong to
+    bool checked = false;              ///< Whether checked since the last run
+    std::vector<std::uint64_t> blocks; ///< Block addresses by module, or 0
+  };
+
+  pid_t m_pid; ///< Process ID of the debugged program
+  std::unordered_map<std::uint64_t, thread_dtv>
+      m_threads; ///< DTVs by thread pointer
+};
+
+#endif // TLS_H_
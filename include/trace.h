@@ -0,0 +1,247 @@
+/**
+ * @file trace.h
+ * @brief Tracepoints and the frames they collect.
+ *
+ * This file contains the tracepoint and trace_buffer types. A tracepoint
+ * never stops the program for the user: each hit records the registers and
+ * the memory its collect actions ask for into a trace frame, and the
+ * program resumes at once. Frames are kept in a ring that overwrites the
+ * oldest ones, and are browsed later with tfind. Expressions are evaluated
+ * against a frame by a trace_frame_context, which reads registers and
+ * memory from what was collected instead of from the live process.
+ *
+ * Tracepoints whose actions the agent can carry out run as fast
+ * tracepoints, and their records are turned into frames when the debugger
+ * drains the ring of the agent. Others trap on an int3 and are collected by
+ * the debugger, through a trace_recorder that keeps every byte the
+ * evaluation of an expression reads.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "agent.h"
+#include "expression.h"
+#include "frame_context.h"
+#include "registers.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @enum collect_kind
+ * @brief What a collect action records.
+ */
+enum class collect_kind {
+  registers,  ///< The general purpose registers, which are always recorded
+  expression, ///< The memory read to evaluate an expression
+  memory      ///< A range of memory
+};
+
+/**
+ * @struct collect_action
+ * @brief Data a tracepoint records at each hit.
+ */
+struct collect_action {
+  collect_kind kind = collect_kind::registers; ///< What is recorded
+  std::string text;                            ///< Action as written
+  std::unique_ptr<expression> expr;            ///< Expression collected
+  std::uint64_t address = 0;                   ///< Start of a memory range
+  std::size_t size = 0;                        ///< Size of a memory range
+};
+
+/**
+ * @struct tracepoint
+ * @brief A location whose hits are recorded without stopping.
+ */
+struct tracepoint {
+  unsigned number = 0;                 ///< Number identifying the tracepoint
+  std::uint64_t address = 0;           ///< Runtime address of the location
+  unsigned fast = 0;                   ///< Its fast tracepoint, 0 if it traps
+  std::uint64_t hits = 0;              ///< Hits collected by the debugger
+  bool slow = false;                   ///< Whether the agent cannot collect it
+  std::vector<collect_action> actions; ///< What each hit records
+};
+
+/**
+ * @struct trace_block
+ * @brief A range of memory recorded in a trace frame.
+ */
+struct trace_block {
+  std::uint64_t address = 0;       ///< Address of the range in the process
+  std::vector<std::uint8_t> bytes; ///< Contents of the range
+};
+
+/**
+ * @struct trace_frame
+ * @brief The state recorded at one hit of a tracepoint.
+ */
+struct trace_frame {
+  std::uint64_t number = 0;        ///< Position in the order of collection
+  unsigned tracepoint = 0;         ///< Tracepoint that recorded the frame
+  dwarf_register_set regs;         ///< Registers, rip being the tracepoint
+  std::uint64_t eflags = 0;        ///< Flags register
+  std::uint64_t cfa = 0;           ///< Canonical frame address, 0 if unknown
+  std::vector<trace_block> blocks; ///< Memory recorded, in order
+
+  /**
+   * @brief Gets the address of the tracepoint.
+   */
+  auto pc() const noexcept -> std::uint64_t {
+    return regs.values[dwarf_return_address_register];
+  }
+
+  /**
+   * @brief Copies recorded memory.
+   *
+   * @param address Address in the process
+   * @param buffer Receives the bytes
+   * @param size Number of bytes to copy
+   * @return false if some of the range was not recorded
+   */
+  auto read(std::uint64_t address, void *buffer, std::size_t size) const
+      noexcept -> bool;
+};
+
+/**
+ * @brief Turns a record of the agent into a trace frame.
+ *
+ * The canonical frame address is left for the caller to fill in.
+ *
+ * @param record The record
+ * @param site The site that wrote it, whose ranges are in the record
+ * @param tracepoint Number of the tracepoint of the site
+ * @return The frame, not numbered yet
+ */
+auto make_trace_frame(const agent_record &record, const agent_site &site,
+                      unsigned tracepoint) -> trace_frame;
+
+/**
+ * @class trace_buffer
+ * @brief A ring of trace frames that overwrites the oldest ones.
+ */
+class trace_buffer {
+public:
+  /**
+   * @brief Creates an empty buffer.
+   *
+   * @param capacity Most frames kept
+   */
+  explicit trace_buffer(std::size_t capacity) noexcept
+      : m_capacity{capacity} {}
+
+  /**
+   * @brief Appends a frame, numbering it.
+   *
+   * @param frame The frame
+   * @return The frame in the buffer
+   */
+  auto add(trace_frame frame) -> const trace_frame &;
+
+  /**
+   * @brief Finds a frame by number.
+   *
+   * @param number Number of the frame
+   * @return The frame, or nullptr if it was never collected or has been
+   * overwritten
+   */
+  auto find(std::uint64_t number) const noexcept -> const trace_frame *;
+
+  /**
+   * @brief Gets the number of the oldest frame kept.
+   */
+  auto first() const noexcept -> std::uint64_t { return m_first; }
+
+  /**
+   * @brief Gets the number the next frame will have.
+   */
+  auto end() const noexcept -> std::uint64_t { return m_next; }
+
+  /**
+   * @brief Discards all frames, numbering them from 0 again.
+   */
+  auto clear() noexcept -> void;
+
+private:
+  std::size_t m_capacity;            ///< Most frames kept
+  std::vector<trace_frame> m_frames; ///< Frames by number modulo capacity
+  std::uint64_t m_first = 0;         ///< Number of the oldest frame kept
+  std::uint64_t m_next = 0;          ///< Number of the next frame
+};
+
+/**
+ * @class trace_frame_context
+ * @brief Evaluates expressions against the state recorded in a frame.
+ */
+class trace_frame_context : public frame_context {
+public:
+  /**
+   * @brief Creates a context for a frame.
+   *
+   * @param frame The trace frame
+   * @param frames The frame as the only frame of a backtrace
+   * @param function Function containing the tracepoint
+   * @param locations Cache of decoded location attributes
+   * @param load_address Base load address of the program
+   */
+  trace_frame_context(const trace_frame &frame,
+                      const std::vector<::frame> &frames,
+                      dwarf::die function, location_cache &locations,
+                      std::uint64_t load_address)
+      : frame_context(0, frames, 0, std::move(function), dwarf::die{},
+                      locations, load_address),
+        m_frame{frame} {}
+
+  /**
+   * @brief Reads recorded memory.
+   *
+   * @throws std::out_of_range if the memory was not collected
+   */
+  auto read_memory(std::uint64_t address, void *buffer, std::size_t size)
+      -> void override;
+
+private:
+  const trace_frame &m_frame; ///< Frame whose memory is read
+};
+
+/**
+ * @class trace_recorder
+ * @brief Evaluates expressions in the stopped process, recording memory.
+ */
+class trace_recorder : public frame_context {
+public:
+  /**
+   * @brief Creates a context recording into a frame.
+   *
+   * @param frame Receives the memory read
+   * @param pid Process ID of the program being debugged
+   * @param frames Frames of the backtrace of the process
+   * @param function Function containing the tracepoint
+   * @param caller Function of the calling frame, if known
+   * @param locations Cache of decoded location attributes
+   * @param load_address Base load address of the program
+   * @param tls Thread-local storage blocks of the process, if any
+   */
+  trace_recorder(trace_frame &frame, pid_t pid,
+                 const std::vector<::frame> &frames, dwarf::die function,
+                 dwarf::die caller, location_cache &locations,
+                 std::uint64_t load_address, tls_cache *tls)
+      : frame_context(pid, frames, 0, std::move(function), std::move(caller),
+                      locations, load_address, tls),
+        m_frame{frame} {}
+
+  /**
+   * @brief Reads memory of the process and records it in the frame.
+   */
+  auto read_memory(std::uint64_t address, void *buffer, std::size_t size)
+      -> void override;
+
+private:
+  trace_frame &m_frame; ///< Frame recording the memory read
+};
+
+#endif // TRACE_H_
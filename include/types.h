@@ -0,0 +1,170 @@
+/**
+ * @file types.h
+ * @brief DWARF type descriptions and formatting of typed values.
+ *
+ * This file contains the type_index class, which turns DWARF type DIEs into
+ * compact type descriptions cached by DIE offset, and format_value, which
+ * prints an object from a local copy of its bytes. Together they let a whole
+ * object be fetched from the debugged process with a single read and then
+ * decoded without touching the process or the DWARF data again.
+ */
+
+#ifndef TYPES_H_
+#define TYPES_H_
+
+#include "dwarf/dwarf++.hh"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct type_desc;
+
+/**
+ * @enum type_kind
+ * @brief The shape of a type.
+ */
+enum class type_kind {
+  base,        ///< Integer, floating point, boolean or character
+  pointer,     ///< Pointer or pointer to member
+  reference,   ///< Lvalue or rvalue reference
+  structure,   ///< Structure, class or union
+  array,       ///< Array of one or more dimensions
+  enumeration, ///< Enumeration
+  function,    ///< Function, only reachable through pointers
+  unknown      ///< void, or a type that cannot be described
+};
+
+/**
+ * @struct type_member
+ * @brief A data member of a structure.
+ */
+struct type_member {
+  std::string name;                ///< Name, empty for anonymous members
+  const type_desc *type = nullptr; ///< Type of the member
+  std::uint64_t offset = 0;        ///< Byte offset within the structure
+  std::uint64_t bit_size = 0;      ///< Width of a bitfield, 0 otherwise
+  std::uint64_t bit_offset = 0;    ///< Bit offset of a bitfield from offset
+  bool is_base_class = false;      ///< Whether the member is a base class
+};
+
+/**
+ * @struct type_desc
+ * @brief A type, decoded from its DWARF DIE.
+ */
+struct type_desc {
+  type_kind kind = type_kind::unknown;   ///< Shape of the type
+  std::string name;                      ///< Name as written in source
+  std::uint64_t size = 0;                ///< Size in bytes
+  dwarf::DW_ATE encoding{};              ///< Encoding of base types
+  const type_desc *target = nullptr;     ///< Pointee or element type
+  std::vector<type_member> members;      ///< Data members of structures
+  std::vector<std::uint64_t> dimensions; ///< Element counts of arrays
+  std::vector<std::pair<std::string, std::int64_t>>
+      enumerators; ///< Names and values of enumerations
+  std::vector<const type_desc *>
+      template_args;     ///< Type parameters of class templates
+  bool is_union = false; ///< Whether all members share offset 0
+};
+
+/**
+ * @class type_index
+ * @brief Type descriptions of a program, built on demand.
+ *
+ * Each type DIE is decoded once; later lookups of the same DIE return the
+ * cached description. Typedefs and cv-qualifiers resolve to the description
+ * of the type they name.
+ */
+class type_index {
+public:
+  /**
+   * @brief Default constructor, creates an empty index.
+   */
+  type_index();
+
+  /**
+   * @brief Gets the description of a type.
+   *
+   * @param die The type DIE
+   * @return The description, which lives as long as the index
+   */
+  auto get(const dwarf::die &die) -> const type_desc &;
+
+  /**
+   * @brief Gets the description of the type of a DIE.
+   *
+   * @param die A DIE with a DW_AT_type attribute, such as a variable, or the
+   * definition of a variable declared elsewhere
+   * @return The description of its type, or of void if it has none
+   */
+  auto get_type_of(const dwarf::die &die) -> const type_desc &;
+
+private:
+  /**
+   * @brief Fills in a type description from its DIE.
+   *
+   * @param die The type DIE
+   * @param type The description to fill in, already in the cache
+   */
+  auto build(const dwarf::die &die, type_desc &type) -> void;
+
+  std::unordered_map<dwarf::section_offset, const type_desc *>
+      m_types; ///< Descriptions by DIE offset
+  std::vector<std::unique_ptr<type_desc>>
+      m_storage;    ///< Owns the descriptions, whose addresses are stable
+  type_desc m_void; ///< Description used for missing types
+};
+
+/**
+ * @class value_formatter
+ * @brief Custom formatting for some types, such as library containers.
+ */
+class value_formatter {
+public:
+  virtual ~value_formatter() = default;
+
+  /**
+   * @brief Prints a value if its type is handled by this formatter.
+   *
+   * @param type Type of the value
+   * @param data The bytes of the value
+   * @param out Stream to print to
+   * @return true if the value was printed, false to use the default format
+   */
+  virtual auto format(const type_desc &type, const std::uint8_t *data,
+                      std::ostream &out) -> bool = 0;
+};
+
+/**
+ * @brief Prints a value from a local copy of its bytes.
+ *
+ * Pointers are printed as addresses and not followed, so the default format
+ * never needs to access the process.
+ *
+ * @param type Type of the value
+ * @param data The bytes of the value, at least type.size of them
+ * @param out Stream to print to
+ * @param custom Formatter consulted first for the value and every value
+ * nested in it, if any
+ */
+auto format_value(const type_desc &type, const std::uint8_t *data,
+                  std::ostream &out, value_formatter *custom = nullptr)
+    -> void;
+
+/**
+ * @brief Prints characters as a quoted, escaped string literal.
+ *
+ * @param data The characters
+ * @param size Number of characters to print
+ * @param truncated Whether to mark the string as cut short
+ * @param out Stream to print to
+ */
+auto format_string(const std::uint8_t *data, std::size_t size, bool truncated,
+                   std::ostream &out) -> void;
+
+#endif // TYPES_H_
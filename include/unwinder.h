@@ -0,0 +1,327 @@
+/**
+ * @file unwinder.h
+ * @brief Defines the stack unwinder used to produce backtraces.
+ *
+ * This file contains the frame type and the unwinder class, which walks the
+ * call stack of the debugged process. Frames whose function keeps a frame
+ * pointer in rbp are unwound by chasing the rbp chain, and all other frames
+ * use DWARF call frame information. Signal trampolines are recognised by
+ * their code and unwound through the rt_sigframe the kernel pushed, and
+ * objects other than the program, such as the vDSO, can be registered as
+ * additional code modules. The stack is captured with one bulk read per
+ * backtrace, so unwinding many frames does not issue one ptrace call per
+ * saved register, and the frames of the previous backtrace are reused for
+ * the part of the stack that has not changed since.
+ */
+
+#ifndef UNWINDER_H_
+#define UNWINDER_H_
+
+#include "cfi.h"
+#include "dwarf_expr.h"
+#include "memory.h"
+#include "registers.h"
+#include "symbols.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @struct frame
+ * @brief A single frame of a backtrace.
+ */
+struct frame {
+  std::uint64_t pc = 0;           ///< Runtime program counter of the frame
+  std::uint64_t cfa = 0;          ///< Canonical frame address, 0 if unknown
+  dwarf_register_set regs;        ///< Registers as they were in this frame
+  bool interrupted = false;       ///< Whether pc is not a return address
+  bool signal_trampoline = false; ///< Whether the frame is a sigreturn stub
+};
+
+/**
+ * @struct code_module
+ * @brief A mapped object whose frames the unwinder can step through.
+ */
+struct code_module {
+  std::uint64_t low = 0;                 ///< Runtime start of the mapping
+  std::uint64_t high = 0;                ///< Runtime end of the mapping
+  std::uint64_t bias = 0;                ///< Runtime minus link-time address
+  cfi_table *cfi = nullptr;              ///< Call frame information
+  const symbol_index *symbols = nullptr; ///< Function symbols
+  section_view text;                     ///< Code used for prologue analysis
+};
+
+/**
+ * @enum unwind_mode
+ * @brief How much of the register state of each frame an unwind recovers.
+ */
+enum class unwind_mode {
+  fast, ///< Follows frame pointers where possible, recovering pc, rsp and rbp
+  full  ///< Prefers CFI, recovering every register its rules describe
+};
+
+/**
+ * @class unwinder
+ * @brief Walks the call stack of a process using call frame information.
+ */
+class unwinder {
+public:
+  /**
+   * @brief Constructs an unwinder for a process.
+   *
+   * @param pid Process ID of the program being debugged
+   * @param cfi Call frame information of the program
+   * @param symbols Function symbols of the program
+   */
+  unwinder(pid_t pid, cfi_table &cfi, const symbol_index &symbols) noexcept
+      : m_pid{pid}, m_cfi{cfi}, m_symbols{symbols} {}
+
+  /**
+   * @brief Sets the code used for prologue analysis.
+   *
+   * @param text The .text section of the program
+   */
+  auto set_text(section_view text) noexcept -> void { m_text = text; }
+
+  /**
+   * @brief Sets the address the program has been loaded at.
+   *
+   * @param load_address Base load address of the program in memory
+   */
+  auto set_load_address(std::uint64_t load_address) noexcept -> void {
+    m_load_address = load_address;
+    m_prologues.clear();
+    m_trampolines.clear();
+    m_cfi_programs.clear();
+    m_cache.clear();
+  }
+
+  /**
+   * @brief Registers an object mapped into the process besides the program.
+   *
+   * Frames whose pc lies inside the module are unwound with its call frame
+   * information and named with its symbols.
+   *
+   * @param module The module to register
+   */
+  auto add_module(const code_module &module) -> void {
+    m_modules.push_back(module);
+    m_cache.clear();
+  }
+
+  /**
+   * @brief Finds the function symbol containing a runtime address.
+   *
+   * @param pc Runtime address to look up
+   * @return The containing symbol, or nullptr if there is none
+   */
+  auto find_symbol(std::uint64_t pc) const noexcept -> const symbol *;
+
+  /**
+   * @brief Unwinds the stack starting from a register set.
+   *
+   * Once a caller frame with the same registers as a frame of the previous
+   * backtrace is reached, the remaining frames are taken from the previous
+   * backtrace, provided the stack slots they were unwound from still hold
+   * the same values.
+   *
+   * @param regs Registers of the innermost frame
+   * @param max_frames Maximum number of frames to produce
+   * @param mode Which registers to recover for the outer frames
+   * @return The frames of the stack, innermost first
+   */
+  auto unwind(const dwarf_register_set &regs, std::size_t max_frames = 256,
+              unwind_mode mode = unwind_mode::fast) -> std::vector<frame>;
+
+  /**
+   * @brief Discards the frames remembered from the previous backtrace.
+   *
+   * Must be called when registers of the process are modified, since outer
+   * frames may inherit register values from the innermost frame.
+   */
+  auto invalidate_cache() noexcept -> void { m_cache.clear(); }
+
+  /**
+   * @brief Unwinds another process from now on, a copy of the first.
+   *
+   * @param pid Process ID of the copy
+   */
+  auto set_pid(pid_t pid) noexcept -> void {
+    m_pid = pid;
+    m_cache.clear();
+  }
+
+private:
+  /**
+   * @struct memory_slot
+   * @brief A stack slot read while unwinding, and the value it held.
+   */
+  struct memory_slot {
+    std::uint64_t addr;  ///< Address of the slot
+    std::uint64_t value; ///< Value read from the slot
+  };
+
+  /**
+   * @class stack_reader
+   * @brief Reads from a stack snapshot and records every slot read.
+   */
+  class stack_reader {
+  public:
+    stack_reader(const memory_snapshot &stack,
+                 std::vector<memory_slot> &log) noexcept
+        : m_stack{stack}, m_log{log} {}
+
+    auto read(std::uint64_t address, std::uint64_t &value) -> bool;
+
+  private:
+    const memory_snapshot &m_stack;
+    std::vector<memory_slot> &m_log;
+  };
+
+  /**
+   * @brief Finds a frame of the previous backtrace that can be reused.
+   *
+   * @param caller A newly unwound frame
+   * @param stack Snapshot of the stack
+   * @return Index of the matching cached frame, or the size of the cache if
+   * the previous backtrace cannot be reused from @p caller on
+   */
+  auto find_reusable_suffix(const frame &caller,
+                            const memory_snapshot &stack) const
+      -> std::size_t;
+
+  /**
+   * @brief Gets the module containing a runtime address.
+   *
+   * @param pc Runtime address to look up
+   * @return The registered module containing @p pc, or the program itself
+   */
+  auto find_module(std::uint64_t pc) const noexcept -> code_module;
+
+  /**
+   * @struct prologue_info
+   * @brief The result of analysing the prologue of a function.
+   */
+  struct prologue_info {
+    bool sets_frame_pointer = false; ///< Whether rbp is used as frame pointer
+    std::uint64_t established = 0;   ///< First PC at which rbp is set up
+  };
+
+  /**
+   * @brief Checks whether rbp holds the frame pointer at a program counter.
+   *
+   * The prologue of the containing function is decoded once and cached. An
+   * interrupted pc just after pop %rbp or leave, or at ret, is past the
+   * point where the epilogue restored the caller's rbp.
+   *
+   * @param module The module containing @p pc
+   * @param runtime_pc Runtime program counter
+   * @param is_interrupted Whether @p runtime_pc is the next instruction to run
+   * @return true if rbp points at the saved rbp of the frame
+   */
+  auto has_frame_pointer(const code_module &module, std::uint64_t runtime_pc,
+                         bool is_interrupted) -> bool;
+
+  /**
+   * @brief Computes the caller of a frame by following its frame pointer.
+   *
+   * Fills in the CFA of @p current as a side effect.
+   *
+   * @param current The frame to unwind from
+   * @param stack Snapshot of the stack
+   * @param caller Receives the calling frame
+   * @return true if the frame pointer chain could be followed
+   */
+  auto step_frame_pointer(frame &current, stack_reader &stack,
+                          frame &caller) -> bool;
+
+  /**
+   * @brief Evaluates a DWARF expression of the call frame information.
+   *
+   * Each expression is decoded once and kept for later unwinds.
+   *
+   * @param expr The bytes of the expression
+   * @param size Size of the expression in bytes
+   * @param regs Registers of the frame being unwound
+   * @param stack Snapshot of the stack
+   * @param initial Value pushed on the stack before evaluation, if any
+   * @param result Receives the computed value
+   * @return true if the expression could be evaluated
+   */
+  auto evaluate_cfi_expression(const std::uint8_t *expr, std::size_t size,
+                               const dwarf_register_set &regs,
+                               stack_reader &stack,
+                               const std::uint64_t *initial,
+                               std::uint64_t &result) -> bool;
+
+  /**
+   * @brief Computes the caller of a frame using call frame information.
+   *
+   * Fills in the CFA of @p current as a side effect.
+   *
+   * @param module The module containing the pc of @p current
+   * @param current The frame to unwind from
+   * @param stack Snapshot of the stack
+   * @param caller Receives the calling frame
+   * @return true if the caller could be recovered
+   */
+  auto step_cfi(const code_module &module, frame &current,
+                stack_reader &stack, frame &caller) -> bool;
+
+  /**
+   * @brief Checks whether code is the rt_sigreturn trampoline.
+   *
+   * The code is read from the process once per address and cached.
+   *
+   * @param pc Runtime address of the code
+   * @return true if @p pc is the start of a signal return trampoline
+   */
+  auto is_signal_trampoline(std::uint64_t pc) -> bool;
+
+  /**
+   * @brief Computes the frame a signal interrupted from its rt_sigframe.
+   *
+   * Fills in the CFA of @p current as a side effect.
+   *
+   * @param current A signal trampoline frame
+   * @param stack Snapshot of the stack
+   * @param caller Receives the interrupted frame
+   * @return true if the saved registers could be read
+   */
+  auto step_signal_frame(frame &current, stack_reader &stack, frame &caller)
+      -> bool;
+
+  /**
+   * @brief Captures the part of the stack the unwinder will need.
+   *
+   * @param sp The stack pointer of the innermost frame
+   * @return A snapshot of the stack from @p sp upwards
+   */
+  auto capture_stack(std::uint64_t sp) -> memory_snapshot;
+
+  pid_t m_pid;                        ///< Process ID of the debugged program
+  cfi_table &m_cfi;                   ///< CFI of the debugged program
+  const symbol_index &m_symbols;      ///< Function symbols of the program
+  section_view m_text;                ///< Code of the program
+  std::vector<code_module> m_modules; ///< Objects other than the program
+  std::unordered_map<std::uint64_t, prologue_info>
+      m_prologues; ///< Analysed prologues by runtime function start
+  std::unordered_map<std::uint64_t, bool>
+      m_trampolines; ///< Whether code is a signal trampoline, by address
+  std::unordered_map<const std::uint8_t *, dwarf_program>
+      m_cfi_programs; ///< Decoded CFI expressions by their bytes
+  std::uint64_t m_load_address = 0; ///< Base load address of the program
+  std::uint64_t m_stack_low = 0;    ///< Start of the main thread's stack
+  std::uint64_t m_stack_high = 0;   ///< End of the main thread's stack
+  std::vector<frame> m_cache;       ///< Frames of the previous backtrace
+  unwind_mode m_cache_mode = unwind_mode::fast; ///< Mode of m_cache
+  std::vector<memory_slot>
+      m_cache_reads; ///< Stack slots the previous backtrace was unwound from
+  std::vector<std::size_t>
+      m_cache_read_offsets; ///< First slot read while unwinding each frame
+};
+
+#endif // UNWINDER_H_
@@ -0,0 +1,98 @@
+/**
+ * @file vdso.h
+ * @brief Loads the vDSO of the debugged process for unwinding.
+ *
+ * This file contains the vdso class, which copies the ELF image of the
+ * virtual dynamic shared object out of the memory of the debugged process.
+ * The vDSO has no file on disk, so its symbols and call frame information
+ * are read from the copy, which lets backtraces continue through functions
+ * such as clock_gettime. The clock functions can also be replaced with
+ * system calls, so that tracing system calls sees the program read the clock,
+ * and put back when the calls are no longer traced.
+ */
+
+#ifndef VDSO_H_
+#define VDSO_H_
+
+#include "cfi.h"
+#include "elf/elf++.hh"
+#include "symbols.h"
+#include "unwinder.h"
+
+#include <cstdint>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
+/**
+ * @class vdso
+ * @brief The vDSO image of a process and the unwind information it holds.
+ */
+class vdso {
+public:
+  /**
+   * @brief Default constructor, creates an unloaded vDSO.
+   */
+  vdso() = default;
+
+  /**
+   * @brief Copies the vDSO out of a process and indexes it.
+   *
+   * The mapping is located through /proc/pid/maps and read with a single
+   * bulk read.
+   *
+   * @param pid Process ID of the program being debugged
+   * @return true if the process has a vDSO and it could be loaded
+   */
+  auto load(pid_t pid) -> bool;
+
+  /**
+   * @brief Checks whether a vDSO has been loaded.
+   */
+  auto loaded() const noexcept -> bool { return m_high != 0; }
+
+  /**
+   * @brief Describes the vDSO as a module for the unwinder.
+   *
+   * @return The code module of the vDSO, which refers to this object
+   */
+  auto module() noexcept -> code_module;
+
+  /**
+   * @brief Makes the clock functions of the vDSO enter the kernel.
+   *
+   * The vDSO reads the clock without a system call, which hides it from
+   * PTRACE_SYSCALL. Each clock function is overwritten, in the process
+   * only, with a stub making the system call it stands for. The code
+   * overwritten is kept until restore_clock puts it back, and the functions
+   * already redirected are left as they are.
+   *
+   * @param pid Process ID of the program being debugged
+   * @throws std::out_of_range if the code of the vDSO cannot be written
+   */
+  auto redirect_clock(pid_t pid) -> void;
+
+  /**
+   * @brief Puts back the clock functions overwritten by redirect_clock.
+   *
+   * Code that cannot be written is left as it is, which only happens once
+   * the process is gone.
+   *
+   * @param pid Process ID of the program being debugged
+   */
+  auto restore_clock(pid_t pid) noexcept -> void;
+
+private:
+  elf::elf m_elf;           ///< ELF image copied from the process
+  cfi_table m_cfi;          ///< Call frame information of the vDSO
+  symbol_index m_symbols;   ///< Function symbols of the vDSO
+  section_view m_text;      ///< Code of the vDSO
+  std::uint64_t m_low = 0;  ///< Runtime start of the mapping
+  std::uint64_t m_high = 0; ///< Runtime end of the mapping
+  std::uint64_t m_bias = 0; ///< Runtime minus link-time address
+
+  /// Runtime addresses of the clock functions overwritten, and their code
+  std::vector<std::pair<std::uint64_t, std::vector<std::uint8_t>>> m_replaced;
+};
+
+#endif // VDSO_H_
@@ -0,0 +1,220 @@
+/**
+ * @file watchpoint.h
+ * @brief Watchpoints on objects in the memory of the debugged process.
+ *
+ * This file contains the watchpoint_table class, which stops the program
+ * when it changes a watched object. Up to four small aligned objects are
+ * watched with the x86-64 debug registers, which trap after the writing
+ * instruction at no cost to the program. Other objects are watched by
+ * write-protecting their pages with mprotect calls injected into the
+ * process: a write to such a page faults, and only the faulting instruction
+ * is single-stepped with the page writable again before its values are
+ * compared. The program otherwise runs at full speed, so any number of
+ * objects can be watched.
+ *
+ * Writes made by the kernel on behalf of the program, such as by read(2),
+ * fail with EFAULT on protected pages rather than being caught, so the
+ * debugger only protects pages that hold nothing but the watched object.
+ */
+
+#ifndef WATCHPOINT_H_
+#define WATCHPOINT_H_
+
+#include "inject.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * @enum watch_kind
+ * @brief How a watchpoint catches writes.
+ */
+enum class watch_kind {
+  hardware, ///< A debug register traps on writes
+  page      ///< Writes fault on the write-protected page
+};
+
+/**
+ * @struct watchpoint
+ * @brief A watched object.
+ */
+struct watchpoint {
+  unsigned number = 0;                ///< Number identifying the watchpoint
+  std::uint64_t address = 0;          ///< Address of the object
+  std::size_t size = 0;               ///< Size of the object in bytes
+  watch_kind kind = watch_kind::page; ///< How writes are caught
+  unsigned slot = 0;                  ///< Debug register of a hardware one
+  std::vector<std::uint8_t> value;    ///< Contents when last checked
+};
+
+/**
+ * @struct watch_hit
+ * @brief A change of a watched object.
+ */
+struct watch_hit {
+  unsigned number = 0;                 ///< Number of the watchpoint
+  std::vector<std::uint8_t> old_value; ///< Contents before the change
+  std::vector<std::uint8_t> new_value; ///< Contents after the change
+};
+
+/**
+ * @class watchpoint_table
+ * @brief The watchpoints of a process.
+ */
+class watchpoint_table {
+public:
+  /**
+   * @brief Creates a table without watchpoints.
+   *
+   * @param pid Process ID of the program being debugged
+   * @param injector Makes the mprotect calls in the process
+   */
+  watchpoint_table(pid_t pid, syscall_injector &injector) noexcept
+      : m_pid{pid}, m_injector{injector} {}
+
+  /**
+   * @brief Watches an object.
+   *
+   * A free debug register is used if the object is 1, 2, 4 or 8 bytes long
+   * and aligned to its size, and its pages are write-protected otherwise.
+   * The process must be stopped.
+   *
+   * @param address Address of the object
+   * @param size Size of the object in bytes
+   * @return The new watchpoint
+   * @throws std::out_of_range if the object cannot be read or its pages
+   * cannot be protected
+   */
+  auto add(std::uint64_t address, std::size_t size) -> const watchpoint &;
+
+  /**
+   * @brief Checks whether watching an object would write-protect its pages.
+   *
+   * @param address Address of the object
+   * @param size Size of the object in bytes
+   * @return false if the object would be watched with a debug register
+   */
+  auto uses_pages(std::uint64_t address, std::size_t size) const noexcept
+      -> bool;
+
+  /**
+   * @brief Stops watching an object.
+   *
+   * @param number Number of the watchpoint
+   * @return false if there is no such watchpoint
+   */
+  auto remove(unsigned number) -> bool;
+
+  /**
+   * @brief Gets the watchpoints, in the order they were added.
+   */
+  auto watchpoints() const noexcept -> const std::vector<watchpoint> & {
+    return m_watchpoints;
+  }
+
+  /**
+   * @brief Checks a stop for writes to watched objects.
+   *
+   * A fault on a protected page is handled by stepping the faulting
+   * instruction with its pages writable, after which the process is stopped
+   * past the instruction. Debug register traps are acknowledged.
+   *
+   * @param signal Signal the process stopped with
+   * @param fault_address Address of a SIGSEGV fault
+   * @param hits Receives the watched objects whose contents changed
+   * @return true if the stop was caused by a watchpoint, in which case it
+   * only needs to be reported if @p hits is not empty
+   */
+  auto check_stop(int signal, std::uint64_t fault_address,
+                  std::vector<watch_hit> &hits) -> bool;
+
+  /**
+   * @brief Watches the same objects in another process, a copy of the
+   * first.
+   *
+   * The debug registers of the copy are set and the contents of the
+   * objects read again. Write-protected pages are not changed, so the copy
+   * must have been made while they were protected.
+   *
+   * @param pid Process ID of the copy
+   * @throws std::out_of_range if the debug registers cannot be set
+   */
+  auto set_pid(pid_t pid) -> void;
+
+private:
+  /**
+   * @struct protected_page
+   * @brief A page write-protected for watchpoints.
+   */
+  struct protected_page {
+    int protection = 0; ///< Protection the page had before
+    unsigned users = 0; ///< Number of watchpoints on the page
+  };
+
+  /**
+   * @brief Write-protects the pages of an object.
+   *
+   * Pages that are not protected yet are protected with one mprotect call
+   * per run of adjacent pages with the same protection.
+   *
+   * @param w The watchpoint
+   */
+  auto protect(const watchpoint &w) -> void;
+
+  /**
+   * @brief Restores the protection of pages no other watchpoint is on.
+   *
+   * @param w The watchpoint being removed
+   */
+  auto unprotect(const watchpoint &w) -> void;
+
+  /**
+   * @brief Steps the instruction that faulted on a protected page.
+   *
+   * Every protected page the instruction faults on is made writable until
+   * the instruction has completed.
+   *
+   * @param fault_address Address the instruction faulted on
+   * @param trapped Set if the instruction triggered a debug register
+   * @return The pages that were made writable
+   */
+  auto step_faulting_instruction(std::uint64_t fault_address, bool &trapped)
+      -> std::vector<std::uint64_t>;
+
+  /**
+   * @brief Compares watched objects with their last known contents.
+   *
+   * All objects are read with one vectored read.
+   *
+   * @param watched Indices of the watchpoints to compare
+   * @param hits Receives the objects whose contents changed
+   */
+  auto compare(const std::vector<std::size_t> &watched,
+               std::vector<watch_hit> &hits) -> void;
+
+  /**
+   * @brief Checks and clears the debug status register.
+   *
+   * @return true if a debug register caused the last trap
+   */
+  auto hardware_triggered() -> bool;
+
+  /**
+   * @brief Writes the debug control register from the hardware watchpoints.
+   */
+  auto update_debug_control() -> void;
+
+  pid_t m_pid;                           ///< Process ID of the program
+  syscall_injector &m_injector;          ///< Makes calls in the process
+  std::vector<watchpoint> m_watchpoints; ///< Watchpoints by number
+  unsigned m_next_number = 1;            ///< Number of the next one
+  std::array<bool, 4> m_slots{};         ///< Debug registers in use
+  std::map<std::uint64_t, protected_page>
+      m_pages; ///< Protected pages by address
+};
+
+#endif // WATCHPOINT_H_
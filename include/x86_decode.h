@@ -0,0 +1,89 @@
+/**
+ * @file x86_decode.h
+ * @brief Length decoding and relocation of x86-64 instructions.
+ *
+ * This file contains the functions that find the length of an instruction
+ * and move it to another address, for the instructions a patched jump
+ * overwrites. Only the layout of instructions is decoded, not their
+ * meaning: prefixes, the opcode, the ModRM and SIB bytes, the displacement
+ * and the immediate. RIP-relative operands are relocated by adjusting their
+ * displacement, while relative branches are reported so that callers can
+ * avoid them.
+ *
+ * The operand an instruction addresses memory with is decoded as well, with
+ * the stores it makes implicitly through the stack pointer and rdi, so that
+ * the memory an instruction may write can be found before it runs.
+ */
+
+#ifndef X86_DECODE_H_
+#define X86_DECODE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @struct x86_instruction
+ * @brief The layout of a decoded instruction.
+ */
+struct x86_instruction {
+  std::size_t length = 0;           ///< Length in bytes
+  std::size_t rip_displacement = 0; ///< Offset of a RIP-relative disp32, or 0
+  bool relative_branch = false;     ///< Whether it jumps or calls relative
+  bool memory = false;              ///< Whether an operand is in memory
+  std::int8_t base = -1;            ///< Base register of the operand, or -1
+  std::int8_t index = -1;           ///< Index register of the operand, or -1
+  std::uint8_t scale = 1;           ///< Scale of the index
+  std::int64_t displacement = 0;    ///< Displacement or absolute address
+  std::uint8_t segment = 0;         ///< fs or gs override prefix, or 0
+  bool address_size = false;        ///< Whether addresses are 32 bits
+  bool pushes = false;              ///< Whether it stores below rsp
+  bool stores_string = false;       ///< Whether it stores at rdi
+};
+
+/// Number of general purpose registers, in the order instructions encode
+/// them: rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, then r8 to r15
+constexpr std::size_t x86_registers = 16;
+
+/**
+ * @brief Decodes the layout of an instruction.
+ *
+ * @param code The bytes of the instruction
+ * @param size Number of bytes available at @p code
+ * @param insn Receives the layout
+ * @return false if the instruction is invalid, unknown or truncated
+ */
+auto decode_x86_instruction(const std::uint8_t *code, std::size_t size,
+                            x86_instruction &insn) noexcept -> bool;
+
+/**
+ * @brief Copies an instruction to another address.
+ *
+ * @param insn Layout of the instruction
+ * @param code The bytes of the instruction
+ * @param from Address of the instruction
+ * @param to Address the copy will run at
+ * @param out Receives insn.length bytes
+ * @return false if the instruction is a relative branch or its operand is
+ * out of reach of the new address
+ */
+auto relocate_x86_instruction(const x86_instruction &insn,
+                              const std::uint8_t *code, std::uint64_t from,
+                              std::uint64_t to, std::uint8_t *out) noexcept
+    -> bool;
+
+/**
+ * @brief Computes the address of the memory operand of an instruction.
+ *
+ * @param insn Layout of the instruction, whose memory is set
+ * @param address Address of the instruction
+ * @param registers Values of the general purpose registers, in the order
+ * instructions encode them
+ * @param fs_base Base of the fs segment
+ * @param gs_base Base of the gs segment
+ * @return The address of the operand
+ */
+auto x86_memory_address(const x86_instruction &insn, std::uint64_t address,
+                        const std::uint64_t *registers, std::uint64_t fs_base,
+                        std::uint64_t gs_base) noexcept -> std::uint64_t;
+
+#endif // X86_DECODE_H_
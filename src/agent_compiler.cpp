@@ -0,0 +1,763 @@
+#include "../include/agent_compiler.h"
+#include "../include/types.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// The DWARF operations locations of variables use at fast tracepoints
+constexpr std::uint8_t DW_OP_addr = 0x03;
+constexpr std::uint8_t DW_OP_deref = 0x06;
+constexpr std::uint8_t DW_OP_const1u = 0x08;
+constexpr std::uint8_t DW_OP_consts = 0x11;
+constexpr std::uint8_t DW_OP_and = 0x1a;
+constexpr std::uint8_t DW_OP_minus = 0x1c;
+constexpr std::uint8_t DW_OP_mul = 0x1e;
+constexpr std::uint8_t DW_OP_neg = 0x1f;
+constexpr std::uint8_t DW_OP_not = 0x20;
+constexpr std::uint8_t DW_OP_or = 0x21;
+constexpr std::uint8_t DW_OP_plus = 0x22;
+constexpr std::uint8_t DW_OP_plus_uconst = 0x23;
+constexpr std::uint8_t DW_OP_shl = 0x24;
+constexpr std::uint8_t DW_OP_shr = 0x25;
+constexpr std::uint8_t DW_OP_shra = 0x26;
+constexpr std::uint8_t DW_OP_xor = 0x27;
+constexpr std::uint8_t DW_OP_lit0 = 0x30;
+constexpr std::uint8_t DW_OP_lit31 = 0x4f;
+constexpr std::uint8_t DW_OP_reg0 = 0x50;
+constexpr std::uint8_t DW_OP_reg31 = 0x6f;
+constexpr std::uint8_t DW_OP_breg0 = 0x70;
+constexpr std::uint8_t DW_OP_breg31 = 0x8f;
+constexpr std::uint8_t DW_OP_regx = 0x90;
+constexpr std::uint8_t DW_OP_fbreg = 0x91;
+constexpr std::uint8_t DW_OP_bregx = 0x92;
+constexpr std::uint8_t DW_OP_deref_size = 0x94;
+constexpr std::uint8_t DW_OP_nop = 0x96;
+constexpr std::uint8_t DW_OP_call_frame_cfa = 0x9c;
+constexpr std::uint8_t DW_OP_stack_value = 0x9f;
+
+// DWARF register of the program counter, which is constant at a site
+constexpr unsigned dwarf_rip = 16;
+
+auto is_float(const type_desc &type) noexcept -> bool {
+  return type.kind == type_kind::base &&
+         type.encoding == dwarf::DW_ATE::float_;
+}
+
+auto is_bool(const type_desc &type) noexcept -> bool {
+  return type.kind == type_kind::base &&
+         type.encoding == dwarf::DW_ATE::boolean;
+}
+
+auto is_signed(const type_desc &type) noexcept -> bool {
+  return type.kind == type_kind::enumeration ||
+         (type.kind == type_kind::base &&
+          (type.encoding == dwarf::DW_ATE::signed_ ||
+           type.encoding == dwarf::DW_ATE::signed_char));
+}
+
+auto is_pointer_like(const type_desc &type) noexcept -> bool {
+  return type.kind == type_kind::pointer || type.kind == type_kind::array;
+}
+
+auto extend(std::uint64_t bits, std::uint64_t size, bool is_signed) noexcept
+    -> std::uint64_t {
+  if (size >= 8) {
+    return bits;
+  }
+  auto mask = (std::uint64_t{1} << (size * 8)) - 1;
+  bits &= mask;
+  if (is_signed && (bits >> (size * 8 - 1)) != 0) {
+    bits |= ~mask;
+  }
+  return bits;
+}
+
+auto unsupported(const std::string &what) -> std::invalid_argument {
+  return std::invalid_argument{"The agent cannot evaluate " + what};
+}
+
+auto uncollectable(const std::string &what) -> std::invalid_argument {
+  return std::invalid_argument{"The agent cannot collect " + what};
+}
+
+// How a value on the stack of the bytecode is held
+enum class slot_kind {
+  value,   // The value itself
+  direct,  // Address of the object, which is known to be mapped
+  checked, // Address of the object, which may not be mapped
+};
+
+struct slot {
+  const type_desc *type = nullptr;
+  slot_kind kind = slot_kind::value;
+};
+
+class agent_compiler {
+public:
+  agent_compiler(const expression &condition, std::uint64_t pc,
+                 std::uint64_t load_address, location_cache &locations,
+                 cfi_table &cfi)
+      : m_condition{condition}, m_pc{pc}, m_load_address{load_address},
+        m_locations{locations}, m_cfi{cfi} {}
+
+  auto compile() -> std::vector<agent_insn> {
+    const auto &insns = m_condition.insns();
+    find_consumers();
+
+    std::vector<std::size_t> starts;
+    for (std::size_t i = 0; i < insns.size(); ++i) {
+      starts.push_back(m_code.size());
+      compile_insn(i);
+    }
+    starts.push_back(m_code.size());
+
+    // Jumps were emitted with the index of their target in the expression
+    for (auto &insn : m_code) {
+      if (insn.op == agent_op::and_jump || insn.op == agent_op::or_jump) {
+        insn.arg = static_cast<std::int64_t>(starts[insn.arg]);
+      }
+    }
+    if (m_code.size() > agent_max_insns) {
+      throw unsupported("a condition this long");
+    }
+    return std::move(m_code);
+  }
+
+  auto collect() -> agent_collect {
+    const auto &insns = m_condition.insns();
+    if (insns.empty() || insns.front().op != expr_opcode::variable) {
+      throw uncollectable("anything but variables");
+    }
+    auto program = insns.front().location->find(m_pc);
+    if (program == nullptr) {
+      throw unsupported("variables that are optimized out");
+    }
+
+    auto address = fixed_address(*program, false);
+    for (std::size_t i = 1; i < insns.size(); ++i) {
+      if (insns[i].op != expr_opcode::member) {
+        throw uncollectable("anything but variables and members");
+      }
+      address.offset += static_cast<std::int64_t>(insns[i].arg1);
+    }
+
+    const auto &type = m_condition.type();
+    if (type.size == 0 || type.size > agent_record_data) {
+      throw uncollectable("objects of type " + type.name);
+    }
+    address.size = static_cast<std::uint32_t>(type.size);
+    return address;
+  }
+
+private:
+  // Finds the address a location computes, if it is a constant or a
+  // register plus a constant
+  auto fixed_address(const dwarf_program &program, bool is_frame_base)
+      -> agent_collect {
+    std::vector<agent_collect> stack;
+    auto base = [this](unsigned regnum) {
+      agent_collect address;
+      if (regnum == dwarf_rip) {
+        address.offset = static_cast<std::int64_t>(m_pc + m_load_address);
+      } else if (regnum < sizeof(agent_dwarf_registers) /
+                              sizeof(agent_dwarf_registers[0])) {
+        address.base = agent_dwarf_registers[regnum];
+      } else {
+        throw unsupported("registers other than general purpose ones");
+      }
+      return address;
+    };
+
+    for (const auto &op : program.ops()) {
+      auto code = op.code;
+      auto arg1 = static_cast<std::int64_t>(op.arg1);
+      if (code >= DW_OP_breg0 && code <= DW_OP_breg31) {
+        stack.push_back(base(code - DW_OP_breg0));
+        stack.back().offset += arg1;
+      } else if (is_frame_base && code >= DW_OP_reg0 && code <= DW_OP_reg31) {
+        // A frame base in a register is the contents of the register
+        stack.push_back(base(code - DW_OP_reg0));
+      } else if (code == DW_OP_addr) {
+        stack.emplace_back();
+        stack.back().offset =
+            static_cast<std::int64_t>(op.arg1 + m_load_address);
+      } else if (code == DW_OP_bregx) {
+        stack.push_back(base(static_cast<unsigned>(op.arg1)));
+        stack.back().offset += static_cast<std::int64_t>(op.arg2);
+      } else if (code == DW_OP_fbreg) {
+        stack.push_back(frame_base_address());
+        stack.back().offset += arg1;
+      } else if (code == DW_OP_call_frame_cfa) {
+        auto row = m_cfi.find_row(m_pc);
+        if (row == nullptr || row->cfa_expr != nullptr) {
+          throw unsupported("this frame's canonical frame address");
+        }
+        stack.push_back(base(row->cfa_reg));
+        stack.back().offset += row->cfa_offset;
+      } else if (code == DW_OP_plus_uconst && !stack.empty()) {
+        stack.back().offset += arg1;
+      } else if (code != DW_OP_nop) {
+        throw uncollectable("a variable at this location");
+      }
+    }
+    if (stack.size() != 1) {
+      throw uncollectable("a variable at this location");
+    }
+    return stack.front();
+  }
+
+  auto frame_base_address() -> agent_collect {
+    const auto &function = m_condition.function();
+    if (!function.has(dwarf::DW_AT::frame_base)) {
+      throw unsupported("a function without a frame base");
+    }
+    auto program =
+        m_locations.get(function, dwarf::DW_AT::frame_base).find(m_pc);
+    if (program == nullptr) {
+      throw unsupported("the frame base of the function");
+    }
+    return fixed_address(*program, true);
+  }
+
+  // Finds which operation uses the result of each operation, and as which
+  // operand, so that results are loaded and converted as they are produced
+  auto find_consumers() -> void {
+    const auto &insns = m_condition.insns();
+    m_consumers.assign(insns.size(), {insns.size(), 0});
+    std::vector<std::size_t> producers;
+    for (std::size_t i = 0; i < insns.size(); ++i) {
+      std::size_t operands = 0;
+      switch (insns[i].op) {
+      case expr_opcode::constant:
+      case expr_opcode::variable:
+      case expr_opcode::reg:
+        break;
+      case expr_opcode::member:
+      case expr_opcode::bitfield:
+      case expr_opcode::deref:
+      case expr_opcode::address:
+      case expr_opcode::convert:
+      case expr_opcode::negate:
+      case expr_opcode::bit_not:
+      case expr_opcode::logical_not:
+      case expr_opcode::to_bool:
+      case expr_opcode::and_jump:
+      case expr_opcode::or_jump:
+        operands = 1;
+        break;
+      default:
+        operands = 2;
+        break;
+      }
+      if (producers.size() < operands) {
+        throw std::invalid_argument{"Malformed expression"};
+      }
+      for (std::size_t n = 0; n < operands; ++n) {
+        m_consumers[producers.back()] = {i, operands - 1 - n};
+        producers.pop_back();
+      }
+
+      // The value a jump yields is taken to be the one of the operations
+      // it skips
+      if (insns[i].op != expr_opcode::and_jump &&
+          insns[i].op != expr_opcode::or_jump) {
+        producers.push_back(i);
+      }
+    }
+  }
+
+  auto emit(agent_op op, std::int64_t arg = 0, std::uint8_t size = 8,
+            bool is_signed = false) -> void {
+    agent_insn insn;
+    insn.op = op;
+    insn.arg = arg;
+    insn.size = size;
+    insn.is_signed = is_signed;
+    m_code.push_back(insn);
+
+    switch (op) {
+    case agent_op::constant:
+    case agent_op::reg:
+      ++m_depth;
+      break;
+    case agent_op::and_jump:
+    case agent_op::or_jump:
+    case agent_op::add:
+    case agent_op::sub:
+    case agent_op::mul:
+    case agent_op::div:
+    case agent_op::mod:
+    case agent_op::shl:
+    case agent_op::shr:
+    case agent_op::bit_and:
+    case agent_op::bit_or:
+    case agent_op::bit_xor:
+    case agent_op::eq:
+    case agent_op::ne:
+    case agent_op::lt:
+    case agent_op::le:
+    case agent_op::gt:
+    case agent_op::ge:
+      --m_depth;
+      break;
+    default:
+      break;
+    }
+    if (m_depth > agent_max_stack) {
+      throw unsupported("a condition this deeply nested");
+    }
+  }
+
+  auto emit_register(unsigned regnum) -> void {
+    if (regnum == dwarf_rip) {
+      emit(agent_op::constant,
+           static_cast<std::int64_t>(m_pc + m_load_address));
+    } else if (regnum < sizeof(agent_dwarf_registers) /
+                            sizeof(agent_dwarf_registers[0])) {
+      emit(agent_op::reg, agent_dwarf_registers[regnum]);
+    } else {
+      throw unsupported("registers other than general purpose ones");
+    }
+  }
+
+  auto emit_offset(std::int64_t offset) -> void {
+    if (offset != 0) {
+      emit(agent_op::constant, offset);
+      emit(agent_op::add);
+    }
+  }
+
+  // Pushes the canonical frame address of the site
+  auto emit_cfa() -> void {
+    auto row = m_cfi.find_row(m_pc);
+    if (row == nullptr || row->cfa_expr != nullptr) {
+      throw unsupported("this frame's canonical frame address");
+    }
+    emit_register(row->cfa_reg);
+    emit_offset(row->cfa_offset);
+  }
+
+  // Translates a DWARF expression, returning whether its result is the
+  // address of the object rather than its value
+  auto emit_dwarf(const dwarf_program &program) -> bool {
+    auto in_memory = true;
+    for (const auto &op : program.ops()) {
+      auto code = op.code;
+      auto arg1 = static_cast<std::int64_t>(op.arg1);
+      if (code >= DW_OP_lit0 && code <= DW_OP_lit31) {
+        emit(agent_op::constant, code - DW_OP_lit0);
+      } else if (code >= DW_OP_reg0 && code <= DW_OP_reg31) {
+        emit_register(code - DW_OP_reg0);
+        in_memory = false;
+      } else if (code >= DW_OP_breg0 && code <= DW_OP_breg31) {
+        emit_register(code - DW_OP_breg0);
+        emit_offset(arg1);
+      } else if (code >= DW_OP_const1u && code <= DW_OP_consts) {
+        emit(agent_op::constant, arg1);
+      } else {
+        switch (code) {
+        case DW_OP_addr:
+          emit(agent_op::constant,
+               static_cast<std::int64_t>(op.arg1 + m_load_address));
+          break;
+        case DW_OP_regx:
+          emit_register(static_cast<unsigned>(op.arg1));
+          in_memory = false;
+          break;
+        case DW_OP_bregx:
+          emit_register(static_cast<unsigned>(op.arg1));
+          emit_offset(static_cast<std::int64_t>(op.arg2));
+          break;
+        case DW_OP_fbreg:
+          emit_frame_base();
+          emit_offset(arg1);
+          break;
+        case DW_OP_call_frame_cfa:
+          emit_cfa();
+          break;
+        case DW_OP_deref:
+          emit(agent_op::load_checked, 0, 8);
+          break;
+        case DW_OP_deref_size:
+          emit(agent_op::load_checked, 0, static_cast<std::uint8_t>(arg1));
+          break;
+        case DW_OP_plus_uconst:
+          emit_offset(arg1);
+          break;
+        case DW_OP_plus:
+          emit(agent_op::add);
+          break;
+        case DW_OP_minus:
+          emit(agent_op::sub);
+          break;
+        case DW_OP_mul:
+          emit(agent_op::mul);
+          break;
+        case DW_OP_and:
+          emit(agent_op::bit_and);
+          break;
+        case DW_OP_or:
+          emit(agent_op::bit_or);
+          break;
+        case DW_OP_xor:
+          emit(agent_op::bit_xor);
+          break;
+        case DW_OP_neg:
+          emit(agent_op::negate);
+          break;
+        case DW_OP_not:
+          emit(agent_op::bit_not);
+          break;
+        case DW_OP_shl:
+          emit(agent_op::shl);
+          break;
+        case DW_OP_shr:
+        case DW_OP_shra:
+          emit(agent_op::shr, 0, 8, code == DW_OP_shra);
+          break;
+        case DW_OP_stack_value:
+          in_memory = false;
+          break;
+        case DW_OP_nop:
+          break;
+        default:
+          throw unsupported("the location of a variable");
+        }
+      }
+    }
+    return in_memory;
+  }
+
+  // Pushes the frame base of the function of the condition, which is the
+  // contents of a register when it is described by one
+  auto emit_frame_base() -> void {
+    const auto &function = m_condition.function();
+    if (!function.has(dwarf::DW_AT::frame_base)) {
+      throw unsupported("a function without a frame base");
+    }
+    auto program =
+        m_locations.get(function, dwarf::DW_AT::frame_base).find(m_pc);
+    if (program == nullptr) {
+      throw unsupported("the frame base of the function");
+    }
+    emit_dwarf(*program);
+  }
+
+  auto check_scalar(const type_desc &type) -> void {
+    if (is_float(type)) {
+      throw unsupported("floating point values");
+    }
+    if (type.kind == type_kind::structure ||
+        type.kind == type_kind::unknown ||
+        type.kind == type_kind::function) {
+      throw unsupported("values of type " + type.name);
+    }
+  }
+
+  // Replaces the address of an object on the stack by its value
+  auto load(slot &s) -> void {
+    if (s.kind == slot_kind::value) {
+      return;
+    }
+    const auto &type = *s.type;
+    if (type.kind != type_kind::array) {
+      check_scalar(type);
+      if (type.size == 0 || type.size > 8) {
+        throw unsupported("values of type " + type.name);
+      }
+      emit(s.kind == slot_kind::checked ? agent_op::load_checked
+                                        : agent_op::load,
+           0, static_cast<std::uint8_t>(type.size), is_signed(type));
+    }
+    s.kind = slot_kind::value;
+  }
+
+  // Converts the value on top of the stack to a type, as expression.cpp
+  // does for the operands of arithmetic
+  auto convert(slot &s, const type_desc &type) -> void {
+    check_scalar(type);
+    check_scalar(*s.type);
+    if (is_bool(type)) {
+      if (!is_bool(*s.type)) {
+        emit(agent_op::to_bool);
+      }
+    } else if (type.size < 8 &&
+               (type.size < s.type->size ||
+                (type.size == s.type->size &&
+                 is_signed(type) != is_signed(*s.type)))) {
+      emit(agent_op::extend, 0, static_cast<std::uint8_t>(type.size),
+           is_signed(type));
+    }
+    s.type = &type;
+  }
+
+  // Loads and converts a result as its consumer needs it
+  auto finish(std::size_t index, slot s) -> void {
+    const auto &insns = m_condition.insns();
+    auto consumer = m_consumers[index];
+    if (consumer.first == insns.size()) {
+      load(s);
+      check_scalar(*s.type);
+      m_stack.push_back(s);
+      return;
+    }
+
+    const auto &user = insns[consumer.first];
+    if (user.op != expr_opcode::member && user.op != expr_opcode::address &&
+        user.op != expr_opcode::bitfield) {
+      load(s);
+    }
+    switch (user.op) {
+    case expr_opcode::add:
+    case expr_opcode::sub:
+    case expr_opcode::mul:
+    case expr_opcode::div:
+    case expr_opcode::mod:
+    case expr_opcode::bit_and:
+    case expr_opcode::bit_or:
+    case expr_opcode::bit_xor:
+    case expr_opcode::eq:
+    case expr_opcode::ne:
+    case expr_opcode::lt:
+    case expr_opcode::le:
+    case expr_opcode::gt:
+    case expr_opcode::ge:
+    case expr_opcode::negate:
+    case expr_opcode::bit_not:
+    case expr_opcode::convert:
+      convert(s, *user.type);
+      break;
+    case expr_opcode::shl:
+    case expr_opcode::shr:
+      // Only the value shifted is converted
+      if (consumer.second == 0) {
+        convert(s, *user.type);
+      }
+      break;
+    case expr_opcode::ptr_add:
+    case expr_opcode::ptr_sub:
+      if (!is_pointer_like(*s.type)) {
+        emit(agent_op::constant, static_cast<std::int64_t>(user.arg1));
+        emit(agent_op::mul);
+      }
+      break;
+    default:
+      break;
+    }
+    m_stack.push_back(s);
+  }
+
+  auto pop() -> slot {
+    auto s = m_stack.back();
+    m_stack.pop_back();
+    return s;
+  }
+
+  auto compile_insn(std::size_t index) -> void {
+    const auto &insn = m_condition.insns()[index];
+    const auto &type = *insn.type;
+    slot result{&type, slot_kind::value};
+
+    switch (insn.op) {
+    case expr_opcode::constant: {
+      check_scalar(type);
+      auto bits = is_bool(type) ? (insn.arg1 != 0 ? 1 : 0)
+                                : extend(insn.arg1, type.size, is_signed(type));
+      emit(agent_op::constant, static_cast<std::int64_t>(bits));
+      break;
+    }
+
+    case expr_opcode::variable: {
+      auto program = insn.location->find(m_pc);
+      if (program == nullptr) {
+        throw unsupported("variables that are optimized out");
+      }
+      if (emit_dwarf(*program)) {
+        result.kind = slot_kind::direct;
+      } else {
+        // Registers and computed values hold more bits than the variable
+        check_scalar(type);
+        if (is_bool(type)) {
+          emit(agent_op::to_bool);
+        } else if (type.size < 8) {
+          emit(agent_op::extend, 0, static_cast<std::uint8_t>(type.size),
+               is_signed(type));
+        }
+      }
+      break;
+    }
+
+    case expr_opcode::reg:
+      emit_register(static_cast<unsigned>(insn.arg1));
+      break;
+
+    case expr_opcode::member: {
+      auto object = pop();
+      if (object.kind == slot_kind::value) {
+        throw unsupported("members of values in registers");
+      }
+      emit_offset(static_cast<std::int64_t>(insn.arg1));
+      result.kind = object.kind;
+      break;
+    }
+
+    case expr_opcode::bitfield:
+      throw unsupported("bitfields");
+
+    case expr_opcode::deref:
+      pop();
+      result.kind = slot_kind::checked;
+      break;
+
+    case expr_opcode::address:
+      if (pop().kind == slot_kind::value) {
+        throw std::invalid_argument{
+            "Attempt to take address of value not located in memory."};
+      }
+      break;
+
+    case expr_opcode::convert:
+      pop();
+      break;
+
+    case expr_opcode::negate:
+    case expr_opcode::bit_not:
+      pop();
+      emit(insn.op == expr_opcode::negate ? agent_op::negate
+                                          : agent_op::bit_not,
+           0, static_cast<std::uint8_t>(type.size), is_signed(type));
+      break;
+
+    case expr_opcode::logical_not:
+    case expr_opcode::to_bool:
+      pop();
+      emit(insn.op == expr_opcode::logical_not ? agent_op::logical_not
+                                               : agent_op::to_bool);
+      break;
+
+    case expr_opcode::add:
+    case expr_opcode::sub:
+    case expr_opcode::mul:
+    case expr_opcode::div:
+    case expr_opcode::mod:
+    case expr_opcode::shl:
+    case expr_opcode::shr:
+    case expr_opcode::bit_and:
+    case expr_opcode::bit_or:
+    case expr_opcode::bit_xor:
+    case expr_opcode::eq:
+    case expr_opcode::ne:
+    case expr_opcode::lt:
+    case expr_opcode::le:
+    case expr_opcode::gt:
+    case expr_opcode::ge: {
+      pop();
+      pop();
+      auto op = binary_op(insn.op);
+      auto is_compare =
+          insn.op >= expr_opcode::eq && insn.op <= expr_opcode::ge;
+      emit(op, 0, is_compare ? 8 : static_cast<std::uint8_t>(type.size),
+           is_signed(type));
+      if (!is_compare && is_bool(type)) {
+        emit(agent_op::to_bool);
+      }
+      break;
+    }
+
+    case expr_opcode::ptr_add:
+    case expr_opcode::ptr_sub:
+      pop();
+      pop();
+      emit(insn.op == expr_opcode::ptr_add ? agent_op::add : agent_op::sub);
+      break;
+
+    case expr_opcode::ptr_diff:
+      pop();
+      pop();
+      emit(agent_op::sub);
+      emit(agent_op::constant, static_cast<std::int64_t>(insn.arg1));
+      emit(agent_op::div, 0, 8, true);
+      break;
+
+    case expr_opcode::and_jump:
+    case expr_opcode::or_jump:
+      pop();
+      emit(insn.op == expr_opcode::and_jump ? agent_op::and_jump
+                                            : agent_op::or_jump,
+           static_cast<std::int64_t>(insn.arg1));
+      return;
+    }
+
+    finish(index, result);
+  }
+
+  static auto binary_op(expr_opcode op) noexcept -> agent_op {
+    switch (op) {
+    case expr_opcode::add:
+      return agent_op::add;
+    case expr_opcode::sub:
+      return agent_op::sub;
+    case expr_opcode::mul:
+      return agent_op::mul;
+    case expr_opcode::div:
+      return agent_op::div;
+    case expr_opcode::mod:
+      return agent_op::mod;
+    case expr_opcode::shl:
+      return agent_op::shl;
+    case expr_opcode::shr:
+      return agent_op::shr;
+    case expr_opcode::bit_and:
+      return agent_op::bit_and;
+    case expr_opcode::bit_or:
+      return agent_op::bit_or;
+    case expr_opcode::bit_xor:
+      return agent_op::bit_xor;
+    case expr_opcode::eq:
+      return agent_op::eq;
+    case expr_opcode::ne:
+      return agent_op::ne;
+    case expr_opcode::lt:
+      return agent_op::lt;
+    case expr_opcode::le:
+      return agent_op::le;
+    case expr_opcode::gt:
+      return agent_op::gt;
+    default:
+      return agent_op::ge;
+    }
+  }
+
+  const expression &m_condition;
+  std::uint64_t m_pc;
+  std::uint64_t m_load_address;
+  location_cache &m_locations;
+  cfi_table &m_cfi;
+  std::vector<agent_insn> m_code;
+  std::vector<slot> m_stack;
+  std::size_t m_depth = 0;
+  std::vector<std::pair<std::size_t, std::size_t>> m_consumers;
+};
+
+} // namespace
+
+auto compile_agent_condition(const expression &condition, std::uint64_t pc,
+                             std::uint64_t load_address,
+                             location_cache &locations, cfi_table &cfi)
+    -> std::vector<agent_insn> {
+  return agent_compiler{condition, pc, load_address, locations, cfi}
+      .compile();
+}
+
+auto compile_agent_collect(const expression &object, std::uint64_t pc,
+                           std::uint64_t load_address,
+                           location_cache &locations, cfi_table &cfi)
+    -> agent_collect {
+  return agent_compiler{object, pc, load_address, locations, cfi}.collect();
+}
@@ -0,0 +1,149 @@
+#include "../include/arena.h"
+#include "../include/inject.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+constexpr std::size_t page_size = 4096;
+
+// Bytes below the stack pointer the ABI lets leaf functions use
+constexpr std::uint64_t red_zone = 128;
+
+// Name of the memfd, shown in /proc/<pid>/maps as /memfd:cdb-arena
+constexpr char memfd_name[16] = "cdb-arena";
+
+} // namespace
+
+shared_arena::~shared_arena() {
+  if (m_local != nullptr) {
+    munmap(m_local, m_size);
+  }
+}
+
+auto shared_arena::create_memfd() -> int {
+  user_regs_struct regs;
+  if (ptrace(PTRACE_GETREGS, m_pid, nullptr, &regs) == -1) {
+    throw std::out_of_range{"Cannot read registers"};
+  }
+
+  constexpr auto words = sizeof(memfd_name) / sizeof(std::uint64_t);
+  auto name = (regs.rsp - red_zone - sizeof(memfd_name)) & ~std::uint64_t{15};
+  std::uint64_t saved[words];
+  for (std::size_t i = 0; i < words; ++i) {
+    errno = 0;
+    saved[i] = ptrace(PTRACE_PEEKDATA, m_pid, name + i * 8, nullptr);
+    if (errno != 0) {
+      throw std::out_of_range{"Cannot access the stack"};
+    }
+  }
+  for (std::size_t i = 0; i < words; ++i) {
+    std::uint64_t word;
+    std::memcpy(&word, memfd_name + i * 8, sizeof(word));
+    ptrace(PTRACE_POKEDATA, m_pid, name + i * 8, word);
+  }
+
+  std::int64_t fd;
+  try {
+    fd = m_injector.call(SYS_memfd_create, {name, MFD_CLOEXEC});
+  } catch (std::out_of_range &) {
+    fd = -EINTR;
+  }
+  for (std::size_t i = 0; i < words; ++i) {
+    ptrace(PTRACE_POKEDATA, m_pid, name + i * 8, saved[i]);
+  }
+
+  if (fd < 0) {
+    throw std::out_of_range{"Cannot create the shared memory file"};
+  }
+  return static_cast<int>(fd);
+}
+
+auto shared_arena::map(std::size_t size, std::uint64_t hint) -> void {
+  if (m_local != nullptr) {
+    return;
+  }
+
+  size = (size + page_size - 1) & ~(page_size - 1);
+  auto fd = create_memfd();
+  auto remote_fd = static_cast<std::uint64_t>(fd);
+  auto close_remote = [this, remote_fd] {
+    m_injector.call(SYS_close, {remote_fd});
+  };
+
+  auto address = m_injector.call(SYS_ftruncate, {remote_fd, size});
+  if (address == 0) {
+    address = m_injector.call(SYS_mmap, {hint, size,
+                                         PROT_READ | PROT_WRITE | PROT_EXEC,
+                                         MAP_SHARED, remote_fd, 0});
+  }
+  if (address < 0) {
+    close_remote();
+    throw std::out_of_range{"Cannot map the shared memory in the process"};
+  }
+
+  // The process keeps the file open until the debugger has opened it too,
+  // after which neither needs a descriptor for the mappings to stay
+  auto path = "/proc/" + std::to_string(m_pid) + "/fd/" + std::to_string(fd);
+  auto local_fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+  close_remote();
+  void *local = MAP_FAILED;
+  if (local_fd != -1) {
+    local =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, local_fd, 0);
+    close(local_fd);
+  }
+  if (local == MAP_FAILED) {
+    m_injector.call(SYS_munmap, {static_cast<std::uint64_t>(address), size});
+    throw std::out_of_range{"Cannot map the shared memory in the debugger"};
+  }
+
+  m_address = static_cast<std::uint64_t>(address);
+  m_local = static_cast<std::uint8_t *>(local);
+  m_size = size;
+  m_used = 0;
+}
+
+auto shared_arena::contains(std::uint64_t address,
+                            std::size_t size) const noexcept -> bool {
+  if (m_local == nullptr || address < m_address) {
+    return false;
+  }
+  auto offset = address - m_address;
+  return offset <= m_size && size <= m_size - offset;
+}
+
+auto shared_arena::allocate(std::size_t size, std::size_t alignment)
+    -> std::uint64_t {
+  if (m_local == nullptr) {
+    throw std::out_of_range{"Shared memory is not mapped"};
+  }
+
+  auto offset = (m_used + alignment - 1) & ~(alignment - 1);
+  if (offset > m_size || size > m_size - offset) {
+    throw std::out_of_range{"Shared memory is full"};
+  }
+  m_used = offset + size;
+  return m_address + offset;
+}
+
+auto shared_arena::read(std::uint64_t address, void *buffer,
+                        std::size_t size) const noexcept -> bool {
+  if (!contains(address, size)) {
+    return false;
+  }
+  std::memcpy(buffer, local(address), size);
+  return true;
+}
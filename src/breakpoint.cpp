@@ -6,7 +6,7 @@
 #include <cstdint>
 
 auto breakpoint::enable() noexcept -> void {
-  pid_t data = ptrace(PTRACE_PEEKDATA, m_pid, m_addr, nullptr);
+  auto data = ptrace(PTRACE_PEEKDATA, m_pid, m_addr, nullptr);
   m_saved_data = static_cast<uint8_t>(data & 0xff);
   uint64_t int3 = 0xcc;
   uint64_t data_with_int3 = ((data & ~0xff) | int3);
@@ -17,9 +17,9 @@ auto breakpoint::enable() noexcept -> void {
 }
 
 auto breakpoint::disable() noexcept -> void {
-  pid_t data = ptrace(PTRACE_PEEKDATA, m_pid, m_addr, nullptr);
+  auto data = ptrace(PTRACE_PEEKDATA, m_pid, m_addr, nullptr);
   auto restored_data = ((data & ~0xff) | m_saved_data);
-  ptrace(PTRACE_POKEDATA, m_pid, restored_data);
+  ptrace(PTRACE_POKEDATA, m_pid, m_addr, restored_data);
 
   m_enabled = false;
 }
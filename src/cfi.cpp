@@ -0,0 +1,704 @@
+#include "../include/cfi.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// Pointer encodings used by .eh_frame and .eh_frame_hdr
+constexpr std::uint8_t DW_EH_PE_omit = 0xff;
+constexpr std::uint8_t DW_EH_PE_absptr = 0x00;
+constexpr std::uint8_t DW_EH_PE_uleb128 = 0x01;
+constexpr std::uint8_t DW_EH_PE_udata2 = 0x02;
+constexpr std::uint8_t DW_EH_PE_udata4 = 0x03;
+constexpr std::uint8_t DW_EH_PE_udata8 = 0x04;
+constexpr std::uint8_t DW_EH_PE_sleb128 = 0x09;
+constexpr std::uint8_t DW_EH_PE_sdata2 = 0x0a;
+constexpr std::uint8_t DW_EH_PE_sdata4 = 0x0b;
+constexpr std::uint8_t DW_EH_PE_sdata8 = 0x0c;
+constexpr std::uint8_t DW_EH_PE_pcrel = 0x10;
+constexpr std::uint8_t DW_EH_PE_datarel = 0x30;
+
+/**
+ * A bounds-checked cursor over the bytes of a CFI section.
+ */
+struct byte_reader {
+  const std::uint8_t *pos;
+  const std::uint8_t *end;
+  const section_view *section;
+
+  auto need(std::size_t n) const -> void {
+    if (static_cast<std::size_t>(end - pos) < n) {
+      throw std::out_of_range{"Truncated call frame information"};
+    }
+  }
+
+  template <typename T> auto fixed() -> T {
+    need(sizeof(T));
+    T value;
+    std::memcpy(&value, pos, sizeof(T));
+    pos += sizeof(T);
+    return value;
+  }
+
+  auto uleb128() -> std::uint64_t {
+    std::uint64_t result = 0;
+    unsigned shift = 0;
+    std::uint8_t byte;
+    do {
+      byte = fixed<std::uint8_t>();
+      if (shift < 64) {
+        result |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+      }
+      shift += 7;
+    } while (byte & 0x80);
+    return result;
+  }
+
+  auto sleb128() -> std::int64_t {
+    std::int64_t result = 0;
+    unsigned shift = 0;
+    std::uint8_t byte;
+    do {
+      byte = fixed<std::uint8_t>();
+      if (shift < 64) {
+        result |= static_cast<std::int64_t>(byte & 0x7f) << shift;
+      }
+      shift += 7;
+    } while (byte & 0x80);
+    if (shift < 64 && (byte & 0x40)) {
+      result |= -(static_cast<std::int64_t>(1) << shift);
+    }
+    return result;
+  }
+
+  // The link-time address of the current position
+  auto address() const -> std::uint64_t {
+    return section->addr + (pos - section->data);
+  }
+
+  auto encoded(std::uint8_t encoding, std::uint64_t data_base = 0)
+      -> std::uint64_t {
+    if (encoding == DW_EH_PE_omit) {
+      return 0;
+    }
+
+    auto here = address();
+    std::uint64_t value;
+    switch (encoding & 0x0f) {
+    case DW_EH_PE_absptr:
+      value = fixed<std::uint64_t>();
+      break;
+    case DW_EH_PE_uleb128:
+      value = uleb128();
+      break;
+    case DW_EH_PE_udata2:
+      value = fixed<std::uint16_t>();
+      break;
+    case DW_EH_PE_udata4:
+      value = fixed<std::uint32_t>();
+      break;
+    case DW_EH_PE_udata8:
+      value = fixed<std::uint64_t>();
+      break;
+    case DW_EH_PE_sleb128:
+      value = sleb128();
+      break;
+    case DW_EH_PE_sdata2:
+      value = static_cast<std::int64_t>(fixed<std::int16_t>());
+      break;
+    case DW_EH_PE_sdata4:
+      value = static_cast<std::int64_t>(fixed<std::int32_t>());
+      break;
+    case DW_EH_PE_sdata8:
+      value = fixed<std::int64_t>();
+      break;
+    default:
+      throw std::out_of_range{"Unsupported pointer encoding"};
+    }
+
+    switch (encoding & 0x70) {
+    case DW_EH_PE_pcrel:
+      value += here;
+      break;
+    case DW_EH_PE_datarel:
+      value += data_base;
+      break;
+    default:
+      break;
+    }
+
+    return value;
+  }
+
+  auto block() -> std::pair<const std::uint8_t *, std::size_t> {
+    auto size = uleb128();
+    need(size);
+    auto start = pos;
+    pos += size;
+    return {start, size};
+  }
+};
+
+// Size of the fixed-width part of a pointer encoding, 0 if variable
+auto encoded_size(std::uint8_t encoding) noexcept -> std::size_t {
+  switch (encoding & 0x0f) {
+  case DW_EH_PE_udata2:
+  case DW_EH_PE_sdata2:
+    return 2;
+  case DW_EH_PE_udata4:
+  case DW_EH_PE_sdata4:
+    return 4;
+  case DW_EH_PE_absptr:
+  case DW_EH_PE_udata8:
+  case DW_EH_PE_sdata8:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * Reads the length field of a CIE or FDE and returns the end of the entry.
+ * Returns nullptr for the zero terminator.
+ */
+auto read_entry_length(byte_reader &r, bool &is_64) -> const std::uint8_t * {
+  std::uint64_t length = r.fixed<std::uint32_t>();
+  is_64 = length == 0xffffffff;
+  if (is_64) {
+    length = r.fixed<std::uint64_t>();
+  }
+  if (length == 0) {
+    return nullptr;
+  }
+  r.need(length);
+  return r.pos + length;
+}
+
+// x86-64 registers preserved across calls by the System V ABI
+constexpr unsigned callee_saved_registers[] = {3, 6, 12, 13, 14, 15};
+
+} // namespace
+
+auto cfi_table::find_row(std::uint64_t pc) -> const cfi_row * {
+  auto it = m_rows.upper_bound(pc);
+  if (it != m_rows.begin()) {
+    --it;
+    if (pc >= it->second.low_pc && pc < it->second.high_pc) {
+      return &it->second;
+    }
+  }
+
+  try {
+    fde f;
+    if (!find_fde(pc, f)) {
+      return nullptr;
+    }
+
+    cfi_row row;
+    execute(f, pc, row);
+    auto &cached = m_rows[row.low_pc];
+    cached = row;
+    return &cached;
+  } catch (std::out_of_range &) {
+    return nullptr;
+  }
+}
+
+auto cfi_table::find_function_start(std::uint64_t pc, std::uint64_t &start)
+    -> bool {
+  try {
+    fde f;
+    if (!find_fde(pc, f)) {
+      return false;
+    }
+    start = f.pc_begin;
+    return true;
+  } catch (std::out_of_range &) {
+    return false;
+  }
+}
+
+auto cfi_table::find_fde(std::uint64_t pc, fde &out) -> bool {
+  if (m_eh_frame_hdr.valid() && m_eh_frame.valid() &&
+      search_eh_frame_hdr(pc, out)) {
+    return true;
+  }
+
+  if (!m_fde_index_built) {
+    build_fde_index();
+  }
+
+  return search_fde_index(pc, out);
+}
+
+auto cfi_table::search_eh_frame_hdr(std::uint64_t pc, fde &out) -> bool {
+  byte_reader r{m_eh_frame_hdr.data, m_eh_frame_hdr.data + m_eh_frame_hdr.size,
+                &m_eh_frame_hdr};
+
+  auto version = r.fixed<std::uint8_t>();
+  auto eh_frame_ptr_enc = r.fixed<std::uint8_t>();
+  auto fde_count_enc = r.fixed<std::uint8_t>();
+  auto table_enc = r.fixed<std::uint8_t>();
+  if (version != 1 || fde_count_enc == DW_EH_PE_omit ||
+      table_enc == DW_EH_PE_omit) {
+    return false;
+  }
+
+  r.encoded(eh_frame_ptr_enc, m_eh_frame_hdr.addr);
+  auto count = r.encoded(fde_count_enc, m_eh_frame_hdr.addr);
+
+  // The table can only be bisected when its entries have a fixed size
+  auto field_size = encoded_size(table_enc);
+  if (field_size == 0) {
+    return false;
+  }
+  auto entry_size = 2 * field_size;
+  r.need(count * entry_size);
+  auto table = r.pos;
+
+  auto entry_at = [&](std::size_t i, std::uint64_t &initial_loc,
+                      std::uint64_t &fde_addr) {
+    byte_reader e{table + i * entry_size, table + (i + 1) * entry_size,
+                  &m_eh_frame_hdr};
+    initial_loc = e.encoded(table_enc, m_eh_frame_hdr.addr);
+    fde_addr = e.encoded(table_enc, m_eh_frame_hdr.addr);
+  };
+
+  // Find the last entry whose initial location is <= pc
+  std::size_t low = 0, high = count;
+  while (low < high) {
+    auto mid = low + (high - low) / 2;
+    std::uint64_t initial_loc, fde_addr;
+    entry_at(mid, initial_loc, fde_addr);
+    if (initial_loc <= pc) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == 0) {
+    return false;
+  }
+
+  std::uint64_t initial_loc, fde_addr;
+  entry_at(low - 1, initial_loc, fde_addr);
+  if (fde_addr < m_eh_frame.addr ||
+      fde_addr >= m_eh_frame.addr + m_eh_frame.size) {
+    return false;
+  }
+
+  return decode_fde(m_eh_frame, fde_addr - m_eh_frame.addr, out) &&
+         pc >= out.pc_begin && pc < out.pc_end;
+}
+
+auto cfi_table::search_fde_index(std::uint64_t pc, fde &out) -> bool {
+  auto it = std::upper_bound(
+      m_fde_index.begin(), m_fde_index.end(), pc,
+      [](std::uint64_t value, const fde_entry &e) {
+        return value < e.pc_begin;
+      });
+  if (it == m_fde_index.begin()) {
+    return false;
+  }
+  --it;
+  if (pc >= it->pc_end) {
+    return false;
+  }
+
+  auto &section = it->debug_frame ? m_debug_frame : m_eh_frame;
+  return decode_fde(section, it->offset, out);
+}
+
+auto cfi_table::build_fde_index() -> void {
+  m_fde_index_built = true;
+
+  auto scan = [this](const section_view &section, bool debug_frame) {
+    std::size_t offset = 0;
+    while (offset < section.size) {
+      byte_reader r{section.data + offset, section.data + section.size,
+                    &section};
+      bool is_64;
+      const std::uint8_t *entry_end;
+      try {
+        entry_end = read_entry_length(r, is_64);
+      } catch (std::out_of_range &) {
+        return;
+      }
+      if (entry_end == nullptr) {
+        // .eh_frame is terminated by a zero length entry
+        if (!debug_frame) {
+          return;
+        }
+        offset = r.pos - section.data;
+        continue;
+      }
+
+      fde f;
+      try {
+        if (decode_fde(section, offset, f)) {
+          m_fde_index.push_back({f.pc_begin, f.pc_end, debug_frame, offset});
+        }
+      } catch (std::out_of_range &) {
+      }
+      offset = entry_end - section.data;
+    }
+  };
+
+  // With a binary search table, .eh_frame never needs to be scanned
+  if (!m_eh_frame_hdr.valid() && m_eh_frame.valid()) {
+    scan(m_eh_frame, false);
+  }
+  if (m_debug_frame.valid()) {
+    scan(m_debug_frame, true);
+  }
+
+  std::sort(m_fde_index.begin(), m_fde_index.end(),
+            [](const fde_entry &a, const fde_entry &b) {
+              return a.pc_begin < b.pc_begin;
+            });
+}
+
+auto cfi_table::decode_fde(const section_view &section, std::size_t offset,
+                           fde &out) -> bool {
+  auto is_eh = &section == &m_eh_frame;
+  byte_reader r{section.data + offset, section.data + section.size, &section};
+
+  bool is_64;
+  auto entry_end = read_entry_length(r, is_64);
+  if (entry_end == nullptr) {
+    return false;
+  }
+  r.end = entry_end;
+
+  auto id_pos = r.pos;
+  std::uint64_t id =
+      is_64 ? r.fixed<std::uint64_t>() : r.fixed<std::uint32_t>();
+  const std::uint8_t *cie_pos;
+  if (is_eh) {
+    if (id == 0) {
+      return false;
+    }
+    cie_pos = id_pos - id;
+  } else {
+    if (id == (is_64 ? 0xffffffffffffffffull : 0xffffffffull)) {
+      return false;
+    }
+    cie_pos = section.data + id;
+  }
+  if (cie_pos < section.data || cie_pos >= section.data + section.size) {
+    return false;
+  }
+
+  auto c = decode_cie(section, cie_pos - section.data);
+  if (c == nullptr) {
+    return false;
+  }
+
+  auto encoding = is_eh ? c->fde_encoding : DW_EH_PE_absptr;
+  out.pc_begin = r.encoded(encoding);
+  out.pc_end = out.pc_begin + r.encoded(encoding & 0x0f);
+  out.owner = c;
+
+  if (c->has_augmentation_data) {
+    auto size = r.uleb128();
+    r.need(size);
+    r.pos += size;
+  }
+
+  out.instructions = r.pos;
+  out.instructions_end = entry_end;
+  return true;
+}
+
+auto cfi_table::decode_cie(const section_view &section, std::size_t offset)
+    -> const cie * {
+  auto key = section.data + offset;
+  auto cached = m_cies.find(key);
+  if (cached != m_cies.end()) {
+    return &cached->second;
+  }
+
+  auto is_eh = &section == &m_eh_frame;
+  byte_reader r{key, section.data + section.size, &section};
+
+  bool is_64;
+  auto entry_end = read_entry_length(r, is_64);
+  if (entry_end == nullptr) {
+    return nullptr;
+  }
+  r.end = entry_end;
+
+  std::uint64_t id =
+      is_64 ? r.fixed<std::uint64_t>() : r.fixed<std::uint32_t>();
+  if (is_eh ? id != 0 : id != (is_64 ? 0xffffffffffffffffull : 0xffffffffull)) {
+    return nullptr;
+  }
+
+  cie c;
+  auto version = r.fixed<std::uint8_t>();
+  auto augmentation = reinterpret_cast<const char *>(r.pos);
+  auto augmentation_size = strnlen(augmentation, r.end - r.pos);
+  r.need(augmentation_size + 1);
+  r.pos += augmentation_size + 1;
+
+  // Old GCC "eh" augmentation carries a pointer to exception data
+  if (augmentation_size >= 2 && augmentation[0] == 'e' &&
+      augmentation[1] == 'h') {
+    r.fixed<std::uint64_t>();
+  }
+  if (version >= 4) {
+    c.address_size = r.fixed<std::uint8_t>();
+    r.fixed<std::uint8_t>(); // segment selector size
+  }
+
+  c.code_alignment = r.uleb128();
+  c.data_alignment = r.sleb128();
+  c.return_address_register =
+      version == 1 ? r.fixed<std::uint8_t>() : r.uleb128();
+
+  if (augmentation_size > 0 && augmentation[0] == 'z') {
+    c.has_augmentation_data = true;
+    auto size = r.uleb128();
+    r.need(size);
+    auto data_end = r.pos + size;
+
+    for (std::size_t i = 1; i < augmentation_size; ++i) {
+      switch (augmentation[i]) {
+      case 'L':
+        r.fixed<std::uint8_t>();
+        break;
+      case 'P':
+        r.encoded(r.fixed<std::uint8_t>() & 0x7f);
+        break;
+      case 'R':
+        c.fde_encoding = r.fixed<std::uint8_t>();
+        break;
+      case 'S':
+        c.signal_frame = true;
+        break;
+      default:
+        break;
+      }
+    }
+    r.pos = data_end;
+  }
+
+  c.instructions = r.pos;
+  c.instructions_end = entry_end;
+
+  return &m_cies.emplace(key, c).first->second;
+}
+
+auto cfi_table::execute(const fde &f, std::uint64_t pc, cfi_row &row) const
+    -> void {
+  const auto &c = *f.owner;
+
+  row = cfi_row{};
+  row.low_pc = f.pc_begin;
+  row.high_pc = f.pc_end;
+  row.return_address_register = c.return_address_register;
+  row.signal_frame = c.signal_frame;
+  for (auto regnum : callee_saved_registers) {
+    row.regs[regnum].rule = register_rule::kind::same_value;
+  }
+
+  auto initial = row;
+  std::vector<cfi_row> state_stack;
+  auto loc = f.pc_begin;
+
+  auto set_rule = [&row](std::uint64_t regnum, register_rule rule) {
+    if (regnum < n_dwarf_registers) {
+      row.regs[regnum] = rule;
+    }
+  };
+
+  auto run = [&](const std::uint8_t *begin, const std::uint8_t *end,
+                 bool is_cie) -> bool {
+    byte_reader r{begin, end, nullptr};
+
+    // Returns false once the row for pc is complete
+    auto advance = [&](std::uint64_t new_loc) -> bool {
+      if (new_loc > pc) {
+        row.high_pc = new_loc;
+        return false;
+      }
+      loc = new_loc;
+      row.low_pc = loc;
+      return true;
+    };
+
+    while (r.pos < r.end) {
+      auto op = r.fixed<std::uint8_t>();
+      auto high = op & 0xc0;
+      unsigned low = op & 0x3f;
+      register_rule rule;
+
+      if (high == 0x40) { // DW_CFA_advance_loc
+        if (!advance(loc + low * c.code_alignment)) {
+          return false;
+        }
+        continue;
+      }
+      if (high == 0x80) { // DW_CFA_offset
+        rule.rule = register_rule::kind::offset;
+        rule.offset = static_cast<std::int64_t>(r.uleb128()) * c.data_alignment;
+        set_rule(low, rule);
+        continue;
+      }
+      if (high == 0xc0) { // DW_CFA_restore
+        if (low < n_dwarf_registers) {
+          row.regs[low] = initial.regs[low];
+        }
+        continue;
+      }
+
+      switch (op) {
+      case 0x00: // DW_CFA_nop
+        break;
+      case 0x01: { // DW_CFA_set_loc
+        if (!advance(r.fixed<std::uint64_t>())) {
+          return false;
+        }
+        break;
+      }
+      case 0x02: // DW_CFA_advance_loc1
+        if (!advance(loc + r.fixed<std::uint8_t>() * c.code_alignment)) {
+          return false;
+        }
+        break;
+      case 0x03: // DW_CFA_advance_loc2
+        if (!advance(loc + r.fixed<std::uint16_t>() * c.code_alignment)) {
+          return false;
+        }
+        break;
+      case 0x04: // DW_CFA_advance_loc4
+        if (!advance(loc + r.fixed<std::uint32_t>() * c.code_alignment)) {
+          return false;
+        }
+        break;
+      case 0x05: { // DW_CFA_offset_extended
+        auto regnum = r.uleb128();
+        rule.rule = register_rule::kind::offset;
+        rule.offset = static_cast<std::int64_t>(r.uleb128()) * c.data_alignment;
+        set_rule(regnum, rule);
+        break;
+      }
+      case 0x06: { // DW_CFA_restore_extended
+        auto regnum = r.uleb128();
+        if (regnum < n_dwarf_registers) {
+          row.regs[regnum] = initial.regs[regnum];
+        }
+        break;
+      }
+      case 0x07: // DW_CFA_undefined
+        set_rule(r.uleb128(), rule);
+        break;
+      case 0x08: // DW_CFA_same_value
+        rule.rule = register_rule::kind::same_value;
+        set_rule(r.uleb128(), rule);
+        break;
+      case 0x09: { // DW_CFA_register
+        auto regnum = r.uleb128();
+        rule.rule = register_rule::kind::reg;
+        rule.reg = r.uleb128();
+        set_rule(regnum, rule);
+        break;
+      }
+      case 0x0a: // DW_CFA_remember_state
+        state_stack.push_back(row);
+        break;
+      case 0x0b: { // DW_CFA_restore_state
+        if (state_stack.empty()) {
+          throw std::out_of_range{"Unbalanced DW_CFA_restore_state"};
+        }
+        auto low_pc = row.low_pc;
+        auto high_pc = row.high_pc;
+        row = state_stack.back();
+        row.low_pc = low_pc;
+        row.high_pc = high_pc;
+        state_stack.pop_back();
+        break;
+      }
+      case 0x0c: // DW_CFA_def_cfa
+        row.cfa_reg = r.uleb128();
+        row.cfa_offset = r.uleb128();
+        row.cfa_expr = nullptr;
+        break;
+      case 0x0d: // DW_CFA_def_cfa_register
+        row.cfa_reg = r.uleb128();
+        row.cfa_expr = nullptr;
+        break;
+      case 0x0e: // DW_CFA_def_cfa_offset
+        row.cfa_offset = r.uleb128();
+        break;
+      case 0x0f: { // DW_CFA_def_cfa_expression
+        auto expr = r.block();
+        row.cfa_expr = expr.first;
+        row.cfa_expr_size = expr.second;
+        break;
+      }
+      case 0x10:   // DW_CFA_expression
+      case 0x16: { // DW_CFA_val_expression
+        auto regnum = r.uleb128();
+        auto expr = r.block();
+        rule.rule = op == 0x10 ? register_rule::kind::expression
+                               : register_rule::kind::val_expression;
+        rule.expr = expr.first;
+        rule.expr_size = expr.second;
+        set_rule(regnum, rule);
+        break;
+      }
+      case 0x11: { // DW_CFA_offset_extended_sf
+        auto regnum = r.uleb128();
+        rule.rule = register_rule::kind::offset;
+        rule.offset = r.sleb128() * c.data_alignment;
+        set_rule(regnum, rule);
+        break;
+      }
+      case 0x12: // DW_CFA_def_cfa_sf
+        row.cfa_reg = r.uleb128();
+        row.cfa_offset = r.sleb128() * c.data_alignment;
+        row.cfa_expr = nullptr;
+        break;
+      case 0x13: // DW_CFA_def_cfa_offset_sf
+        row.cfa_offset = r.sleb128() * c.data_alignment;
+        break;
+      case 0x14:   // DW_CFA_val_offset
+      case 0x15: { // DW_CFA_val_offset_sf
+        auto regnum = r.uleb128();
+        rule.rule = register_rule::kind::val_offset;
+        rule.offset = (op == 0x14 ? static_cast<std::int64_t>(r.uleb128())
+                                  : r.sleb128()) *
+                      c.data_alignment;
+        set_rule(regnum, rule);
+        break;
+      }
+      case 0x2e: // DW_CFA_GNU_args_size
+        r.uleb128();
+        break;
+      case 0x2f: { // DW_CFA_GNU_negative_offset_extended
+        auto regnum = r.uleb128();
+        rule.rule = register_rule::kind::offset;
+        rule.offset =
+            -static_cast<std::int64_t>(r.uleb128()) * c.data_alignment;
+        set_rule(regnum, rule);
+        break;
+      }
+      default:
+        throw std::out_of_range{"Unknown call frame instruction"};
+      }
+    }
+
+    if (is_cie) {
+      initial = row;
+    }
+    return true;
+  };
+
+  run(c.instructions, c.instructions_end, true);
+  run(f.instructions, f.instructions_end, false);
+}
@@ -0,0 +1,103 @@
+#include "../include/checkpoint.h"
+#include "../include/inject.h"
+
+#include <sched.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+// Copies a stopped process, leaving the copy stopped with the same registers
+auto fork_process(pid_t pid, std::uint64_t scratch) -> pid_t {
+  user_regs_struct regs;
+  if (ptrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+    throw std::out_of_range{"Cannot read registers"};
+  }
+
+  // Without an exit signal, the program never sees its copies come and go
+  syscall_injector injector{pid};
+  injector.set_scratch_address(scratch);
+  auto result = injector.call(SYS_clone, {CLONE_PTRACE, 0, 0, 0, 0});
+  if (result < 0) {
+    throw std::out_of_range{std::string{"Cannot copy the process: "} +
+                            std::strerror(static_cast<int>(-result))};
+  }
+
+  // The copy starts stopped by a SIGSTOP, returning from the clone call. It
+  // was made while the syscall instruction was in place, so it gets the
+  // text the process has again
+  auto copy = static_cast<pid_t>(result);
+  int status;
+  errno = 0;
+  auto word = ptrace(PTRACE_PEEKTEXT, pid, scratch, nullptr);
+  auto restored = errno == 0;
+  if (waitpid(copy, &status, __WALL) == -1 || !WIFSTOPPED(status) ||
+      !restored || ptrace(PTRACE_POKETEXT, copy, scratch, word) == -1 ||
+      ptrace(PTRACE_SETOPTIONS, copy, nullptr,
+             PTRACE_O_EXITKILL | PTRACE_O_TRACESYSGOOD |
+                 PTRACE_O_TRACESECCOMP | PTRACE_O_TRACEFORK |
+                 PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE) == -1 ||
+      ptrace(PTRACE_SETREGS, copy, nullptr, &regs) == -1) {
+    kill_process(copy);
+    throw std::out_of_range{"Cannot take control of the copy"};
+  }
+  return copy;
+}
+
+} // namespace
+
+auto kill_process(pid_t pid) noexcept -> void {
+  int status;
+  kill(pid, SIGKILL);
+  waitpid(pid, &status, __WALL);
+}
+
+checkpoint_table::~checkpoint_table() {
+  for (const auto &c : m_checkpoints) {
+    kill_process(c.pid);
+  }
+}
+
+auto checkpoint_table::add(pid_t pid, std::uint64_t scratch, std::uint64_t pc)
+    -> const checkpoint & {
+  checkpoint c;
+  c.number = m_next_number;
+  c.pid = fork_process(pid, scratch);
+  c.pc = pc;
+  ++m_next_number;
+  m_checkpoints.push_back(c);
+  return m_checkpoints.back();
+}
+
+auto checkpoint_table::spawn(unsigned number, std::uint64_t scratch)
+    -> pid_t {
+  auto it = std::find_if(
+      m_checkpoints.begin(), m_checkpoints.end(),
+      [number](const checkpoint &c) { return c.number == number; });
+  if (it == m_checkpoints.end()) {
+    throw std::out_of_range{"No checkpoint " + std::to_string(number)};
+  }
+  return fork_process(it->pid, scratch);
+}
+
+auto checkpoint_table::remove(unsigned number) -> bool {
+  auto it = std::find_if(
+      m_checkpoints.begin(), m_checkpoints.end(),
+      [number](const checkpoint &c) { return c.number == number; });
+  if (it == m_checkpoints.end()) {
+    return false;
+  }
+  kill_process(it->pid);
+  m_checkpoints.erase(it);
+  return true;
+}
@@ -1,21 +1,48 @@
 #include "../include/debugger.h"
+#include "../include/agent_compiler.h"
+#include "../include/memory.h"
 #include "../include/registers.h"
 
 #include <fstream>
 #include <iomanip>
 #include <sys/ptrace.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <csignal>
 #include <cstdint>
+#include <cstring>
 #include <ios>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 #include "dwarf/dwarf++.hh"
 #include "linenoise.h"
 
+// Elements of a container printed before the rest are elided
+constexpr std::size_t max_printed_elements = 200;
+
+// Size of the pages write-protected by watchpoints
+constexpr std::uint64_t page_size = 4096;
+
+// Size of the memory shared with the process
+constexpr std::size_t arena_size = 4 << 20;
+
+// Records of fast tracepoints kept by the debugger
+constexpr std::size_t max_agent_records = 1 << 16;
+
+// Largest range of memory a collect action records
+constexpr std::size_t max_collected_memory = 1 << 16;
+
+// Memory the undo log of the recorder uses unless told otherwise
+constexpr std::size_t default_record_size = 64 << 20;
+
 auto split(const std::string &s, char delimiter) noexcept
     -> std::vector<std::string> {
   std::vector<std::string> out{};
@@ -35,9 +62,58 @@ auto is_prefix(const std::string &s, const std::string &of) noexcept -> bool {
   return std::equal(s.begin(), s.end(), of.begin());
 }
 
+// Parses a number of bytes with an optional K, M or G suffix
+auto parse_size(const std::string &s) -> std::size_t {
+  std::size_t end = 0;
+  auto size = std::stoull(s, &end, 0);
+  auto suffix = end < s.size() ? s.substr(end) : std::string{};
+  if (suffix == "K" || suffix == "k") {
+    size <<= 10;
+  } else if (suffix == "M" || suffix == "m") {
+    size <<= 20;
+  } else if (suffix == "G" || suffix == "g") {
+    size <<= 30;
+  } else if (!suffix.empty()) {
+    throw std::invalid_argument{"Bad size " + s};
+  }
+  return size;
+}
+
+auto write_output(const std::string &s) noexcept -> void {
+  // Anything buffered by the stream goes first, to keep the output in order
+  std::cout.flush();
+  std::size_t written = 0;
+  while (written < s.size()) {
+    auto n = write(STDOUT_FILENO, s.data() + written, s.size() - written);
+    if (n <= 0) {
+      break;
+    }
+    written += n;
+  }
+}
+
+auto get_variable_size(const dwarf::die &variable) -> std::size_t {
+  // Typedefs and qualifiers have the size of the type they refer to
+  auto die = variable;
+  while (die.has(dwarf::DW_AT::type)) {
+    die = die[dwarf::DW_AT::type].as_reference();
+    if (die.has(dwarf::DW_AT::byte_size)) {
+      return std::min<std::uint64_t>(
+          die[dwarf::DW_AT::byte_size].as_uconstant(), sizeof(std::uint64_t));
+    }
+  }
+  return sizeof(std::uint64_t);
+}
+
 auto debugger::run() noexcept -> void {
   wait_for_signal();
+
+  // Stops at system calls are told apart from traps
+  ptrace(PTRACE_SETOPTIONS, m_pid, nullptr,
+         PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACESECCOMP | PTRACE_O_TRACEFORK |
+             PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE);
   initialise_load_address();
+  initialise_vdso();
 
   char *line = nullptr;
   while ((line = linenoise("cd-debugger> ")) != nullptr) {
@@ -54,53 +130,470 @@ auto debugger::handle_command(const std::string &line) noexcept -> void {
   if (is_prefix(command, "continue")) {
     continue_execution();
   } else if (is_prefix(command, "break")) {
-    std::string addr{args[1], 2};
-    set_breakpoint_at_address(std::stol(addr, 0, 16));
+    if (args.size() < 2) {
+      std::cerr << "Usage: break 0x<address> [if <condition>]\n";
+    } else {
+      try {
+        std::string addr{args[1], 2};
+        auto condition = line.find(" if ");
+        if (condition == std::string::npos) {
+          set_breakpoint_at_address(std::stol(addr, 0, 16));
+        } else {
+          set_conditional_breakpoint(std::stol(addr, 0, 16),
+                                     line.substr(condition + 4));
+        }
+      } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+      }
+    }
+  } else if (is_prefix(command, "backtrace") || command == "bt") {
+    print_backtrace();
+  } else if (is_prefix(command, "frame")) {
+    try {
+      select_frame(args.size() > 1 ? std::stoul(args[1]) : m_selected_frame);
+    } catch (std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+  } else if (is_prefix(command, "up")) {
+    try {
+      auto n = args.size() > 1 ? std::stoul(args[1]) : 1;
+      auto outermost = get_frames().empty() ? 0 : get_frames().size() - 1;
+      if (m_selected_frame == outermost) {
+        std::cerr << "Initial frame selected; cannot go up\n";
+      } else {
+        select_frame(std::min(m_selected_frame + n, outermost));
+      }
+    } catch (std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+  } else if (is_prefix(command, "down")) {
+    try {
+      auto n = args.size() > 1 ? std::stoul(args[1]) : 1;
+      if (m_selected_frame == 0) {
+        std::cerr << "Bottom (innermost) frame selected; cannot go down\n";
+      } else {
+        select_frame(m_selected_frame - std::min(n, m_selected_frame));
+      }
+    } catch (std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+  } else if (is_prefix(command, "print")) {
+    if (args.size() < 2) {
+      std::cerr << "Usage: print <expression>\n";
+    } else {
+      print_expression(line.substr(line.find(' ') + 1));
+    }
+  } else if (is_prefix(command, "display")) {
+    if (args.size() < 2) {
+      show_displays();
+    } else {
+      add_display(line.substr(line.find(' ') + 1));
+    }
+  } else if (is_prefix(command, "undisplay")) {
+    if (args.size() < 2) {
+      std::cerr << "Usage: undisplay <number>\n";
+    } else {
+      try {
+        remove_display(std::stoul(args[1]));
+      } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+      }
+    }
+  } else if (is_prefix(command, "info")) {
+    if (args.size() > 1 && is_prefix(args[1], "locals")) {
+      print_frame_variables(false);
+    } else if (args.size() > 1 && is_prefix(args[1], "args")) {
+      print_frame_variables(true);
+    } else if (args.size() > 1 && is_prefix(args[1], "watchpoints")) {
+      print_watchpoints();
+    } else if (args.size() > 1 && is_prefix(args[1], "checkpoints")) {
+      print_checkpoints();
+    } else if (args.size() > 1 && is_prefix(args[1], "catchpoints")) {
+      print_catchpoints();
+    } else if (args.size() > 2 && args[1] == "proc" &&
+               is_prefix(args[2], "mappings")) {
+      print_mappings();
+    } else {
+      std::cerr << "Usage: info locals|args|watchpoints|checkpoints|"
+                   "catchpoints|proc mappings\n";
+    }
+  } else if (command == "watch-globals") {
+    if (args.size() < 2) {
+      show_watched_globals();
+    } else {
+      watch_globals({args.begin() + 1, args.end()});
+    }
+  } else if (command == "unwatch-globals") {
+    m_watched_globals.clear();
+  } else if (is_prefix(command, "watch")) {
+    if (args.size() < 2) {
+      std::cerr << "Usage: watch <expression>\n"
+                   "Objects of 1, 2, 4 or 8 aligned bytes use one of four "
+                   "debug registers.\nOthers write-protect their pages, "
+                   "which must not hold other objects,\nand system calls "
+                   "that write them fail with EFAULT.\n";
+    } else {
+      add_watchpoint(line.substr(line.find(' ') + 1));
+    }
+  } else if (is_prefix(command, "unwatch")) {
+    if (args.size() < 2) {
+      std::cerr << "Usage: unwatch <number>\n";
+    } else {
+      try {
+        remove_watchpoint(std::stoul(args[1]));
+      } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+      }
+    }
+  } else if (command == "ftrace") {
+    if (args.size() < 2) {
+      print_fast_tracepoints();
+    } else {
+      try {
+        add_fast_tracepoint(std::stoull(args[1], 0, 16));
+      } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+      }
+    }
+  } else if (command == "unftrace") {
+    if (args.size() < 2) {
+      std::cerr << "Usage: unftrace <number>\n";
+    } else {
+      try {
+        remove_fast_tracepoint(std::stoul(args[1]));
+      } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+      }
+    }
+  } else if (command == "trace") {
+    if (args.size() < 2) {
+      print_tracepoints();
+    } else {
+      try {
+        add_tracepoint(std::stoull(args[1], 0, 16));
+      } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+      }
+    }
+  } else if (command == "untrace") {
+    if (args.size() < 2) {
+      std::cerr << "Usage: untrace <number>\n";
+    } else {
+      try {
+        remove_tracepoint(std::stoul(args[1]));
+      } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+      }
+    }
+  } else if (command == "collect") {
+    if (args.size() < 3) {
+      std::cerr << "Usage: collect <tracepoint> $regs|mem <address> "
+                   "<size>|<expression>\n";
+    } else {
+      try {
+        add_collect_action(
+            std::stoul(args[1]),
+            line.substr(line.find(' ', line.find(' ') + 1) + 1));
+      } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+      }
+    }
+  } else if (command == "tfind") {
+    find_trace_frame({args.begin() + 1, args.end()});
+  } else if (command == "tdump") {
+    dump_trace_frame();
+  } else if (command == "tstatus") {
+    print_trace_status();
+  } else if (command == "journal") {
+    handle_journal({args.begin() + 1, args.end()});
+  } else if (command == "record") {
+    handle_record({args.begin() + 1, args.end()});
+  } else if (command == "syscalls") {
+    handle_syscalls({args.begin() + 1, args.end()});
+  } else if (command == "stepi" || command == "si") {
+    try {
+      prepare_instruction_step();
+      step_instruction();
+      report_instruction_stop();
+    } catch (std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+  } else if (command == "reverse-stepi" || command == "rsi") {
+    reverse_execute(reverse_mode::instruction);
+  } else if (command == "reverse-next" || command == "rn") {
+    reverse_execute(reverse_mode::line);
+  } else if (command == "reverse-continue" || command == "rc") {
+    reverse_execute(reverse_mode::breakpoint);
+  } else if (command == "checkpoint") {
+    try {
+      take_checkpoint();
+    } catch (std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+  } else if (command == "restart") {
+    if (args.size() < 2) {
+      std::cerr << "Usage: restart <checkpoint>\n";
+      return;
+    }
+    try {
+      restart_checkpoint(std::stoul(args[1]));
+    } catch (std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+  } else if (command == "catch") {
+    if (args.size() < 2 || args[1] != "syscall") {
+      std::cerr << "Usage: catch syscall [<name>|<number>...]\n";
+    } else {
+      catch_syscalls({args.begin() + 2, args.end()});
+    }
+  } else if (command == "delete") {
+    if (args.size() < 3 ||
+        (args[1] != "checkpoint" && args[1] != "catchpoint")) {
+      std::cerr << "Usage: delete checkpoint|catchpoint <number>\n";
+    } else {
+      try {
+        auto number = std::stoul(args[2]);
+        auto removed = args[1] == "checkpoint"
+                           ? m_checkpoints.remove(number)
+                           : m_syscall_catches.remove(number);
+        if (!removed) {
+          std::cerr << "No " << args[1] << ' ' << args[2] << std::endl;
+        }
+      } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+      }
+    }
+  } else if (command == "arena") {
+    try {
+      const auto &arena = get_arena();
+      std::cout << "Shared arena at 0x" << std::hex << arena.address() << ", "
+                << std::dec << arena.size() << " bytes, " << arena.used()
+                << " used" << std::endl;
+    } catch (std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+  } else if (command == "inject-benchmark") {
+    try {
+      benchmark_injection(args.size() > 1 ? std::stoul(args[1]) : 10000);
+    } catch (std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+  } else if (is_prefix(command, "variables")) {
+    read_variables();
   } else if (is_prefix(command, "register")) {
-    if (is_prefix(args[1], "dump")) {
+    if (args.size() >= 2 && is_prefix(args[1], "dump")) {
       dump_registers();
-    } else if (is_prefix(args[1], "read")) {
-      std::cout << get_register_value(m_pid, get_register_from_name(args[2]))
-                << std::endl;
-    } else if (is_prefix(args[1], "write")) {
-      std::string val{args[3], 2}; // assume 0xVAL
-      set_register_value(m_pid, get_register_from_name(args[2]),
-                         std::stol(val, 0, 16));
-    } else if (is_prefix(command, "memory")) {
-      std::string addr{args[2], 2}; // assume 0xADDRESS
-
-      if (is_prefix(args[1], "read")) {
-        std::cout << std::hex << read_memory(std::stol(addr, 0, 16))
+    } else if (args.size() >= 3 && is_prefix(args[1], "read")) {
+      try {
+        std::cout << get_frame_register_value(get_register_from_name(args[2]))
                   << std::endl;
+      } catch (std::out_of_range &) {
+        std::cout << "<not saved>" << std::endl;
       }
-      if (is_prefix(args[1], "write")) {
+    } else if (args.size() >= 4 && is_prefix(args[1], "write")) {
+      try {
         std::string val{args[3], 2}; // assume 0xVAL
+        set_register_value(m_pid, get_register_from_name(args[2]),
+                           std::stol(val, 0, 16));
+        m_unwinder.invalidate_cache();
+        forget_frames();
+      } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+      }
+    } else {
+      std::cerr << "Usage: register dump|read <reg>|write <reg> 0x<value>\n";
+    }
+  } else if (is_prefix(command, "memory")) {
+    if (args.size() >= 3 && is_prefix(args[1], "read")) {
+      try {
+        std::string addr{args[2], 2}; // assume 0xADDRESS
+        std::cout << std::hex << read_memory(std::stol(addr, 0, 16))
+                  << std::endl;
+      } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
+      }
+    } else if (args.size() >= 4 && is_prefix(args[1], "write")) {
+      try {
+        std::string addr{args[2], 2}; // assume 0xADDRESS
+        std::string val{args[3], 2};  // assume 0xVAL
         write_memory(std::stol(addr, 0, 16), std::stol(val, 0, 16));
+      } catch (std::exception &e) {
+        std::cerr << e.what() << std::endl;
       }
     } else {
-      std::cerr << "Unknown command\n";
+      std::cerr << "Usage: memory read 0x<address>|write 0x<address> "
+                   "0x<value>\n";
     }
+  } else {
+    std::cerr << "Unknown command\n";
   }
 }
 
 auto debugger::continue_execution() noexcept -> void {
-  step_over_breakpoint();
-  ptrace(PTRACE_CONT, m_pid, nullptr, nullptr);
-  wait_for_signal();
+  if (m_recorder.recording()) {
+    try {
+      continue_recorded();
+    } catch (std::exception &e) {
+      std::cerr << e.what() << std::endl;
+    }
+  } else {
+    auto stop = false;
+    do {
+      forget_frames();
+      m_tls.invalidate();
+      step_over_breakpoint();
+
+      // The instruction under the breakpoint may have changed a watched
+      // object
+      if (!m_watch_hits.empty()) {
+        break;
+      }
+      if (!resume()) {
+        journal_stop(true);
+        break;
+      }
+      m_fast_tracepoints.land();
+      stop = should_stop();
+      journal_stop(stop);
+    } while (!stop);
+  }
+  drain_agent_records();
+  report_watch_hits();
+  show_displays();
+  show_watched_globals();
 }
 
 auto debugger::set_breakpoint_at_address(std::intptr_t addr) noexcept -> void {
+  if (m_fast_tracepoints.covers(addr)) {
+    std::cerr << "A fast tracepoint is in the way of the breakpoint"
+              << std::endl;
+    return;
+  }
+  if (traps_to_tracepoint(addr)) {
+    std::cerr << "A tracepoint is in the way of the breakpoint" << std::endl;
+    return;
+  }
   std::cout << "Set breakpoint at address 0x" << std::hex << addr << std::endl;
 
-  breakpoint bp{m_pid, addr};
-  bp.enable();
-  m_breakpoints[addr] = bp;
+  // Enabling an existing breakpoint again would save its int3 as the
+  // original instruction
+  auto existing = m_breakpoints.find(addr);
+  if (existing == m_breakpoints.end() || !existing->second.is_enabled()) {
+    breakpoint bp{m_pid, addr};
+    bp.enable();
+    m_breakpoints[addr] = bp;
+  }
+  m_conditions.erase(addr);
+}
+
+auto debugger::set_conditional_breakpoint(std::intptr_t addr,
+                                          const std::string &condition)
+    -> void {
+  try {
+    auto pc = offset_load_address(addr);
+    expression compiled{condition, get_function_from_pc(pc), pc, m_types,
+                        m_locations, m_globals};
+    if (compiled.type().kind == type_kind::structure ||
+        compiled.type().kind == type_kind::unknown) {
+      std::cerr << "Condition must be a scalar value\n";
+      return;
+    }
+
+    if (m_fast_tracepoints.covers(addr) || traps_to_tracepoint(addr)) {
+      std::cerr << "A tracepoint is in the way of the breakpoint"
+                << std::endl;
+      return;
+    }
+    m_slow_conditions.erase(addr);
+    if (!set_fast_conditional_breakpoint(addr, compiled)) {
+      set_breakpoint_at_address(addr);
+    }
+    m_conditions.erase(addr);
+    m_conditions.emplace(addr, std::move(compiled));
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+  }
+}
+
+auto debugger::set_fast_conditional_breakpoint(std::intptr_t addr,
+                                               const expression &condition)
+    -> bool {
+  auto existing = m_breakpoints.find(addr);
+  if ((existing != m_breakpoints.end() && existing->second.is_enabled()) ||
+      !m_fast_tracepoints.agent_loaded()) {
+    return false;
+  }
+
+  try {
+    auto code = compile_agent_condition(condition, offset_load_address(addr),
+                                        m_load_address, m_locations, m_cfi);
+    const auto &t = add_fast_site(addr, agent_site_stop, code);
+    std::cout << "Set fast conditional breakpoint at address 0x" << std::hex
+              << addr << ", fast tracepoint " << std::dec << t.number
+              << std::endl;
+    return true;
+  } catch (std::exception &e) {
+    std::cerr << "Condition is tested by the debugger: " << e.what()
+              << std::endl;
+    m_slow_conditions.insert(addr);
+    return false;
+  }
+}
+
+auto debugger::move_condition_to_agent(std::intptr_t addr) -> bool {
+  auto condition = m_conditions.find(addr);
+  if (condition == m_conditions.end() || m_slow_conditions.count(addr) != 0) {
+    return false;
+  }
+
+  // A preloaded agent is mapped before any code of the program runs
+  if (!m_fast_tracepoints.agent_loaded()) {
+    m_slow_conditions.insert(addr);
+    return false;
+  }
+
+  auto &bp = m_breakpoints[addr];
+  bp.disable();
+  if (!set_fast_conditional_breakpoint(addr, condition->second)) {
+    bp.enable();
+    return false;
+  }
+  m_breakpoints.erase(addr);
+  set_pc(m_fast_tracepoints.find(addr)->displaced);
+  return true;
+}
+
+auto debugger::breakpoint_condition_holds() noexcept -> bool {
+  // Fast conditional breakpoints stop at their address rather than after it
+  auto landed = m_fast_tracepoints.landed();
+  auto condition = m_conditions.find(landed != 0 ? landed : get_pc() - 1);
+  if (condition == m_conditions.end()) {
+    return true;
+  }
+
+  try {
+    dwarf::die caller;
+    auto frames = get_innermost_frames(caller);
+    frame_context context(m_pid, frames, 0, condition->second.function(),
+                          caller, m_locations, m_load_address, &m_tls);
+    return condition->second.test(context);
+  } catch (std::exception &e) {
+    std::cerr << "Error in testing condition for breakpoint: " << e.what()
+              << std::endl;
+    return true;
+  }
 }
 
 auto debugger::dump_registers() -> void {
   for (const auto &rd : g_register_descriptors) {
-    std::cout << rd.name << " 0x" << std::setfill('0') << std::setw(16)
-              << std::hex << get_register_value(m_pid, rd.r) << std::endl;
+    std::cout << rd.name << ' ';
+    try {
+      auto value = get_frame_register_value(rd.r);
+      std::cout << "0x" << std::setfill('0') << std::setw(16) << std::hex
+                << value << std::endl;
+    } catch (std::out_of_range &) {
+      std::cout << "<not saved>" << std::endl;
+    }
   }
 }
 
@@ -112,50 +605,2012 @@ auto debugger::set_pc(std::uint64_t pc) -> void {
   set_register_value(m_pid, reg::rip, pc);
 }
 
-auto debugger::step_over_breakpoint() -> void {
-  // - 1 because execution will go past the breakpoint
-  auto possible_breakpoint_location = get_pc() - 1;
+auto debugger::should_stop() noexcept -> bool {
+  if (check_watchpoints()) {
+    return !m_watch_hits.empty();
+  }
+  if (collect_trace_frame()) {
+    return false;
+  }
+  return breakpoint_condition_holds();
+}
 
-  if (m_breakpoints.count(possible_breakpoint_location)) {
-    auto &bp = m_breakpoints[possible_breakpoint_location];
+auto debugger::journal_stop(bool reported) noexcept -> void {
+  if (!m_journal.is_open()) {
+    return;
+  }
 
-    if (bp.is_enabled()) {
-      auto previous_instruction_address = possible_breakpoint_location;
-      set_pc(previous_instruction_address);
+  journal_record record{};
+  record.timestamp = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count());
+  record.thread = m_pid;
+  record.flags = reported ? 0 : journal_resumed;
 
-      bp.disable();
-      ptrace(PTRACE_SINGLESTEP, m_pid, nullptr, nullptr);
-      wait_for_signal();
-      bp.enable();
+  siginfo_t info;
+  if (ptrace(PTRACE_GETSIGINFO, m_pid, nullptr, &info) == -1) {
+    record.reason = journal_reason::exited;
+    m_journal.append(record);
+    return;
+  }
+  record.signal = static_cast<std::uint32_t>(info.si_signo);
+  if (!m_watch_hits.empty()) {
+    record.reason = journal_reason::watchpoint;
+  } else if (info.si_signo != SIGTRAP) {
+    record.reason = journal_reason::signal;
+  }
+
+  auto regs = get_stop_registers();
+  record.pc = regs.values[dwarf_return_address_register];
+  if (m_journal_registers) {
+    std::copy(regs.values.begin(), regs.values.end(), record.regs);
+    record.eflags = get_register_value(m_pid, reg::rflags);
+    record.flags |= journal_registers;
+  }
+  if (m_journal_bytes != 0 &&
+      read_memory_block(m_pid, m_journal_address, record.memory,
+                        m_journal_bytes)) {
+    record.memory_address = m_journal_address;
+    record.memory_bytes = static_cast<std::uint32_t>(m_journal_bytes);
+    record.flags |= journal_memory;
+  }
+  m_journal.append(record);
+}
+
+auto debugger::handle_journal(const std::vector<std::string> &args) -> void {
+  try {
+    if (args.empty()) {
+      if (m_journal.is_open()) {
+        std::cout << "Journaling stops to " << m_journal.path() << ", "
+                  << std::dec << m_journal.size() << " records" << std::endl;
+      } else {
+        std::cout << "Not journaling stops." << std::endl;
+      }
+    } else if (args[0] == "off") {
+      m_journal.close();
+    } else if (args[0] == "show") {
+      if (args.size() < 2) {
+        std::cerr << "Usage: journal show <path> [<first>|@<seconds> "
+                     "[<count>]]\n";
+        return;
+      }
+      journal_reader reader{args[1]};
+      std::uint64_t first = 0;
+      if (args.size() > 2 && args[2][0] == '@') {
+        first = reader.seek(static_cast<std::uint64_t>(
+            std::stold(args[2].substr(1)) * 1000000000));
+      } else if (args.size() > 2) {
+        first = std::stoull(args[2]);
+      }
+      auto count = args.size() > 3 ? std::stoull(args[3]) : 20;
+      print_journal(reader, first, count, std::cout);
+    } else {
+      bool registers = false;
+      std::uint64_t address = 0;
+      std::size_t bytes = 0;
+      for (std::size_t i = 1; i < args.size(); ++i) {
+        if (args[i] == "regs") {
+          registers = true;
+        } else if (args[i] == "mem" && i + 2 < args.size()) {
+          address = std::stoull(args[i + 1], 0, 16);
+          bytes = std::stoul(args[i + 2], 0, 0);
+          i += 2;
+        } else {
+          std::cerr << "Usage: journal <path> [regs] [mem <address> <size>]\n";
+          return;
+        }
+      }
+      if (bytes > journal_memory_size) {
+        std::cerr << "Stops record at most " << std::dec
+                  << journal_memory_size << " bytes of memory" << std::endl;
+        return;
+      }
+
+      m_journal.open(args[0]);
+      m_journal_registers = registers;
+      m_journal_address = address;
+      m_journal_bytes = bytes;
+      std::cout << "Journaling stops to " << args[0] << " after " << std::dec
+                << m_journal.size() << " records" << std::endl;
+    }
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+  }
+}
+
+auto debugger::handle_syscalls(const std::vector<std::string> &args)
+    -> void {
+  try {
+    if (args.empty()) {
+      if (m_syscalls.mode() == syscall_mode::record) {
+        std::cout << "Recording system calls to " << m_syscalls.path()
+                  << ", " << std::dec << m_syscalls.events() << " events"
+                  << std::endl;
+      } else if (m_syscalls.mode() == syscall_mode::replay) {
+        std::cout << "Replaying system calls from " << m_syscalls.path()
+                  << ", " << std::dec << m_syscalls.events()
+                  << " events replayed" << std::endl;
+      } else {
+        std::cout << "Not recording or replaying system calls." << std::endl;
+      }
+      if (m_latencies.active()) {
+        std::cout << "Timing system calls." << std::endl;
+      }
+    } else if (args[0] == "stop") {
+      m_syscalls.stop();
+      m_vdso.restore_clock(m_pid);
+    } else if (args[0] == "time" && args.size() <= 2) {
+      if (args.size() == 2 && args[1] == "stop") {
+        m_latencies.stop();
+      } else {
+        auto syscalls = parse_syscalls(args.size() == 2 ? args[1] : "all");
+        m_latencies.start(syscalls.empty() ? known_syscalls() : syscalls);
+        std::cout << "Timing system calls." << std::endl;
+      }
+    } else if (args[0] == "latency" && args.size() <= 2) {
+      if (args.size() == 1) {
+        m_latencies.print(std::cout);
+      } else {
+        auto syscalls = parse_syscalls(args[1]);
+        for (auto s : syscalls) {
+          m_latencies.print(std::cout, s);
+        }
+      }
+    } else if (args.size() == 2 &&
+               (args[0] == "record" || args[0] == "replay")) {
+      if (args[0] == "record") {
+        m_syscalls.record(args[1]);
+      } else {
+        m_syscalls.replay(args[1]);
+      }
+
+      // The clock is read in the vDSO, out of sight of ptrace
+      if (m_vdso.loaded()) {
+        try {
+          m_vdso.redirect_clock(m_pid);
+        } catch (std::out_of_range &) {
+          m_syscalls.stop();
+          throw;
+        }
+      }
+      if (args[0] == "record") {
+        std::cout << "Recording system calls to " << args[1] << std::endl;
+      } else {
+        std::cout << "Replaying system calls from " << args[1] << std::endl;
+      }
+    } else {
+      std::cerr << "Usage: syscalls [record <path>|replay <path>|stop|time "
+                   "[<calls>|stop]|latency [<calls>]]\n";
     }
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
   }
 }
 
-auto debugger::wait_for_signal() const noexcept -> void {
-  int wait_status;
-  auto options = 0;
-  waitpid(m_pid, &wait_status, options);
+auto debugger::handle_record(const std::vector<std::string> &args)
+    -> void {
+  try {
+    if (!args.empty() && args[0] == "stop") {
+      m_recorder.stop();
+    } else if (!args.empty() && args[0] == "status") {
+      if (!m_recorder.recording()) {
+        std::cout << "Not recording." << std::endl;
+        return;
+      }
+      const auto &log = m_recorder.log();
+      auto instructions = m_recorder.instructions();
+      auto elapsed = std::chrono::duration<double>(m_recorder.elapsed());
+      std::cout << "Recorded " << std::dec << instructions
+                << " instructions in " << elapsed.count() << " s";
+      if (instructions != 0) {
+        std::cout << ", " << elapsed.count() * 1e6 / instructions
+                  << " us each";
+      }
+      std::cout << "\nUndo log: " << log.entries() << " entries in "
+                << log.used() << " of " << log.capacity() << " bytes, "
+                << log.dropped() << " dropped" << std::endl;
+    } else {
+      auto size = args.empty() ? default_record_size : parse_size(args[0]);
+      prepare_instruction_step();
+      m_recorder.start(size);
+      std::cout << "Recording into " << std::dec << size << " bytes."
+                << std::endl;
+    }
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+  }
 }
 
-auto debugger::initialise_load_address() noexcept -> void {
-  // If this is a dynamic library (e.g. PIE)
-  if (m_elf.get_hdr().type == elf::et::dyn) {
-    std::ifstream map("/proc/" + std::to_string(m_pid) + "/maps");
+auto debugger::prepare_instruction_step() -> void {
+  auto pc = get_pc();
+  auto bp = m_breakpoints.find(pc - 1);
+  if (bp != m_breakpoints.end() && bp->second.is_enabled()) {
+    set_pc(pc - 1);
+  }
+  m_fast_tracepoints.leave();
+  forget_frames();
+  m_tls.invalidate();
 
-    // Read the first address from the file
-    std::string addr;
-    std::getline(map, addr, '-');
+  // A caught call stepped over returns without a stop
+  m_caught = 0;
+  m_caught_entered = false;
 
-    m_load_address = std::stoi(addr, 0, 16);
+  if (m_recorder.recording()) {
+    m_recorder.forget_code();
+    m_recorder.after_step();
   }
 }
 
-auto debugger::read_memory(std::uint64_t address) const noexcept
-    -> std::uint64_t {
+auto debugger::step_instruction() -> bool {
+  auto recording = m_recorder.recording();
+  auto pc = recording ? m_recorder.registers().rip : get_pc();
+  auto bp = m_breakpoints.find(pc);
+  auto covered = bp != m_breakpoints.end() && bp->second.is_enabled();
+  if (covered) {
+    bp->second.disable();
+  }
+  int status = 0;
+  if (recording) {
+    try {
+      status = m_recorder.step();
+    } catch (std::out_of_range &) {
+      if (covered) {
+        bp->second.enable();
+      }
+      throw;
+    }
+  } else {
+    ptrace(PTRACE_SINGLESTEP, m_pid, nullptr, nullptr);
+    waitpid(m_pid, &status, 0);
+  }
+  if (covered) {
+    bp->second.enable();
+  }
+
+  if (!WIFSTOPPED(status)) {
+    m_recorder.stop();
+    journal_stop(true);
+    return true;
+  }
+
+  auto signal = WSTOPSIG(status);
+  if (!m_watchpoints.watchpoints().empty()) {
+    // A write to a protected page faults, and the watchpoint table steps it
+    if (recording && signal == SIGSEGV) {
+      m_recorder.before_step();
+    }
+    auto caught = check_watchpoints();
+    if (recording) {
+      m_recorder.after_step();
+    }
+    if (caught) {
+      auto stop = !m_watch_hits.empty();
+      journal_stop(stop);
+      return stop;
+    }
+  }
+  if (signal != SIGTRAP) {
+    journal_stop(true);
+    return true;
+  }
+
+  forget_frames();
+  m_tls.invalidate();
+  if (m_fast_tracepoints.land() != nullptr) {
+    if (recording) {
+      m_recorder.after_step();
+    }
+    auto stop = should_stop();
+    journal_stop(stop);
+    if (!stop) {
+      m_fast_tracepoints.leave();
+      if (recording) {
+        m_recorder.after_step();
+      }
+    }
+    return stop;
+  }
+
+  pc = recording ? m_recorder.registers().rip : get_pc();
+  bp = m_breakpoints.find(pc);
+  if (bp == m_breakpoints.end() || !bp->second.is_enabled()) {
+    return false;
+  }
+
+  // The breakpoint is tested as if its int3 had run
+  set_pc(pc + 1);
+  auto stop = should_stop();
+  journal_stop(stop);
+  if (!stop) {
+    if (get_pc() == pc + 1) {
+      set_pc(pc);
+    }
+    if (recording) {
+      // A tracepoint may have moved to the agent, patching in its jump
+      m_recorder.forget_code();
+      m_recorder.after_step();
+    }
+  }
+  return stop;
+}
+
+auto debugger::continue_recorded() -> void {
+  prepare_instruction_step();
+  while (!step_instruction()) {
+  }
+}
+
+auto debugger::reverse_execute(reverse_mode mode) -> void {
+  if (!m_recorder.recording()) {
+    std::cerr << "Not recording." << std::endl;
+    return;
+  }
+
+  try {
+    prepare_instruction_step();
+    auto found = false;
+    std::size_t count = 1;
+    if (mode == reverse_mode::line) {
+      // The log is walked first, because where the previous line starts
+      // is only known once the walk has gone past its start and any calls
+      // it made
+      const auto &now = m_recorder.registers();
+      auto start_line = get_line_from_pc(now.rip);
+      auto start_cfa = get_frame_cfa(now);
+      unsigned target = 0;
+      std::size_t visited = 0;
+      count = 0;
+      auto walked = m_recorder.walk_back([&](const user_regs_struct &regs) {
+        ++visited;
+        auto cfa = get_frame_cfa(regs);
+        if (start_cfa != 0 && cfa > start_cfa) {
+          // From the start of a function, back to its call
+          count = count == 0 ? visited : count;
+          found = true;
+          return false;
+        }
+        // Frames deeper than the starting one are calls being stepped over
+        auto line = cfa == start_cfa ? get_line_from_pc(regs.rip) : 0;
+        if (line == 0) {
+          return true;
+        }
+        if (target == 0 && line != start_line) {
+          target = line;
+        } else if (target != 0 && line != target) {
+          found = true;
+          return false;
+        }
+        count = visited;
+        return true;
+      });
+      if (!found) {
+        count = walked;
+      }
+    } else if (mode == reverse_mode::breakpoint) {
+      count = m_recorder.log().entries();
+    }
+
+    std::size_t undone = 0;
+    while (undone < count && m_recorder.undo()) {
+      ++undone;
+      auto pc = m_recorder.registers().rip;
+      auto bp = m_breakpoints.find(pc);
+      if (mode == reverse_mode::breakpoint && bp != m_breakpoints.end() &&
+          bp->second.is_enabled() && !traps_to_tracepoint(pc)) {
+        set_pc(pc + 1);
+        found = breakpoint_condition_holds();
+        set_pc(pc);
+        if (found) {
+          break;
+        }
+      }
+    }
+    if (mode == reverse_mode::instruction ? undone == 0 : !found) {
+      std::cout << "No more reverse-execution history." << std::endl;
+    }
+    report_instruction_stop();
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+  }
+}
+
+auto debugger::report_instruction_stop() -> void {
+  auto pc = get_pc();
+  auto bp = m_breakpoints.find(pc);
+  if (bp != m_breakpoints.end() && bp->second.is_enabled()) {
+    set_pc(pc + 1);
+  }
+  m_unwinder.invalidate_cache();
+  forget_frames();
+  m_tls.invalidate();
+
+  const auto &frames = get_frames();
+  if (!frames.empty()) {
+    print_frame(0, frames[0]);
+  }
+  report_watch_hits();
+  show_displays();
+  show_watched_globals();
+}
+
+auto debugger::get_frame_cfa(const user_regs_struct &regs) -> std::uint64_t {
+  auto row = m_cfi.find_row(offset_load_address(regs.rip));
+  auto set = to_dwarf_register_set(regs);
+  if (row == nullptr || row->cfa_expr != nullptr || !set.has(row->cfa_reg)) {
+    return 0;
+  }
+  return set.values[row->cfa_reg] + row->cfa_offset;
+}
+
+auto debugger::get_line_from_pc(std::uint64_t pc) noexcept -> unsigned {
+  try {
+    return get_line_entry_from_pc(offset_load_address(pc))->line;
+  } catch (std::exception &) {
+    return 0;
+  }
+}
+
+auto debugger::take_checkpoint() -> void {
+  if (protects_pages()) {
+    throw std::out_of_range{"Checkpoints cannot be taken while watchpoints "
+                            "write-protect pages"};
+  }
+
+  auto pc = get_stop_registers().values[dwarf_return_address_register];
+  std::vector<breakpoint *> enabled;
+  for (auto &bp : m_breakpoints) {
+    if (bp.second.is_enabled()) {
+      bp.second.disable();
+      enabled.push_back(&bp.second);
+    }
+  }
+  auto put_back = [this, &enabled] {
+    m_fast_tracepoints.patch();
+    for (auto bp : enabled) {
+      bp->enable();
+    }
+  };
+
+  m_fast_tracepoints.unpatch();
+  try {
+    const auto &c = m_checkpoints.add(m_pid, m_injector.scratch_address(), pc);
+    std::cout << "Checkpoint " << std::dec << c.number << ": process "
+              << c.pid << " at 0x" << std::hex << c.pc << std::endl;
+  } catch (...) {
+    put_back();
+    throw;
+  }
+  put_back();
+}
+
+auto debugger::restart_checkpoint(unsigned number) -> void {
+  if (protects_pages()) {
+    throw std::out_of_range{"Checkpoints cannot be restarted while "
+                            "watchpoints write-protect pages"};
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto pid = m_checkpoints.spawn(number, m_injector.scratch_address());
+  drain_agent_records();
+  auto previous = m_pid;
+  m_pid = pid;
+
+  // The copy was made without breakpoints and jumps in its code
+  for (auto &bp : m_breakpoints) {
+    bp.second.set_pid(pid);
+    if (bp.second.is_enabled()) {
+      bp.second.enable();
+    }
+  }
+  m_injector.set_pid(pid);
+  m_arena.set_pid(pid);
+  m_fast_tracepoints.set_pid(pid);
+  m_fast_tracepoints.patch();
+  m_tls.set_pid(pid);
+  m_unwinder.set_pid(pid);
+  m_watch_hits.clear();
+  forget_frames();
+  if (m_syscalls.mode() != syscall_mode::off) {
+    std::cout << "Stopped recording or replaying system calls." << std::endl;
+  }
+  m_syscalls.set_pid(pid);
+  m_vdso.restore_clock(pid);
+  m_latencies.forget_call();
+  m_caught = 0;
+  m_caught_entered = false;
+  try {
+    m_syscall_catches.set_pid(pid);
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+  }
+  auto capacity = m_recorder.recording() ? m_recorder.log().capacity() : 0;
+  m_recorder.set_pid(pid);
+  if (capacity != 0) {
+    m_recorder.start(capacity);
+  }
+  kill_process(previous);
+  m_watchpoints.set_pid(pid);
+
+  auto elapsed = std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - start);
+  std::cout << "Restarted from checkpoint " << std::dec << number
+            << " as process " << pid << " in " << elapsed.count() << " ms"
+            << std::endl;
+  const auto &frames = get_frames();
+  if (!frames.empty()) {
+    print_frame(0, frames[0]);
+  }
+}
+
+auto debugger::print_checkpoints() -> void {
+  if (m_checkpoints.checkpoints().empty()) {
+    std::cout << "No checkpoints." << std::endl;
+    return;
+  }
+
+  for (const auto &c : m_checkpoints.checkpoints()) {
+    std::cout << std::dec << c.number << ": process " << c.pid << " at 0x"
+              << std::hex << c.pc;
+    auto sym = m_unwinder.find_symbol(c.pc);
+    if (sym != nullptr) {
+      std::cout << ' ' << sym->name;
+    }
+    std::cout << std::endl;
+  }
+}
+
+auto debugger::catch_syscalls(const std::vector<std::string> &args) -> void {
+  try {
+    std::vector<long> syscalls;
+    for (const auto &a : args) {
+      auto listed = parse_syscalls(a);
+      syscalls.insert(syscalls.end(), listed.begin(), listed.end());
+    }
+    const auto &c = m_syscall_catches.add(syscalls);
+    std::cout << "Catchpoint " << std::dec << c.number << " (";
+    if (c.syscalls.empty()) {
+      std::cout << "any syscall";
+    } else {
+      std::cout << (c.syscalls.size() == 1 ? "syscall" : "syscalls");
+      for (auto s : c.syscalls) {
+        std::cout << ' ' << syscall_name(s);
+      }
+    }
+    std::cout << ')' << std::endl;
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+  }
+}
+
+auto debugger::print_catchpoints() -> void {
+  if (m_syscall_catches.catchpoints().empty()) {
+    std::cout << "No catchpoints." << std::endl;
+    return;
+  }
+
+  for (const auto &c : m_syscall_catches.catchpoints()) {
+    std::cout << std::dec << c.number << ": syscall";
+    if (c.syscalls.empty()) {
+      std::cout << " any";
+    }
+    for (auto s : c.syscalls) {
+      std::cout << ' ' << syscall_name(s);
+    }
+    std::cout << std::endl;
+  }
+}
+
+auto debugger::report_syscall_catch(const syscall_catchpoint &catchpoint,
+                                    bool returning) -> void {
+  user_regs_struct regs;
+  if (ptrace(PTRACE_GETREGS, m_pid, nullptr, &regs) == -1) {
+    return;
+  }
+  auto number = static_cast<long>(regs.orig_rax);
+  std::cout << "Catchpoint " << std::dec << catchpoint.number << " ("
+            << (returning ? "returned from" : "call to") << " syscall "
+            << syscall_name(number) << "), ";
+  if (returning) {
+    std::cout << "= " << format_syscall_result(regs);
+  } else {
+    std::cout << format_syscall(m_pid, regs);
+  }
+  std::cout << std::endl;
+}
+
+auto debugger::protects_pages() const noexcept -> bool {
+  const auto &watchpoints = m_watchpoints.watchpoints();
+  return std::any_of(watchpoints.begin(), watchpoints.end(),
+                     [](const watchpoint &w) {
+                       return w.kind == watch_kind::page;
+                     });
+}
+
+auto debugger::check_watchpoints() noexcept -> bool {
+  siginfo_t info;
+  if (m_watchpoints.watchpoints().empty() ||
+      ptrace(PTRACE_GETSIGINFO, m_pid, nullptr, &info) == -1) {
+    return false;
+  }
+
+  try {
+    return m_watchpoints.check_stop(
+        info.si_signo, reinterpret_cast<std::uint64_t>(info.si_addr),
+        m_watch_hits);
+  } catch (std::exception &e) {
+    std::cerr << "Error in checking watchpoints: " << e.what() << std::endl;
+    return false;
+  }
+}
+
+auto debugger::add_watchpoint(const std::string &text) -> void {
+  dwarf::die func, caller;
+  if (!get_selected_functions(func, caller)) {
+    return;
+  }
+
+  frame_context context(m_pid, get_frames(), m_selected_frame, func, caller,
+                        m_locations, m_load_address, &m_tls);
+  try {
+    expression expr{text, func, context.link_pc(), m_types, m_locations,
+                    m_globals};
+    auto value = expr.evaluate(context);
+    if (!value.in_memory) {
+      std::cerr << "Cannot watch constant value `" << text << "'."
+                << std::endl;
+      return;
+    }
+
+    if (m_watchpoints.uses_pages(value.address, value.type->size)) {
+      auto neighbour = page_neighbour(value.address, value.type->size);
+      if (!neighbour.empty()) {
+        std::cerr << "Cannot watch `" << text << "': its page also holds "
+                  << neighbour
+                  << ", which system calls would fail to write while the "
+                     "page is protected."
+                  << std::endl;
+        return;
+      }
+    }
+
+    const auto &w = m_watchpoints.add(value.address, value.type->size);
+    std::cout << (w.kind == watch_kind::hardware ? "Hardware watchpoint "
+                                                 : "Watchpoint ")
+              << std::dec << w.number << ": " << text << std::endl;
+    m_watch_expressions.emplace(w.number, std::move(expr));
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+  }
+}
+
+auto debugger::page_neighbour(std::uint64_t address, std::size_t size)
+    -> std::string {
+  auto low = address & ~(page_size - 1);
+  auto high = (address + size + page_size - 1) & ~(page_size - 1);
+  if (low == address && high == address + size) {
+    return "";
+  }
+
+  // Only the data of the program is known object by object
+  auto link_address = offset_load_address(address);
+  if (m_objects.find(link_address) == nullptr) {
+    return "other memory";
+  }
+  for (auto s : m_objects.find_overlapping(offset_load_address(low),
+                                           offset_load_address(high))) {
+    if (s->addr < link_address ||
+        s->addr + std::max<std::uint64_t>(s->size, 1) > link_address + size) {
+      return s->name.empty() ? "another object" : "`" + s->name + "'";
+    }
+  }
+  return "";
+}
+
+auto debugger::remove_watchpoint(unsigned number) -> void {
+  try {
+    if (!m_watchpoints.remove(number)) {
+      std::cerr << "No watchpoint number " << std::dec << number << std::endl;
+      return;
+    }
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+  }
+  m_watch_expressions.erase(number);
+}
+
+auto debugger::print_watchpoints() -> void {
+  if (m_watchpoints.watchpoints().empty()) {
+    std::cout << "No watchpoints." << std::endl;
+    return;
+  }
+
+  for (const auto &w : m_watchpoints.watchpoints()) {
+    std::cout << std::dec << w.number << ": "
+              << m_watch_expressions.at(w.number).text() << " (0x" << std::hex
+              << w.address << ", " << std::dec << w.size << " bytes, "
+              << (w.kind == watch_kind::hardware ? "debug register"
+                                                 : "page protection")
+              << ')' << std::endl;
+  }
+}
+
+auto debugger::report_watch_hits() noexcept -> void {
+  for (const auto &hit : m_watch_hits) {
+    auto expr = m_watch_expressions.find(hit.number);
+    if (expr == m_watch_expressions.end()) {
+      continue;
+    }
+
+    const auto &type = expr->second.type();
+    std::ostringstream out;
+    out << "\nWatchpoint " << std::dec << hit.number << ": "
+        << expr->second.text() << "\n\nOld value = ";
+    format_value(type, hit.old_value.data(), out);
+    out << "\nNew value = ";
+    format_value(type, hit.new_value.data(), out);
+    out << '\n';
+    write_output(out.str());
+  }
+  m_watch_hits.clear();
+}
+
+auto debugger::benchmark_injection(std::size_t count) -> void {
+  using clock = std::chrono::steady_clock;
+  auto fastest = clock::duration::max();
+  auto start = clock::now();
+  try {
+    for (std::size_t i = 0; i < count; ++i) {
+      auto before = clock::now();
+      m_injector.call(SYS_getpid, {});
+      fastest = std::min(fastest, clock::now() - before);
+    }
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return;
+  }
+
+  auto total = clock::now() - start;
+  auto nanoseconds = [](clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  };
+  std::cout << std::dec << count << " injected getpid calls: "
+            << nanoseconds(total) / 1000 / (count == 0 ? 1 : count)
+            << " us average, " << nanoseconds(fastest) / 1000
+            << " us fastest" << std::endl;
+}
+
+auto debugger::get_arena() -> shared_arena & {
+  if (!m_arena.mapped()) {
+    // Placed just below the lowest mapping, the program, so that jumps from
+    // its code reach trampolines in the arena
+    std::ifstream maps{"/proc/" + std::to_string(m_pid) + "/maps"};
+    std::string start;
+    std::getline(maps, start, '-');
+    auto lowest = std::stoull(start, 0, 16);
+    m_arena.map(arena_size, lowest > arena_size ? lowest - arena_size : 0);
+  }
+  return m_arena;
+}
+
+auto debugger::add_fast_site(std::uint64_t address, std::uint32_t flags,
+                             const std::vector<agent_insn> &condition)
+    -> const fast_tracepoint & {
+  auto sym = m_symbols.find(offset_load_address(address));
+  if (sym == nullptr || sym->size == 0) {
+    std::ostringstream message;
+    message << "No function of the program at 0x" << std::hex << address;
+    throw std::out_of_range{message.str()};
+  }
+
+  // Everything in the way of the jump is checked before the text is
+  // patched
+  auto end = sym->addr + sym->size + m_load_address;
+  auto length = m_fast_tracepoints.patch_length(address, end);
+  for (const auto &bp : m_breakpoints) {
+    auto at = static_cast<std::uint64_t>(bp.first);
+    if (bp.second.is_enabled() && at >= address && at < address + length) {
+      throw std::out_of_range{"A breakpoint is in the way of the jump"};
+    }
+  }
+  auto pc = get_pc();
+  if (pc > address && pc < address + length) {
+    throw std::out_of_range{"The program is stopped inside the instructions "
+                            "the jump replaces"};
+  }
+  if (branch_target_within(address + 1, address + length)) {
+    throw std::out_of_range{"The jump would replace the start of a function "
+                            "or line"};
+  }
+
+  get_arena();
+  return m_fast_tracepoints.add(address, end, flags, condition);
+}
+
+auto debugger::branch_target_within(std::uint64_t low, std::uint64_t high)
+    -> bool {
+  auto link_low = offset_load_address(low);
+  auto link_high = offset_load_address(high);
+  for (auto s : m_symbols.find_overlapping(link_low, link_high)) {
+    if (s->addr >= link_low) {
+      return true;
+    }
+  }
+
+  // A unit without a line table only has its functions to go by
+  for (auto &cu : m_dwarf.compilation_units()) {
+    try {
+      if (!die_pc_range(cu.root()).contains(link_low)) {
+        continue;
+      }
+      for (const auto &entry : cu.get_line_table()) {
+        if (!entry.end_sequence && entry.address >= link_low &&
+            entry.address < link_high) {
+          return true;
+        }
+      }
+    } catch (std::out_of_range &) {
+    }
+  }
+  return false;
+}
+
+auto debugger::add_fast_tracepoint(std::uint64_t address) -> void {
+  try {
+    const auto &t = add_fast_site(address, agent_site_record, {});
+    std::cout << "Fast tracepoint " << std::dec << t.number << " at 0x"
+              << std::hex << address << std::endl;
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+  }
+}
+
+auto debugger::remove_fast_tracepoint(unsigned number) -> void {
+  const fast_tracepoint *found = nullptr;
+  for (const auto &t : m_fast_tracepoints.tracepoints()) {
+    if (t.number == number) {
+      found = &t;
+    }
+  }
+  if (found == nullptr) {
+    std::cerr << "No fast tracepoint number " << std::dec << number
+              << std::endl;
+    return;
+  }
+  for (const auto &t : m_tracepoints) {
+    if (t.fast == number) {
+      std::cerr << "Fast tracepoint " << std::dec << number
+                << " belongs to tracepoint " << t.number << std::endl;
+      return;
+    }
+  }
+
+  if ((m_fast_tracepoints.site(*found).flags & agent_site_stop) != 0) {
+    m_conditions.erase(found->address);
+  }
+  m_fast_tracepoints.remove(number);
+}
+
+auto debugger::print_fast_tracepoints() -> void {
+  drain_agent_records();
+  if (m_fast_tracepoints.tracepoints().empty()) {
+    std::cout << "No fast tracepoints." << std::endl;
+    return;
+  }
+
+  for (const auto &t : m_fast_tracepoints.tracepoints()) {
+    const auto &site = m_fast_tracepoints.site(t);
+    std::cout << std::dec << t.number << ": 0x" << std::hex << t.address
+              << ", " << std::dec << site.hits.load() << " hits";
+    auto condition = m_conditions.find(t.address);
+    if ((site.flags & agent_site_stop) != 0 &&
+        condition != m_conditions.end()) {
+      std::cout << ", stops if " << condition->second.text();
+    }
+    std::cout << std::endl;
+  }
+  std::cout << m_agent_records.size() << " records collected, "
+            << m_fast_tracepoints.dropped() + m_agent_records_dropped
+            << " dropped" << std::endl;
+}
+
+auto debugger::drain_agent_records() -> void {
+  std::vector<agent_record> records;
+  m_fast_tracepoints.drain(records);
+  for (const auto &record : records) {
+    auto t = std::find_if(
+        m_tracepoints.begin(), m_tracepoints.end(),
+        [&record](const tracepoint &t) { return t.fast == record.site; });
+    if (t == m_tracepoints.end()) {
+      // Like the ring, the list keeps the oldest records once it is full
+      if (m_agent_records.size() < max_agent_records) {
+        m_agent_records.push_back(record);
+      } else {
+        ++m_agent_records_dropped;
+      }
+      continue;
+    }
+
+    const auto &site = m_fast_tracepoints.site(
+        *m_fast_tracepoints.find(t->address));
+    auto collected = make_trace_frame(record, site, t->number);
+
+    // The agent does not unwind, but the CFA of the tracepoint is a
+    // register plus an offset in all but unusual code
+    auto row = m_cfi.find_row(offset_load_address(record.rip));
+    if (row != nullptr && row->cfa_expr == nullptr &&
+        collected.regs.has(row->cfa_reg)) {
+      collected.cfa = collected.regs.values[row->cfa_reg] + row->cfa_offset;
+    }
+    m_trace.add(std::move(collected));
+  }
+}
+
+auto debugger::find_tracepoint(unsigned number) noexcept -> tracepoint * {
+  for (auto &t : m_tracepoints) {
+    if (t.number == number) {
+      return &t;
+    }
+  }
+  return nullptr;
+}
+
+auto debugger::traps_to_tracepoint(std::uint64_t address) const noexcept
+    -> bool {
+  return std::any_of(m_tracepoints.begin(), m_tracepoints.end(),
+                     [address](const tracepoint &t) {
+                       return t.fast == 0 && t.address == address;
+                     });
+}
+
+auto debugger::add_tracepoint(std::uint64_t address) -> void {
+  auto existing = m_breakpoints.find(address);
+  if ((existing != m_breakpoints.end() && existing->second.is_enabled()) ||
+      m_fast_tracepoints.covers(address)) {
+    std::cerr << "A breakpoint is in the way of the tracepoint" << std::endl;
+    return;
+  }
+
+  tracepoint t;
+  t.number = m_next_tracepoint++;
+  t.address = address;
+  m_tracepoints.push_back(std::move(t));
+  install_tracepoint(m_tracepoints.back());
+  std::cout << "Tracepoint " << std::dec << m_tracepoints.back().number
+            << " at 0x" << std::hex << address << std::endl;
+}
+
+auto debugger::remove_tracepoint(unsigned number) -> void {
+  auto t = find_tracepoint(number);
+  if (t == nullptr) {
+    std::cerr << "No tracepoint number " << std::dec << number << std::endl;
+    return;
+  }
+
+  if (t->fast != 0) {
+    drain_agent_records();
+    m_fast_tracepoints.remove(t->fast);
+  } else {
+    auto bp = m_breakpoints.find(t->address);
+    if (bp != m_breakpoints.end()) {
+      bp->second.disable();
+      m_breakpoints.erase(bp);
+    }
+  }
+  m_tracepoints.erase(m_tracepoints.begin() + (t - m_tracepoints.data()));
+}
+
+auto debugger::add_collect_action(unsigned number, const std::string &text)
+    -> void {
+  auto t = find_tracepoint(number);
+  if (t == nullptr) {
+    std::cerr << "No tracepoint number " << std::dec << number << std::endl;
+    return;
+  }
+
+  collect_action action;
+  action.text = text;
+  try {
+    auto args = split(text, ' ');
+    if (text == "$regs") {
+      action.kind = collect_kind::registers;
+    } else if (args[0] == "mem") {
+      if (args.size() != 3) {
+        throw std::invalid_argument{
+            "Usage: collect <tracepoint> mem <address> <size>"};
+      }
+      action.kind = collect_kind::memory;
+      action.address = std::stoull(args[1], 0, 16);
+      action.size = std::stoul(args[2], 0, 0);
+      if (action.size == 0 || action.size > max_collected_memory) {
+        throw std::invalid_argument{"Cannot collect that much memory"};
+      }
+      std::vector<std::uint8_t> probe(action.size);
+      if (!read_memory_block(m_pid, action.address, probe.data(),
+                             action.size)) {
+        std::ostringstream message;
+        message << "Cannot access memory at 0x" << std::hex
+                << action.address;
+        throw std::out_of_range{message.str()};
+      }
+    } else {
+      auto pc = offset_load_address(t->address);
+      action.kind = collect_kind::expression;
+      action.expr.reset(new expression{text, get_function_from_pc(pc), pc,
+                                       m_types, m_locations, m_globals});
+    }
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return;
+  }
+
+  t->actions.push_back(std::move(action));
+  t->slow = false;
+  install_tracepoint(*t);
+}
+
+auto debugger::install_tracepoint(tracepoint &t) -> void {
+  if (t.fast != 0) {
+    // Records written under the number of the old site go first
+    drain_agent_records();
+    t.hits +=
+        m_fast_tracepoints.site(*m_fast_tracepoints.find(t.address)).hits;
+    m_fast_tracepoints.remove(t.fast);
+    t.fast = 0;
+  }
+  auto bp = m_breakpoints.find(t.address);
+  if (bp != m_breakpoints.end()) {
+    bp->second.disable();
+    m_breakpoints.erase(bp);
+  }
+
+  if (m_fast_tracepoints.agent_loaded()) {
+    try {
+      auto pc = offset_load_address(t.address);
+      std::vector<agent_collect> ranges;
+      std::size_t total = 0;
+      for (const auto &action : t.actions) {
+        agent_collect range;
+        if (action.kind == collect_kind::registers) {
+          continue;
+        } else if (action.kind == collect_kind::memory) {
+          range.size = static_cast<std::uint32_t>(action.size);
+          range.offset = static_cast<std::int64_t>(action.address);
+        } else {
+          range = compile_agent_collect(*action.expr, pc, m_load_address,
+                                        m_locations, m_cfi);
+        }
+        total += range.size;
+        ranges.push_back(range);
+      }
+      if (ranges.size() > agent_max_collect || total > agent_record_data) {
+        throw std::invalid_argument{"Too much to collect for the agent"};
+      }
+
+      const auto &fast = add_fast_site(t.address, agent_site_record, {});
+      auto &site = m_fast_tracepoints.site(fast);
+      std::copy(ranges.begin(), ranges.end(), site.collect);
+      site.collects = static_cast<std::uint32_t>(ranges.size());
+      t.fast = fast.number;
+      return;
+    } catch (std::exception &e) {
+      std::cerr << "Tracepoint " << std::dec << t.number
+                << " is collected by the debugger: " << e.what()
+                << std::endl;
+      t.slow = true;
+    }
+  }
+
+  breakpoint trap{m_pid, static_cast<std::intptr_t>(t.address)};
+  trap.enable();
+  m_breakpoints[t.address] = trap;
+}
+
+auto debugger::collect_trace_frame() noexcept -> bool {
+  auto address = get_pc() - 1;
+  auto bp = m_breakpoints.find(address);
+  auto t = std::find_if(m_tracepoints.begin(), m_tracepoints.end(),
+                        [address](const tracepoint &t) {
+                          return t.fast == 0 && t.address == address;
+                        });
+  if (t == m_tracepoints.end() || bp == m_breakpoints.end() ||
+      !bp->second.is_enabled()) {
+    return false;
+  }
+
+  ++t->hits;
+  trace_frame collected;
+  collected.tracepoint = t->number;
+  try {
+    dwarf::die caller;
+    auto frames = get_innermost_frames(caller);
+    collected.regs = frames.at(0).regs;
+    collected.cfa = frames[0].cfa;
+    collected.eflags = get_register_value(m_pid, reg::rflags);
+
+    dwarf::die function;
+    try {
+      function = get_function_from_pc(offset_load_address(address));
+    } catch (std::out_of_range &) {
+    }
+    trace_recorder recorder{collected, m_pid,       frames,         function,
+                            caller,    m_locations, m_load_address, &m_tls};
+    for (const auto &action : t->actions) {
+      // Like the agent, a hit keeps whatever memory it could read
+      try {
+        if (action.kind == collect_kind::expression) {
+          read_value(action.expr->evaluate(recorder), recorder);
+        } else if (action.kind == collect_kind::memory) {
+          trace_block block;
+          block.address = action.address;
+          block.bytes.resize(action.size);
+          if (read_memory_block(m_pid, action.address, block.bytes.data(),
+                                action.size)) {
+            collected.blocks.push_back(std::move(block));
+          }
+        }
+      } catch (std::exception &) {
+      }
+    }
+
+    // A preloaded agent is mapped before any code of the program runs
+    if (!t->slow && !m_fast_tracepoints.agent_loaded()) {
+      t->slow = true;
+    } else if (!t->slow) {
+      install_tracepoint(*t);
+      if (t->fast != 0) {
+        set_pc(m_fast_tracepoints.find(t->address)->displaced);
+      }
+    }
+  } catch (std::exception &e) {
+    std::cerr << "Error in collecting tracepoint " << std::dec << t->number
+              << ": " << e.what() << std::endl;
+  }
+  m_trace.add(std::move(collected));
+  return true;
+}
+
+auto debugger::print_tracepoints() -> void {
+  drain_agent_records();
+  if (m_tracepoints.empty()) {
+    std::cout << "No tracepoints." << std::endl;
+    return;
+  }
+
+  for (const auto &t : m_tracepoints) {
+    auto hits = t.hits;
+    if (t.fast != 0) {
+      hits += m_fast_tracepoints.site(*m_fast_tracepoints.find(t.address))
+                  .hits.load();
+    }
+    std::cout << std::dec << t.number << ": 0x" << std::hex << t.address
+              << ", " << (t.fast != 0 ? "fast" : "trap") << ", " << std::dec
+              << hits << " hits" << std::endl;
+    for (const auto &action : t.actions) {
+      std::cout << "    collect " << action.text << std::endl;
+    }
+  }
+}
+
+auto debugger::find_trace_frame(const std::vector<std::string> &args)
+    -> void {
+  drain_agent_records();
+  auto mode = args.empty() ? std::string{"next"} : args[0];
+  if (mode == "end" || mode == "none") {
+    m_trace_selected = false;
+    std::cout << "No longer looking at any trace frame" << std::endl;
+    return;
+  }
+
+  // Frames before the selected one may have been overwritten since
+  auto next = m_trace_selected ? std::max(m_trace_frame + 1, m_trace.first())
+                               : m_trace.first();
+  const trace_frame *found = nullptr;
+  try {
+    if (mode == "start") {
+      found = m_trace.find(m_trace.first());
+    } else if (mode == "next" || mode == "+") {
+      found = m_trace.find(next);
+    } else if (mode == "prev" || mode == "-") {
+      auto last = m_trace_selected ? m_trace_frame : m_trace.end();
+      found = last > 0 ? m_trace.find(last - 1) : nullptr;
+    } else if (mode == "tracepoint") {
+      if (args.size() < 2) {
+        std::cerr << "Usage: tfind tracepoint <number>\n";
+        return;
+      }
+      auto number = std::stoul(args[1]);
+      for (auto n = next; n < m_trace.end() && found == nullptr; ++n) {
+        found = m_trace.find(n);
+        if (found->tracepoint != number) {
+          found = nullptr;
+        }
+      }
+    } else {
+      found = m_trace.find(std::stoull(mode));
+    }
+  } catch (std::exception &e) {
+    std::cerr << "Usage: tfind [start|end|next|prev|<frame>|tracepoint "
+                 "<number>]\n";
+    return;
+  }
+
+  if (found == nullptr) {
+    std::cerr << "No such trace frame" << std::endl;
+    return;
+  }
+  m_trace_selected = true;
+  m_trace_frame = found->number;
+  std::cout << "Found trace frame " << std::dec << found->number
+            << ", tracepoint " << found->tracepoint << std::endl;
+  frame f;
+  f.pc = found->pc();
+  f.interrupted = true;
+  print_frame(0, f);
+}
+
+auto debugger::dump_trace_frame() -> void {
+  auto collected = m_trace_selected ? m_trace.find(m_trace_frame) : nullptr;
+  if (collected == nullptr) {
+    std::cerr << "No trace frame selected" << std::endl;
+    return;
+  }
+  auto t = find_tracepoint(collected->tracepoint);
+  if (t == nullptr) {
+    std::cerr << "Tracepoint " << std::dec << collected->tracepoint
+              << " has been deleted" << std::endl;
+    return;
+  }
+
+  // Expressions see the frame as the only one of a stopped process
+  std::vector<frame> frames(1);
+  frames[0].pc = collected->pc();
+  frames[0].cfa = collected->cfa;
+  frames[0].regs = collected->regs;
+  frames[0].interrupted = true;
+  dwarf::die function;
+  try {
+    function = get_frame_function(frames[0]);
+  } catch (std::out_of_range &) {
+  }
+  trace_frame_context context{*collected, frames, function, m_locations,
+                              m_load_address};
+
+  for (const auto &action : t->actions) {
+    if (action.kind == collect_kind::registers) {
+      for (const auto &rd : g_register_descriptors) {
+        std::uint64_t value;
+        if (rd.r == reg::rip) {
+          value = collected->pc();
+        } else if (rd.r == reg::rflags) {
+          value = collected->eflags;
+        } else if (rd.dwarf_r >= 0 && collected->regs.has(rd.dwarf_r)) {
+          value = collected->regs.values[rd.dwarf_r];
+        } else {
+          continue;
+        }
+        std::cout << rd.name << " 0x" << std::setfill('0') << std::setw(16)
+                  << std::hex << value << std::endl;
+      }
+    } else if (action.kind == collect_kind::memory) {
+      for (std::size_t i = 0; i < action.size; i += 16) {
+        std::cout << "0x" << std::hex << action.address + i << ':';
+        for (auto j = i; j < std::min(i + 16, action.size); ++j) {
+          std::uint8_t byte;
+          if (collected->read(action.address + j, &byte, 1)) {
+            std::cout << ' ' << std::setfill('0') << std::setw(2)
+                      << static_cast<unsigned>(byte);
+          } else {
+            std::cout << " ??";
+          }
+        }
+        std::cout << std::endl;
+      }
+    } else {
+      try {
+        auto value = action.expr->evaluate(context);
+        auto bytes = read_value(value, context);
+        const auto &type = *value.type;
+        std::cout << action.text << " = ";
+        if (type.kind == type_kind::pointer) {
+          std::cout << '(' << type.name << ") ";
+        }
+        format_value(type, bytes.data(), std::cout);
+        std::cout << std::endl;
+      } catch (std::exception &e) {
+        std::cout << action.text << " = <" << e.what() << '>' << std::endl;
+      }
+    }
+  }
+}
+
+auto debugger::print_trace_status() -> void {
+  drain_agent_records();
+  std::cout << std::dec << m_trace.end() - m_trace.first()
+            << " trace frames collected, " << m_trace.first()
+            << " overwritten, " << m_fast_tracepoints.dropped()
+            << " dropped by the agent" << std::endl;
+  if (m_trace_selected) {
+    std::cout << "Looking at trace frame " << m_trace_frame << std::endl;
+  }
+}
+
+auto debugger::print_mappings() -> void {
+  std::ifstream maps{"/proc/" + std::to_string(m_pid) + "/maps"};
+  if (!maps) {
+    std::cerr << "Cannot read the mappings of the process" << std::endl;
+    return;
+  }
+
+  std::cout << std::setw(18) << "Start Addr" << ' ' << std::setw(18)
+            << "End Addr" << ' ' << std::setw(10) << "Size" << ' '
+            << std::setw(10) << "Offset" << " Perms  objfile\n";
+  std::string line;
+  while (std::getline(maps, line)) {
+    std::istringstream in{line};
+    std::uint64_t start, end, offset;
+    char dash;
+    std::string perms, device, inode, name;
+    in >> std::hex >> start >> dash >> end >> perms >> offset >> device >>
+        inode;
+    std::getline(in >> std::ws, name);
+    if (m_arena.mapped() && start == m_arena.address()) {
+      name = "[cdb shared arena]";
+    }
+    std::cout << std::hex << std::showbase << std::setw(18) << start << ' '
+              << std::setw(18) << end << ' ' << std::setw(10) << end - start
+              << ' ' << std::setw(10) << offset << std::noshowbase << ' '
+              << perms << "   " << name << '\n';
+  }
+  std::cout << std::flush;
+}
+
+auto debugger::step_over_breakpoint() -> void {
+  // A thread stopped at a fast conditional breakpoint resumes in the
+  // instructions its jump displaced
+  m_fast_tracepoints.leave();
+
+  // - 1 because execution will go past the breakpoint
+  auto possible_breakpoint_location = get_pc() - 1;
+
+  if (m_breakpoints.count(possible_breakpoint_location)) {
+    auto &bp = m_breakpoints[possible_breakpoint_location];
+
+    if (bp.is_enabled() &&
+        !move_condition_to_agent(possible_breakpoint_location)) {
+      auto previous_instruction_address = possible_breakpoint_location;
+      set_pc(previous_instruction_address);
+
+      bp.disable();
+      ptrace(PTRACE_SINGLESTEP, m_pid, nullptr, nullptr);
+      wait_for_signal();
+      check_watchpoints();
+      bp.enable();
+    }
+  }
+}
+
+auto debugger::wait_for_signal() noexcept -> int {
+  int status = 0;
+  pid_t pid;
+  while ((pid = waitpid(-1, &status, __WALL)) != -1 && pid != m_pid) {
+    auto first = m_tasks.insert(pid).second;
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      m_tasks.erase(pid);
+    }
+    resume_task(pid, status, first);
+  }
+  return status;
+}
+
+auto debugger::resume() noexcept -> bool {
+  auto at_syscall = [](int status) {
+    return WIFSTOPPED(status) && WSTOPSIG(status) == (SIGTRAP | 0x80);
+  };
+
+  int status;
+  while (true) {
+    // The return of a caught call is only seen with PTRACE_SYSCALL
+    auto request = m_syscalls.mode() == syscall_mode::off &&
+                           !m_latencies.active() && !m_caught_entered
+                       ? PTRACE_CONT
+                       : PTRACE_SYSCALL;
+    ptrace(request, m_pid, nullptr, nullptr);
+    status = wait_for_signal();
+
+    // The tasks the program starts are followed, not debugged
+    if (is_fork_stop(status)) {
+      continue;
+    }
+
+    user_regs_struct regs;
+    if (is_seccomp_stop(status)) {
+      if (ptrace(PTRACE_GETREGS, m_pid, nullptr, &regs) == -1) {
+        continue;
+      }
+
+      // A caught call is reported outside of the kernel, and is made again
+      // when the process is resumed, to stop at its return
+      if (m_caught != 0 && !m_caught_entered && regs.rip == m_caught_pc) {
+        m_caught_entered = true;
+        continue;
+      }
+      m_caught = 0;
+      m_caught_entered = false;
+      auto c = m_syscall_catches.find(static_cast<long>(regs.orig_rax));
+      if (c == nullptr) {
+        continue;
+      }
+      if (restart_syscall(m_pid, regs)) {
+        m_syscalls.forget_call();
+        m_latencies.forget_call();
+        m_caught = c->number;
+        m_caught_pc = regs.rip;
+      }
+      report_syscall_catch(*c, false);
+      return false;
+    }
+    if (!at_syscall(status)) {
+      break;
+    }
+
+    // The time of a call ends as soon as it returns
+    if (m_latencies.inside()) {
+      m_latencies.leave();
+    } else if (m_latencies.active() &&
+               ptrace(PTRACE_GETREGS, m_pid, nullptr, &regs) != -1) {
+      m_latencies.enter(static_cast<long>(regs.orig_rax));
+    }
+
+    // The return of a caught call follows the stop of the filter
+    auto returning = m_caught_entered ? m_caught : 0;
+    if (m_caught_entered) {
+      m_caught = 0;
+      m_caught_entered = false;
+    }
+    auto logging = m_syscalls.syscall_stop();
+    if (!logging) {
+      std::cout << m_syscalls.message() << std::endl;
+      m_vdso.restore_clock(m_pid);
+    }
+    if (returning != 0) {
+      const auto &catchpoints = m_syscall_catches.catchpoints();
+      auto c = std::find_if(catchpoints.begin(), catchpoints.end(),
+                            [returning](const syscall_catchpoint &c) {
+                              return c.number == returning;
+                            });
+      if (c != catchpoints.end()) {
+        report_syscall_catch(*c, true);
+        return false;
+      }
+    }
+    if (!logging) {
+      return false;
+    }
+  }
+  m_caught = 0;
+  m_caught_entered = false;
+  if ((WIFEXITED(status) || WIFSIGNALED(status)) && m_latencies.active()) {
+    std::cout << "System call latencies:\n";
+    m_latencies.print(std::cout);
+    m_latencies.stop();
+  }
+  return true;
+}
+
+auto debugger::initialise_load_address() noexcept -> void {
+  // If this is a dynamic library (e.g. PIE)
+  if (m_elf.get_hdr().type == elf::et::dyn) {
+    std::ifstream map("/proc/" + std::to_string(m_pid) + "/maps");
+
+    // Read the first address from the file
+    std::string addr;
+    std::getline(map, addr, '-');
+
+    m_load_address = std::stoull(addr, 0, 16);
+  }
+
+  m_unwinder.set_load_address(m_load_address);
+
+  // The entry point holds the instruction of injected system calls while
+  // they are made
+  m_injector.set_scratch_address(m_elf.get_hdr().entry + m_load_address);
+}
+
+auto debugger::initialise_cfi() noexcept -> void {
+  auto view = [this](const std::string &name) {
+    section_view v;
+    const auto &sec = m_elf.get_section(name);
+    if (sec.valid()) {
+      v.data = static_cast<const std::uint8_t *>(sec.data());
+      v.size = sec.size();
+      v.addr = sec.get_hdr().addr;
+    }
+    return v;
+  };
+
+  m_cfi = cfi_table{view(".eh_frame_hdr"), view(".eh_frame"),
+                    view(".debug_frame")};
+  m_symbols = symbol_index{m_elf};
+  m_objects = symbol_index{m_elf, elf::stt::object};
+  m_unwinder.set_text(view(".text"));
+  m_locations = location_cache{view(".debug_loc")};
+}
+
+auto debugger::initialise_vdso() -> void {
+  if (m_vdso.load(m_pid)) {
+    m_unwinder.add_module(m_vdso.module());
+  }
+}
+
+auto debugger::update_shared_objects() -> void {
+  if (m_shared_objects_current) {
+    return;
+  }
+  for (const auto &module : m_shared_objects.update(m_pid)) {
+    m_unwinder.add_module(module);
+  }
+  m_shared_objects_current = true;
+}
+
+auto debugger::print_backtrace() -> void {
+  update_shared_objects();
+  auto frames = m_unwinder.unwind(get_stop_registers());
+  for (std::size_t i = 0; i < frames.size(); ++i) {
+    print_frame(i, frames[i]);
+  }
+}
+
+auto debugger::get_stop_registers() noexcept -> dwarf_register_set {
+  auto regs = get_dwarf_register_set(m_pid);
+
+  // Report the breakpoint address rather than the byte after the int3
+  auto pc = regs.values[dwarf_return_address_register];
+  auto bp = m_breakpoints.find(pc - 1);
+  if (bp != m_breakpoints.end() && bp->second.is_enabled()) {
+    regs.set(dwarf_return_address_register, pc - 1);
+  }
+
+  return regs;
+}
+
+auto debugger::get_frames() -> const std::vector<frame> & {
+  if (m_frames.empty()) {
+    update_shared_objects();
+    m_frames = m_unwinder.unwind(get_stop_registers(), 256, unwind_mode::full);
+  }
+  return m_frames;
+}
+
+auto debugger::forget_frames() noexcept -> void {
+  m_frames.clear();
+  m_selected_frame = 0;
+  m_shared_objects_current = false;
+}
+
+auto debugger::select_frame(std::size_t index) -> void {
+  const auto &frames = get_frames();
+  if (index >= frames.size()) {
+    std::cerr << "No frame at level " << std::dec << index << std::endl;
+    return;
+  }
+
+  m_selected_frame = index;
+  print_frame(index, frames[index]);
+}
+
+auto debugger::print_frame(std::size_t index, const frame &f) -> void {
+  std::cout << "frame #" << std::dec << index << ": 0x" << std::hex << f.pc
+            << ' ' << get_frame_function_name(f) << std::endl;
+}
+
+auto debugger::get_frame_register_value(reg r) -> std::uint64_t {
+  if (m_selected_frame == 0) {
+    return get_register_value(m_pid, r);
+  }
+
+  auto it =
+      std::find_if(begin(g_register_descriptors), end(g_register_descriptors),
+                   [r](auto &&rd) { return rd.r == r; });
+  auto regnum = r == reg::rip ? static_cast<int>(dwarf_return_address_register)
+                              : it->dwarf_r;
+  if (regnum < 0 || static_cast<std::size_t>(regnum) >= n_dwarf_registers) {
+    return get_register_value(m_pid, r);
+  }
+
+  const auto &f = get_frames()[m_selected_frame];
+  return get_register_value_from_dwarf_register(f.regs, regnum);
+}
+
+auto debugger::read_variables() -> void {
+  dwarf::die func, caller;
+  if (!get_selected_functions(func, caller)) {
+    return;
+  }
+
+  frame_context context(m_pid, get_frames(), m_selected_frame, func, caller,
+                        m_locations, m_load_address, &m_tls);
+  for (const auto &die : func) {
+    if ((die.tag != dwarf::DW_TAG::variable &&
+         die.tag != dwarf::DW_TAG::formal_parameter) ||
+        !die.has(dwarf::DW_AT::location)) {
+      continue;
+    }
+
+    std::ostringstream out;
+    out << dwarf::at_name(die);
+    try {
+      auto program =
+          m_locations.get(die, dwarf::DW_AT::location).find(context.link_pc());
+      if (program == nullptr) {
+        throw std::out_of_range{"Variable is not live"};
+      }
+
+      auto location = evaluate_location(*program, context);
+      const auto &piece = location.pieces.front();
+      if (location.pieces.size() > 1) {
+        out << " (pieces)";
+      } else if (piece.type == location_piece::kind::memory) {
+        out << " (0x" << std::hex << piece.value << ')';
+      } else if (piece.type == location_piece::kind::reg) {
+        out << " ($" << get_dwarf_register_name(piece.value) << ')';
+      } else {
+        out << " (computed)";
+      }
+
+      auto bytes = read_location(location, get_variable_size(die), context);
+      std::uint64_t value = 0;
+      std::memcpy(&value, bytes.data(), bytes.size());
+      out << " = 0x" << std::hex << value;
+    } catch (std::exception &) {
+      out.str(dwarf::at_name(die));
+      out.seekp(0, std::ios_base::end);
+      out << " = <optimized out>";
+    }
+    std::cout << out.str() << std::endl;
+  }
+}
+
+auto debugger::print_expression(const std::string &text) -> void {
+  dwarf::die func, caller;
+  if (!get_selected_functions(func, caller)) {
+    return;
+  }
+
+  frame_context context(m_pid, get_frames(), m_selected_frame, func, caller,
+                        m_locations, m_load_address, &m_tls);
+  try {
+    expression expr{text, func, context.link_pc(), m_types, m_locations,
+                    m_globals};
+    auto value = expr.evaluate(context);
+
+    // The whole object is fetched at once and decoded locally
+    auto bytes = read_value(value, context);
+
+    // Containers fetch their elements as they are printed, so the output is
+    // streamed rather than built up first
+    const auto &type = *value.type;
+    std::cout << text << " = ";
+    if (type.kind == type_kind::pointer) {
+      std::cout << '(' << type.name << ") ";
+    }
+    libstdcxx_printer printer{m_pid, max_printed_elements};
+    format_value(type, bytes.data(), std::cout, &printer);
+    std::cout << std::endl;
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+  }
+}
+
+auto debugger::print_frame_variables(bool parameters) -> void {
+  dwarf::die func, caller;
+  if (!get_selected_functions(func, caller)) {
+    return;
+  }
+
+  frame_context context(m_pid, get_frames(), m_selected_frame, func, caller,
+                        m_locations, m_load_address, &m_tls);
+  const auto &scopes = m_scopes.get(func);
+  std::vector<const scope_variable *> variables;
+  if (parameters) {
+    variables = scopes.parameters();
+  } else {
+    for (const auto *block : scopes.visible(context.link_pc())) {
+      for (const auto &variable : block->variables) {
+        if (!variable.is_parameter) {
+          variables.push_back(&variable);
+        }
+      }
+    }
+  }
+  if (variables.empty()) {
+    std::cout << (parameters ? "No arguments." : "No locals.") << std::endl;
+    return;
+  }
+
+  // Locations are evaluated first, so that every variable living in memory
+  // can then be fetched with one read
+  std::vector<std::vector<std::uint8_t>> values(variables.size());
+  std::vector<std::string> errors(variables.size());
+  std::vector<memory_range> ranges;
+  std::vector<std::size_t> in_memory;
+  for (std::size_t i = 0; i < variables.size(); ++i) {
+    const auto &variable = *variables[i];
+    auto size = variable.type->size;
+    try {
+      auto program = variable.location == nullptr
+                         ? nullptr
+                         : variable.location->find(context.link_pc());
+      if (program == nullptr) {
+        throw std::out_of_range{"Variable is not live"};
+      }
+
+      auto location = evaluate_location(*program, context);
+      const auto &piece = location.pieces.front();
+      if (location.pieces.size() == 1 &&
+          piece.type == location_piece::kind::memory && piece.bit_size == 0) {
+        values[i].resize(size);
+        ranges.push_back({piece.value, values[i].data(), size});
+        in_memory.push_back(i);
+      } else {
+        values[i] = read_location(location, size, context);
+      }
+    } catch (std::exception &) {
+      errors[i] = "<optimized out>";
+    }
+  }
+
+  // A failed batch is retried range by range to find the unreadable ones
+  if (!read_memory_ranges(m_pid, ranges)) {
+    for (std::size_t k = 0; k < ranges.size(); ++k) {
+      if (!read_memory_block(m_pid, ranges[k].address, ranges[k].buffer,
+                             ranges[k].size)) {
+        errors[in_memory[k]] = "<error: Cannot access memory>";
+      }
+    }
+  }
+
+  libstdcxx_printer printer{m_pid, max_printed_elements};
+  for (std::size_t i = 0; i < variables.size(); ++i) {
+    const auto &variable = *variables[i];
+    std::cout << variable.name << " = ";
+    if (!errors[i].empty()) {
+      std::cout << errors[i];
+    } else {
+      if (variable.type->kind == type_kind::pointer) {
+        std::cout << '(' << variable.type->name << ") ";
+      }
+      format_value(*variable.type, values[i].data(), std::cout, &printer);
+    }
+    std::cout << std::endl;
+  }
+}
+
+auto debugger::add_display(const std::string &text) -> void {
+  dwarf::die func, caller;
+  if (!get_selected_functions(func, caller)) {
+    return;
+  }
+
+  frame_context context(m_pid, get_frames(), m_selected_frame, func, caller,
+                        m_locations, m_load_address, &m_tls);
+  try {
+    m_displays.push_back({m_next_display, expression{text, func,
+                                                     context.link_pc(),
+                                                     m_types, m_locations,
+                                                     m_globals}});
+    ++m_next_display;
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return;
+  }
+
+  write_output(format_displays({&m_displays.back()}, m_pid, get_frames(),
+                               m_selected_frame, caller, m_locations,
+                               m_load_address, &m_tls, max_printed_elements));
+}
+
+auto debugger::remove_display(unsigned number) -> void {
+  auto it = std::find_if(m_displays.begin(), m_displays.end(),
+                         [number](const display &d) {
+                           return d.number == number;
+                         });
+  if (it == m_displays.end()) {
+    std::cerr << "No display number " << std::dec << number << std::endl;
+    return;
+  }
+  m_displays.erase(it);
+}
+
+auto debugger::show_displays() noexcept -> void {
+  if (m_displays.empty()) {
+    return;
+  }
+
+  try {
+    dwarf::die caller;
+    auto frames = get_innermost_frames(caller);
+    if (frames.empty()) {
+      return;
+    }
+
+    dwarf::die function;
+    try {
+      function = get_frame_function(frames[0]);
+    } catch (std::out_of_range &) {
+    }
+
+    std::vector<const display *> shown;
+    for (const auto &d : m_displays) {
+      if (!d.expr.needs_frame() ||
+          (function.valid() && d.expr.function() == function)) {
+        shown.push_back(&d);
+      }
+    }
+    write_output(format_displays(shown, m_pid, frames, 0, caller,
+                                 m_locations, m_load_address, &m_tls,
+                                 max_printed_elements));
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+  }
+}
+
+auto debugger::watch_globals(const std::vector<std::string> &names)
+    -> void {
+  // Every name is resolved before any is watched, so that a typo adds none
+  std::vector<const global_variable *> globals;
+  for (const auto &name : names) {
+    auto global = m_globals.find(name);
+    if (global == nullptr) {
+      std::cerr << "No global \"" << name << "\"." << std::endl;
+      return;
+    }
+    globals.push_back(global);
+  }
+
+  for (auto global : globals) {
+    if (std::find(m_watched_globals.begin(), m_watched_globals.end(),
+                  global) == m_watched_globals.end()) {
+      m_watched_globals.push_back(global);
+    }
+  }
+  show_watched_globals();
+}
+
+auto debugger::show_watched_globals() noexcept -> void {
+  if (m_watched_globals.empty()) {
+    return;
+  }
+
+  try {
+    std::vector<std::vector<std::uint8_t>> values(m_watched_globals.size());
+    std::vector<std::string> errors(m_watched_globals.size());
+    std::vector<memory_range> ranges;
+    std::vector<std::size_t> fetched;
+    std::uint64_t thread_pointer = 0;
+    for (std::size_t i = 0; i < m_watched_globals.size(); ++i) {
+      const auto &global = *m_watched_globals[i];
+      std::uint64_t address;
+      if (global.fixed) {
+        address = global.address + m_load_address;
+      } else if (global.tls) {
+        try {
+          if (thread_pointer == 0) {
+            thread_pointer = get_dwarf_register_set(m_pid).fs_base;
+          }
+          address = m_tls.block_address(thread_pointer,
+                                        executable_tls_module) +
+                    global.address;
+        } catch (std::out_of_range &e) {
+          errors[i] = std::string{"<"} + e.what() + ">";
+          continue;
+        }
+      } else {
+        errors[i] = "<not at a fixed address>";
+        continue;
+      }
+
+      values[i].resize(m_types.get_type_of(global.die).size);
+      ranges.push_back({address, values[i].data(), values[i].size()});
+      fetched.push_back(i);
+    }
+
+    if (!read_memory_ranges(m_pid, ranges)) {
+      for (std::size_t k = 0; k < ranges.size(); ++k) {
+        if (!read_memory_block(m_pid, ranges[k].address, ranges[k].buffer,
+                               ranges[k].size)) {
+          errors[fetched[k]] = "<error: Cannot access memory>";
+        }
+      }
+    }
+
+    std::ostringstream out;
+    for (std::size_t i = 0; i < m_watched_globals.size(); ++i) {
+      const auto &global = *m_watched_globals[i];
+      const auto &type = m_types.get_type_of(global.die);
+      out << global.name << " = ";
+      if (!errors[i].empty()) {
+        out << errors[i];
+      } else {
+        if (type.kind == type_kind::pointer) {
+          out << '(' << type.name << ") ";
+        }
+        format_value(type, values[i].data(), out);
+      }
+      out << '\n';
+    }
+    write_output(out.str());
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+  }
+}
+
+auto debugger::get_innermost_frames(dwarf::die &caller)
+    -> std::vector<frame> {
+  // Expressions only see the stopped frame, and its caller for entry
+  // values, so the rest of the stack is not unwound
+  update_shared_objects();
+  auto frames = m_unwinder.unwind(get_stop_registers(), 2, unwind_mode::full);
+  if (frames.size() > 1) {
+    try {
+      caller = get_frame_function(frames[1]);
+    } catch (std::out_of_range &) {
+    }
+  }
+  return frames;
+}
+
+auto debugger::get_selected_functions(dwarf::die &function, dwarf::die &caller)
+    -> bool {
+  const auto &frames = get_frames();
+  if (m_selected_frame >= frames.size()) {
+    std::cerr << "No stack\n";
+    return false;
+  }
+
+  try {
+    function = get_frame_function(frames[m_selected_frame]);
+    if (m_selected_frame + 1 < frames.size()) {
+      caller = get_frame_function(frames[m_selected_frame + 1]);
+    }
+  } catch (std::out_of_range &) {
+    if (!function.valid()) {
+      std::cerr << "No symbol table info available\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+auto debugger::get_frame_function(const frame &f) -> dwarf::die {
+  // Return addresses may point past the end of the calling function
+  auto pc = f.interrupted ? f.pc : f.pc - 1;
+  return get_function_from_pc(offset_load_address(pc));
+}
+
+auto debugger::get_frame_function_name(const frame &f) -> std::string {
+  if (f.signal_trampoline) {
+    return "<signal handler called>";
+  }
+
+  try {
+    return dwarf::at_name(get_frame_function(f));
+  } catch (std::exception &) {
+    auto sym = m_unwinder.find_symbol(f.interrupted ? f.pc : f.pc - 1);
+    return sym != nullptr ? sym->name : "??";
+  }
+}
+
+auto debugger::read_memory(std::uint64_t address) const noexcept
+    -> std::uint64_t {
+  std::uint64_t value;
+  if (m_arena.read(address, &value, sizeof(value))) {
+    return value;
+  }
   return ptrace(PTRACE_PEEKDATA, m_pid, address, nullptr);
 }
 
-auto debugger::write_memory(std::uint16_t address,
+auto debugger::write_memory(std::uint64_t address,
                             std::uint64_t value) const noexcept -> void {
   ptrace(PTRACE_POKEDATA, m_pid, address, value);
 }
@@ -0,0 +1,148 @@
+#include "../include/display.h"
+#include "../include/frame_context.h"
+#include "../include/memory.h"
+#include "../include/pretty_printers.h"
+#include "../include/types.h"
+
+#include <cstdint>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Thrown when an evaluation needs memory that has not been fetched yet
+struct memory_pending {};
+
+/**
+ * A frame whose memory is read through a batch, so that an evaluation
+ * either completes from fetched memory or records what it is missing.
+ */
+class batched_frame_context : public frame_context {
+public:
+  batched_frame_context(memory_batch &batch, pid_t pid,
+                        const std::vector<frame> &frames, std::size_t index,
+                        dwarf::die function, dwarf::die caller,
+                        location_cache &locations, std::uint64_t load_address,
+                        tls_cache *tls)
+      : frame_context(pid, frames, index, std::move(function),
+                      std::move(caller), locations, load_address, tls),
+        m_batch{batch} {}
+
+  auto read_memory(std::uint64_t address, void *buffer, std::size_t size)
+      -> void override {
+    if (!m_batch.read(address, buffer, size)) {
+      throw memory_pending{};
+    }
+  }
+
+private:
+  memory_batch &m_batch; ///< Memory fetched for the evaluation
+};
+
+/**
+ * A container printer whose memory is read through the batch of the
+ * displays, so that the reads of every container shown at a stop share the
+ * rounds of the other displays.
+ */
+class batched_printer : public libstdcxx_printer {
+public:
+  batched_printer(memory_batch &batch, pid_t pid,
+                  std::size_t max_elements) noexcept
+      : libstdcxx_printer(pid, max_elements), m_batch{batch} {}
+
+protected:
+  auto read_block(std::uint64_t address, void *buffer, std::size_t size)
+      -> bool override {
+    try {
+      if (!m_batch.read(address, buffer, size)) {
+        throw memory_pending{};
+      }
+    } catch (std::out_of_range &) {
+      return false;
+    }
+    return true;
+  }
+
+  auto read_ranges(const std::vector<memory_range> &ranges)
+      -> bool override {
+    // Every missing range is recorded before the evaluation is abandoned,
+    // so that they are all fetched in the next round
+    auto fetched = true;
+    try {
+      for (const auto &r : ranges) {
+        fetched = m_batch.read(r.address, r.buffer, r.size) && fetched;
+      }
+    } catch (std::out_of_range &) {
+      return false;
+    }
+    if (!fetched) {
+      throw memory_pending{};
+    }
+    return true;
+  }
+
+private:
+  memory_batch &m_batch; ///< Memory fetched for the displays
+};
+
+} // namespace
+
+auto format_displays(const std::vector<const display *> &displays, pid_t pid,
+                     const std::vector<frame> &frames, std::size_t index,
+                     const dwarf::die &caller, location_cache &locations,
+                     std::uint64_t load_address, tls_cache *tls,
+                     std::size_t max_elements) -> std::string {
+  memory_batch batch{pid};
+  std::vector<std::string> lines(displays.size());
+  std::vector<std::size_t> pending(displays.size());
+  for (std::size_t i = 0; i < pending.size(); ++i) {
+    pending[i] = i;
+  }
+
+  // Every round evaluates the displays that are still missing memory, then
+  // fetches everything they asked for at once. Each round makes progress,
+  // as a display never asks for the same memory twice
+  while (!pending.empty()) {
+    std::vector<std::size_t> missing;
+    for (auto i : pending) {
+      const auto &d = *displays[i];
+      batched_frame_context context(batch, pid, frames, index,
+                                    d.expr.function(), caller, locations,
+                                    load_address, tls);
+      std::ostringstream out;
+      out << d.number << ": " << d.expr.text() << " = ";
+      try {
+        auto value = d.expr.evaluate(context);
+        auto bytes = read_value(value, context);
+        const auto &type = *value.type;
+        if (type.kind == type_kind::pointer) {
+          out << '(' << type.name << ") ";
+        }
+        batched_printer printer{batch, pid, max_elements};
+        format_value(type, bytes.data(), out, &printer);
+      } catch (memory_pending &) {
+        missing.push_back(i);
+        continue;
+      } catch (std::exception &e) {
+        out << '<' << e.what() << '>';
+      }
+      out << '\n';
+      lines[i] = out.str();
+    }
+
+    if (!batch.fetch()) {
+      break;
+    }
+    pending = std::move(missing);
+  }
+
+  std::string result;
+  for (const auto &line : lines) {
+    result += line;
+  }
+  return result;
+}
@@ -0,0 +1,768 @@
+#include "../include/dwarf_expr.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// DWARF expression opcodes
+constexpr std::uint8_t DW_OP_addr = 0x03;
+constexpr std::uint8_t DW_OP_deref = 0x06;
+constexpr std::uint8_t DW_OP_const1u = 0x08;
+constexpr std::uint8_t DW_OP_const1s = 0x09;
+constexpr std::uint8_t DW_OP_const2u = 0x0a;
+constexpr std::uint8_t DW_OP_const2s = 0x0b;
+constexpr std::uint8_t DW_OP_const4u = 0x0c;
+constexpr std::uint8_t DW_OP_const4s = 0x0d;
+constexpr std::uint8_t DW_OP_const8u = 0x0e;
+constexpr std::uint8_t DW_OP_const8s = 0x0f;
+constexpr std::uint8_t DW_OP_constu = 0x10;
+constexpr std::uint8_t DW_OP_consts = 0x11;
+constexpr std::uint8_t DW_OP_dup = 0x12;
+constexpr std::uint8_t DW_OP_drop = 0x13;
+constexpr std::uint8_t DW_OP_over = 0x14;
+constexpr std::uint8_t DW_OP_pick = 0x15;
+constexpr std::uint8_t DW_OP_swap = 0x16;
+constexpr std::uint8_t DW_OP_rot = 0x17;
+constexpr std::uint8_t DW_OP_abs = 0x19;
+constexpr std::uint8_t DW_OP_and = 0x1a;
+constexpr std::uint8_t DW_OP_div = 0x1b;
+constexpr std::uint8_t DW_OP_minus = 0x1c;
+constexpr std::uint8_t DW_OP_mod = 0x1d;
+constexpr std::uint8_t DW_OP_mul = 0x1e;
+constexpr std::uint8_t DW_OP_neg = 0x1f;
+constexpr std::uint8_t DW_OP_not = 0x20;
+constexpr std::uint8_t DW_OP_or = 0x21;
+constexpr std::uint8_t DW_OP_plus = 0x22;
+constexpr std::uint8_t DW_OP_plus_uconst = 0x23;
+constexpr std::uint8_t DW_OP_shl = 0x24;
+constexpr std::uint8_t DW_OP_shr = 0x25;
+constexpr std::uint8_t DW_OP_shra = 0x26;
+constexpr std::uint8_t DW_OP_xor = 0x27;
+constexpr std::uint8_t DW_OP_bra = 0x28;
+constexpr std::uint8_t DW_OP_eq = 0x29;
+constexpr std::uint8_t DW_OP_ge = 0x2a;
+constexpr std::uint8_t DW_OP_gt = 0x2b;
+constexpr std::uint8_t DW_OP_le = 0x2c;
+constexpr std::uint8_t DW_OP_lt = 0x2d;
+constexpr std::uint8_t DW_OP_ne = 0x2e;
+constexpr std::uint8_t DW_OP_skip = 0x2f;
+constexpr std::uint8_t DW_OP_lit0 = 0x30;
+constexpr std::uint8_t DW_OP_lit31 = 0x4f;
+constexpr std::uint8_t DW_OP_reg0 = 0x50;
+constexpr std::uint8_t DW_OP_reg31 = 0x6f;
+constexpr std::uint8_t DW_OP_breg0 = 0x70;
+constexpr std::uint8_t DW_OP_breg31 = 0x8f;
+constexpr std::uint8_t DW_OP_regx = 0x90;
+constexpr std::uint8_t DW_OP_fbreg = 0x91;
+constexpr std::uint8_t DW_OP_bregx = 0x92;
+constexpr std::uint8_t DW_OP_piece = 0x93;
+constexpr std::uint8_t DW_OP_deref_size = 0x94;
+constexpr std::uint8_t DW_OP_nop = 0x96;
+constexpr std::uint8_t DW_OP_form_tls_address = 0x9b;
+constexpr std::uint8_t DW_OP_call_frame_cfa = 0x9c;
+constexpr std::uint8_t DW_OP_bit_piece = 0x9d;
+constexpr std::uint8_t DW_OP_implicit_value = 0x9e;
+constexpr std::uint8_t DW_OP_stack_value = 0x9f;
+constexpr std::uint8_t DW_OP_entry_value = 0xa3;
+constexpr std::uint8_t DW_OP_GNU_push_tls_address = 0xe0;
+constexpr std::uint8_t DW_OP_GNU_entry_value = 0xf3;
+
+/**
+ * A bounds-checked cursor over the bytes of an expression.
+ */
+struct expr_reader {
+  const std::uint8_t *begin;
+  const std::uint8_t *pos;
+  const std::uint8_t *end;
+
+  auto need(std::size_t n) const -> void {
+    if (static_cast<std::size_t>(end - pos) < n) {
+      throw std::invalid_argument{"Truncated DWARF expression"};
+    }
+  }
+
+  auto offset() const -> std::size_t { return pos - begin; }
+
+  auto fixed(std::size_t n, bool is_signed) -> std::uint64_t {
+    need(n);
+    std::uint64_t value = 0;
+    std::memcpy(&value, pos, n);
+    pos += n;
+    if (is_signed && n < 8 && ((value >> (n * 8 - 1)) & 1)) {
+      value |= ~0ull << (n * 8);
+    }
+    return value;
+  }
+
+  auto uleb128() -> std::uint64_t {
+    std::uint64_t result = 0;
+    unsigned shift = 0;
+    std::uint8_t byte;
+    do {
+      byte = static_cast<std::uint8_t>(fixed(1, false));
+      if (shift < 64) {
+        result |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+      }
+      shift += 7;
+    } while (byte & 0x80);
+    return result;
+  }
+
+  auto sleb128() -> std::int64_t {
+    std::int64_t result = 0;
+    unsigned shift = 0;
+    std::uint8_t byte;
+    do {
+      byte = static_cast<std::uint8_t>(fixed(1, false));
+      if (shift < 64) {
+        result |= static_cast<std::int64_t>(byte & 0x7f) << shift;
+      }
+      shift += 7;
+    } while (byte & 0x80);
+    if (shift < 64 && (byte & 0x40)) {
+      result |= -(static_cast<std::int64_t>(1) << shift);
+    }
+    return result;
+  }
+};
+
+/**
+ * Runs decoded operations against a context. Locations that are not in
+ * memory are tracked separately from the stack until a piece completes.
+ */
+class machine {
+public:
+  machine(const std::vector<dwarf_op> &ops,
+          const std::vector<std::uint8_t> &data,
+          dwarf_expr_context &context) noexcept
+      : m_ops{ops}, m_data{data}, m_context{context} {}
+
+  auto push(std::uint64_t value) -> void { m_stack.push_back(value); }
+
+  auto run(std::size_t begin, std::size_t end) -> dwarf_location;
+
+private:
+  auto pop() -> std::uint64_t {
+    if (m_stack.empty()) {
+      throw std::invalid_argument{"DWARF expression stack underflow"};
+    }
+    auto value = m_stack.back();
+    m_stack.pop_back();
+    return value;
+  }
+
+  auto top(std::size_t depth = 0) const -> std::uint64_t {
+    if (m_stack.size() <= depth) {
+      throw std::invalid_argument{"DWARF expression stack underflow"};
+    }
+    return m_stack[m_stack.size() - 1 - depth];
+  }
+
+  auto deref(std::uint64_t address, std::size_t size) -> std::uint64_t {
+    std::uint64_t value = 0;
+    m_context.read_memory(address, &value, size);
+    return value;
+  }
+
+  auto binary(std::uint8_t code) -> void;
+
+  const std::vector<dwarf_op> &m_ops;
+  const std::vector<std::uint8_t> &m_data;
+  dwarf_expr_context &m_context;
+  std::vector<std::uint64_t> m_stack;
+};
+
+auto machine::binary(std::uint8_t code) -> void {
+  auto b = pop();
+  auto a = pop();
+  auto sa = static_cast<std::int64_t>(a);
+  auto sb = static_cast<std::int64_t>(b);
+
+  switch (code) {
+  case DW_OP_and:
+    return push(a & b);
+  case DW_OP_div:
+    if (b == 0) {
+      throw std::invalid_argument{"Division by zero in DWARF expression"};
+    }
+    return push(static_cast<std::uint64_t>(sa / sb));
+  case DW_OP_minus:
+    return push(a - b);
+  case DW_OP_mod:
+    if (b == 0) {
+      throw std::invalid_argument{"Division by zero in DWARF expression"};
+    }
+    return push(a % b);
+  case DW_OP_mul:
+    return push(a * b);
+  case DW_OP_or:
+    return push(a | b);
+  case DW_OP_plus:
+    return push(a + b);
+  case DW_OP_shl:
+    return push(b < 64 ? a << b : 0);
+  case DW_OP_shr:
+    return push(b < 64 ? a >> b : 0);
+  case DW_OP_shra:
+    return push(
+        static_cast<std::uint64_t>(sa >> std::min<std::uint64_t>(b, 63)));
+  case DW_OP_xor:
+    return push(a ^ b);
+  case DW_OP_eq:
+    return push(a == b);
+  case DW_OP_ge:
+    return push(sa >= sb);
+  case DW_OP_gt:
+    return push(sa > sb);
+  case DW_OP_le:
+    return push(sa <= sb);
+  case DW_OP_lt:
+    return push(sa < sb);
+  default:
+    return push(a != b);
+  }
+}
+
+auto machine::run(std::size_t begin, std::size_t end) -> dwarf_location {
+  dwarf_location result;
+  location_piece current;
+  auto has_current = false;
+
+  auto i = begin;
+  while (i < end) {
+    const auto &op = m_ops[i++];
+    auto code = op.code;
+
+    if (code >= DW_OP_lit0 && code <= DW_OP_lit31) {
+      push(code - DW_OP_lit0);
+      continue;
+    }
+    if (code >= DW_OP_reg0 && code <= DW_OP_reg31) {
+      current = location_piece{};
+      current.type = location_piece::kind::reg;
+      current.value = code - DW_OP_reg0;
+      has_current = true;
+      continue;
+    }
+    if (code >= DW_OP_breg0 && code <= DW_OP_breg31) {
+      push(m_context.reg(code - DW_OP_breg0) + op.arg1);
+      continue;
+    }
+
+    switch (code) {
+    case DW_OP_addr:
+      push(m_context.relocate(op.arg1));
+      break;
+    case DW_OP_deref:
+      push(deref(pop(), 8));
+      break;
+    case DW_OP_deref_size:
+      push(deref(pop(), op.arg1));
+      break;
+    case DW_OP_const1u:
+    case DW_OP_const1s:
+    case DW_OP_const2u:
+    case DW_OP_const2s:
+    case DW_OP_const4u:
+    case DW_OP_const4s:
+    case DW_OP_const8u:
+    case DW_OP_const8s:
+    case DW_OP_constu:
+    case DW_OP_consts:
+      push(op.arg1);
+      break;
+    case DW_OP_dup:
+      push(top());
+      break;
+    case DW_OP_drop:
+      pop();
+      break;
+    case DW_OP_over:
+      push(top(1));
+      break;
+    case DW_OP_pick:
+      push(top(op.arg1));
+      break;
+    case DW_OP_swap: {
+      auto a = pop();
+      auto b = pop();
+      push(a);
+      push(b);
+      break;
+    }
+    case DW_OP_rot: {
+      auto a = pop();
+      auto b = pop();
+      auto c = pop();
+      push(a);
+      push(c);
+      push(b);
+      break;
+    }
+    case DW_OP_abs: {
+      auto value = static_cast<std::int64_t>(pop());
+      push(static_cast<std::uint64_t>(value < 0 ? -value : value));
+      break;
+    }
+    case DW_OP_neg:
+      push(-pop());
+      break;
+    case DW_OP_not:
+      push(~pop());
+      break;
+    case DW_OP_plus_uconst:
+      push(pop() + op.arg1);
+      break;
+    case DW_OP_and:
+    case DW_OP_div:
+    case DW_OP_minus:
+    case DW_OP_mod:
+    case DW_OP_mul:
+    case DW_OP_or:
+    case DW_OP_plus:
+    case DW_OP_shl:
+    case DW_OP_shr:
+    case DW_OP_shra:
+    case DW_OP_xor:
+    case DW_OP_eq:
+    case DW_OP_ge:
+    case DW_OP_gt:
+    case DW_OP_le:
+    case DW_OP_lt:
+    case DW_OP_ne:
+      binary(code);
+      break;
+    case DW_OP_bra:
+      if (pop() != 0) {
+        i = op.arg1;
+      }
+      break;
+    case DW_OP_skip:
+      i = op.arg1;
+      break;
+    case DW_OP_regx:
+      current = location_piece{};
+      current.type = location_piece::kind::reg;
+      current.value = op.arg1;
+      has_current = true;
+      break;
+    case DW_OP_fbreg:
+      push(m_context.frame_base() + op.arg1);
+      break;
+    case DW_OP_bregx:
+      push(m_context.reg(op.arg1) + op.arg2);
+      break;
+    case DW_OP_call_frame_cfa:
+      push(m_context.call_frame_cfa());
+      break;
+    case DW_OP_form_tls_address:
+    case DW_OP_GNU_push_tls_address:
+      push(m_context.tls_address(pop()));
+      break;
+    case DW_OP_implicit_value:
+      current = location_piece{};
+      current.type = location_piece::kind::implicit;
+      current.data = m_data.data() + op.arg2;
+      current.bit_size = op.arg1 * 8;
+      has_current = true;
+      break;
+    case DW_OP_stack_value:
+      current = location_piece{};
+      current.type = location_piece::kind::value;
+      current.value = top();
+      has_current = true;
+      break;
+    case DW_OP_entry_value:
+    case DW_OP_GNU_entry_value: {
+      // The nested expression is evaluated against the state at function
+      // entry, and a register location there stands for its contents
+      auto &entry = m_context.entry_context();
+      machine inner{m_ops, m_data, entry};
+      auto location = inner.run(i, i + op.arg1);
+      i += op.arg1;
+      if (location.pieces.size() != 1) {
+        throw std::invalid_argument{"Composite entry value"};
+      }
+      const auto &piece = location.pieces.front();
+      switch (piece.type) {
+      case location_piece::kind::reg:
+        push(entry.reg(piece.value));
+        break;
+      case location_piece::kind::memory:
+      case location_piece::kind::value:
+        push(piece.value);
+        break;
+      default:
+        throw std::out_of_range{"Entry value is not available"};
+      }
+      break;
+    }
+    case DW_OP_piece:
+    case DW_OP_bit_piece: {
+      location_piece piece;
+      if (has_current) {
+        piece = current;
+        if (piece.type == location_piece::kind::value) {
+          pop();
+        }
+      } else if (!m_stack.empty()) {
+        piece.type = location_piece::kind::memory;
+        piece.value = pop();
+      }
+      piece.bit_size = code == DW_OP_piece ? op.arg1 * 8 : op.arg1;
+      piece.bit_offset = code == DW_OP_piece ? 0 : op.arg2;
+      result.pieces.push_back(piece);
+      has_current = false;
+      break;
+    }
+    case DW_OP_nop:
+      break;
+    default:
+      throw std::invalid_argument{"Unsupported DWARF operation"};
+    }
+  }
+
+  // Without pieces the expression describes the whole object
+  if (result.pieces.empty()) {
+    location_piece whole;
+    if (has_current) {
+      whole = current;
+      whole.bit_size = current.type == location_piece::kind::implicit
+                           ? current.bit_size
+                           : 0;
+    } else if (!m_stack.empty()) {
+      whole.type = location_piece::kind::memory;
+      whole.value = top();
+    }
+    result.pieces.push_back(whole);
+  }
+
+  return result;
+}
+
+} // namespace
+
+dwarf_program::dwarf_program(const std::uint8_t *expr, std::size_t size) {
+  decode(expr, size);
+}
+
+auto dwarf_program::decode(const std::uint8_t *expr, std::size_t size)
+    -> void {
+  expr_reader r{expr, expr, expr + size};
+
+  // Byte offset and index of every operation, to resolve branch targets
+  std::vector<std::pair<std::size_t, std::size_t>> positions;
+  std::vector<std::size_t> branches;
+
+  while (r.pos < r.end) {
+    positions.emplace_back(r.offset(), m_ops.size());
+
+    dwarf_op op;
+    op.code = static_cast<std::uint8_t>(r.fixed(1, false));
+    auto code = op.code;
+
+    if ((code >= DW_OP_lit0 && code <= DW_OP_lit31) ||
+        (code >= DW_OP_reg0 && code <= DW_OP_reg31)) {
+      m_ops.push_back(op);
+      continue;
+    }
+    if (code >= DW_OP_breg0 && code <= DW_OP_breg31) {
+      op.arg1 = r.sleb128();
+      m_ops.push_back(op);
+      continue;
+    }
+
+    switch (code) {
+    case DW_OP_addr:
+    case DW_OP_const8u:
+    case DW_OP_const8s:
+      op.arg1 = r.fixed(8, false);
+      break;
+    case DW_OP_const1u:
+    case DW_OP_const1s:
+    case DW_OP_const2u:
+    case DW_OP_const2s:
+    case DW_OP_const4u:
+    case DW_OP_const4s:
+      op.arg1 = r.fixed(std::size_t{1} << ((code - DW_OP_const1u) / 2),
+                        code & 1);
+      break;
+    case DW_OP_deref_size:
+    case DW_OP_pick:
+      op.arg1 = r.fixed(1, false);
+      if (code == DW_OP_deref_size && (op.arg1 == 0 || op.arg1 > 8)) {
+        throw std::invalid_argument{"Invalid DW_OP_deref_size"};
+      }
+      break;
+    case DW_OP_constu:
+    case DW_OP_plus_uconst:
+    case DW_OP_regx:
+    case DW_OP_piece:
+      op.arg1 = r.uleb128();
+      break;
+    case DW_OP_consts:
+    case DW_OP_fbreg:
+      op.arg1 = r.sleb128();
+      break;
+    case DW_OP_bregx:
+    case DW_OP_bit_piece:
+      op.arg1 = r.uleb128();
+      op.arg2 = code == DW_OP_bregx ? r.sleb128() : r.uleb128();
+      break;
+    case DW_OP_bra:
+    case DW_OP_skip: {
+      auto offset = static_cast<std::int64_t>(r.fixed(2, true));
+      op.arg1 = r.offset() + offset;
+      branches.push_back(m_ops.size());
+      break;
+    }
+    case DW_OP_implicit_value: {
+      op.arg1 = r.uleb128();
+      r.need(op.arg1);
+      op.arg2 = m_data.size();
+      m_data.insert(m_data.end(), r.pos, r.pos + op.arg1);
+      r.pos += op.arg1;
+      break;
+    }
+    case DW_OP_entry_value:
+    case DW_OP_GNU_entry_value: {
+      auto nested_size = r.uleb128();
+      r.need(nested_size);
+      auto index = m_ops.size();
+      m_ops.push_back(op);
+      decode(r.pos, nested_size);
+      m_ops[index].arg1 = m_ops.size() - index - 1;
+      r.pos += nested_size;
+      continue;
+    }
+    case DW_OP_deref:
+    case DW_OP_dup:
+    case DW_OP_drop:
+    case DW_OP_over:
+    case DW_OP_swap:
+    case DW_OP_rot:
+    case DW_OP_abs:
+    case DW_OP_and:
+    case DW_OP_div:
+    case DW_OP_minus:
+    case DW_OP_mod:
+    case DW_OP_mul:
+    case DW_OP_neg:
+    case DW_OP_not:
+    case DW_OP_or:
+    case DW_OP_plus:
+    case DW_OP_shl:
+    case DW_OP_shr:
+    case DW_OP_shra:
+    case DW_OP_xor:
+    case DW_OP_eq:
+    case DW_OP_ge:
+    case DW_OP_gt:
+    case DW_OP_le:
+    case DW_OP_lt:
+    case DW_OP_ne:
+    case DW_OP_nop:
+    case DW_OP_form_tls_address:
+    case DW_OP_call_frame_cfa:
+    case DW_OP_stack_value:
+    case DW_OP_GNU_push_tls_address:
+      break;
+    default:
+      throw std::invalid_argument{"Unsupported DWARF operation"};
+    }
+
+    m_ops.push_back(op);
+  }
+
+  // Branches may only target the start of an operation or the end
+  positions.emplace_back(size, m_ops.size());
+  for (auto index : branches) {
+    auto target = m_ops[index].arg1;
+    auto it = std::lower_bound(
+        positions.begin(), positions.end(), target,
+        [](const std::pair<std::size_t, std::size_t> &p, std::uint64_t t) {
+          return p.first < t;
+        });
+    if (it == positions.end() || it->first != target) {
+      throw std::invalid_argument{"Invalid branch in DWARF expression"};
+    }
+    m_ops[index].arg1 = it->second;
+  }
+}
+
+auto evaluate_location(const dwarf_program &program,
+                       dwarf_expr_context &context,
+                       const std::uint64_t *initial) -> dwarf_location {
+  machine m{program.ops(), program.data(), context};
+  if (initial != nullptr) {
+    m.push(*initial);
+  }
+  return m.run(0, program.ops().size());
+}
+
+auto evaluate_value(const dwarf_program &program, dwarf_expr_context &context,
+                    const std::uint64_t *initial) -> std::uint64_t {
+  auto location = evaluate_location(program, context, initial);
+  if (location.pieces.size() != 1) {
+    throw std::out_of_range{"Expression does not compute a single value"};
+  }
+
+  const auto &piece = location.pieces.front();
+  switch (piece.type) {
+  case location_piece::kind::memory:
+  case location_piece::kind::value:
+    return piece.value;
+  case location_piece::kind::reg:
+    return context.reg(piece.value);
+  default:
+    throw std::out_of_range{"Expression does not compute a value"};
+  }
+}
+
+auto read_location(const dwarf_location &location, std::size_t size,
+                   dwarf_expr_context &context) -> std::vector<std::uint8_t> {
+  std::vector<std::uint8_t> result(size);
+  std::vector<std::uint8_t> source;
+  std::uint64_t dest_bit = 0;
+  auto total_bits = static_cast<std::uint64_t>(size) * 8;
+
+  for (const auto &piece : location.pieces) {
+    if (dest_bit >= total_bits) {
+      break;
+    }
+
+    auto bits = piece.bit_size != 0 ? piece.bit_size : total_bits - dest_bit;
+    bits = std::min(bits, total_bits - dest_bit);
+    auto n_bytes = (piece.bit_offset + bits + 7) / 8;
+    source.assign(n_bytes, 0);
+
+    switch (piece.type) {
+    case location_piece::kind::memory:
+      context.read_memory(piece.value, source.data(), n_bytes);
+      break;
+    case location_piece::kind::reg:
+    case location_piece::kind::value: {
+      if (n_bytes > 8) {
+        throw std::out_of_range{"Piece is larger than a register"};
+      }
+      auto value = piece.type == location_piece::kind::reg
+                       ? context.reg(piece.value)
+                       : piece.value;
+      std::memcpy(source.data(), &value, n_bytes);
+      break;
+    }
+    case location_piece::kind::implicit:
+      std::memcpy(source.data(), piece.data,
+                  std::min<std::uint64_t>(n_bytes, piece.bit_size / 8));
+      break;
+    case location_piece::kind::undefined:
+      throw std::out_of_range{"Value is optimized out"};
+    }
+
+    // Pieces are byte aligned in practice, but bit pieces need not be
+    if (piece.bit_offset % 8 == 0 && bits % 8 == 0 && dest_bit % 8 == 0) {
+      std::memcpy(result.data() + dest_bit / 8,
+                  source.data() + piece.bit_offset / 8, bits / 8);
+    } else {
+      for (std::uint64_t b = 0; b < bits; ++b) {
+        auto src = piece.bit_offset + b;
+        auto dst = dest_bit + b;
+        auto bit = (source[src / 8] >> (src % 8)) & 1;
+        result[dst / 8] = static_cast<std::uint8_t>(
+            (result[dst / 8] & ~(1u << (dst % 8))) | (bit << (dst % 8)));
+      }
+    }
+    dest_bit += bits;
+  }
+
+  return result;
+}
+
+compiled_location::compiled_location(dwarf_program program) {
+  location_entry everywhere;
+  everywhere.high_pc = ~0ull;
+  everywhere.program = std::move(program);
+  m_entries.push_back(std::move(everywhere));
+}
+
+auto compiled_location::find(std::uint64_t pc) const noexcept
+    -> const dwarf_program * {
+  for (const auto &entry : m_entries) {
+    if (pc >= entry.low_pc && pc < entry.high_pc) {
+      return &entry.program;
+    }
+  }
+  return nullptr;
+}
+
+auto location_cache::get(const dwarf::die &die, dwarf::DW_AT attr)
+    -> const compiled_location & {
+  auto key =
+      (die.get_section_offset() << 16) | static_cast<std::uint64_t>(attr);
+  auto cached = m_locations.find(key);
+  if (cached != m_locations.end()) {
+    return cached->second;
+  }
+
+  auto value = die[attr];
+  compiled_location location;
+  switch (value.get_type()) {
+  case dwarf::value::type::exprloc:
+  case dwarf::value::type::block: {
+    std::size_t size;
+    auto data = static_cast<const std::uint8_t *>(value.as_block(&size));
+    location = compiled_location{dwarf_program{data, size}};
+    break;
+  }
+  case dwarf::value::type::loclist: {
+    // List entries are relative to the base address of the unit
+    const auto &root = die.get_unit().root();
+    auto base = root.has(dwarf::DW_AT::low_pc) ? dwarf::at_low_pc(root) : 0;
+    location = compiled_location{decode_list(value.as_sec_offset(), base)};
+    break;
+  }
+  default:
+    throw std::invalid_argument{"Unsupported location attribute form"};
+  }
+
+  return m_locations.emplace(key, std::move(location)).first->second;
+}
+
+auto location_cache::decode_list(std::uint64_t offset,
+                                 std::uint64_t base) const
+    -> std::vector<location_entry> {
+  if (!m_debug_loc.valid() || offset >= m_debug_loc.size) {
+    throw std::out_of_range{"Location list is outside .debug_loc"};
+  }
+
+  expr_reader r{m_debug_loc.data, m_debug_loc.data + offset,
+                m_debug_loc.data + m_debug_loc.size};
+  std::vector<location_entry> entries;
+  for (;;) {
+    auto begin = r.fixed(8, false);
+    auto end = r.fixed(8, false);
+    if (begin == 0 && end == 0) {
+      break;
+    }
+    if (begin == ~0ull) {
+      base = end;
+      continue;
+    }
+
+    auto length = r.fixed(2, false);
+    r.need(length);
+    location_entry entry;
+    entry.low_pc = base + begin;
+    entry.high_pc = base + end;
+    entry.program = dwarf_program{r.pos, length};
+    entries.push_back(std::move(entry));
+    r.pos += length;
+  }
+
+  return entries;
+}
@@ -0,0 +1,1404 @@
+#include "../include/expression.h"
+#include "../include/registers.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+/**
+ * A token of an expression. Numbers carry their value and type; every
+ * other token is identified by its text.
+ */
+struct token {
+  enum class kind {
+    end,        ///< End of the expression
+    identifier, ///< Name, possibly qualified with ::
+    reg,        ///< Register name following a $
+    number,     ///< Integer, floating or character literal
+    punct       ///< Operator or bracket
+  };
+
+  kind type = kind::end;
+  std::string text;
+  std::uint64_t value = 0; ///< Bits of a number
+  const type_desc *number_type = nullptr;
+};
+
+// Binary operators and their precedence, lowest first
+const struct {
+  const char *text;
+  int precedence;
+} binary_operators[] = {
+    {"||", 1}, {"&&", 2}, {"|", 3},   {"^", 4},   {"&", 5},
+    {"==", 6}, {"!=", 6}, {"<", 7},   {"<=", 7},  {">", 7},
+    {">=", 7}, {"<<", 8}, {">>", 8},  {"+", 9},   {"-", 9},
+    {"*", 10}, {"/", 10}, {"%", 10},
+};
+
+// Punctuators, with longer ones first so that they are matched first
+const char *const punctuators[] = {
+    "->", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||", ".", "[", "]",
+    "(",  ")",  "&",  "*",  "+",  "-",  "!",  "~",  "/",  "%", "<", ">",
+    "^",  "|",
+};
+
+// Words that may make up the name of a base type
+const char *const type_words[] = {"unsigned", "signed", "int",    "long",
+                                  "short",    "char",   "float",  "double",
+                                  "bool",     "void",   "const",  "volatile",
+                                  "struct",   "class",  "union",  "enum"};
+
+auto make_base(const char *name, std::uint64_t size, dwarf::DW_ATE encoding)
+    -> type_desc {
+  type_desc type;
+  type.kind = type_kind::base;
+  type.name = name;
+  type.size = size;
+  type.encoding = encoding;
+  return type;
+}
+
+// Types of literals and of the results of arithmetic, named as in C
+auto builtin_type(const std::string &name) -> const type_desc * {
+  static const std::vector<type_desc> types = [] {
+    std::vector<type_desc> t{
+        make_base("char", 1, dwarf::DW_ATE::signed_char),
+        make_base("signed char", 1, dwarf::DW_ATE::signed_char),
+        make_base("unsigned char", 1, dwarf::DW_ATE::unsigned_char),
+        make_base("short", 2, dwarf::DW_ATE::signed_),
+        make_base("unsigned short", 2, dwarf::DW_ATE::unsigned_),
+        make_base("int", 4, dwarf::DW_ATE::signed_),
+        make_base("unsigned int", 4, dwarf::DW_ATE::unsigned_),
+        make_base("long", 8, dwarf::DW_ATE::signed_),
+        make_base("unsigned long", 8, dwarf::DW_ATE::unsigned_),
+        make_base("bool", 1, dwarf::DW_ATE::boolean),
+        make_base("float", 4, dwarf::DW_ATE::float_),
+        make_base("double", 8, dwarf::DW_ATE::float_),
+        make_base("long double", 16, dwarf::DW_ATE::float_),
+    };
+    type_desc void_type;
+    void_type.name = "void";
+    t.push_back(void_type);
+    return t;
+  }();
+
+  for (const auto &type : types) {
+    if (type.name == name) {
+      return &type;
+    }
+  }
+  return nullptr;
+}
+
+auto int_type() -> const type_desc & { return *builtin_type("int"); }
+
+auto is_float(const type_desc &type) noexcept -> bool {
+  return type.kind == type_kind::base &&
+         type.encoding == dwarf::DW_ATE::float_;
+}
+
+auto is_integer(const type_desc &type) noexcept -> bool {
+  return (type.kind == type_kind::base && !is_float(type)) ||
+         type.kind == type_kind::enumeration;
+}
+
+auto is_signed(const type_desc &type) noexcept -> bool {
+  return type.kind == type_kind::enumeration ||
+         (type.kind == type_kind::base &&
+          (type.encoding == dwarf::DW_ATE::signed_ ||
+           type.encoding == dwarf::DW_ATE::signed_char));
+}
+
+// Arrays decay to pointers to their first element
+auto is_pointer_like(const type_desc &type) noexcept -> bool {
+  return type.kind == type_kind::pointer || type.kind == type_kind::array;
+}
+
+auto is_arithmetic(const type_desc &type) noexcept -> bool {
+  return is_integer(type) || is_float(type);
+}
+
+auto is_scalar(const type_desc &type) noexcept -> bool {
+  return is_arithmetic(type) || is_pointer_like(type);
+}
+
+auto tokenize(const std::string &text) -> std::vector<token> {
+  std::vector<token> tokens;
+  std::size_t i = 0;
+  auto is_name_char = [&](std::size_t at) {
+    return at < text.size() &&
+           (std::isalnum(static_cast<unsigned char>(text[at])) ||
+            text[at] == '_');
+  };
+
+  while (i < text.size()) {
+    auto c = text[i];
+    if (std::isspace(static_cast<unsigned char>(c))) {
+      ++i;
+      continue;
+    }
+
+    token tok;
+    auto start = i;
+    if (std::isalpha(static_cast<unsigned char>(c)) || c == '_' ||
+        c == '$') {
+      tok.type = c == '$' ? token::kind::reg : token::kind::identifier;
+      if (c == '$') {
+        ++start;
+        ++i;
+      }
+      // Qualified names such as std::string are a single token
+      while (is_name_char(i) ||
+             (tok.type == token::kind::identifier &&
+              text.compare(i, 2, "::") == 0 && is_name_char(i + 2))) {
+        i += text[i] == ':' ? 2 : 1;
+      }
+      tok.text = text.substr(start, i - start);
+    } else if (std::isdigit(static_cast<unsigned char>(c)) ||
+               (c == '.' && i + 1 < text.size() &&
+                std::isdigit(static_cast<unsigned char>(text[i + 1])))) {
+      tok.type = token::kind::number;
+      char *end;
+      auto hex = text.compare(i, 2, "0x") == 0 || text.compare(i, 2, "0X") == 0;
+      auto mantissa = i;
+      while (mantissa < text.size() &&
+             std::isdigit(static_cast<unsigned char>(text[mantissa]))) {
+        ++mantissa;
+      }
+      auto floating = !hex && mantissa < text.size() &&
+                      (text[mantissa] == '.' || text[mantissa] == 'e' ||
+                       text[mantissa] == 'E');
+      if (floating) {
+        auto value = std::strtod(text.c_str() + i, &end);
+        i = end - text.c_str();
+        tok.number_type = builtin_type("double");
+        if (i < text.size() && (text[i] == 'f' || text[i] == 'F')) {
+          tok.number_type = builtin_type("float");
+          ++i;
+        }
+        std::memcpy(&tok.value, &value, sizeof(value));
+      } else {
+        tok.value = std::strtoull(text.c_str() + i, &end, 0);
+        i = end - text.c_str();
+        auto is_unsigned = false;
+        auto is_long = false;
+        for (; i < text.size(); ++i) {
+          if (text[i] == 'u' || text[i] == 'U') {
+            is_unsigned = true;
+          } else if (text[i] == 'l' || text[i] == 'L') {
+            is_long = true;
+          } else {
+            break;
+          }
+        }
+        // A literal gets the smallest of int, long and unsigned long that
+        // holds it, as in C
+        auto int_max = is_unsigned ? 0xffffffffu : 0x7fffffffu;
+        if (!is_long && tok.value <= int_max) {
+          tok.number_type = builtin_type(is_unsigned ? "unsigned int" : "int");
+        } else if (!is_unsigned && tok.value <= 0x7fffffffffffffffu) {
+          tok.number_type = builtin_type("long");
+        } else {
+          tok.number_type = builtin_type("unsigned long");
+        }
+      }
+      if (is_name_char(i)) {
+        throw std::invalid_argument{"Invalid number \"" +
+                                    text.substr(start, i + 1 - start) + "\"."};
+      }
+      tok.text = text.substr(start, i - start);
+    } else if (c == '\'') {
+      tok.type = token::kind::number;
+      tok.number_type = builtin_type("char");
+      ++i;
+      if (i < text.size() && text[i] == '\\' && i + 1 < text.size()) {
+        ++i;
+        switch (text[i]) {
+        case 'n':
+          tok.value = '\n';
+          break;
+        case 't':
+          tok.value = '\t';
+          break;
+        case '0':
+          tok.value = 0;
+          break;
+        default:
+          tok.value = static_cast<unsigned char>(text[i]);
+          break;
+        }
+      } else if (i < text.size()) {
+        tok.value = static_cast<unsigned char>(text[i]);
+      }
+      if (i + 1 >= text.size() || text[i + 1] != '\'') {
+        throw std::invalid_argument{"Unmatched single quote."};
+      }
+      i += 2;
+      tok.text = text.substr(start, i - start);
+    } else {
+      tok.type = token::kind::punct;
+      for (auto p : punctuators) {
+        if (text.compare(i, std::strlen(p), p) == 0) {
+          tok.text = p;
+          break;
+        }
+      }
+      if (tok.text.empty()) {
+        throw std::invalid_argument{"Invalid character '" +
+                                    std::string(1, c) + "' in expression."};
+      }
+      i += tok.text.size();
+    }
+    tokens.push_back(std::move(tok));
+  }
+
+  tokens.emplace_back();
+  return tokens;
+}
+
+/**
+ * A scalar widened for arithmetic. Integers of signed types are sign
+ * extended to 64 bits.
+ */
+struct scalar {
+  bool is_float = false;
+  bool is_signed = false;
+  std::uint64_t bits = 0;
+  long double real = 0;
+};
+
+auto is_true(const scalar &s) noexcept -> bool {
+  return s.is_float ? s.real != 0 : s.bits != 0;
+}
+
+auto extend(std::uint64_t bits, std::uint64_t size, bool is_signed) noexcept
+    -> std::uint64_t {
+  if (size == 0 || size >= 8) {
+    return bits;
+  }
+  bits &= ~0ull >> (64 - size * 8);
+  if (is_signed && ((bits >> (size * 8 - 1)) & 1)) {
+    bits |= ~0ull << (size * 8);
+  }
+  return bits;
+}
+
+// Converts a scalar to the domain of a type, as a C cast would
+auto convert(const scalar &s, const type_desc &type) noexcept -> scalar {
+  scalar result;
+  if (is_float(type)) {
+    result.is_float = true;
+    result.real = s.is_float    ? s.real
+                  : s.is_signed ? static_cast<long double>(
+                                      static_cast<std::int64_t>(s.bits))
+                                : static_cast<long double>(s.bits);
+    return result;
+  }
+
+  result.is_signed = is_signed(type);
+  if (s.is_float) {
+    result.bits = result.is_signed
+                      ? static_cast<std::uint64_t>(
+                            static_cast<std::int64_t>(s.real))
+                      : static_cast<std::uint64_t>(s.real);
+  } else {
+    result.bits = s.bits;
+  }
+  if (type.kind == type_kind::base &&
+      type.encoding == dwarf::DW_ATE::boolean) {
+    result.bits = is_true(s) ? 1 : 0;
+  }
+  result.bits = extend(result.bits, type.size, result.is_signed);
+  return result;
+}
+
+auto make_value(const type_desc &type, const scalar &s) -> expr_value {
+  auto converted = convert(s, type);
+  expr_value value;
+  value.type = &type;
+  value.bytes.resize(type.size);
+  if (converted.is_float) {
+    if (type.size == sizeof(float)) {
+      auto f = static_cast<float>(converted.real);
+      std::memcpy(value.bytes.data(), &f, sizeof(f));
+    } else if (type.size == sizeof(double)) {
+      auto d = static_cast<double>(converted.real);
+      std::memcpy(value.bytes.data(), &d, sizeof(d));
+    } else {
+      std::memcpy(value.bytes.data(), &converted.real,
+                  std::min<std::size_t>(type.size, sizeof(converted.real)));
+    }
+  } else {
+    std::memcpy(value.bytes.data(), &converted.bits,
+                std::min<std::size_t>(type.size, sizeof(converted.bits)));
+  }
+  return value;
+}
+
+auto load_scalar(const expr_value &value, dwarf_expr_context &context)
+    -> scalar {
+  const auto &type = *value.type;
+  scalar s;
+  if (type.kind == type_kind::array) {
+    if (!value.in_memory) {
+      throw std::invalid_argument{"Array is not located in memory."};
+    }
+    s.bits = value.address;
+    return s;
+  }
+  if (!is_scalar(type)) {
+    throw std::invalid_argument{"Value of type " + type.name +
+                                " is not a scalar."};
+  }
+
+  std::uint8_t data[16] = {};
+  auto size = std::min<std::size_t>(type.size, sizeof(data));
+  if (value.in_memory) {
+    context.read_memory(value.address, data, size);
+  } else {
+    std::memcpy(data, value.bytes.data(),
+                std::min(size, value.bytes.size()));
+  }
+
+  if (is_float(type)) {
+    s.is_float = true;
+    if (size == sizeof(float)) {
+      float f;
+      std::memcpy(&f, data, sizeof(f));
+      s.real = f;
+    } else if (size == sizeof(double)) {
+      double d;
+      std::memcpy(&d, data, sizeof(d));
+      s.real = d;
+    } else {
+      std::memcpy(&s.real, data, std::min(size, sizeof(s.real)));
+    }
+    return s;
+  }
+
+  s.is_signed = is_signed(type);
+  std::memcpy(&s.bits, data, std::min(size, sizeof(s.bits)));
+  s.bits = extend(s.bits, size, s.is_signed);
+  return s;
+}
+
+auto arithmetic(expr_opcode op, const scalar &a, const scalar &b) -> scalar {
+  scalar result = a;
+  if (a.is_float) {
+    switch (op) {
+    case expr_opcode::add:
+      result.real = a.real + b.real;
+      break;
+    case expr_opcode::sub:
+      result.real = a.real - b.real;
+      break;
+    case expr_opcode::mul:
+      result.real = a.real * b.real;
+      break;
+    default:
+      if (b.real == 0) {
+        throw std::invalid_argument{"Division by zero"};
+      }
+      result.real = a.real / b.real;
+      break;
+    }
+    return result;
+  }
+
+  auto sa = static_cast<std::int64_t>(a.bits);
+  auto sb = static_cast<std::int64_t>(b.bits);
+  switch (op) {
+  case expr_opcode::add:
+    result.bits = a.bits + b.bits;
+    break;
+  case expr_opcode::sub:
+    result.bits = a.bits - b.bits;
+    break;
+  case expr_opcode::mul:
+    result.bits = a.bits * b.bits;
+    break;
+  case expr_opcode::div:
+  case expr_opcode::mod:
+    if (b.bits == 0) {
+      throw std::invalid_argument{"Division by zero"};
+    }
+    if (a.is_signed && !(sb == -1 && sa == INT64_MIN)) {
+      result.bits = static_cast<std::uint64_t>(
+          op == expr_opcode::div ? sa / sb : sa % sb);
+    } else if (a.is_signed) {
+      result.bits = op == expr_opcode::div ? a.bits : 0;
+    } else {
+      result.bits = op == expr_opcode::div ? a.bits / b.bits : a.bits % b.bits;
+    }
+    break;
+  case expr_opcode::shl:
+    result.bits = a.bits << (b.bits & 63);
+    break;
+  case expr_opcode::shr:
+    result.bits = a.is_signed ? static_cast<std::uint64_t>(sa >> (b.bits & 63))
+                              : a.bits >> (b.bits & 63);
+    break;
+  case expr_opcode::bit_and:
+    result.bits = a.bits & b.bits;
+    break;
+  case expr_opcode::bit_or:
+    result.bits = a.bits | b.bits;
+    break;
+  default:
+    result.bits = a.bits ^ b.bits;
+    break;
+  }
+  return result;
+}
+
+auto compare(expr_opcode op, const scalar &a, const scalar &b) noexcept
+    -> bool {
+  int order;
+  if (a.is_float) {
+    order = a.real < b.real ? -1 : a.real > b.real ? 1 : 0;
+  } else if (a.is_signed) {
+    auto sa = static_cast<std::int64_t>(a.bits);
+    auto sb = static_cast<std::int64_t>(b.bits);
+    order = sa < sb ? -1 : sa > sb ? 1 : 0;
+  } else {
+    order = a.bits < b.bits ? -1 : a.bits > b.bits ? 1 : 0;
+  }
+
+  switch (op) {
+  case expr_opcode::eq:
+    return order == 0;
+  case expr_opcode::ne:
+    return order != 0;
+  case expr_opcode::lt:
+    return order < 0;
+  case expr_opcode::le:
+    return order <= 0;
+  case expr_opcode::gt:
+    return order > 0;
+  default:
+    return order >= 0;
+  }
+}
+
+// Finds a variable by name in a scope. Variables of the innermost enclosing
+// block shadow outer ones
+auto find_variable(const dwarf::die &scope, const std::string &name,
+                   std::uint64_t pc, dwarf::die &result) -> bool {
+  for (const auto &die : scope) {
+    if (die.tag == dwarf::DW_TAG::lexical_block &&
+        dwarf::die_pc_range(die).contains(pc) &&
+        find_variable(die, name, pc, result)) {
+      return true;
+    }
+  }
+
+  for (const auto &die : scope) {
+    if ((die.tag == dwarf::DW_TAG::variable ||
+         die.tag == dwarf::DW_TAG::formal_parameter) &&
+        die.has(dwarf::DW_AT::location) && die.has(dwarf::DW_AT::name) &&
+        dwarf::at_name(die) == name) {
+      result = die;
+      return true;
+    }
+  }
+  return false;
+}
+
+auto find_enumerator(const dwarf::die &scope, const std::string &name,
+                     dwarf::die &type, std::int64_t &value) -> bool {
+  for (const auto &die : scope) {
+    if (die.tag != dwarf::DW_TAG::enumeration_type) {
+      continue;
+    }
+    for (const auto &e : die) {
+      if (e.tag == dwarf::DW_TAG::enumerator && e.has(dwarf::DW_AT::name) &&
+          e.has(dwarf::DW_AT::const_value) && dwarf::at_name(e) == name) {
+        auto v = e[dwarf::DW_AT::const_value];
+        value = v.get_type() == dwarf::value::type::sconstant
+                    ? v.as_sconstant()
+                    : static_cast<std::int64_t>(v.as_uconstant());
+        type = die;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Finds a named type, descending into namespaces for qualified names
+auto find_type(const dwarf::die &scope, const std::string &name,
+               dwarf::die &result) -> bool {
+  auto qualifier = name.find("::");
+  for (const auto &die : scope) {
+    if (!die.has(dwarf::DW_AT::name)) {
+      continue;
+    }
+    if (qualifier != std::string::npos) {
+      if (die.tag == dwarf::DW_TAG::namespace_ &&
+          dwarf::at_name(die) == name.substr(0, qualifier) &&
+          find_type(die, name.substr(qualifier + 2), result)) {
+        return true;
+      }
+      continue;
+    }
+
+    switch (die.tag) {
+    case dwarf::DW_TAG::base_type:
+    case dwarf::DW_TAG::typedef_:
+    case dwarf::DW_TAG::structure_type:
+    case dwarf::DW_TAG::class_type:
+    case dwarf::DW_TAG::union_type:
+    case dwarf::DW_TAG::enumeration_type:
+      if (!die.has(dwarf::DW_AT::declaration) && dwarf::at_name(die) == name) {
+        result = die;
+        return true;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  return false;
+}
+
+// Finds a member by name, looking through base classes and anonymous
+// structures and unions
+auto find_member(const type_desc &type, const std::string &name,
+                 std::uint64_t base, type_member &result) -> bool {
+  for (const auto &member : type.members) {
+    if (!member.is_base_class && member.name == name) {
+      result = member;
+      result.offset += base;
+      return true;
+    }
+  }
+  for (const auto &member : type.members) {
+    if ((member.is_base_class || member.name.empty()) &&
+        member.type->kind == type_kind::structure &&
+        find_member(*member.type, name, base + member.offset, result)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+/**
+ * Recursive descent parser that type checks an expression and emits its
+ * operations in evaluation order.
+ */
+class expr_compiler {
+public:
+  expr_compiler(expression &expr, std::uint64_t pc, type_index &types,
+                location_cache &locations, const global_index &globals)
+      : m_expr{expr}, m_pc{pc}, m_types{types}, m_locations{locations},
+        m_globals{globals}, m_tokens{tokenize(expr.m_text)} {}
+
+  auto compile() -> void {
+    auto result = parse_binary(1);
+    if (peek().type != token::kind::end) {
+      throw std::invalid_argument{"A syntax error in expression, near `" +
+                                  peek().text + "'."};
+    }
+    m_expr.m_type = result.type;
+  }
+
+private:
+  /**
+   * The static type of a subexpression, and whether it designates an
+   * object, which may have its address taken.
+   */
+  struct operand {
+    const type_desc *type;
+    bool lvalue;
+  };
+
+  auto peek() const noexcept -> const token & { return m_tokens[m_pos]; }
+
+  auto accept(const char *punct) noexcept -> bool {
+    if (peek().type == token::kind::punct && peek().text == punct) {
+      ++m_pos;
+      return true;
+    }
+    return false;
+  }
+
+  auto expect(const char *punct) -> void {
+    if (!accept(punct)) {
+      throw std::invalid_argument{std::string{"Expected `"} + punct +
+                                  "' in expression."};
+    }
+  }
+
+  auto emit(expr_opcode op, const type_desc &type, std::uint64_t arg1 = 0,
+            std::uint64_t arg2 = 0) -> std::size_t {
+    expr_insn insn;
+    insn.op = op;
+    insn.type = &type;
+    insn.arg1 = arg1;
+    insn.arg2 = arg2;
+    m_expr.m_insns.push_back(insn);
+    return m_expr.m_insns.size() - 1;
+  }
+
+  auto derive(type_desc type) -> const type_desc & {
+    m_expr.m_derived.emplace_back(new type_desc(std::move(type)));
+    return *m_expr.m_derived.back();
+  }
+
+  auto pointer_to(const type_desc &target) -> const type_desc & {
+    for (const auto &derived : m_expr.m_derived) {
+      if (derived->kind == type_kind::pointer && derived->target == &target) {
+        return *derived;
+      }
+    }
+    type_desc type;
+    type.kind = type_kind::pointer;
+    type.size = sizeof(std::uint64_t);
+    type.target = &target;
+    type.name = target.name + " *";
+    return derive(std::move(type));
+  }
+
+  // The type of an element of an array, which for arrays of several
+  // dimensions is itself an array
+  auto element_of(const type_desc &type) -> const type_desc & {
+    if (type.kind == type_kind::pointer) {
+      return *type.target;
+    }
+    if (type.dimensions.size() <= 1) {
+      return *type.target;
+    }
+
+    type_desc element;
+    element.kind = type_kind::array;
+    element.target = type.target;
+    element.dimensions.assign(type.dimensions.begin() + 1,
+                              type.dimensions.end());
+    element.size = type.target->size;
+    element.name = type.target->name;
+    for (auto n : element.dimensions) {
+      element.size *= n;
+      element.name += "[" + std::to_string(n) + "]";
+    }
+    return derive(std::move(element));
+  }
+
+  // The type an integer is promoted to before arithmetic
+  auto promote(const type_desc &type) -> const type_desc & {
+    if (is_float(type)) {
+      return type;
+    }
+    auto is_unsigned = !is_signed(type);
+    if (type.size < 4 || (type.size == 4 && !is_unsigned)) {
+      return int_type();
+    }
+    if (type.size == 4) {
+      return *builtin_type("unsigned int");
+    }
+    return *builtin_type(is_unsigned ? "unsigned long" : "long");
+  }
+
+  // The common type of the operands of arithmetic
+  auto common_type(const type_desc &a, const type_desc &b)
+      -> const type_desc & {
+    if (is_float(a) || is_float(b)) {
+      if (!is_float(b)) {
+        return a;
+      }
+      if (!is_float(a)) {
+        return b;
+      }
+      return a.size >= b.size ? a : b;
+    }
+
+    const auto &pa = promote(a);
+    const auto &pb = promote(b);
+    if (pa.size != pb.size) {
+      return pa.size > pb.size ? pa : pb;
+    }
+    return is_signed(pa) ? pb : pa;
+  }
+
+  auto require(bool condition, const std::string &message) -> void {
+    if (!condition) {
+      throw std::invalid_argument{message};
+    }
+  }
+
+  // References are used through the object they refer to
+  auto dereference(operand op) -> operand {
+    if (op.type->kind == type_kind::reference) {
+      emit(expr_opcode::deref, *op.type->target);
+      return {op.type->target, true};
+    }
+    return op;
+  }
+
+  auto parse_binary(int min_precedence) -> operand {
+    auto lhs = parse_unary();
+    while (peek().type == token::kind::punct) {
+      auto precedence = 0;
+      for (const auto &o : binary_operators) {
+        if (peek().text == o.text) {
+          precedence = o.precedence;
+        }
+      }
+      if (precedence < min_precedence || precedence == 0) {
+        break;
+      }
+
+      auto text = peek().text;
+      ++m_pos;
+      if (text == "&&" || text == "||") {
+        require(is_scalar(*lhs.type), "Invalid operand of " + text + ".");
+        auto jump = emit(text == "&&" ? expr_opcode::and_jump
+                                      : expr_opcode::or_jump,
+                         int_type());
+        auto rhs = parse_binary(precedence + 1);
+        require(is_scalar(*rhs.type), "Invalid operand of " + text + ".");
+        emit(expr_opcode::to_bool, int_type());
+        m_expr.m_insns[jump].arg1 = m_expr.m_insns.size();
+        lhs = {&int_type(), false};
+        continue;
+      }
+
+      auto rhs = parse_binary(precedence + 1);
+      lhs = emit_binary(text, lhs, rhs);
+    }
+    return lhs;
+  }
+
+  auto emit_binary(const std::string &text, operand lhs, operand rhs)
+      -> operand {
+    const auto &a = *lhs.type;
+    const auto &b = *rhs.type;
+
+    // Pointer arithmetic scales the integer by the size of the pointee
+    if ((text == "+" || text == "-") && is_pointer_like(a) && is_integer(b)) {
+      const auto &element = element_of(a);
+      const auto &pointer = pointer_to(element);
+      emit(text == "+" ? expr_opcode::ptr_add : expr_opcode::ptr_sub, pointer,
+           element.size != 0 ? element.size : 1);
+      return {&pointer, false};
+    }
+    if (text == "+" && is_integer(a) && is_pointer_like(b)) {
+      const auto &element = element_of(b);
+      const auto &pointer = pointer_to(element);
+      emit(expr_opcode::ptr_add, pointer,
+           element.size != 0 ? element.size : 1);
+      return {&pointer, false};
+    }
+    if (text == "-" && is_pointer_like(a) && is_pointer_like(b)) {
+      const auto &element = element_of(a);
+      emit(expr_opcode::ptr_diff, *builtin_type("long"),
+           element.size != 0 ? element.size : 1);
+      return {builtin_type("long"), false};
+    }
+
+    struct {
+      const char *text;
+      expr_opcode op;
+    } const comparisons[] = {
+        {"==", expr_opcode::eq}, {"!=", expr_opcode::ne},
+        {"<", expr_opcode::lt},  {"<=", expr_opcode::le},
+        {">", expr_opcode::gt},  {">=", expr_opcode::ge},
+    };
+    for (const auto &c : comparisons) {
+      if (text != c.text) {
+        continue;
+      }
+      require(is_scalar(a) && is_scalar(b),
+              "Invalid operands of " + text + ".");
+      // Pointers are compared as addresses
+      const auto &type = is_pointer_like(a) || is_pointer_like(b)
+                             ? *builtin_type("unsigned long")
+                             : common_type(a, b);
+      emit(c.op, type);
+      return {&int_type(), false};
+    }
+
+    struct {
+      const char *text;
+      expr_opcode op;
+      bool integer_only;
+    } const operators[] = {
+        {"+", expr_opcode::add, false},    {"-", expr_opcode::sub, false},
+        {"*", expr_opcode::mul, false},    {"/", expr_opcode::div, false},
+        {"%", expr_opcode::mod, true},     {"<<", expr_opcode::shl, true},
+        {">>", expr_opcode::shr, true},    {"&", expr_opcode::bit_and, true},
+        {"|", expr_opcode::bit_or, true},  {"^", expr_opcode::bit_xor, true},
+    };
+    for (const auto &o : operators) {
+      if (text != o.text) {
+        continue;
+      }
+      require(o.integer_only ? is_integer(a) && is_integer(b)
+                             : is_arithmetic(a) && is_arithmetic(b),
+              "Invalid operands of " + text + ".");
+      // Shifts have the type of their promoted left operand
+      const auto &type = o.op == expr_opcode::shl || o.op == expr_opcode::shr
+                             ? promote(a)
+                             : common_type(a, b);
+      emit(o.op, type);
+      return {&type, false};
+    }
+    throw std::invalid_argument{"Unknown operator " + text + "."};
+  }
+
+  auto parse_unary() -> operand {
+    if (accept("-") || accept("+") || accept("~")) {
+      auto text = m_tokens[m_pos - 1].text;
+      auto op = parse_unary();
+      require(text == "~" ? is_integer(*op.type) : is_arithmetic(*op.type),
+              "Invalid operand of unary " + text + ".");
+      const auto &type = promote(*op.type);
+      emit(text == "-"   ? expr_opcode::negate
+           : text == "~" ? expr_opcode::bit_not
+                         : expr_opcode::convert,
+           type);
+      return {&type, false};
+    }
+    if (accept("!")) {
+      auto op = parse_unary();
+      require(is_scalar(*op.type), "Invalid operand of !.");
+      emit(expr_opcode::logical_not, int_type());
+      return {&int_type(), false};
+    }
+    if (accept("*")) {
+      auto op = parse_unary();
+      require(is_pointer_like(*op.type),
+              "Attempt to take contents of a non-pointer value.");
+      const auto &target = element_of(*op.type);
+      require(target.kind != type_kind::unknown &&
+                  target.kind != type_kind::function,
+              "Attempt to take contents of a non-pointer value.");
+      emit(expr_opcode::deref, target);
+      return {&target, true};
+    }
+    if (accept("&")) {
+      auto op = parse_unary();
+      require(op.lvalue,
+              "Attempt to take address of value not located in memory.");
+      const auto &pointer = pointer_to(*op.type);
+      emit(expr_opcode::address, pointer);
+      return {&pointer, false};
+    }
+
+    // A parenthesised type name is a cast
+    if (peek().type == token::kind::punct && peek().text == "(" &&
+        is_type_name(m_tokens[m_pos + 1])) {
+      ++m_pos;
+      const auto &type = parse_type();
+      expect(")");
+      auto op = parse_unary();
+      if (op.type == &type) {
+        return op;
+      }
+      require(is_scalar(type) && type.kind != type_kind::array &&
+                  is_scalar(*op.type),
+              "Invalid cast.");
+      emit(expr_opcode::convert, type);
+      return {&type, false};
+    }
+
+    return parse_postfix();
+  }
+
+  auto parse_postfix() -> operand {
+    auto op = parse_primary();
+    while (true) {
+      if (accept("[")) {
+        require(is_pointer_like(*op.type), "Cannot subscript something of "
+                                           "type `" +
+                                               op.type->name + "'.");
+        auto index = parse_binary(1);
+        require(is_integer(*index.type), "Array index must be an integer.");
+        expect("]");
+        const auto &element = element_of(*op.type);
+        emit(expr_opcode::ptr_add, pointer_to(element),
+             element.size != 0 ? element.size : 1);
+        emit(expr_opcode::deref, element);
+        op = {&element, true};
+      } else if (accept(".")) {
+        require(op.type->kind == type_kind::structure,
+                "Attempt to extract a component of a value that is not a "
+                "structure.");
+        op = parse_member(op);
+      } else if (accept("->")) {
+        require(op.type->kind == type_kind::pointer &&
+                    op.type->target->kind == type_kind::structure,
+                "The -> operator needs a pointer to a structure.");
+        emit(expr_opcode::deref, *op.type->target);
+        op = parse_member({op.type->target, true});
+      } else {
+        return op;
+      }
+    }
+  }
+
+  auto parse_member(operand op) -> operand {
+    if (peek().type != token::kind::identifier) {
+      throw std::invalid_argument{"Expected a member name."};
+    }
+    auto name = peek().text;
+    ++m_pos;
+
+    type_member member;
+    if (!find_member(*op.type, name, 0, member)) {
+      throw std::invalid_argument{"There is no member named " + name + "."};
+    }
+    if (member.bit_size != 0) {
+      emit(expr_opcode::bitfield, *member.type,
+           member.offset * 8 + member.bit_offset, member.bit_size);
+      return {member.type, false};
+    }
+    emit(expr_opcode::member, *member.type, member.offset);
+    return dereference({member.type, op.lvalue});
+  }
+
+  auto parse_primary() -> operand {
+    const auto &tok = peek();
+    switch (tok.type) {
+    case token::kind::number:
+      ++m_pos;
+      emit(expr_opcode::constant, *tok.number_type, tok.value);
+      return {tok.number_type, false};
+
+    case token::kind::reg: {
+      ++m_pos;
+      unsigned regnum = dwarf_return_address_register;
+      if (tok.text != "rip" && tok.text != "pc") {
+        auto it = std::find_if(
+            std::begin(g_register_descriptors),
+            std::end(g_register_descriptors),
+            [&](const reg_descriptor &rd) { return rd.name == tok.text; });
+        require(it != std::end(g_register_descriptors) && it->dwarf_r >= 0 &&
+                    static_cast<std::size_t>(it->dwarf_r) < n_dwarf_registers,
+                "Invalid register $" + tok.text + ".");
+        regnum = it->dwarf_r;
+      }
+      emit(expr_opcode::reg, *builtin_type("unsigned long"), regnum);
+      m_expr.m_needs_frame = true;
+      return {builtin_type("unsigned long"), false};
+    }
+
+    case token::kind::identifier: {
+      ++m_pos;
+      dwarf::die die;
+      if (find_variable(m_expr.m_function, tok.text, m_pc, die)) {
+        m_expr.m_needs_frame = true;
+      }
+      if (die.valid() || lookup_variable(tok.text, die)) {
+        const auto &type = m_types.get_type_of(die);
+        auto index = emit(expr_opcode::variable, type);
+        m_expr.m_insns[index].location =
+            &m_locations.get(die, dwarf::DW_AT::location);
+        return dereference({&type, true});
+      }
+
+      std::int64_t value;
+      if (find_enumerator(m_expr.m_function.get_unit().root(), tok.text, die,
+                          value)) {
+        const auto &type = m_types.get(die);
+        emit(expr_opcode::constant, type, static_cast<std::uint64_t>(value));
+        return {&type, false};
+      }
+      throw std::invalid_argument{"No symbol \"" + tok.text +
+                                  "\" in current context."};
+    }
+
+    case token::kind::punct:
+      if (accept("(")) {
+        auto op = parse_binary(1);
+        expect(")");
+        return op;
+      }
+      break;
+
+    case token::kind::end:
+      break;
+    }
+    throw std::invalid_argument{
+        tok.type == token::kind::end
+            ? "A syntax error in expression, near the end."
+            : "A syntax error in expression, near `" + tok.text + "'."};
+  }
+
+  auto lookup_variable(const std::string &name, dwarf::die &result) -> bool {
+    const auto &function = m_expr.m_function;
+    if (find_variable(function, name, m_pc, result)) {
+      return true;
+    }
+    auto global = m_globals.find(name, function.get_unit());
+    if (global != nullptr) {
+      result = global->die;
+    }
+    return global != nullptr;
+  }
+
+  // Whether a token starts a type name rather than an expression
+  auto is_type_name(const token &tok) -> bool {
+    if (tok.type != token::kind::identifier) {
+      return false;
+    }
+    for (auto word : type_words) {
+      if (tok.text == word) {
+        return true;
+      }
+    }
+
+    dwarf::die die;
+    std::int64_t value;
+    return !lookup_variable(tok.text, die) &&
+           !find_enumerator(m_expr.m_function.get_unit().root(), tok.text,
+                            die, value) &&
+           find_type(m_expr.m_function.get_unit().root(), tok.text, die);
+  }
+
+  auto parse_type() -> const type_desc & {
+    auto n_long = 0;
+    auto is_unsigned = false;
+    auto is_signed_word = false;
+    std::string base;
+    std::string tag_name;
+    while (peek().type == token::kind::identifier) {
+      const auto &word = peek().text;
+      if (word == "const" || word == "volatile") {
+        // Qualifiers do not change how a value is read
+      } else if (word == "unsigned") {
+        is_unsigned = true;
+      } else if (word == "signed") {
+        is_signed_word = true;
+      } else if (word == "long") {
+        ++n_long;
+      } else if (word == "int" || word == "short" || word == "char" ||
+                 word == "float" || word == "double" || word == "bool" ||
+                 word == "void") {
+        base = word;
+      } else if (word == "struct" || word == "class" || word == "union" ||
+                 word == "enum") {
+        ++m_pos;
+        require(peek().type == token::kind::identifier,
+                "Expected a name after " + word + ".");
+        tag_name = peek().text;
+      } else if (base.empty() && n_long == 0 && !is_unsigned &&
+                 !is_signed_word && tag_name.empty()) {
+        tag_name = word;
+      } else {
+        break;
+      }
+      ++m_pos;
+    }
+
+    const type_desc *type = nullptr;
+    if (!tag_name.empty()) {
+      dwarf::die die;
+      require(find_type(m_expr.m_function.get_unit().root(), tag_name, die),
+              "No type named " + tag_name + ".");
+      type = &m_types.get(die);
+    } else {
+      std::string name;
+      if (base == "char") {
+        name = is_unsigned     ? "unsigned char"
+               : is_signed_word ? "signed char"
+                                : "char";
+      } else if (base == "double" || base == "float" || base == "bool" ||
+                 base == "void") {
+        name = base == "double" && n_long > 0 ? "long double" : base;
+      } else if (base == "short") {
+        name = is_unsigned ? "unsigned short" : "short";
+      } else if (n_long > 0) {
+        name = is_unsigned ? "unsigned long" : "long";
+      } else {
+        name = is_unsigned ? "unsigned int" : "int";
+      }
+      type = builtin_type(name);
+    }
+
+    while (accept("*")) {
+      type = &pointer_to(*type);
+      while (peek().type == token::kind::identifier &&
+             (peek().text == "const" || peek().text == "volatile")) {
+        ++m_pos;
+      }
+    }
+    return *type;
+  }
+
+  expression &m_expr;            ///< Expression being compiled
+  std::uint64_t m_pc;            ///< Link-time PC selecting lexical blocks
+  type_index &m_types;           ///< Type descriptions of the program
+  location_cache &m_locations;   ///< Decoded location attributes
+  const global_index &m_globals; ///< Global variables by name
+  std::vector<token> m_tokens;   ///< Tokens of the expression
+  std::size_t m_pos = 0;         ///< Index of the next token
+};
+
+expression::expression(std::string text, const dwarf::die &function,
+                       std::uint64_t pc, type_index &types,
+                       location_cache &locations, const global_index &globals)
+    : m_text{std::move(text)}, m_function{function} {
+  expr_compiler compiler{*this, pc, types, locations, globals};
+  compiler.compile();
+}
+
+auto expression::evaluate(frame_context &frame) const -> expr_value {
+  std::vector<expr_value> stack;
+  auto pop = [&stack]() {
+    auto value = std::move(stack.back());
+    stack.pop_back();
+    return value;
+  };
+
+  for (std::size_t i = 0; i < m_insns.size(); ++i) {
+    const auto &insn = m_insns[i];
+    const auto &type = *insn.type;
+    switch (insn.op) {
+    case expr_opcode::constant: {
+      scalar s;
+      if (is_float(type)) {
+        double d;
+        std::memcpy(&d, &insn.arg1, sizeof(d));
+        s.is_float = true;
+        s.real = d;
+      } else {
+        s.bits = insn.arg1;
+        s.is_signed = is_signed(type);
+      }
+      stack.push_back(make_value(type, s));
+      break;
+    }
+
+    case expr_opcode::variable: {
+      auto program = insn.location->find(frame.link_pc());
+      if (program == nullptr) {
+        throw std::out_of_range{"Value has been optimized out"};
+      }
+
+      // Objects in memory are left there, so that only the parts of them
+      // the expression uses are read
+      auto location = evaluate_location(*program, frame);
+      const auto &piece = location.pieces.front();
+      expr_value value;
+      value.type = &type;
+      if (location.pieces.size() == 1 &&
+          piece.type == location_piece::kind::memory && piece.bit_size == 0) {
+        value.in_memory = true;
+        value.address = piece.value;
+      } else {
+        value.bytes = read_location(location, type.size, frame);
+      }
+      stack.push_back(std::move(value));
+      break;
+    }
+
+    case expr_opcode::reg: {
+      scalar s;
+      s.bits = frame.reg(static_cast<unsigned>(insn.arg1));
+      stack.push_back(make_value(type, s));
+      break;
+    }
+
+    case expr_opcode::member: {
+      auto value = pop();
+      value.type = &type;
+      if (value.in_memory) {
+        value.address += insn.arg1;
+      } else {
+        if (insn.arg1 + type.size > value.bytes.size()) {
+          throw std::out_of_range{"Member is outside of the value"};
+        }
+        value.bytes.erase(value.bytes.begin(),
+                          value.bytes.begin() + insn.arg1);
+        value.bytes.resize(type.size);
+      }
+      stack.push_back(std::move(value));
+      break;
+    }
+
+    case expr_opcode::bitfield: {
+      auto value = pop();
+      auto first = insn.arg1 / 8;
+      auto shift = insn.arg1 % 8;
+      std::uint8_t storage[16] = {};
+      auto n_bytes = std::min<std::uint64_t>((shift + insn.arg2 + 7) / 8,
+                                             sizeof(storage));
+      if (value.in_memory) {
+        frame.read_memory(value.address + first, storage, n_bytes);
+      } else {
+        if (first + n_bytes > value.bytes.size()) {
+          throw std::out_of_range{"Member is outside of the value"};
+        }
+        std::memcpy(storage, value.bytes.data() + first, n_bytes);
+      }
+
+      scalar s;
+      for (std::uint64_t b = 0; b < insn.arg2 && b < 64; ++b) {
+        auto src = shift + b;
+        s.bits |= static_cast<std::uint64_t>((storage[src / 8] >> (src % 8)) &
+                                             1)
+                  << b;
+      }
+      s.is_signed = is_signed(type);
+      if (s.is_signed && insn.arg2 < 64 && ((s.bits >> (insn.arg2 - 1)) & 1)) {
+        s.bits |= ~0ull << insn.arg2;
+      }
+      stack.push_back(make_value(type, s));
+      break;
+    }
+
+    case expr_opcode::deref: {
+      auto pointer = load_scalar(pop(), frame);
+      expr_value value;
+      value.type = &type;
+      value.in_memory = true;
+      value.address = pointer.bits;
+      stack.push_back(std::move(value));
+      break;
+    }
+
+    case expr_opcode::address: {
+      auto value = pop();
+      if (!value.in_memory) {
+        throw std::invalid_argument{
+            "Attempt to take address of value not located in memory."};
+      }
+      scalar s;
+      s.bits = value.address;
+      stack.push_back(make_value(type, s));
+      break;
+    }
+
+    case expr_opcode::convert:
+      stack.push_back(make_value(type, load_scalar(pop(), frame)));
+      break;
+
+    case expr_opcode::negate: {
+      auto s = convert(load_scalar(pop(), frame), type);
+      s.bits = 0 - s.bits;
+      s.real = -s.real;
+      stack.push_back(make_value(type, s));
+      break;
+    }
+
+    case expr_opcode::bit_not: {
+      auto s = convert(load_scalar(pop(), frame), type);
+      s.bits = ~s.bits;
+      stack.push_back(make_value(type, s));
+      break;
+    }
+
+    case expr_opcode::logical_not:
+    case expr_opcode::to_bool: {
+      scalar s;
+      s.bits = is_true(load_scalar(pop(), frame)) ==
+               (insn.op == expr_opcode::to_bool);
+      stack.push_back(make_value(type, s));
+      break;
+    }
+
+    case expr_opcode::add:
+    case expr_opcode::sub:
+    case expr_opcode::mul:
+    case expr_opcode::div:
+    case expr_opcode::mod:
+    case expr_opcode::shl:
+    case expr_opcode::shr:
+    case expr_opcode::bit_and:
+    case expr_opcode::bit_or:
+    case expr_opcode::bit_xor: {
+      auto b = load_scalar(pop(), frame);
+      auto a = convert(load_scalar(pop(), frame), type);
+      if (insn.op != expr_opcode::shl && insn.op != expr_opcode::shr) {
+        b = convert(b, type);
+      }
+      stack.push_back(make_value(type, arithmetic(insn.op, a, b)));
+      break;
+    }
+
+    case expr_opcode::eq:
+    case expr_opcode::ne:
+    case expr_opcode::lt:
+    case expr_opcode::le:
+    case expr_opcode::gt:
+    case expr_opcode::ge: {
+      auto b = convert(load_scalar(pop(), frame), type);
+      auto a = convert(load_scalar(pop(), frame), type);
+      scalar s;
+      s.bits = compare(insn.op, a, b);
+      stack.push_back(make_value(int_type(), s));
+      break;
+    }
+
+    case expr_opcode::ptr_add:
+    case expr_opcode::ptr_sub: {
+      auto b = pop();
+      auto a = pop();
+      if (!is_pointer_like(*a.type)) {
+        std::swap(a, b);
+      }
+      auto pointer = load_scalar(a, frame);
+      auto offset = load_scalar(b, frame).bits * insn.arg1;
+      pointer.bits = insn.op == expr_opcode::ptr_add ? pointer.bits + offset
+                                                     : pointer.bits - offset;
+      stack.push_back(make_value(type, pointer));
+      break;
+    }
+
+    case expr_opcode::ptr_diff: {
+      auto b = load_scalar(pop(), frame);
+      auto a = load_scalar(pop(), frame);
+      scalar s;
+      s.is_signed = true;
+      s.bits = static_cast<std::uint64_t>(
+          static_cast<std::int64_t>(a.bits - b.bits) /
+          static_cast<std::int64_t>(insn.arg1));
+      stack.push_back(make_value(type, s));
+      break;
+    }
+
+    case expr_opcode::and_jump:
+    case expr_opcode::or_jump: {
+      auto truth = is_true(load_scalar(pop(), frame));
+      if (truth == (insn.op == expr_opcode::or_jump)) {
+        scalar s;
+        s.bits = truth;
+        stack.push_back(make_value(type, s));
+        i = insn.arg1 - 1;
+      }
+      break;
+    }
+    }
+  }
+
+  return pop();
+}
+
+auto expression::test(frame_context &frame) const -> bool {
+  return is_true(load_scalar(evaluate(frame), frame));
+}
+
+auto read_value(const expr_value &value, dwarf_expr_context &context)
+    -> std::vector<std::uint8_t> {
+  if (!value.in_memory) {
+    auto bytes = value.bytes;
+    bytes.resize(value.type->size);
+    return bytes;
+  }
+
+  std::vector<std::uint8_t> bytes(value.type->size);
+  if (!bytes.empty()) {
+    context.read_memory(value.address, bytes.data(), bytes.size());
+  }
+  return bytes;
+}
@@ -0,0 +1,441 @@
+#include "../include/fast_tracepoint.h"
+#include "../include/agent.h"
+#include "../include/memory.h"
+#include "../include/x86_decode.h"
+#include "elf/elf++.hh"
+
+#include <fcntl.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <limits>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Records in the ring
+constexpr std::uint64_t ring_capacity = 4096;
+
+// Length of jmp rel32
+constexpr std::size_t jump_length = 5;
+
+// Longest x86-64 instruction
+constexpr std::size_t max_instruction_length = 15;
+
+// Space reserved for a trampoline, including the displaced instructions
+constexpr std::size_t trampoline_size = 192;
+
+// Trampolines are kept apart from data the program writes, as stores near
+// code that is running are treated as self-modifying code
+constexpr std::size_t code_page_size = 4096;
+
+// File name the agent library starts with
+const std::string agent_library = "libcdb_agent";
+
+auto fits_rel32(std::int64_t distance) noexcept -> bool {
+  return distance >= std::numeric_limits<std::int32_t>::min() &&
+         distance <= std::numeric_limits<std::int32_t>::max();
+}
+
+// Machine code of a trampoline
+class code_writer {
+public:
+  explicit code_writer(std::uint64_t address) noexcept : m_address{address} {}
+
+  auto emit(std::initializer_list<std::uint8_t> bytes) -> void {
+    m_code.insert(m_code.end(), bytes);
+  }
+
+  auto emit64(std::uint64_t value) -> void {
+    for (auto i = 0; i < 8; ++i) {
+      m_code.push_back(static_cast<std::uint8_t>(value >> (i * 8)));
+    }
+  }
+
+  // jmp rel32 to an address
+  auto jump(std::uint64_t target) -> void {
+    auto distance = static_cast<std::int64_t>(target - (here() + jump_length));
+    if (!fits_rel32(distance)) {
+      throw std::out_of_range{"Tracepoint is out of reach of the arena"};
+    }
+    emit({0xe9});
+    for (auto i = 0; i < 4; ++i) {
+      m_code.push_back(static_cast<std::uint8_t>(distance >> (i * 8)));
+    }
+  }
+
+  auto here() const noexcept -> std::uint64_t {
+    return m_address + m_code.size();
+  }
+
+  auto code() noexcept -> std::vector<std::uint8_t> & { return m_code; }
+
+private:
+  std::uint64_t m_address;
+  std::vector<std::uint8_t> m_code;
+};
+
+} // namespace
+
+auto fast_tracepoint_table::find_agent(std::string &path) const
+    -> std::uint64_t {
+  std::ifstream maps{"/proc/" + std::to_string(m_pid) + "/maps"};
+  std::string line;
+  while (std::getline(maps, line)) {
+    std::istringstream in{line};
+    std::uint64_t start, end, offset;
+    char dash;
+    std::string perms, device, inode, name;
+    in >> std::hex >> start >> dash >> end >> perms >> offset >> device >>
+        inode >> name;
+    auto file = name.substr(name.rfind('/') + 1);
+    auto is_agent = file.compare(0, agent_library.size(), agent_library) == 0;
+    if (offset == 0 && is_agent) {
+      path = name;
+      return start;
+    }
+  }
+  return 0;
+}
+
+auto fast_tracepoint_table::agent_loaded() const -> bool {
+  std::string path;
+  return find_agent(path) != 0;
+}
+
+auto fast_tracepoint_table::load_agent() -> void {
+  std::string path;
+  auto base = find_agent(path);
+  if (base == 0) {
+    throw std::out_of_range{"The agent library is not loaded in the program"};
+  }
+
+  auto fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw std::out_of_range{"Cannot open the agent library"};
+  }
+  elf::elf agent{elf::create_mmap_loader(fd)};
+  const auto &dynsym = agent.get_section(".dynsym");
+  if (dynsym.valid()) {
+    for (const auto &sym : dynsym.as_symtab()) {
+      if (sym.get_name() == agent_hit_symbol) {
+        m_hit_function = base + sym.get_data().value;
+      }
+    }
+  }
+  if (m_hit_function == 0) {
+    throw std::out_of_range{"The agent library has no cdb_agent_hit"};
+  }
+
+  m_ring_address = m_arena.allocate(
+      sizeof(agent_ring) + ring_capacity * sizeof(agent_record), 64);
+  m_ring = new (m_arena.local(m_ring_address)) agent_ring;
+  m_ring->capacity = ring_capacity;
+}
+
+auto fast_tracepoint_table::add(std::uint64_t address, std::uint64_t limit,
+                                std::uint32_t flags,
+                                const std::vector<agent_insn> &condition)
+    -> const fast_tracepoint & {
+  if (condition.size() > agent_max_insns) {
+    throw std::invalid_argument{"Condition of the tracepoint is too long"};
+  }
+  if (m_hit_function == 0) {
+    load_agent();
+  }
+  if (std::any_of(m_tracepoints.begin(), m_tracepoints.end(),
+                  [address](const fast_tracepoint &t) {
+                    return address < t.address + t.original.size() &&
+                           t.address < address + jump_length;
+                  })) {
+    throw std::out_of_range{"Tracepoint overlaps another one"};
+  }
+
+  std::uint8_t code[jump_length + max_instruction_length] = {};
+  auto available = read_instructions(address, limit, code);
+
+  fast_tracepoint t;
+  t.number = m_next_number;
+  t.address = address;
+  t.site = m_arena.allocate(sizeof(agent_site), 64);
+  if (m_code_page == 0 || m_code_used + trampoline_size > code_page_size) {
+    m_code_page = m_arena.allocate(code_page_size, code_page_size);
+    m_code_used = 0;
+  }
+  t.trampoline = m_code_page + m_code_used;
+  m_code_used += trampoline_size;
+  build_trampoline(t, code, available);
+
+  auto site = new (m_arena.local(t.site)) agent_site;
+  site->address = address;
+  site->ring = m_ring_address;
+  site->number = t.number;
+  site->flags = flags;
+  site->pid = m_pid;
+  std::copy(condition.begin(), condition.end(), site->condition);
+  site->insns = static_cast<std::uint32_t>(condition.size());
+
+  code_writer jump{address};
+  jump.jump(t.trampoline);
+  write_text(m_pid, address, jump.code().data(), jump.code().size());
+
+  ++m_next_number;
+  m_tracepoints.push_back(std::move(t));
+  return m_tracepoints.back();
+}
+
+auto fast_tracepoint_table::patch_length(std::uint64_t address,
+                                         std::uint64_t limit) const
+    -> std::size_t {
+  std::uint8_t code[jump_length + max_instruction_length] = {};
+  auto available = read_instructions(address, limit, code);
+
+  std::size_t offset = 0;
+  while (offset < jump_length) {
+    x86_instruction insn;
+    if (!decode_x86_instruction(code + offset, available - offset, insn)) {
+      throw std::out_of_range{"Cannot decode the instructions of the "
+                              "tracepoint"};
+    }
+    offset += insn.length;
+  }
+  return offset;
+}
+
+auto fast_tracepoint_table::read_instructions(std::uint64_t address,
+                                              std::uint64_t limit,
+                                              std::uint8_t *code) const
+    -> std::size_t {
+  auto available = static_cast<std::size_t>(std::min<std::uint64_t>(
+      jump_length + max_instruction_length, limit - address));
+  if (limit <= address ||
+      !read_memory_block(m_pid, address, code, available)) {
+    throw std::out_of_range{"Cannot read the instructions of the tracepoint"};
+  }
+  return available;
+}
+
+auto fast_tracepoint_table::build_trampoline(fast_tracepoint &t,
+                                             const std::uint8_t *code,
+                                             std::size_t size) -> void {
+  code_writer out{t.trampoline};
+
+  // Save the flags and registers below the red zone, in the layout of
+  // agent_registers
+  out.emit({0x48, 0x8d, 0x64, 0x24, 0x80}); // lea rsp, [rsp - 128]
+  out.emit({0x9c});                         // pushfq
+  out.emit({0x50, 0x53, 0x51, 0x52});       // push rax, rbx, rcx, rdx
+  out.emit({0x55, 0x56, 0x57});             // push rbp, rsi, rdi
+  for (std::uint8_t r = 0; r < 8; ++r) {
+    out.emit({0x41, static_cast<std::uint8_t>(0x50 + r)}); // push r8 ... r15
+  }
+
+  // Call the agent on an aligned stack, keeping the SSE state of the program
+  out.emit({0x48, 0x89, 0xe6});             // mov rsi, rsp
+  out.emit({0x48, 0xbf});                   // mov rdi, site
+  out.emit64(t.site);
+  out.emit({0x48, 0x89, 0xe3});             // mov rbx, rsp
+  out.emit({0x48, 0x83, 0xe4, 0xf0});       // and rsp, -16
+  out.emit({0x48, 0x81, 0xec, 0, 2, 0, 0}); // sub rsp, 512
+  out.emit({0x48, 0x0f, 0xae, 0x04, 0x24}); // fxsave64 [rsp]
+  out.emit({0x48, 0xb8});                   // mov rax, cdb_agent_hit
+  out.emit64(m_hit_function);
+  out.emit({0xff, 0xd0});                   // call rax
+  out.emit({0x48, 0x0f, 0xae, 0x0c, 0x24}); // fxrstor64 [rsp]
+  out.emit({0x48, 0x89, 0xdc});             // mov rsp, rbx
+
+  // Trap to the debugger if the agent asks to stop, with rsp pointing at
+  // the saved registers
+  out.emit({0x85, 0xc0}); // test eax, eax
+  out.emit({0x74, 0x01}); // je restore
+  t.trap = out.here();
+  out.emit({0xcc}); // int3
+
+  for (std::uint8_t r = 8; r-- > 0;) {
+    out.emit({0x41, static_cast<std::uint8_t>(0x58 + r)}); // pop r15 ... r8
+  }
+  out.emit({0x5f, 0x5e, 0x5d});                         // pop rdi, rsi, rbp
+  out.emit({0x5a, 0x59, 0x5b, 0x58});                   // pop rdx ... rax
+  out.emit({0x9d});                                     // popfq
+  out.emit({0x48, 0x8d, 0xa4, 0x24, 0x80, 0, 0, 0});    // lea rsp, [rsp + 128]
+
+  // Run the instructions the jump replaces, then jump back after them
+  t.displaced = out.here();
+  std::size_t offset = 0;
+  while (offset < jump_length) {
+    x86_instruction insn;
+    if (!decode_x86_instruction(code + offset, size - offset, insn)) {
+      throw std::out_of_range{"Cannot decode the instructions of the "
+                              "tracepoint"};
+    }
+
+    std::uint8_t moved[max_instruction_length];
+    if (!relocate_x86_instruction(insn, code + offset, t.address + offset,
+                                  out.here(), moved)) {
+      throw std::out_of_range{"Cannot move the instructions of the "
+                              "tracepoint"};
+    }
+    out.code().insert(out.code().end(), moved, moved + insn.length);
+    offset += insn.length;
+  }
+  out.jump(t.address + offset);
+
+  t.original.assign(code, code + offset);
+  std::memcpy(m_arena.local(t.trampoline), out.code().data(),
+              out.code().size());
+}
+
+auto fast_tracepoint_table::remove(unsigned number) -> bool {
+  auto it = std::find_if(
+      m_tracepoints.begin(), m_tracepoints.end(),
+      [number](const fast_tracepoint &t) { return t.number == number; });
+  if (it == m_tracepoints.end()) {
+    return false;
+  }
+
+  // The trampoline stays in the arena for threads that are still in it
+  if (m_landed == it->address) {
+    m_landed = 0;
+  }
+  write_text(m_pid, it->address, it->original.data(), it->original.size());
+  m_tracepoints.erase(it);
+  return true;
+}
+
+auto fast_tracepoint_table::unpatch() -> void {
+  for (const auto &t : m_tracepoints) {
+    write_text(m_pid, t.address, t.original.data(), t.original.size());
+  }
+}
+
+auto fast_tracepoint_table::patch() -> void {
+  for (const auto &t : m_tracepoints) {
+    code_writer jump{t.address};
+    jump.jump(t.trampoline);
+    write_text(m_pid, t.address, jump.code().data(), jump.code().size());
+  }
+}
+
+auto fast_tracepoint_table::set_pid(pid_t pid) noexcept -> void {
+  m_pid = pid;
+  m_landed = 0;
+
+  // Sites are shared, and the agent reads memory checked by their pid
+  for (const auto &t : m_tracepoints) {
+    site(t).pid = pid;
+  }
+}
+
+auto fast_tracepoint_table::drain(std::vector<agent_record> &records)
+    -> std::size_t {
+  if (m_ring == nullptr) {
+    return 0;
+  }
+
+  // A record reserved but not yet published is read by a later drain, with
+  // those after it
+  auto head = m_ring->head.load(std::memory_order_acquire);
+  auto tail = m_ring->tail.load(std::memory_order_relaxed);
+  auto position = tail;
+  for (; position != head; ++position) {
+    auto &record = m_ring->slot(position);
+    if (__atomic_load_n(&record.sequence, __ATOMIC_ACQUIRE) != position + 1) {
+      break;
+    }
+    records.push_back(record);
+  }
+  m_ring->tail.store(position, std::memory_order_release);
+  return position - tail;
+}
+
+auto fast_tracepoint_table::dropped() const noexcept -> std::uint64_t {
+  if (m_ring == nullptr) {
+    return 0;
+  }
+  return m_ring->dropped.load(std::memory_order_relaxed);
+}
+
+auto fast_tracepoint_table::covers(std::uint64_t address) const noexcept
+    -> bool {
+  return std::any_of(m_tracepoints.begin(), m_tracepoints.end(),
+                     [address](const fast_tracepoint &t) {
+                       return address >= t.address &&
+                              address < t.address + t.original.size();
+                     });
+}
+
+auto fast_tracepoint_table::find(std::uint64_t address) const noexcept
+    -> const fast_tracepoint * {
+  for (const auto &t : m_tracepoints) {
+    if (t.address == address) {
+      return &t;
+    }
+  }
+  return nullptr;
+}
+
+auto fast_tracepoint_table::land() -> const fast_tracepoint * {
+  m_landed = 0;
+  user_regs_struct regs;
+  if (m_tracepoints.empty() ||
+      ptrace(PTRACE_GETREGS, m_pid, nullptr, &regs) == -1) {
+    return nullptr;
+  }
+
+  // The trap leaves the program counter after the int3
+  auto it = std::find_if(
+      m_tracepoints.begin(), m_tracepoints.end(),
+      [&regs](const fast_tracepoint &t) { return t.trap + 1 == regs.rip; });
+  agent_registers saved;
+  if (it == m_tracepoints.end() ||
+      !read_memory_block(m_pid, regs.rsp, &saved, sizeof(saved))) {
+    return nullptr;
+  }
+
+  regs.r15 = saved.r15;
+  regs.r14 = saved.r14;
+  regs.r13 = saved.r13;
+  regs.r12 = saved.r12;
+  regs.r11 = saved.r11;
+  regs.r10 = saved.r10;
+  regs.r9 = saved.r9;
+  regs.r8 = saved.r8;
+  regs.rdi = saved.rdi;
+  regs.rsi = saved.rsi;
+  regs.rbp = saved.rbp;
+  regs.rdx = saved.rdx;
+  regs.rcx = saved.rcx;
+  regs.rbx = saved.rbx;
+  regs.rax = saved.rax;
+  regs.eflags = saved.eflags;
+  regs.rsp += sizeof(saved) + agent_red_zone;
+  regs.rip = it->address;
+  if (ptrace(PTRACE_SETREGS, m_pid, nullptr, &regs) == -1) {
+    return nullptr;
+  }
+  m_landed = it->address;
+  return &*it;
+}
+
+auto fast_tracepoint_table::leave() -> void {
+  auto t = find(m_landed);
+  m_landed = 0;
+  user_regs_struct regs;
+  if (t == nullptr || ptrace(PTRACE_GETREGS, m_pid, nullptr, &regs) == -1 ||
+      regs.rip != t->address) {
+    return;
+  }
+  regs.rip = t->displaced;
+  ptrace(PTRACE_SETREGS, m_pid, nullptr, &regs);
+}
@@ -0,0 +1,229 @@
+#include "../include/frame_context.h"
+#include "../include/memory.h"
+#include "../include/registers.h"
+
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+// DWARF register numbers with special meaning at function entry
+constexpr unsigned dwarf_rsp = 7;
+
+// Operations that name a register as the location of an object
+constexpr std::uint8_t DW_OP_reg0 = 0x50;
+constexpr std::uint8_t DW_OP_reg31 = 0x6f;
+constexpr std::uint8_t DW_OP_regx = 0x90;
+
+// Registers the x86-64 System V ABI requires a callee to preserve
+constexpr unsigned callee_saved_registers[] = {3, 6, 12, 13, 14, 15};
+
+// Call-site DIEs, in their DWARF 5 and GNU extension forms
+const auto tag_call_site = static_cast<dwarf::DW_TAG>(0x48);
+const auto tag_call_site_parameter = static_cast<dwarf::DW_TAG>(0x49);
+const auto tag_gnu_call_site = static_cast<dwarf::DW_TAG>(0x4109);
+const auto tag_gnu_call_site_parameter = static_cast<dwarf::DW_TAG>(0x410a);
+const auto at_call_return_pc = static_cast<dwarf::DW_AT>(0x7d);
+const auto at_call_value = static_cast<dwarf::DW_AT>(0x7e);
+const auto at_gnu_call_site_value = static_cast<dwarf::DW_AT>(0x2111);
+
+auto is_callee_saved(unsigned regnum) noexcept -> bool {
+  for (auto r : callee_saved_registers) {
+    if (r == regnum) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Finds the call site whose return address is return_pc, searching nested
+// lexical blocks and inlined functions
+auto find_call_site(const dwarf::die &scope, std::uint64_t return_pc,
+                    dwarf::die &result) -> bool {
+  for (const auto &child : scope) {
+    if (child.tag == tag_call_site || child.tag == tag_gnu_call_site) {
+      auto attr = child.has(at_call_return_pc) ? at_call_return_pc
+                                               : dwarf::DW_AT::low_pc;
+      if (child.has(attr) && child[attr].as_address() == return_pc) {
+        result = child;
+        return true;
+      }
+    } else if (child.tag == dwarf::DW_TAG::lexical_block ||
+               child.tag == dwarf::DW_TAG::inlined_subroutine) {
+      if (find_call_site(child, return_pc, result)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Gets the register a call-site parameter is passed in, from a location
+// that is a lone DW_OP_reg<n> or DW_OP_regx
+auto parameter_register(const dwarf::die &parameter,
+                        location_cache &locations, unsigned &regnum) -> bool {
+  if (!parameter.has(dwarf::DW_AT::location)) {
+    return false;
+  }
+
+  const dwarf_program *program;
+  try {
+    program = locations.get(parameter, dwarf::DW_AT::location).find(0);
+  } catch (std::invalid_argument &) {
+    return false;
+  }
+  if (program == nullptr || program->ops().size() != 1) {
+    return false;
+  }
+
+  const auto &op = program->ops().front();
+  if (op.code >= DW_OP_reg0 && op.code <= DW_OP_reg31) {
+    regnum = op.code - DW_OP_reg0;
+    return true;
+  }
+  if (op.code == DW_OP_regx) {
+    regnum = static_cast<unsigned>(op.arg1);
+    return true;
+  }
+  return false;
+}
+
+} // namespace
+
+frame_context::frame_context(pid_t pid, const std::vector<frame> &frames,
+                             std::size_t index, dwarf::die function,
+                             dwarf::die caller, location_cache &locations,
+                             std::uint64_t load_address, tls_cache *tls)
+    : m_pid{pid}, m_frames{frames}, m_index{index},
+      m_function{std::move(function)}, m_caller{std::move(caller)},
+      m_locations{locations}, m_load_address{load_address}, m_tls{tls} {}
+
+auto frame_context::link_pc() const noexcept -> std::uint64_t {
+  const auto &f = m_frames[m_index];
+  return (f.interrupted ? f.pc : f.pc - 1) - m_load_address;
+}
+
+auto frame_context::reg(unsigned regnum) -> std::uint64_t {
+  return get_register_value_from_dwarf_register(m_frames[m_index].regs,
+                                                regnum);
+}
+
+auto frame_context::read_memory(std::uint64_t address, void *buffer,
+                                std::size_t size) -> void {
+  if (!read_memory_block(m_pid, address, buffer, size)) {
+    throw std::out_of_range{"Cannot access memory"};
+  }
+}
+
+auto frame_context::frame_base() -> std::uint64_t {
+  if (!m_has_frame_base) {
+    const auto &location =
+        m_locations.get(m_function, dwarf::DW_AT::frame_base);
+    auto program = location.find(link_pc());
+    if (program == nullptr) {
+      throw std::out_of_range{"Frame base is not available"};
+    }
+    m_frame_base = evaluate_value(*program, *this);
+    m_has_frame_base = true;
+  }
+  return m_frame_base;
+}
+
+auto frame_context::call_frame_cfa() -> std::uint64_t {
+  auto cfa = m_frames[m_index].cfa;
+  if (cfa == 0) {
+    throw std::out_of_range{"Call frame address is not known"};
+  }
+  return cfa;
+}
+
+auto frame_context::tls_address(std::uint64_t offset) -> std::uint64_t {
+  if (m_tls == nullptr) {
+    throw std::out_of_range{"No thread-local storage"};
+  }
+
+  // Only the innermost frame holds the thread pointer
+  return m_tls->block_address(m_frames.front().regs.fs_base,
+                              executable_tls_module) +
+         offset;
+}
+
+auto frame_context::relocate(std::uint64_t address) -> std::uint64_t {
+  return address + m_load_address;
+}
+
+auto frame_context::entry_context() -> dwarf_expr_context & {
+  if (!m_entry) {
+    m_entry.reset(new entry_state{*this});
+  }
+  return *m_entry;
+}
+
+auto frame_context::call_site_value(unsigned regnum) -> std::uint64_t {
+  if (!m_caller.valid() || m_index + 1 >= m_frames.size()) {
+    throw std::out_of_range{"Caller is not known"};
+  }
+
+  // The call site is identified by the return address into the caller
+  const auto &caller_frame = m_frames[m_index + 1];
+  dwarf::die site;
+  if (!find_call_site(m_caller, caller_frame.pc - m_load_address, site)) {
+    throw std::out_of_range{"No call site information"};
+  }
+
+  for (const auto &parameter : site) {
+    if (parameter.tag != tag_call_site_parameter &&
+        parameter.tag != tag_gnu_call_site_parameter) {
+      continue;
+    }
+
+    unsigned parameter_reg;
+    if (!parameter_register(parameter, m_locations, parameter_reg) ||
+        parameter_reg != regnum) {
+      continue;
+    }
+
+    auto attr = parameter.has(at_call_value) ? at_call_value
+                                             : at_gnu_call_site_value;
+    if (!parameter.has(attr)) {
+      break;
+    }
+
+    // The value is expressed in terms of the caller's state at the call
+    auto program = m_locations.get(parameter, attr).find(0);
+    if (program == nullptr) {
+      break;
+    }
+    frame_context caller(m_pid, m_frames, m_index + 1, m_caller, dwarf::die{},
+                         m_locations, m_load_address);
+    return evaluate_value(*program, caller);
+  }
+
+  throw std::out_of_range{"Entry value is not described by the call site"};
+}
+
+auto frame_context::entry_state::reg(unsigned regnum) -> std::uint64_t {
+  // On entry the stack pointer addresses the return address, just below the
+  // CFA
+  if (regnum == dwarf_rsp) {
+    return m_frame.call_frame_cfa() - 8;
+  }
+
+  // The caller's callee-saved registers hold their values from entry
+  if (is_callee_saved(regnum) &&
+      m_frame.m_index + 1 < m_frame.m_frames.size()) {
+    const auto &caller = m_frame.m_frames[m_frame.m_index + 1];
+    if (caller.regs.has(regnum)) {
+      return caller.regs.values[regnum];
+    }
+  }
+
+  return m_frame.call_site_value(regnum);
+}
+
+auto frame_context::entry_state::read_memory(std::uint64_t address,
+                                             void *buffer, std::size_t size)
+    -> void {
+  m_frame.read_memory(address, buffer, size);
+}
@@ -0,0 +1,142 @@
+#include "../include/globals.h"
+#include "../include/dwarf_expr.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr std::uint8_t DW_OP_addr = 0x03;
+constexpr std::uint8_t DW_OP_const4u = 0x0c;
+constexpr std::uint8_t DW_OP_const8u = 0x0e;
+constexpr std::uint8_t DW_OP_constu = 0x10;
+constexpr std::uint8_t DW_OP_form_tls_address = 0x9b;
+constexpr std::uint8_t DW_OP_GNU_push_tls_address = 0xe0;
+
+// Finds the address of a variable whose location is a lone DW_OP_addr, or
+// its offset in the thread-local storage block if it is a constant followed
+// by a TLS operation
+auto locate(const dwarf::die &die, global_variable &variable) -> void {
+  auto value = die[dwarf::DW_AT::location];
+  if (value.get_type() != dwarf::value::type::exprloc &&
+      value.get_type() != dwarf::value::type::block) {
+    return;
+  }
+
+  try {
+    std::size_t size;
+    auto data = static_cast<const std::uint8_t *>(value.as_block(&size));
+    dwarf_program program{data, size};
+    const auto &ops = program.ops();
+    if (ops.size() == 1 && ops[0].code == DW_OP_addr) {
+      variable.address = ops[0].arg1;
+      variable.fixed = true;
+    } else if (ops.size() == 2 &&
+               (ops[0].code == DW_OP_const4u ||
+                ops[0].code == DW_OP_const8u ||
+                ops[0].code == DW_OP_constu) &&
+               (ops[1].code == DW_OP_form_tls_address ||
+                ops[1].code == DW_OP_GNU_push_tls_address)) {
+      variable.address = ops[0].arg1;
+      variable.tls = true;
+    }
+  } catch (std::exception &) {
+  }
+}
+
+} // namespace
+
+global_index::global_index(const dwarf::dwarf &dw) {
+  for (const auto &cu : dw.compilation_units()) {
+    std::unordered_map<dwarf::section_offset, std::string> declarations;
+    std::vector<dwarf::die> definitions;
+    index_scope(cu.root(), "", declarations, definitions);
+
+    // Definitions may precede the declarations naming them, so they are
+    // only resolved once the whole unit has been seen
+    for (const auto &die : definitions) {
+      auto spec = die[dwarf::DW_AT::specification].as_reference();
+      auto name = declarations.find(spec.get_section_offset());
+      if (name != declarations.end()) {
+        add(name->second, die);
+      } else if (spec.has(dwarf::DW_AT::name)) {
+        add(dwarf::at_name(spec), die);
+      }
+    }
+  }
+}
+
+auto global_index::index_scope(
+    const dwarf::die &scope, const std::string &prefix,
+    std::unordered_map<dwarf::section_offset, std::string> &declarations,
+    std::vector<dwarf::die> &definitions) -> void {
+  for (const auto &die : scope) {
+    auto named = die.has(dwarf::DW_AT::name);
+    switch (die.tag) {
+    case dwarf::DW_TAG::namespace_:
+      // Members of anonymous namespaces are used unqualified
+      index_scope(die, named ? prefix + dwarf::at_name(die) + "::" : prefix,
+                  declarations, definitions);
+      break;
+    case dwarf::DW_TAG::structure_type:
+    case dwarf::DW_TAG::class_type:
+    case dwarf::DW_TAG::union_type:
+      if (named) {
+        index_scope(die, prefix + dwarf::at_name(die) + "::", declarations,
+                    definitions);
+      }
+      break;
+    case dwarf::DW_TAG::member:
+    case dwarf::DW_TAG::variable:
+      if (die.has(dwarf::DW_AT::location)) {
+        if (die.has(dwarf::DW_AT::specification)) {
+          definitions.push_back(die);
+        } else if (named) {
+          add(prefix + dwarf::at_name(die), die);
+        }
+      } else if (named && die.has(dwarf::DW_AT::declaration)) {
+        declarations[die.get_section_offset()] = prefix + dwarf::at_name(die);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+auto global_index::add(const std::string &name, const dwarf::die &die)
+    -> void {
+  global_variable variable;
+  variable.name = name;
+  variable.die = die;
+  locate(die, variable);
+  m_variables[name].push_back(std::move(variable));
+}
+
+auto global_index::find(const std::string &name,
+                        const dwarf::unit &unit) const noexcept
+    -> const global_variable * {
+  auto it = m_variables.find(name);
+  if (it == m_variables.end()) {
+    return nullptr;
+  }
+
+  auto offset = unit.root().get_section_offset();
+  for (const auto &variable : it->second) {
+    if (variable.die.get_unit().root().get_section_offset() == offset) {
+      return &variable;
+    }
+  }
+  return &it->second.front();
+}
+
+auto global_index::find(const std::string &name) const noexcept
+    -> const global_variable * {
+  auto it = m_variables.find(name);
+  return it == m_variables.end() ? nullptr : &it->second.front();
+}
@@ -0,0 +1,130 @@
+#include "../include/inject.h"
+
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// syscall is 0f 05
+constexpr std::uint64_t syscall_instruction = 0x050f;
+constexpr std::uint64_t syscall_length = 2;
+
+// Results of a call the kernel makes again once a signal is handled
+constexpr std::int64_t first_restart_error = -516;
+constexpr std::int64_t last_restart_error = -512;
+
+// Sends again a signal the process was stopped with, so that it is
+// delivered when the process next runs. Only signals that were queued by
+// a process keep their information, the others are sent anew
+auto requeue_signal(pid_t pid, const siginfo_t &info) noexcept -> void {
+  if (info.si_code < 0 && info.si_code != SI_TKILL &&
+      syscall(SYS_rt_tgsigqueueinfo, pid, pid, info.si_signo, &info) == 0) {
+    return;
+  }
+  syscall(SYS_tgkill, pid, pid, info.si_signo);
+}
+
+} // namespace
+
+auto syscall_injector::set_scratch_address(std::uint64_t address) noexcept
+    -> void {
+  m_scratch = address;
+}
+
+auto syscall_injector::call(long number,
+                            std::initializer_list<std::uint64_t> args)
+    -> std::int64_t {
+  if (args.size() > 6) {
+    throw std::invalid_argument{"System calls take at most six arguments"};
+  }
+  if (m_scratch == 0) {
+    throw std::out_of_range{"No scratch location for system calls"};
+  }
+
+  user_regs_struct saved;
+  if (ptrace(PTRACE_GETREGS, m_pid, nullptr, &saved) == -1) {
+    throw std::out_of_range{"Cannot read registers"};
+  }
+
+  // The instruction only stays in place for the call, as the process may
+  // not have run its entry point yet
+  errno = 0;
+  auto word = ptrace(PTRACE_PEEKTEXT, m_pid, m_scratch, nullptr);
+  if (errno != 0) {
+    throw std::out_of_range{"Cannot read the scratch location"};
+  }
+  auto patched = (static_cast<std::uint64_t>(word) & ~std::uint64_t{0xffff}) |
+                 syscall_instruction;
+  if (ptrace(PTRACE_POKETEXT, m_pid, m_scratch, patched) == -1) {
+    throw std::out_of_range{"Cannot write the scratch location"};
+  }
+
+  // orig_rax of -1 keeps the kernel from restarting a call the process was
+  // stopped in
+  auto regs = saved;
+  regs.rip = m_scratch;
+  regs.rax = static_cast<std::uint64_t>(number);
+  regs.orig_rax = -1;
+  unsigned long long *arg_regs[] = {&regs.rdi, &regs.rsi, &regs.rdx,
+                                    &regs.r10, &regs.r8,  &regs.r9};
+  auto reg = arg_regs;
+  for (auto arg : args) {
+    **reg++ = arg;
+  }
+  ptrace(PTRACE_SETREGS, m_pid, nullptr, &regs);
+
+  // A signal stops the process before the call is made, or after it if it
+  // arrives meanwhile. It is held back until the call is made, then sent
+  // again
+  std::vector<siginfo_t> held;
+  int status;
+  for (;;) {
+    ptrace(PTRACE_SINGLESTEP, m_pid, nullptr, nullptr);
+    waitpid(m_pid, &status, 0);
+    if (!WIFSTOPPED(status)) {
+      break;
+    }
+    // A call starting a task stops for the event before it returns
+    if (status >> 16 != 0) {
+      continue;
+    }
+    ptrace(PTRACE_GETREGS, m_pid, nullptr, &regs);
+    siginfo_t info;
+    if (WSTOPSIG(status) != SIGTRAP &&
+        ptrace(PTRACE_GETSIGINFO, m_pid, nullptr, &info) != -1) {
+      held.push_back(info);
+    }
+
+    // A call a signal interrupted is made again when the process resumes,
+    // which the trap of the step may be reported before
+    auto result = static_cast<std::int64_t>(regs.rax);
+    if (regs.rip != m_scratch &&
+        (result < first_restart_error || result > last_restart_error)) {
+      break;
+    }
+  }
+  if (!WIFSTOPPED(status)) {
+    throw std::out_of_range{"Process exited during a system call"};
+  }
+
+  ptrace(PTRACE_POKETEXT, m_pid, m_scratch, word);
+  ptrace(PTRACE_SETREGS, m_pid, nullptr, &saved);
+  for (const auto &info : held) {
+    requeue_signal(m_pid, info);
+  }
+
+  if (regs.rip != m_scratch + syscall_length) {
+    throw std::out_of_range{"System call was interrupted"};
+  }
+  return static_cast<std::int64_t>(regs.rax);
+}
@@ -0,0 +1,214 @@
+#include "../include/journal.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+constexpr char journal_magic[8] = "CDBJRNL";
+
+// Names of DWARF registers 0 to 16
+const char *const register_names[n_dwarf_registers] = {
+    "rax", "rdx", "rcx", "rbx", "rsi", "rdi", "rbp", "rsp", "r8",
+    "r9",  "r10", "r11", "r12", "r13", "r14", "r15", "rip"};
+
+const char *const reason_names[] = {"trap", "watchpoint", "signal", "exited"};
+
+auto check_header(const journal_header &header) -> void {
+  if (std::memcmp(header.magic, journal_magic, sizeof(journal_magic)) != 0) {
+    throw std::invalid_argument{"Not a journal"};
+  }
+  if (header.version != journal_version ||
+      header.record_size != sizeof(journal_record)) {
+    throw std::invalid_argument{"Unsupported version of journal"};
+  }
+}
+
+} // namespace
+
+journal_writer::~journal_writer() { close(); }
+
+auto journal_writer::open(const std::string &path) -> void {
+  close();
+  auto fd =
+      ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    throw std::out_of_range{"Cannot open " + path};
+  }
+
+  try {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+      throw std::out_of_range{"Cannot open " + path};
+    }
+    if (st.st_size == 0) {
+      journal_header header{};
+      std::memcpy(header.magic, journal_magic, sizeof(journal_magic));
+      header.version = journal_version;
+      header.record_size = sizeof(journal_record);
+      if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+        throw std::out_of_range{"Cannot write to " + path};
+      }
+      st.st_size = sizeof(header);
+    } else {
+      journal_header header;
+      if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        throw std::invalid_argument{"Not a journal"};
+      }
+      check_header(header);
+    }
+
+    // A record cut short by a crash is overwritten by the next one
+    auto records =
+        (static_cast<std::size_t>(st.st_size) - sizeof(journal_header)) /
+        sizeof(journal_record);
+    if (ftruncate(fd, sizeof(journal_header) +
+                          records * sizeof(journal_record)) == -1) {
+      throw std::out_of_range{"Cannot write to " + path};
+    }
+    m_records = records;
+  } catch (...) {
+    ::close(fd);
+    throw;
+  }
+
+  m_fd = fd;
+  m_path = path;
+}
+
+auto journal_writer::close() noexcept -> void {
+  if (m_fd != -1) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  m_path.clear();
+  m_records = 0;
+}
+
+auto journal_writer::append(journal_record &record) noexcept -> bool {
+  if (m_fd == -1) {
+    return false;
+  }
+  record.sequence = m_records;
+  if (write(m_fd, &record, sizeof(record)) != sizeof(record)) {
+    return false;
+  }
+  ++m_records;
+  return true;
+}
+
+journal_reader::journal_reader(const std::string &path) {
+  auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    throw std::out_of_range{"Cannot open " + path};
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 ||
+      static_cast<std::size_t>(st.st_size) < sizeof(journal_header)) {
+    close(fd);
+    throw std::invalid_argument{"Not a journal"};
+  }
+
+  m_size = static_cast<std::size_t>(st.st_size);
+  m_map = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m_map == MAP_FAILED) {
+    m_map = nullptr;
+    throw std::out_of_range{"Cannot map " + path};
+  }
+
+  try {
+    check_header(*static_cast<const journal_header *>(m_map));
+  } catch (...) {
+    munmap(m_map, m_size);
+    throw;
+  }
+  m_first = reinterpret_cast<const journal_record *>(
+      static_cast<const std::uint8_t *>(m_map) + sizeof(journal_header));
+  m_records = (m_size - sizeof(journal_header)) / sizeof(journal_record);
+}
+
+journal_reader::~journal_reader() {
+  if (m_map != nullptr) {
+    munmap(m_map, m_size);
+  }
+}
+
+auto journal_reader::at(std::uint64_t index) const -> const journal_record & {
+  if (index >= m_records) {
+    throw std::out_of_range{"No record " + std::to_string(index) +
+                            " in the journal"};
+  }
+  return m_first[index];
+}
+
+auto journal_reader::seek(std::uint64_t timestamp) const noexcept
+    -> std::uint64_t {
+  // Records are appended in the order of their stops
+  auto found = std::lower_bound(m_first, m_first + m_records, timestamp,
+                                [](const journal_record &r, std::uint64_t t) {
+                                  return r.timestamp < t;
+                                });
+  return static_cast<std::uint64_t>(found - m_first);
+}
+
+auto print_journal_record(const journal_record &record, std::ostream &out)
+    -> void {
+  auto reason = static_cast<std::size_t>(record.reason);
+  out << '#' << std::dec << record.sequence << ' '
+      << record.timestamp / 1000000000 << '.' << std::setfill('0')
+      << std::setw(9) << record.timestamp % 1000000000 << " thread "
+      << record.thread << ' '
+      << (reason < sizeof(reason_names) / sizeof(reason_names[0])
+              ? reason_names[reason]
+              : "unknown");
+  if (record.reason == journal_reason::signal) {
+    out << ' ' << record.signal;
+  }
+  out << " at 0x" << std::hex << record.pc;
+  if ((record.flags & journal_resumed) != 0) {
+    out << ", resumed";
+  }
+  out << '\n';
+
+  if ((record.flags & journal_registers) != 0) {
+    for (std::size_t r = 0; r < n_dwarf_registers; ++r) {
+      out << (r % 4 == 0 ? "    " : " ") << std::setfill(' ') << std::setw(3)
+          << register_names[r] << " 0x" << std::setfill('0') << std::setw(16)
+          << record.regs[r] << (r % 4 == 3 ? "\n" : "");
+    }
+    out << " eflags 0x" << std::setw(16) << record.eflags << '\n';
+  }
+
+  if ((record.flags & journal_memory) != 0) {
+    auto size =
+        std::min<std::size_t>(record.memory_bytes, journal_memory_size);
+    for (std::size_t i = 0; i < size; i += 16) {
+      out << "    0x" << record.memory_address + i << ':';
+      for (auto j = i; j < std::min<std::size_t>(i + 16, size); ++j) {
+        out << ' ' << std::setw(2) << static_cast<unsigned>(record.memory[j]);
+      }
+      out << '\n';
+    }
+  }
+  out << std::dec << std::setfill(' ');
+}
+
+auto print_journal(const journal_reader &reader, std::uint64_t first,
+                   std::uint64_t count, std::ostream &out) -> void {
+  for (auto i = first; i < reader.size() && i - first < count; ++i) {
+    print_journal_record(reader.at(i), out);
+  }
+  out << std::dec << reader.size() << " records" << std::endl;
+}
@@ -1,24 +1,87 @@
+#include <signal.h>
 #include <sys/personality.h>
 #include <sys/ptrace.h>
 #include <unistd.h>
 
+#include <cstdlib>
+#include <exception>
 #include <iostream>
+#include <string>
 
 #include "../include/debugger.h"
+#include "../include/journal.h"
+#include "../include/syscall_trace.h"
 
 auto execute_debugee(const std::string &prog_name) noexcept -> void;
 
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
+  // --journal <path> [first [count]] prints a journal of stops, without a
+  // program to debug
+  if (argc > 2 && std::string{argv[1]} == "--journal") {
+    try {
+      journal_reader reader{argv[2]};
+      print_journal(reader, argc > 3 ? std::stoull(argv[3]) : 0,
+                    argc > 4 ? std::stoull(argv[4]) : reader.size(),
+                    std::cout);
+      return 0;
+    } catch (std::exception &e) {
+      std::cerr << e.what() << '\n';
+      return -1;
+    }
+  }
+
+  // --strace <calls> <program> [args] runs a program, printing the system
+  // calls in a comma-separated list, or all of them, as they return, and
+  // --latency <calls> <program> [args] prints how long they took at its end
+  if (argc > 3 && (std::string{argv[1]} == "--strace" ||
+                   std::string{argv[1]} == "--latency")) {
+    try {
+      auto syscalls = parse_syscalls(argv[2]);
+      auto filter = make_syscall_filter(syscalls, 0);
+      syscall_timer timer;
+      if (std::string{argv[1]} == "--latency") {
+        timer.start(syscalls.empty() ? known_syscalls() : syscalls);
+      }
+      pid_t pid = fork();
+      if (pid == 0) {
+        // The filter is installed once the tracer is ready for its stops
+        if (ptrace(PTRACE_TRACEME, 0, 0, 0) < 0 || raise(SIGSTOP) != 0 ||
+            !install_syscall_filter(filter)) {
+          std::cerr << "Cannot trace the program\n";
+          _exit(127);
+        }
+        execv(argv[3], argv + 3);
+        std::cerr << "Cannot run " << argv[3] << '\n';
+        _exit(127);
+      }
+      return trace_syscalls(pid, std::cerr,
+                            timer.active() ? &timer : nullptr);
+    } catch (std::exception &e) {
+      std::cerr << e.what() << '\n';
+      return -1;
+    }
+  }
+
+  // --agent <library> preloads the agent of fast tracepoints
+  const char *agent = nullptr;
+  auto arg = 1;
+  if (argc > 2 && std::string{argv[1]} == "--agent") {
+    agent = argv[2];
+    arg = 3;
+  }
+  if (argc <= arg) {
     std::cerr << "Program name not specified\n";
     return -1;
   }
 
-  char *prog = argv[1];
+  char *prog = argv[arg];
 
   pid_t pid = fork();
   if (pid == 0) { // child process
     personality(ADDR_NO_RANDOMIZE);
+    if (agent != nullptr) {
+      setenv("LD_PRELOAD", agent, 1);
+    }
     execute_debugee(prog);
   } else if (pid >= 1) { // parent process
     std::cout << "Started debugging process " << pid << '\n';
@@ -0,0 +1,161 @@
+#include "../include/memory.h"
+
+#include <climits>
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+auto read_memory_block(pid_t pid, std::uint64_t address, void *buffer,
+                       std::size_t size) noexcept -> bool {
+  if (size == 0) {
+    return true;
+  }
+
+  iovec local{buffer, size};
+  iovec remote{reinterpret_cast<void *>(address), size};
+  auto n = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+
+  return n == static_cast<ssize_t>(size);
+}
+
+auto write_memory_block(pid_t pid, std::uint64_t address, const void *buffer,
+                        std::size_t size) noexcept -> bool {
+  if (size == 0) {
+    return true;
+  }
+
+  iovec local{const_cast<void *>(buffer), size};
+  iovec remote{reinterpret_cast<void *>(address), size};
+  auto n = process_vm_writev(pid, &local, 1, &remote, 1, 0);
+
+  return n == static_cast<ssize_t>(size);
+}
+
+auto write_text(pid_t pid, std::uint64_t address, const std::uint8_t *bytes,
+                std::size_t size) -> void {
+  auto first = address & ~std::uint64_t{7};
+  for (auto word = first; word < address + size; word += 8) {
+    errno = 0;
+    auto value = ptrace(PTRACE_PEEKTEXT, pid, word, nullptr);
+    if (errno != 0) {
+      throw std::out_of_range{"Cannot access the text of the program"};
+    }
+    auto data = reinterpret_cast<std::uint8_t *>(&value);
+    for (std::size_t i = 0; i < 8; ++i) {
+      if (word + i >= address && word + i < address + size) {
+        data[i] = bytes[word + i - address];
+      }
+    }
+    if (ptrace(PTRACE_POKETEXT, pid, word, value) == -1) {
+      throw std::out_of_range{"Cannot write the text of the program"};
+    }
+  }
+}
+
+auto read_memory_ranges(pid_t pid,
+                        const std::vector<memory_range> &ranges) noexcept
+    -> bool {
+  std::vector<iovec> local, remote;
+  for (std::size_t first = 0; first < ranges.size(); first += IOV_MAX) {
+    auto last = std::min<std::size_t>(first + IOV_MAX, ranges.size());
+    local.clear();
+    remote.clear();
+    ssize_t total = 0;
+    for (auto i = first; i < last; ++i) {
+      local.push_back({ranges[i].buffer, ranges[i].size});
+      remote.push_back({reinterpret_cast<void *>(ranges[i].address),
+                        ranges[i].size});
+      total += ranges[i].size;
+    }
+
+    auto n = process_vm_readv(pid, local.data(), local.size(), remote.data(),
+                              remote.size(), 0);
+    if (n != total) {
+      return false;
+    }
+  }
+  return true;
+}
+
+memory_snapshot::memory_snapshot(pid_t pid, std::uint64_t low,
+                                 std::uint64_t high)
+    : m_pid{pid}, m_low{low}, m_data(high > low ? high - low : 0) {
+  iovec local{m_data.data(), m_data.size()};
+  iovec remote{reinterpret_cast<void *>(low), m_data.size()};
+  auto n = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+
+  // A partial read means the tail of the range is unmapped
+  m_data.resize(n < 0 ? 0 : n);
+}
+
+auto memory_snapshot::read(std::uint64_t address,
+                           std::uint64_t &value) const noexcept -> bool {
+  if (contains(address, sizeof(value))) {
+    std::memcpy(&value, m_data.data() + (address - m_low), sizeof(value));
+    return true;
+  }
+
+  return m_pid != 0 && read_memory_block(m_pid, address, &value, sizeof(value));
+}
+
+auto memory_snapshot::contains(std::uint64_t address,
+                               std::size_t size) const noexcept -> bool {
+  return address >= m_low && address - m_low + size <= m_data.size();
+}
+
+auto memory_batch::read(std::uint64_t address, void *buffer, std::size_t size)
+    -> bool {
+  if (size == 0) {
+    return true;
+  }
+
+  for (const auto &b : m_blocks) {
+    if (address >= b.address && address - b.address + size <= b.data.size()) {
+      if (!b.readable) {
+        throw std::out_of_range{"Cannot access memory"};
+      }
+      std::memcpy(buffer, b.data.data() + (address - b.address), size);
+      return true;
+    }
+  }
+
+  auto recorded = std::any_of(
+      m_pending.begin(), m_pending.end(), [&](const block &b) {
+        return b.address == address && b.data.size() == size;
+      });
+  if (!recorded) {
+    m_pending.push_back({address, std::vector<std::uint8_t>(size), true});
+  }
+  return false;
+}
+
+auto memory_batch::fetch() -> bool {
+  if (m_pending.empty()) {
+    return false;
+  }
+
+  std::vector<memory_range> ranges;
+  for (auto &b : m_pending) {
+    ranges.push_back({b.address, b.data.data(), b.data.size()});
+  }
+
+  // A vectored read stops at the first unreadable range, so the ranges are
+  // only read one by one to find out which of them failed
+  if (!read_memory_ranges(m_pid, ranges)) {
+    for (auto &b : m_pending) {
+      b.readable = read_memory_block(m_pid, b.address, b.data.data(),
+                                     b.data.size());
+    }
+  }
+
+  std::move(m_pending.begin(), m_pending.end(), std::back_inserter(m_blocks));
+  m_pending.clear();
+  return true;
+}
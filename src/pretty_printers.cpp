@@ -0,0 +1,465 @@
+#include "../include/pretty_printers.h"
+#include "../include/memory.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Sizes of the libstdc++ types, used to reject unrelated types of the same
+// name
+constexpr std::uint64_t string_size = 32;
+constexpr std::uint64_t vector_size = 24;
+constexpr std::uint64_t map_size = 48;
+constexpr std::uint64_t unordered_map_size = 56;
+constexpr std::uint64_t deque_size = 80;
+constexpr std::uint64_t shared_ptr_size = 16;
+
+// Offsets within the red-black tree of std::map
+constexpr std::uint64_t map_root = 16;
+constexpr std::uint64_t map_count = 40;
+constexpr std::uint64_t tree_node_left = 16;
+constexpr std::uint64_t tree_node_right = 24;
+constexpr std::uint64_t tree_node_value = 32;
+
+// Offsets within the hashtable of std::unordered_map
+constexpr std::uint64_t hashtable_buckets = 0;
+constexpr std::uint64_t hashtable_bucket_count = 8;
+constexpr std::uint64_t hashtable_count = 24;
+
+// Offsets of the start and finish iterators of std::deque
+constexpr std::uint64_t deque_start = 16;
+constexpr std::uint64_t deque_finish = 48;
+
+auto load(const std::uint8_t *data, std::uint64_t offset) -> std::uint64_t {
+  std::uint64_t value;
+  std::memcpy(&value, data + offset, sizeof(value));
+  return value;
+}
+
+auto align_up(std::uint64_t value, std::uint64_t alignment) -> std::uint64_t {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+auto alignment_of(const type_desc &type) -> std::uint64_t {
+  switch (type.kind) {
+  case type_kind::base:
+  case type_kind::pointer:
+  case type_kind::reference:
+  case type_kind::enumeration:
+    return std::max<std::uint64_t>(std::min<std::uint64_t>(type.size, 16), 1);
+  case type_kind::array:
+    return alignment_of(*type.target);
+  case type_kind::structure: {
+    std::uint64_t alignment = 1;
+    for (const auto &member : type.members) {
+      alignment = std::max(alignment, alignment_of(*member.type));
+    }
+    return alignment;
+  }
+  default:
+    return 1;
+  }
+}
+
+auto is_template(const type_desc &type, const std::string &name,
+                 std::size_t n_args) -> bool {
+  return type.kind == type_kind::structure &&
+         type.name.compare(0, name.size() + 1, name + "<") == 0 &&
+         type.template_args.size() >= n_args;
+}
+
+// Offset of the value within a std::pair<const K, V>
+auto pair_second_offset(const type_desc &key, const type_desc &value)
+    -> std::uint64_t {
+  return align_up(key.size, alignment_of(value));
+}
+
+} // namespace
+
+auto libstdcxx_printer::format(const type_desc &type, const std::uint8_t *data,
+                               std::ostream &out) -> bool {
+  if (type.kind != type_kind::structure) {
+    return false;
+  }
+
+  if (is_template(type, "basic_string", 1) && type.size == string_size &&
+      type.template_args[0]->size == 1) {
+    print_string(data, out);
+  } else if (is_template(type, "vector", 1) && type.size == vector_size &&
+             type.template_args[0]->size != 0) {
+    print_vector(*type.template_args[0], data, out);
+  } else if (is_template(type, "deque", 1) && type.size == deque_size &&
+             type.template_args[0]->size != 0) {
+    print_deque(*type.template_args[0], data, out);
+  } else if (is_template(type, "map", 2) && type.size == map_size) {
+    print_map(*type.template_args[0], *type.template_args[1], data, out);
+  } else if (is_template(type, "unordered_map", 2) &&
+             type.size == unordered_map_size) {
+    print_unordered_map(*type.template_args[0], *type.template_args[1], data,
+                        out);
+  } else if (is_template(type, "shared_ptr", 1) &&
+             type.size == shared_ptr_size) {
+    print_shared_ptr(type, data, out);
+  } else if (is_template(type, "optional", 1) &&
+             type.size > type.template_args[0]->size) {
+    print_optional(type, data, out);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+auto libstdcxx_printer::read_block(std::uint64_t address, void *buffer,
+                                   std::size_t size) -> bool {
+  return read_memory_block(m_pid, address, buffer, size);
+}
+
+auto libstdcxx_printer::read_ranges(const std::vector<memory_range> &ranges)
+    -> bool {
+  return read_memory_ranges(m_pid, ranges);
+}
+
+auto libstdcxx_printer::print_string(const std::uint8_t *data,
+                                     std::ostream &out) -> void {
+  auto pointer = load(data, 0);
+  auto length = load(data, 8);
+  auto n = std::min<std::uint64_t>(length, m_max_elements);
+
+  std::vector<std::uint8_t> chars(n);
+  if (!read_block(pointer, chars.data(), n)) {
+    out << "<error reading string at 0x" << std::hex << pointer << std::dec
+        << '>';
+    return;
+  }
+  format_string(chars.data(), n, n < length, out);
+}
+
+auto libstdcxx_printer::print_vector(const type_desc &element,
+                                     const std::uint8_t *data,
+                                     std::ostream &out) -> void {
+  auto start = load(data, 0);
+  auto finish = load(data, 8);
+  auto end_of_storage = load(data, 16);
+  auto length = (finish - start) / element.size;
+  auto n = std::min<std::uint64_t>(length, m_max_elements);
+
+  out << std::dec << "std::vector of length " << length << ", capacity "
+      << (end_of_storage - start) / element.size << " = {";
+
+  // All printed elements are contiguous, so they arrive with one read
+  std::vector<std::uint8_t> elements(n * element.size);
+  if (!read_block(start, elements.data(), elements.size())) {
+    out << "<error reading elements>}";
+    return;
+  }
+  for (std::uint64_t i = 0; i < n; ++i) {
+    if (i != 0) {
+      out << ", ";
+    }
+    format_value(element, elements.data() + i * element.size, out, this);
+  }
+  out << (n < length ? "...}" : "}");
+}
+
+auto libstdcxx_printer::print_deque(const type_desc &element,
+                                    const std::uint8_t *data,
+                                    std::ostream &out) -> void {
+  auto buffer_size = element.size < 512 ? 512 / element.size : 1;
+  auto start_cur = load(data, deque_start);
+  auto start_last = load(data, deque_start + 16);
+  auto start_node = load(data, deque_start + 24);
+  auto finish_cur = load(data, deque_finish);
+  auto finish_first = load(data, deque_finish + 8);
+  auto finish_node = load(data, deque_finish + 24);
+
+  auto n_nodes = (finish_node - start_node) / 8 + 1;
+  auto length = start_node == finish_node
+                    ? (finish_cur - start_cur) / element.size
+                    : (n_nodes - 2) * buffer_size +
+                          (start_last - start_cur) / element.size +
+                          (finish_cur - finish_first) / element.size;
+  auto n = std::min<std::uint64_t>(length, m_max_elements);
+
+  out << std::dec << "std::deque with " << length << " elements = {";
+
+  // The first buffer starts part way through, and the others are full
+  auto first_available = (start_node == finish_node ? finish_cur : start_last) -
+                         start_cur;
+  auto first_count = std::min<std::uint64_t>(first_available / element.size, n);
+  auto nodes_needed = std::min<std::uint64_t>(
+      n_nodes, 1 + (n - first_count + buffer_size - 1) / buffer_size);
+
+  // The map of buffers is read first, then the printed part of every buffer
+  // in one vectored read
+  std::vector<std::uint64_t> buffers(nodes_needed);
+  std::vector<std::uint8_t> elements(n * element.size);
+  std::vector<memory_range> ranges;
+  auto remaining = n;
+  if (read_block(start_node, buffers.data(), buffers.size() * 8)) {
+    for (std::size_t i = 0; i < buffers.size() && remaining > 0; ++i) {
+      auto take = i == 0 ? first_count
+                         : std::min<std::uint64_t>(remaining, buffer_size);
+      ranges.push_back({i == 0 ? start_cur : buffers[i],
+                        elements.data() + (n - remaining) * element.size,
+                        take * element.size});
+      remaining -= take;
+    }
+  }
+  if (remaining > 0 || !read_ranges(ranges)) {
+    out << "<error reading elements>}";
+    return;
+  }
+
+  for (std::uint64_t i = 0; i < n; ++i) {
+    if (i != 0) {
+      out << ", ";
+    }
+    format_value(element, elements.data() + i * element.size, out, this);
+  }
+  out << (n < length ? "...}" : "}");
+}
+
+auto libstdcxx_printer::print_map(const type_desc &key, const type_desc &value,
+                                  const std::uint8_t *data, std::ostream &out)
+    -> void {
+  struct tree_node {
+    std::uint64_t left = 0;
+    std::uint64_t right = 0;
+    std::vector<std::uint8_t> bytes;
+  };
+
+  auto root = load(data, map_root);
+  auto count = load(data, map_count);
+  auto node_size =
+      tree_node_value + pair_second_offset(key, value) + value.size;
+  out << std::dec << "std::map with " << count << " elements";
+  if (count == 0) {
+    return;
+  }
+
+  // Fetched nodes, and the unfetched subtrees that may still hold one of
+  // the first m_max_elements entries in order
+  std::unordered_map<std::uint64_t, tree_node> nodes;
+  std::vector<std::uint64_t> frontier{root};
+
+  // Walks the fetched part of the tree in order. A missing subtree is only
+  // worth fetching while fewer than m_max_elements nodes precede it.
+  std::size_t preceding = 0;
+  std::function<void(std::uint64_t)> find_frontier =
+      [&](std::uint64_t address) {
+        if (address == 0 || preceding >= m_max_elements) {
+          return;
+        }
+        auto it = nodes.find(address);
+        if (it == nodes.end()) {
+          frontier.push_back(address);
+          return;
+        }
+        find_frontier(it->second.left);
+        ++preceding;
+        find_frontier(it->second.right);
+      };
+
+  while (!frontier.empty()) {
+    std::vector<memory_range> ranges;
+    for (auto address : frontier) {
+      auto &node = nodes[address];
+      node.bytes.resize(node_size);
+      ranges.push_back({address, node.bytes.data(), node_size});
+    }
+    if (!read_ranges(ranges)) {
+      out << " = <error reading tree>";
+      return;
+    }
+    for (auto address : frontier) {
+      auto &node = nodes[address];
+      node.left = load(node.bytes.data(), tree_node_left);
+      node.right = load(node.bytes.data(), tree_node_right);
+    }
+
+    frontier.clear();
+    preceding = 0;
+    find_frontier(root);
+  }
+
+  out << " = {";
+  std::size_t printed = 0;
+  std::function<void(std::uint64_t)> print_in_order =
+      [&](std::uint64_t address) {
+        if (address == 0 || printed >= m_max_elements) {
+          return;
+        }
+        const auto &node = nodes[address];
+        print_in_order(node.left);
+        if (printed >= m_max_elements) {
+          return;
+        }
+        if (printed++ != 0) {
+          out << ", ";
+        }
+        print_entry(key, value, node.bytes.data() + tree_node_value, out);
+        print_in_order(node.right);
+      };
+  print_in_order(root);
+  out << (printed < count ? "...}" : "}");
+}
+
+auto libstdcxx_printer::print_unordered_map(const type_desc &key,
+                                            const type_desc &value,
+                                            const std::uint8_t *data,
+                                            std::ostream &out) -> void {
+  auto buckets_address = load(data, hashtable_buckets);
+  auto bucket_count = load(data, hashtable_bucket_count);
+  auto count = load(data, hashtable_count);
+  auto pair_alignment = std::max(alignment_of(key), alignment_of(value));
+  auto value_offset = align_up(8, pair_alignment);
+  auto node_size = value_offset + pair_second_offset(key, value) + value.size;
+
+  out << std::dec << "std::unordered_map with " << count << " elements";
+  if (count == 0) {
+    return;
+  }
+
+  // Each non-empty bucket points at the node before its first node, so a
+  // bucket's chain ends at the node another bucket points at
+  std::vector<std::uint64_t> buckets(bucket_count);
+  if (!read_block(buckets_address, buckets.data(), buckets.size() * 8)) {
+    out << " = <error reading buckets>";
+    return;
+  }
+  std::vector<std::uint64_t> before_buckets;
+  for (auto b : buckets) {
+    if (b != 0) {
+      before_buckets.push_back(b);
+    }
+  }
+  auto chains_begin = before_buckets;
+  std::sort(before_buckets.begin(), before_buckets.end());
+  auto ends_chain = [&](std::uint64_t address) {
+    return std::binary_search(before_buckets.begin(), before_buckets.end(),
+                              address);
+  };
+
+  out << " = {";
+  std::size_t printed = 0;
+  std::vector<std::uint8_t> bytes;
+  std::vector<memory_range> ranges;
+  for (std::size_t first = 0;
+       first < chains_begin.size() && printed < m_max_elements;) {
+    // Every chain holds at least one node, so this many chains cover the
+    // remaining elements to print
+    auto n_chains = std::min(chains_begin.size() - first,
+                             m_max_elements - printed);
+    std::vector<std::vector<std::uint64_t>> chains(n_chains);
+    std::vector<std::uint64_t> cursors(n_chains);
+    std::unordered_map<std::uint64_t, std::vector<std::uint8_t>> nodes;
+
+    // The first step reads the successor of each bucket's predecessor
+    ranges.clear();
+    for (std::size_t i = 0; i < n_chains; ++i) {
+      ranges.push_back({chains_begin[first + i], &cursors[i], 8});
+    }
+    auto ok = read_ranges(ranges);
+
+    // Later steps read the next node of every chain that has not ended. No
+    // chain needs more nodes than remain to print, which also stops the
+    // walk of a corrupted chain that loops
+    auto remaining = m_max_elements - printed;
+    while (ok) {
+      std::vector<std::size_t> active;
+      ranges.clear();
+      for (std::size_t i = 0; i < n_chains; ++i) {
+        if (cursors[i] != 0) {
+          auto &node = nodes[cursors[i]];
+          node.resize(node_size);
+          ranges.push_back({cursors[i], node.data(), node_size});
+          active.push_back(i);
+        }
+      }
+      if (active.empty()) {
+        break;
+      }
+      ok = read_ranges(ranges);
+
+      for (auto i : active) {
+        auto address = cursors[i];
+        chains[i].push_back(address);
+        cursors[i] = ends_chain(address) || chains[i].size() >= remaining
+                         ? 0
+                         : load(nodes[address].data(), 0);
+      }
+    }
+    if (!ok) {
+      out << "<error reading nodes>}";
+      return;
+    }
+
+    for (const auto &chain : chains) {
+      for (auto address : chain) {
+        if (printed >= m_max_elements) {
+          break;
+        }
+        if (printed++ != 0) {
+          out << ", ";
+        }
+        print_entry(key, value, nodes[address].data() + value_offset, out);
+      }
+    }
+    out.flush();
+    first += n_chains;
+  }
+  out << (printed < count ? "...}" : "}");
+}
+
+auto libstdcxx_printer::print_shared_ptr(const type_desc &type,
+                                         const std::uint8_t *data,
+                                         std::ostream &out) -> void {
+  auto pointer = load(data, 0);
+  auto control = load(data, 8);
+  out << "std::shared_ptr<" << type.template_args[0]->name << "> ";
+
+  // The control block holds its vtable pointer, then the use and weak
+  // counts, the latter biased by one while any use remains
+  std::int32_t counts[2];
+  if (control == 0) {
+    out << "(empty)";
+  } else if (read_block(control + 8, counts, sizeof(counts))) {
+    out << std::dec << "(use count " << counts[0] << ", weak count "
+        << counts[1] - (counts[0] > 0 ? 1 : 0) << ')';
+  } else {
+    out << "<error reading control block>";
+  }
+  out << " = {get() = 0x" << std::hex << pointer << std::dec << '}';
+}
+
+auto libstdcxx_printer::print_optional(const type_desc &type,
+                                       const std::uint8_t *data,
+                                       std::ostream &out) -> void {
+  // The engaged flag directly follows the storage of the value
+  const auto &value = *type.template_args[0];
+  out << "std::optional<" << value.name << '>';
+  if (data[value.size] == 0) {
+    out << " [no contained value]";
+    return;
+  }
+  out << " = {[contained value] = ";
+  format_value(value, data, out, this);
+  out << '}';
+}
+
+auto libstdcxx_printer::print_entry(const type_desc &key,
+                                    const type_desc &value,
+                                    const std::uint8_t *pair,
+                                    std::ostream &out) -> void {
+  out << '[';
+  format_value(key, pair, out, this);
+  out << "] = ";
+  format_value(value, pair + pair_second_offset(key, value), out, this);
+}
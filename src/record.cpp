@@ -0,0 +1,415 @@
+#include "../include/record.h"
+#include "../include/memory.h"
+
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t page_size = 4096;
+
+// Number of 64-bit registers in user_regs_struct
+constexpr std::size_t user_registers =
+    sizeof(user_regs_struct) / sizeof(std::uint64_t);
+
+// The FPU and SSE state is compared in chunks the size of an xmm register
+constexpr std::size_t fp_chunk = 16;
+constexpr std::size_t fp_chunks = sizeof(user_fpregs_struct) / fp_chunk;
+
+static_assert(user_registers <= 32 && fp_chunks <= 32,
+              "Changed registers are kept in 32-bit masks");
+
+template <typename T>
+auto append(std::vector<std::uint8_t> &out, const T &value) -> void {
+  auto bytes = reinterpret_cast<const std::uint8_t *>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(value));
+}
+
+template <typename T>
+auto extract(const std::vector<std::uint8_t> &in, std::size_t &offset) -> T {
+  T value;
+  std::memcpy(&value, in.data() + offset, sizeof(value));
+  offset += sizeof(value);
+  return value;
+}
+
+// Reads as much of a range as is mapped, up to the end of its first page
+auto read_available(pid_t pid, std::uint64_t address, std::uint8_t *buffer,
+                    std::size_t size) noexcept -> std::size_t {
+  if (read_memory_block(pid, address, buffer, size)) {
+    return size;
+  }
+  auto to_page = page_size - address % page_size;
+  if (to_page < size && read_memory_block(pid, address, buffer, to_page)) {
+    return to_page;
+  }
+  return 0;
+}
+
+} // namespace
+
+auto delta_log::push(const std::uint8_t *data, std::size_t size) -> bool {
+  auto framed = size + 2 * sizeof(std::uint32_t);
+  if (framed > m_data.size()) {
+    return false;
+  }
+
+  while (m_data.size() - m_used < framed) {
+    auto tail = (m_head + m_data.size() - m_used) % m_data.size();
+    std::uint32_t oldest;
+    read(tail, &oldest, sizeof(oldest));
+    m_used -= oldest + 2 * sizeof(std::uint32_t);
+    --m_entries;
+    ++m_dropped;
+  }
+
+  auto length = static_cast<std::uint32_t>(size);
+  write(m_head, &length, sizeof(length));
+  write(m_head + sizeof(length), data, size);
+  write(m_head + sizeof(length) + size, &length, sizeof(length));
+  m_head = (m_head + framed) % m_data.size();
+  m_used += framed;
+  ++m_entries;
+  return true;
+}
+
+auto delta_log::newest(std::vector<std::uint8_t> &data) const -> bool {
+  if (m_entries == 0) {
+    return false;
+  }
+  auto at = m_head;
+  entry_before(at, data);
+  return true;
+}
+
+auto delta_log::entry_before(std::size_t &at,
+                             std::vector<std::uint8_t> &data) const -> void {
+  std::uint32_t length;
+  auto end = at + m_data.size() - sizeof(length);
+  read(end, &length, sizeof(length));
+  data.resize(length);
+  read(end + m_data.size() - length, data.data(), length);
+  at = (end + 2 * m_data.size() - length - sizeof(length)) % m_data.size();
+}
+
+auto delta_log::pop() noexcept -> void {
+  if (m_entries == 0) {
+    return;
+  }
+
+  std::uint32_t length;
+  read(m_head + m_data.size() - sizeof(length), &length, sizeof(length));
+  auto framed = length + 2 * sizeof(length);
+  m_head = (m_head + m_data.size() - framed) % m_data.size();
+  m_used -= framed;
+  --m_entries;
+}
+
+auto delta_log::clear() noexcept -> void {
+  m_head = 0;
+  m_used = 0;
+  m_entries = 0;
+  m_dropped = 0;
+}
+
+auto delta_log::write(std::size_t at, const void *data,
+                      std::size_t size) noexcept -> void {
+  at %= m_data.size();
+  auto first = std::min(size, m_data.size() - at);
+  auto bytes = static_cast<const std::uint8_t *>(data);
+  std::memcpy(m_data.data() + at, bytes, first);
+  std::memcpy(m_data.data(), bytes + first, size - first);
+}
+
+auto delta_log::read(std::size_t at, void *data, std::size_t size) const
+    noexcept -> void {
+  at %= m_data.size();
+  auto first = std::min(size, m_data.size() - at);
+  auto bytes = static_cast<std::uint8_t *>(data);
+  std::memcpy(bytes, m_data.data() + at, first);
+  std::memcpy(bytes + first, m_data.data(), size - first);
+}
+
+auto execution_recorder::start(std::size_t capacity) -> void {
+  // The largest entry changes every register and every window, and is
+  // framed by its length twice
+  constexpr std::size_t largest =
+      3 * sizeof(std::uint32_t) + sizeof(user_regs_struct) +
+      sizeof(std::uint32_t) + sizeof(user_fpregs_struct) +
+      sizeof(std::uint8_t) +
+      max_windows *
+          (sizeof(std::uint64_t) + sizeof(std::uint16_t) + window_size);
+  if (capacity < largest) {
+    throw std::invalid_argument{"The record log needs at least " +
+                                std::to_string(largest) + " bytes"};
+  }
+
+  m_log = delta_log{capacity};
+  m_instructions = 0;
+  m_elapsed = std::chrono::nanoseconds{0};
+  sync();
+  m_recording = true;
+}
+
+auto execution_recorder::stop() noexcept -> void {
+  m_recording = false;
+  m_log = delta_log{};
+  m_decoded.clear();
+}
+
+auto execution_recorder::sync() -> void {
+  if (ptrace(PTRACE_GETREGS, m_pid, nullptr, &m_regs) == -1 ||
+      ptrace(PTRACE_GETFPREGS, m_pid, nullptr, &m_fpregs) == -1) {
+    throw std::out_of_range{"Cannot read registers"};
+  }
+
+  // Breakpoints and fast tracepoints may have been patched in since
+  m_decoded.clear();
+}
+
+auto execution_recorder::decode(std::uint64_t address)
+    -> const x86_instruction * {
+  auto cached = m_decoded.find(address);
+  if (cached != m_decoded.end()) {
+    return &cached->second;
+  }
+
+  std::uint8_t code[16];
+  auto size = read_available(m_pid, address, code, sizeof(code));
+  x86_instruction insn;
+  if (!decode_x86_instruction(code, size, insn)) {
+    return nullptr;
+  }
+  return &m_decoded.emplace(address, insn).first->second;
+}
+
+auto execution_recorder::before_step() -> void {
+  m_window_count = 0;
+  auto insn = decode(m_regs.rip);
+  if (insn == nullptr) {
+    return;
+  }
+
+  auto add = [this](std::uint64_t address) {
+    auto &w = m_windows[m_window_count];
+    w.address = address;
+    w.size = read_available(m_pid, address, w.bytes.data(), window_size);
+    if (w.size != 0) {
+      ++m_window_count;
+    }
+  };
+
+  if (insn->memory) {
+    const std::uint64_t registers[x86_registers] = {
+        m_regs.rax, m_regs.rcx, m_regs.rdx, m_regs.rbx,
+        m_regs.rsp, m_regs.rbp, m_regs.rsi, m_regs.rdi,
+        m_regs.r8,  m_regs.r9,  m_regs.r10, m_regs.r11,
+        m_regs.r12, m_regs.r13, m_regs.r14, m_regs.r15};
+    add(x86_memory_address(*insn, m_regs.rip, registers, m_regs.fs_base,
+                           m_regs.gs_base));
+  }
+  if (insn->pushes) {
+    add(m_regs.rsp - window_size);
+  }
+  if (insn->stores_string) {
+    add(m_regs.rdi);
+  }
+}
+
+auto execution_recorder::step() -> int {
+  auto begin = std::chrono::steady_clock::now();
+  before_step();
+
+  int status = 0;
+  ptrace(PTRACE_SINGLESTEP, m_pid, nullptr, nullptr);
+  waitpid(m_pid, &status, 0);
+  user_regs_struct regs;
+  user_fpregs_struct fpregs;
+  if (WIFSTOPPED(status) &&
+      ptrace(PTRACE_GETREGS, m_pid, nullptr, &regs) != -1 &&
+      ptrace(PTRACE_GETFPREGS, m_pid, nullptr, &fpregs) != -1) {
+    log_changes(regs, fpregs);
+    ++m_instructions;
+  }
+  m_window_count = 0;
+  m_elapsed += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - begin);
+  return status;
+}
+
+auto execution_recorder::after_step() -> void {
+  user_regs_struct regs;
+  user_fpregs_struct fpregs;
+  if (ptrace(PTRACE_GETREGS, m_pid, nullptr, &regs) == -1 ||
+      ptrace(PTRACE_GETFPREGS, m_pid, nullptr, &fpregs) == -1) {
+    throw std::out_of_range{"Cannot read registers"};
+  }
+  log_changes(regs, fpregs);
+  m_window_count = 0;
+}
+
+auto execution_recorder::log_changes(const user_regs_struct &regs,
+                                     const user_fpregs_struct &fpregs)
+    -> bool {
+  // Registers: a mask of those that changed, then their old values
+  m_entry.clear();
+  auto before = reinterpret_cast<const std::uint64_t *>(&m_regs);
+  auto after = reinterpret_cast<const std::uint64_t *>(&regs);
+  std::uint32_t mask = 0;
+  for (std::size_t i = 0; i < user_registers; ++i) {
+    mask |= before[i] != after[i] ? 1u << i : 0;
+  }
+  auto changed = mask != 0;
+  append(m_entry, mask);
+  for (std::size_t i = 0; i < user_registers; ++i) {
+    if ((mask & (1u << i)) != 0) {
+      append(m_entry, before[i]);
+    }
+  }
+
+  // The FPU and SSE state, in the same way
+  auto fp_before = reinterpret_cast<const std::uint8_t *>(&m_fpregs);
+  auto fp_after = reinterpret_cast<const std::uint8_t *>(&fpregs);
+  mask = 0;
+  for (std::size_t i = 0; i < fp_chunks; ++i) {
+    if (std::memcmp(fp_before + i * fp_chunk, fp_after + i * fp_chunk,
+                    fp_chunk) != 0) {
+      mask |= 1u << i;
+    }
+  }
+  changed = changed || mask != 0;
+  append(m_entry, mask);
+  for (std::size_t i = 0; i < fp_chunks; ++i) {
+    if ((mask & (1u << i)) != 0) {
+      m_entry.insert(m_entry.end(), fp_before + i * fp_chunk,
+                     fp_before + (i + 1) * fp_chunk);
+    }
+  }
+
+  // Memory: the old contents of the bytes of each window that changed
+  auto count_at = m_entry.size();
+  append(m_entry, std::uint8_t{0});
+  for (std::size_t i = 0; i < m_window_count; ++i) {
+    const auto &w = m_windows[i];
+    std::array<std::uint8_t, window_size> now;
+    if (!read_memory_block(m_pid, w.address, now.data(), w.size)) {
+      continue;
+    }
+    auto first = static_cast<std::size_t>(
+        std::mismatch(w.bytes.begin(), w.bytes.begin() + w.size, now.begin())
+            .first -
+        w.bytes.begin());
+    if (first == w.size) {
+      continue;
+    }
+    auto last = w.size;
+    while (w.bytes[last - 1] == now[last - 1]) {
+      --last;
+    }
+    append(m_entry, w.address + first);
+    append(m_entry, static_cast<std::uint16_t>(last - first));
+    m_entry.insert(m_entry.end(), w.bytes.begin() + first,
+                   w.bytes.begin() + last);
+    ++m_entry[count_at];
+    changed = true;
+  }
+
+  if (!changed) {
+    return false;
+  }
+  if (!m_log.push(m_entry.data(), m_entry.size())) {
+    m_window_count = 0;
+    stop();
+    throw std::out_of_range{"The record log is too small for a step, "
+                            "recording stopped"};
+  }
+  m_regs = regs;
+  m_fpregs = fpregs;
+  return true;
+}
+
+auto execution_recorder::apply_registers(const std::vector<std::uint8_t> &entry,
+                                         user_regs_struct &regs) const
+    -> std::size_t {
+  std::size_t offset = 0;
+  auto mask = extract<std::uint32_t>(entry, offset);
+  auto values = reinterpret_cast<std::uint64_t *>(&regs);
+  for (std::size_t i = 0; i < user_registers; ++i) {
+    if ((mask & (1u << i)) != 0) {
+      values[i] = extract<std::uint64_t>(entry, offset);
+    }
+  }
+  return offset;
+}
+
+auto execution_recorder::undo() -> bool {
+  if (!m_log.newest(m_entry)) {
+    return false;
+  }
+
+  auto regs = m_regs;
+  auto offset = apply_registers(m_entry, regs);
+  auto fpregs = m_fpregs;
+  auto mask = extract<std::uint32_t>(m_entry, offset);
+  for (std::size_t i = 0; i < fp_chunks; ++i) {
+    if ((mask & (1u << i)) != 0) {
+      std::memcpy(reinterpret_cast<std::uint8_t *>(&fpregs) + i * fp_chunk,
+                  m_entry.data() + offset, fp_chunk);
+      offset += fp_chunk;
+    }
+  }
+
+  // Windows may overlap, so they are restored newest first
+  std::size_t ranges[max_windows];
+  auto count = extract<std::uint8_t>(m_entry, offset);
+  for (std::size_t i = 0; i < count; ++i) {
+    ranges[i] = offset;
+    offset += sizeof(std::uint64_t);
+    offset += extract<std::uint16_t>(m_entry, offset);
+  }
+  for (auto i = count; i-- > 0;) {
+    offset = ranges[i];
+    auto address = extract<std::uint64_t>(m_entry, offset);
+    auto size = extract<std::uint16_t>(m_entry, offset);
+    if (!write_memory_block(m_pid, address, m_entry.data() + offset, size)) {
+      throw std::out_of_range{"Cannot restore memory"};
+    }
+  }
+
+  if (ptrace(PTRACE_SETREGS, m_pid, nullptr, &regs) == -1 ||
+      ptrace(PTRACE_SETFPREGS, m_pid, nullptr, &fpregs) == -1) {
+    throw std::out_of_range{"Cannot restore registers"};
+  }
+  m_log.pop();
+  m_regs = regs;
+  m_fpregs = fpregs;
+  return true;
+}
+
+auto execution_recorder::walk_back(
+    const std::function<bool(const user_regs_struct &)> &visit) const
+    -> std::size_t {
+  std::vector<std::uint8_t> entry;
+  auto regs = m_regs;
+  auto at = m_log.end();
+  std::size_t visited = 0;
+  while (visited < m_log.entries()) {
+    m_log.entry_before(at, entry);
+    apply_registers(entry, regs);
+    ++visited;
+    if (!visit(regs)) {
+      break;
+    }
+  }
+  return visited;
+}
@@ -32,6 +32,15 @@ auto get_register_value_from_dwarf_register(pid_t pid, unsigned regnum)
   return get_register_value(pid, it->r);
 }
 
+auto get_register_value_from_dwarf_register(const dwarf_register_set &regs,
+                                            unsigned regnum) -> std::uint64_t {
+  if (!regs.has(regnum)) {
+    throw std::out_of_range("Register not saved in this frame");
+  }
+
+  return regs.values[regnum];
+}
+
 auto get_register_name(reg r) noexcept -> std::string {
   auto it =
       std::find_if(begin(g_register_descriptors), end(g_register_descriptors),
@@ -39,6 +48,22 @@ auto get_register_name(reg r) noexcept -> std::string {
   return it->name;
 }
 
+auto get_dwarf_register_name(unsigned regnum) -> std::string {
+  if (regnum == dwarf_return_address_register) {
+    return get_register_name(reg::rip);
+  }
+
+  auto it =
+      std::find_if(begin(g_register_descriptors), end(g_register_descriptors),
+                   [regnum](auto &&rd) {
+                     return rd.dwarf_r == static_cast<int>(regnum);
+                   });
+  if (it == end(g_register_descriptors)) {
+    return std::to_string(regnum);
+  }
+  return it->name;
+}
+
 auto get_register_from_name(const std::string &name) noexcept -> reg {
   auto it =
       std::find_if(begin(g_register_descriptors), end(g_register_descriptors),
@@ -57,3 +82,25 @@ auto set_register_value(pid_t pid, reg r, uint64_t value) -> void {
     (it - begin(g_register_descriptors))) = value;
   ptrace(PTRACE_SETREGS, pid, nullptr, &regs);
 }
+
+auto get_dwarf_register_set(pid_t pid) noexcept -> dwarf_register_set {
+  user_regs_struct regs;
+  ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
+  return to_dwarf_register_set(regs);
+}
+
+auto to_dwarf_register_set(const user_regs_struct &regs) noexcept
+    -> dwarf_register_set {
+  dwarf_register_set set{};
+  auto raw = reinterpret_cast<const std::uint64_t *>(&regs);
+  for (std::size_t i = 0; i < g_register_descriptors.size(); ++i) {
+    auto regnum = g_register_descriptors[i].dwarf_r;
+    if (regnum >= 0 && static_cast<std::size_t>(regnum) < n_dwarf_registers) {
+      set.set(regnum, raw[i]);
+    }
+  }
+  set.set(dwarf_return_address_register, regs.rip);
+  set.fs_base = regs.fs_base;
+
+  return set;
+}
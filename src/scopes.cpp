@@ -0,0 +1,105 @@
+#include "../include/scopes.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+function_scopes::function_scopes(const dwarf::die &function, type_index &types,
+                                 location_cache &locations)
+    : m_blocks(1) {
+  build(function, 0, types, locations);
+}
+
+auto function_scopes::build(const dwarf::die &die, std::size_t block,
+                            type_index &types, location_cache &locations)
+    -> void {
+  for (const auto &child : die) {
+    if (child.tag == dwarf::DW_TAG::variable ||
+        child.tag == dwarf::DW_TAG::formal_parameter) {
+      // Declarations of globals inside a function have no storage here
+      if (!child.has(dwarf::DW_AT::name) ||
+          child.has(dwarf::DW_AT::declaration)) {
+        continue;
+      }
+
+      scope_variable variable;
+      variable.name = dwarf::at_name(child);
+      variable.type = &types.get_type_of(child);
+      variable.is_parameter = child.tag == dwarf::DW_TAG::formal_parameter;
+      if (child.has(dwarf::DW_AT::location)) {
+        try {
+          variable.location = &locations.get(child, dwarf::DW_AT::location);
+        } catch (std::exception &) {
+          // Shown as optimized out
+        }
+      }
+      m_blocks[block].variables.push_back(std::move(variable));
+    } else if (child.tag == dwarf::DW_TAG::lexical_block) {
+      auto ranges = dwarf::die_pc_range(child);
+      if (ranges.begin() == ranges.end()) {
+        build(child, block, types, locations);
+        continue;
+      }
+
+      // Blocks are referred to by index, as adding one may move the others
+      auto nested = m_blocks.size();
+      m_blocks.emplace_back();
+      for (const auto &range : ranges) {
+        m_blocks[block].children.push_back({range.low, range.high, nested});
+      }
+      build(child, nested, types, locations);
+    }
+  }
+
+  auto &children = m_blocks[block].children;
+  std::sort(children.begin(), children.end(),
+            [](const scope_range &a, const scope_range &b) {
+              return a.low < b.low;
+            });
+}
+
+auto function_scopes::visible(std::uint64_t pc) const
+    -> std::vector<const scope_block *> {
+  std::vector<const scope_block *> blocks{&m_blocks[0]};
+
+  // Sibling blocks never overlap, so at most one child contains the PC: the
+  // last one starting at or before it
+  while (true) {
+    const auto &children = blocks.back()->children;
+    auto it = std::upper_bound(
+        children.begin(), children.end(), pc,
+        [](std::uint64_t pc, const scope_range &r) { return pc < r.low; });
+    if (it == children.begin() || pc >= (--it)->high) {
+      break;
+    }
+    blocks.push_back(&m_blocks[it->block]);
+  }
+
+  std::reverse(blocks.begin(), blocks.end());
+  return blocks;
+}
+
+auto function_scopes::parameters() const
+    -> std::vector<const scope_variable *> {
+  std::vector<const scope_variable *> result;
+  for (const auto &variable : m_blocks[0].variables) {
+    if (variable.is_parameter) {
+      result.push_back(&variable);
+    }
+  }
+  return result;
+}
+
+auto scope_index::get(const dwarf::die &function) -> const function_scopes & {
+  auto offset = function.get_section_offset();
+  auto it = m_functions.find(offset);
+  if (it == m_functions.end()) {
+    it = m_functions
+             .emplace(offset,
+                      function_scopes{function, m_types, m_locations})
+             .first;
+  }
+  return it->second;
+}
@@ -0,0 +1,121 @@
+#include "../include/shared_objects.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+/**
+ * Where a file is mapped into a process.
+ */
+struct file_mapping {
+  std::uint64_t low = 0;   ///< Start of its first mapping
+  std::uint64_t high = 0;  ///< End of its last mapping
+  std::uint64_t base = 0;  ///< Start of the mapping of its first page
+  bool has_base = false;   ///< Whether its first page is mapped
+  bool executable = false; ///< Whether any of it is executable
+};
+
+auto get_section_view(const elf::elf &f, const std::string &name)
+    -> section_view {
+  section_view v;
+  const auto &sec = f.get_section(name);
+  if (sec.valid()) {
+    v.data = static_cast<const std::uint8_t *>(sec.data());
+    v.size = sec.size();
+    v.addr = sec.get_hdr().addr;
+  }
+  return v;
+}
+
+} // namespace
+
+auto shared_object_table::update(pid_t pid) -> std::vector<code_module> {
+  auto proc = "/proc/" + std::to_string(pid);
+
+  // The program has its own tables
+  char exe[PATH_MAX];
+  auto length = readlink((proc + "/exe").c_str(), exe, sizeof(exe) - 1);
+  std::string program{exe, length > 0 ? static_cast<std::size_t>(length) : 0};
+
+  std::map<std::string, file_mapping> files;
+  std::ifstream maps(proc + "/maps");
+  std::string line;
+  while (std::getline(maps, line)) {
+    std::istringstream fields{line};
+    std::string start, end, perms, offset, device, inode, path;
+    std::getline(fields, start, '-');
+    fields >> end >> perms >> offset >> device >> inode >> std::ws;
+    std::getline(fields, path);
+    if (path.empty() || path[0] != '/' || path == program ||
+        m_paths.count(path) != 0) {
+      continue;
+    }
+
+    std::uint64_t low = std::stoull(start, nullptr, 16);
+    std::uint64_t high = std::stoull(end, nullptr, 16);
+    auto &file = files[path];
+    if (file.high == 0 || low < file.low) {
+      file.low = low;
+    }
+    file.high = std::max(file.high, high);
+    if (std::stoull(offset, nullptr, 16) == 0 && !file.has_base) {
+      file.base = low;
+      file.has_base = true;
+    }
+    file.executable = file.executable || perms.find('x') != std::string::npos;
+  }
+
+  std::vector<code_module> loaded;
+  for (const auto &f : files) {
+    // Data files mapped by the program have no code to unwind through
+    if (!f.second.executable || !f.second.has_base) {
+      continue;
+    }
+    m_paths.insert(f.first);
+
+    auto fd = open(f.first.c_str(), O_RDONLY);
+    if (fd < 0) {
+      continue;
+    }
+    try {
+      auto o = std::make_unique<object>();
+      o->elf = elf::elf{elf::create_mmap_loader(fd)};
+
+      std::uint64_t bias = f.second.base;
+      for (const auto &seg : o->elf.segments()) {
+        const auto &hdr = seg.get_hdr();
+        if (hdr.type == elf::pt::load && hdr.offset == 0) {
+          bias = f.second.base - hdr.vaddr;
+          break;
+        }
+      }
+
+      o->cfi = cfi_table{get_section_view(o->elf, ".eh_frame_hdr"),
+                         get_section_view(o->elf, ".eh_frame"),
+                         get_section_view(o->elf, ".debug_frame")};
+      o->symbols = symbol_index{o->elf};
+      o->module.low = f.second.low;
+      o->module.high = f.second.high;
+      o->module.bias = bias;
+      o->module.cfi = &o->cfi;
+      o->module.symbols = &o->symbols;
+      o->module.text = get_section_view(o->elf, ".text");
+      loaded.push_back(o->module);
+      m_objects.push_back(std::move(o));
+    } catch (std::exception &) {
+    }
+  }
+  return loaded;
+}
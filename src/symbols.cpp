@@ -0,0 +1,70 @@
+#include "../include/symbols.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+symbol_index::symbol_index(const elf::elf &f, elf::stt type) {
+  auto index = [this, type](const elf::section &sec) {
+    for (const auto &sym : sec.as_symtab()) {
+      const auto &data = sym.get_data();
+      if (data.type() == type && data.value != 0) {
+        m_symbols.push_back({data.value, data.size, sym.get_name()});
+      }
+    }
+  };
+
+  const auto &symtab = f.get_section(".symtab");
+  if (symtab.valid()) {
+    index(symtab);
+  } else {
+    const auto &dynsym = f.get_section(".dynsym");
+    if (dynsym.valid()) {
+      index(dynsym);
+    }
+  }
+
+  std::sort(m_symbols.begin(), m_symbols.end(),
+            [](const symbol &a, const symbol &b) { return a.addr < b.addr; });
+}
+
+auto symbol_index::find(std::uint64_t addr) const noexcept -> const symbol * {
+  auto it = std::upper_bound(
+      m_symbols.begin(), m_symbols.end(), addr,
+      [](std::uint64_t value, const symbol &s) { return value < s.addr; });
+  if (it == m_symbols.begin()) {
+    return nullptr;
+  }
+
+  auto next = it;
+  --it;
+  if (it->size != 0) {
+    return addr < it->addr + it->size ? &*it : nullptr;
+  }
+  return next != m_symbols.end() && addr < next->addr ? &*it : nullptr;
+}
+
+auto symbol_index::find_by_name(const std::string &name) const noexcept
+    -> const symbol * {
+  auto it = std::find_if(m_symbols.begin(), m_symbols.end(),
+                         [&name](const symbol &s) { return s.name == name; });
+  return it != m_symbols.end() ? &*it : nullptr;
+}
+
+auto symbol_index::find_overlapping(std::uint64_t low,
+                                    std::uint64_t high) const
+    -> std::vector<const symbol *> {
+  // Any symbol may be large enough to reach the range, so all those that
+  // start before its end are checked
+  std::vector<const symbol *> found;
+  for (const auto &s : m_symbols) {
+    if (s.addr >= high) {
+      break;
+    }
+    if (s.addr + std::max<std::uint64_t>(s.size, 1) > low) {
+      found.push_back(&s);
+    }
+  }
+  return found;
+}
@@ -0,0 +1,251 @@
+#include "../include/syscall_latency.h"
+#include "../include/syscall_trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr unsigned sub_bucket_bits = latency_histogram::sub_bucket_bits;
+constexpr std::uint64_t sub_buckets = std::uint64_t{1} << sub_bucket_bits;
+
+// Longest duration told apart from longer ones
+constexpr std::uint64_t max_value =
+    (std::uint64_t{1} << latency_histogram::max_bits) - 1;
+
+// Width of the bar of the most common range of a histogram
+constexpr std::uint64_t bar_width = 40;
+
+// Percentiles printed for each call
+constexpr unsigned percentiles[] = {50, 90, 99};
+
+auto highest_bit(std::uint64_t value) noexcept -> unsigned {
+  return 63 - static_cast<unsigned>(__builtin_clzll(value | 1));
+}
+
+// Values below twice the sub-buckets have a bucket each, and the bucket of
+// a larger one keeps the bits below its highest that fit in a sub-bucket
+auto bucket_index(std::uint64_t value) noexcept -> std::size_t {
+  if (value < 2 * sub_buckets) {
+    return value;
+  }
+  auto shift = highest_bit(value) - sub_bucket_bits;
+  return (shift << sub_bucket_bits) + (value >> shift);
+}
+
+auto lowest_value(std::size_t index) noexcept -> std::uint64_t {
+  if (index < 2 * sub_buckets) {
+    return index;
+  }
+  auto shift = (index >> sub_bucket_bits) - 1;
+  return (sub_buckets + index % sub_buckets) << shift;
+}
+
+auto highest_value(std::size_t index) noexcept -> std::uint64_t {
+  if (index < 2 * sub_buckets) {
+    return index;
+  }
+  auto shift = (index >> sub_bucket_bits) - 1;
+  return lowest_value(index) + (std::uint64_t{1} << shift) - 1;
+}
+
+} // namespace
+
+auto latency_histogram::record(std::uint64_t ns) noexcept -> void {
+  ++m_counts[bucket_index(std::min(ns, max_value))];
+  if (m_count == 0 || ns < m_min) {
+    m_min = ns;
+  }
+  m_max = std::max(m_max, ns);
+  ++m_count;
+  m_total += ns;
+}
+
+auto latency_histogram::clear() noexcept -> void {
+  m_counts.fill(0);
+  m_count = 0;
+  m_total = 0;
+  m_min = 0;
+  m_max = 0;
+}
+
+auto latency_histogram::percentile(double percent) const noexcept
+    -> std::uint64_t {
+  if (m_count == 0) {
+    return 0;
+  }
+  auto target = std::max<std::uint64_t>(
+      1, static_cast<std::uint64_t>(std::ceil(percent / 100 * m_count)));
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < bucket_count; ++i) {
+    seen += m_counts[i];
+    if (seen >= target) {
+      return std::min(highest_value(i), m_max);
+    }
+  }
+  return m_max;
+}
+
+auto latency_histogram::print(std::ostream &out) const -> void {
+  // Range 0 holds durations of 0, and range n those from 2^(n-1) up to 2^n
+  constexpr std::size_t range_count = latency_histogram::max_bits + 1;
+  std::uint64_t ranges[range_count] = {};
+  for (std::size_t i = 0; i < bucket_count; ++i) {
+    auto low = lowest_value(i);
+    ranges[low == 0 ? 0 : highest_bit(low) + 1] += m_counts[i];
+  }
+
+  auto first = std::find_if(std::begin(ranges), std::end(ranges),
+                            [](std::uint64_t n) { return n != 0; });
+  if (first == std::end(ranges)) {
+    return;
+  }
+  auto last = std::find_if(std::rbegin(ranges), std::rend(ranges),
+                           [](std::uint64_t n) { return n != 0; })
+                  .base();
+  auto most = *std::max_element(first, last);
+  for (auto r = first; r != last; ++r) {
+    auto n = static_cast<std::size_t>(r - ranges);
+    std::string range =
+        n == 0 ? "0ns"
+               : format_duration(std::uint64_t{1} << (n - 1)) + " - " +
+                     format_duration(std::uint64_t{1} << n);
+    out << "  " << std::left << std::setw(20) << range << std::right
+        << std::setw(10) << std::dec << *r;
+    if (*r != 0) {
+      out << "  " << std::string((*r * bar_width + most - 1) / most, '#');
+    }
+    out << '\n';
+  }
+}
+
+auto format_duration(std::uint64_t ns) -> std::string {
+  std::ostringstream text;
+  text << std::setprecision(3);
+  if (ns < 1000) {
+    text << ns << "ns";
+  } else if (ns < 999500) {
+    text << ns / 1e3 << "us";
+  } else if (ns < 999500000) {
+    text << ns / 1e6 << "ms";
+  } else if (ns < 999500000000) {
+    text << ns / 1e9 << 's';
+  } else {
+    text << ns / 1000000000 << 's';
+  }
+  return text.str();
+}
+
+auto syscall_timer::start(const std::vector<long> &syscalls) -> void {
+  m_syscalls.clear();
+  for (auto s : syscalls) {
+    if (s >= 0) {
+      m_syscalls.push_back(s);
+    }
+  }
+  std::sort(m_syscalls.begin(), m_syscalls.end());
+  m_syscalls.erase(std::unique(m_syscalls.begin(), m_syscalls.end()),
+                   m_syscalls.end());
+  if (m_syscalls.size() >= untimed) {
+    throw std::invalid_argument{"Too many system calls to time"};
+  }
+
+  // Everything recording needs is allocated here
+  m_histograms.assign(m_syscalls.size(), latency_histogram{});
+  m_slots.assign(m_syscalls.empty() ? 0 : m_syscalls.back() + 1,
+                 std::uint16_t{untimed});
+  for (std::size_t i = 0; i < m_syscalls.size(); ++i) {
+    m_slots[m_syscalls[i]] = static_cast<std::uint16_t>(i);
+  }
+  m_active = true;
+  m_inside = false;
+}
+
+auto syscall_timer::enter(long syscall) noexcept -> void {
+  m_inside = true;
+  m_slot = syscall >= 0 && static_cast<std::size_t>(syscall) < m_slots.size()
+               ? m_slots[syscall]
+               : untimed;
+  m_entry = std::chrono::steady_clock::now();
+}
+
+auto syscall_timer::leave() noexcept -> void {
+  auto now = std::chrono::steady_clock::now();
+  if (m_inside && m_slot != untimed) {
+    m_histograms[m_slot].record(static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_entry)
+            .count()));
+  }
+  m_inside = false;
+}
+
+auto syscall_timer::record(long syscall, std::uint64_t ns) noexcept -> void {
+  if (syscall >= 0 && static_cast<std::size_t>(syscall) < m_slots.size() &&
+      m_slots[syscall] != untimed) {
+    m_histograms[m_slots[syscall]].record(ns);
+  }
+}
+
+auto syscall_timer::print(std::ostream &out) const -> void {
+  std::vector<std::size_t> made;
+  for (std::size_t i = 0; i < m_histograms.size(); ++i) {
+    if (m_histograms[i].count() != 0) {
+      made.push_back(i);
+    }
+  }
+  if (made.empty()) {
+    out << "No system calls timed.\n";
+    return;
+  }
+  std::sort(made.begin(), made.end(), [this](std::size_t a, std::size_t b) {
+    return m_histograms[a].total() > m_histograms[b].total();
+  });
+
+  out << std::left << std::setw(18) << "System call" << std::right
+      << std::setw(8) << "Calls" << std::setw(9) << "Total" << std::setw(9)
+      << "Min";
+  for (auto p : percentiles) {
+    out << std::setw(9) << "p" + std::to_string(p);
+  }
+  out << std::setw(9) << "Max" << '\n';
+  for (auto i : made) {
+    const auto &h = m_histograms[i];
+    out << std::left << std::setw(18) << syscall_name(m_syscalls[i])
+        << std::right << std::setw(8) << std::dec << h.count() << std::setw(9)
+        << format_duration(h.total()) << std::setw(9)
+        << format_duration(h.min());
+    for (auto p : percentiles) {
+      out << std::setw(9) << format_duration(h.percentile(p));
+    }
+    out << std::setw(9) << format_duration(h.max()) << '\n';
+  }
+}
+
+auto syscall_timer::print(std::ostream &out, long syscall) const -> void {
+  auto it = std::lower_bound(m_syscalls.begin(), m_syscalls.end(), syscall);
+  if (it == m_syscalls.end() || *it != syscall) {
+    throw std::invalid_argument{"System call " + syscall_name(syscall) +
+                                " is not timed"};
+  }
+  const auto &h = m_histograms[it - m_syscalls.begin()];
+  out << syscall_name(syscall) << ": " << std::dec << h.count() << " calls";
+  if (h.count() == 0) {
+    out << '\n';
+    return;
+  }
+  out << ", " << format_duration(h.total()) << " in total\n  min "
+      << format_duration(h.min());
+  for (auto p : percentiles) {
+    out << ", p" << p << ' ' << format_duration(h.percentile(p));
+  }
+  out << ", max " << format_duration(h.max()) << '\n';
+  h.print(out);
+}
@@ -0,0 +1,563 @@
+#include "../include/syscall_log.h"
+#include "../include/memory.h"
+
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <istream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr char log_magic[8] = "CDBSYSC";
+
+// Largest region an event of a valid log holds
+constexpr std::uint64_t max_region_size = std::uint64_t{1} << 32;
+
+// Results the kernel returns to calls it makes again after a signal
+constexpr std::int64_t first_restart_error = -516;
+constexpr std::int64_t last_restart_error = -512;
+
+/**
+ * The start of a syscall log file.
+ */
+struct log_header {
+  char magic[8];          ///< "CDBSYSC" and a terminating zero
+  std::uint32_t version;  ///< syscall_log_version
+  std::uint32_t reserved; ///< Zero
+};
+
+auto put_uleb128(std::vector<std::uint8_t> &out, std::uint64_t value)
+    -> void {
+  do {
+    std::uint8_t byte = value & 0x7f;
+    value >>= 7;
+    out.push_back(value != 0 ? byte | 0x80 : byte);
+  } while (value != 0);
+}
+
+auto put_sleb128(std::vector<std::uint8_t> &out, std::int64_t value) -> void {
+  auto more = true;
+  while (more) {
+    std::uint8_t byte = value & 0x7f;
+    value >>= 7;
+    more = !((value == 0 && (byte & 0x40) == 0) ||
+             (value == -1 && (byte & 0x40) != 0));
+    out.push_back(more ? byte | 0x80 : byte);
+  }
+}
+
+auto get_uleb128(std::istream &in, std::uint64_t &value) -> bool {
+  value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    auto byte = in.get();
+    if (byte == std::istream::traits_type::eof()) {
+      return false;
+    }
+    value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  throw std::invalid_argument{"Corrupt syscall log"};
+}
+
+auto get_sleb128(std::istream &in, std::int64_t &value) -> bool {
+  std::uint64_t bits = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    auto byte = in.get();
+    if (byte == std::istream::traits_type::eof()) {
+      return false;
+    }
+    bits |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      if (shift + 7 < 64 && (byte & 0x40) != 0) {
+        bits |= ~std::uint64_t{0} << (shift + 7);
+      }
+      value = static_cast<std::int64_t>(bits);
+      return true;
+    }
+  }
+  throw std::invalid_argument{"Corrupt syscall log"};
+}
+
+} // namespace
+
+syscall_log_writer::~syscall_log_writer() { close(); }
+
+auto syscall_log_writer::open(const std::string &path) -> void {
+  close();
+  auto fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644);
+  if (fd == -1) {
+    throw std::out_of_range{"Cannot open " + path};
+  }
+
+  log_header header{};
+  std::memcpy(header.magic, log_magic, sizeof(log_magic));
+  header.version = syscall_log_version;
+  if (write(fd, &header, sizeof(header)) != sizeof(header)) {
+    ::close(fd);
+    throw std::out_of_range{"Cannot write to " + path};
+  }
+  m_fd = fd;
+}
+
+auto syscall_log_writer::close() noexcept -> void {
+  if (m_fd != -1) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  m_events = 0;
+}
+
+auto syscall_log_writer::append(const syscall_event &event) noexcept -> bool {
+  if (m_fd == -1) {
+    return false;
+  }
+
+  try {
+    m_bytes.clear();
+    put_uleb128(m_bytes, event.number);
+    put_sleb128(m_bytes, event.result);
+    put_uleb128(m_bytes, event.regions.size());
+    for (const auto &r : event.regions) {
+      put_uleb128(m_bytes, r.address);
+      put_uleb128(m_bytes, r.bytes.size());
+      m_bytes.insert(m_bytes.end(), r.bytes.begin(), r.bytes.end());
+    }
+  } catch (std::bad_alloc &) {
+    return false;
+  }
+
+  if (write(m_fd, m_bytes.data(), m_bytes.size()) !=
+      static_cast<ssize_t>(m_bytes.size())) {
+    return false;
+  }
+  ++m_events;
+  return true;
+}
+
+auto syscall_log_reader::open(const std::string &path) -> void {
+  close();
+  m_file.open(path, std::ios::binary);
+  if (!m_file) {
+    throw std::out_of_range{"Cannot open " + path};
+  }
+
+  log_header header;
+  if (!m_file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      std::memcmp(header.magic, log_magic, sizeof(log_magic)) != 0) {
+    close();
+    throw std::invalid_argument{"Not a syscall log"};
+  }
+  if (header.version != syscall_log_version) {
+    close();
+    throw std::invalid_argument{"Unsupported version of syscall log"};
+  }
+}
+
+auto syscall_log_reader::close() noexcept -> void {
+  m_file.close();
+  m_file.clear();
+  m_events = 0;
+}
+
+auto syscall_log_reader::next(syscall_event &event) -> bool {
+  std::uint64_t regions;
+  if (!m_file.is_open() || !get_uleb128(m_file, event.number) ||
+      !get_sleb128(m_file, event.result) || !get_uleb128(m_file, regions)) {
+    return false;
+  }
+
+  event.regions.resize(regions);
+  for (auto &r : event.regions) {
+    std::uint64_t size;
+    if (!get_uleb128(m_file, r.address) || !get_uleb128(m_file, size)) {
+      return false;
+    }
+    if (size > max_region_size) {
+      throw std::invalid_argument{"Corrupt syscall log"};
+    }
+    r.bytes.resize(size);
+    if (!m_file.read(reinterpret_cast<char *>(r.bytes.data()),
+                     static_cast<std::streamsize>(size))) {
+      return false;
+    }
+  }
+  ++m_events;
+  return true;
+}
+
+auto syscall_recorder::record(const std::string &path) -> void {
+  stop();
+  m_writer.open(path);
+  m_mode = syscall_mode::record;
+  m_path = path;
+  m_events = 0;
+  m_message.clear();
+}
+
+auto syscall_recorder::replay(const std::string &path) -> void {
+  stop();
+  m_reader.open(path);
+  m_mode = syscall_mode::replay;
+  m_path = path;
+  m_events = 0;
+  m_message.clear();
+}
+
+auto syscall_recorder::stop() noexcept -> void {
+  m_writer.close();
+  m_reader.close();
+  m_mode = syscall_mode::off;
+  m_inside = false;
+  m_sockets.clear();
+}
+
+auto syscall_recorder::syscall_stop() noexcept -> bool {
+  if (m_mode == syscall_mode::off) {
+    return true;
+  }
+  m_inside = !m_inside;
+  if (m_inside) {
+    enter();
+    return true;
+  }
+  return leave();
+}
+
+auto syscall_recorder::enter() noexcept -> void {
+  m_logged = false;
+  m_diverged = false;
+  if (ptrace(PTRACE_GETREGS, m_pid, nullptr, &m_entry) == -1) {
+    return;
+  }
+
+  auto number = m_entry.orig_rax;
+  if (number == SYS_close) {
+    m_sockets.erase(m_entry.rdi);
+  }
+  if (!logged(m_entry)) {
+    return;
+  }
+  m_logged = true;
+
+  if (m_mode == syscall_mode::record) {
+    // How much room the program gave for addresses is only known before the
+    // call, which overwrites it with their length
+    m_address_length = 0;
+    if (number == SYS_recvfrom && m_entry.r8 != 0 && m_entry.r9 != 0) {
+      read_memory_block(m_pid, m_entry.r9, &m_address_length,
+                        sizeof(m_address_length));
+    } else if ((number == SYS_accept || number == SYS_accept4) &&
+               m_entry.rsi != 0 && m_entry.rdx != 0) {
+      read_memory_block(m_pid, m_entry.rdx, &m_address_length,
+                        sizeof(m_address_length));
+    }
+    m_header = msghdr{};
+    if (number == SYS_recvmsg) {
+      read_memory_block(m_pid, m_entry.rsi, &m_header, sizeof(m_header));
+    }
+    m_messages.clear();
+    if (number == SYS_recvmmsg) {
+      try {
+        m_messages.resize(std::min<std::uint64_t>(m_entry.rdx, UIO_MAXIOV));
+      } catch (std::bad_alloc &) {
+      }
+      if (!read_memory_block(m_pid, m_entry.rsi, m_messages.data(),
+                             m_messages.size() * sizeof(mmsghdr))) {
+        m_messages.clear();
+      }
+    }
+    return;
+  }
+
+  // A call that is not the next one logged runs, and the replay ends after
+  // it
+  try {
+    if (!m_reader.next(m_event)) {
+      m_message = "The syscall log ends at event " +
+                  std::to_string(m_reader.position());
+      m_diverged = true;
+      return;
+    }
+  } catch (std::exception &e) {
+    m_message = e.what();
+    m_diverged = true;
+    return;
+  }
+  if (m_event.number != number) {
+    std::ostringstream message;
+    message << "Replay diverged at event " << m_reader.position() - 1
+            << ": the log has system call " << m_event.number
+            << ", the program made " << number;
+    m_message = message.str();
+    m_diverged = true;
+    return;
+  }
+
+  // The kernel skips a call whose number is invalid
+  auto regs = m_entry;
+  regs.orig_rax = static_cast<std::uint64_t>(-1);
+  if (ptrace(PTRACE_SETREGS, m_pid, nullptr, &regs) == -1) {
+    m_message = "Cannot skip system call " + std::to_string(number);
+    m_diverged = true;
+  }
+}
+
+auto syscall_recorder::leave() noexcept -> bool {
+  if (!m_logged) {
+    return true;
+  }
+  if (m_diverged) {
+    return end(m_message);
+  }
+
+  user_regs_struct regs;
+  if (ptrace(PTRACE_GETREGS, m_pid, nullptr, &regs) == -1) {
+    return end("Cannot read registers");
+  }
+
+  if (m_mode == syscall_mode::record) {
+    // An interrupted call is made again once the signal is handled
+    auto result = static_cast<std::int64_t>(regs.rax);
+    if (result >= first_restart_error && result <= last_restart_error) {
+      return true;
+    }
+
+    m_event.number = m_entry.orig_rax;
+    m_event.result = result;
+    m_event.regions.clear();
+    try {
+      if (!read_regions(result)) {
+        return end("Cannot read what system call " +
+                   std::to_string(m_event.number) + " wrote");
+      }
+    } catch (std::bad_alloc &) {
+      return end("Out of memory");
+    }
+    if (!m_writer.append(m_event)) {
+      return end("Cannot write to " + m_path);
+    }
+    add_socket(result);
+    ++m_events;
+    return true;
+  }
+
+  regs.rax = static_cast<std::uint64_t>(m_event.result);
+  if (ptrace(PTRACE_SETREGS, m_pid, nullptr, &regs) == -1) {
+    return end("Cannot set the result of system call " +
+               std::to_string(m_event.number));
+  }
+  for (const auto &r : m_event.regions) {
+    if (!write_memory_block(m_pid, r.address, r.bytes.data(),
+                            r.bytes.size())) {
+      return end("Cannot write what system call " +
+                 std::to_string(m_event.number) + " wrote");
+    }
+  }
+  add_socket(m_event.result);
+  ++m_events;
+  return true;
+}
+
+auto syscall_recorder::add_socket(std::int64_t result) noexcept -> void {
+  // A non-blocking socket goes on connecting after the call returns
+  auto number = m_entry.orig_rax;
+  if (number == SYS_connect && (result == 0 || result == -EINPROGRESS)) {
+    m_sockets.insert(m_entry.rdi);
+  } else if ((number == SYS_accept || number == SYS_accept4) && result >= 0) {
+    m_sockets.insert(static_cast<std::uint64_t>(result));
+  }
+}
+
+auto syscall_recorder::logged(const user_regs_struct &regs) const noexcept
+    -> bool {
+  switch (regs.orig_rax) {
+  case SYS_read:
+  case SYS_pread64:
+  case SYS_readv:
+  case SYS_preadv:
+  case SYS_recvfrom:
+  case SYS_recvmsg:
+  case SYS_recvmmsg:
+  case SYS_accept:
+  case SYS_accept4:
+  case SYS_connect:
+  case SYS_poll:
+  case SYS_ppoll:
+  case SYS_select:
+  case SYS_pselect6:
+  case SYS_epoll_wait:
+  case SYS_epoll_pwait:
+  case SYS_epoll_pwait2:
+  case SYS_clock_gettime:
+  case SYS_gettimeofday:
+  case SYS_time:
+  case SYS_getrandom:
+    return true;
+  case SYS_write:
+  case SYS_writev:
+  case SYS_sendto:
+  case SYS_sendmsg:
+  case SYS_shutdown:
+    return m_sockets.count(regs.rdi) != 0;
+  default:
+    return false;
+  }
+}
+
+auto syscall_recorder::read_regions(std::int64_t result) -> bool {
+  if (result < 0) {
+    return true;
+  }
+
+  auto add = [this](std::uint64_t address, std::uint64_t size) {
+    if (address == 0 || size == 0) {
+      return true;
+    }
+    m_event.regions.emplace_back();
+    auto &r = m_event.regions.back();
+    r.address = address;
+    r.bytes.resize(size);
+    return read_memory_block(m_pid, address, r.bytes.data(), size);
+  };
+
+  // Data read into an iovec array fills its buffers in order
+  auto add_vector = [this, &add](std::uint64_t address, std::uint64_t count,
+                                 std::uint64_t size) {
+    std::vector<iovec> iov(std::min<std::uint64_t>(count, IOV_MAX));
+    if (!read_memory_block(m_pid, address, iov.data(),
+                           iov.size() * sizeof(iovec))) {
+      return false;
+    }
+    for (const auto &v : iov) {
+      auto n = std::min<std::uint64_t>(v.iov_len, size);
+      if (!add(reinterpret_cast<std::uint64_t>(v.iov_base), n)) {
+        return false;
+      }
+      size -= n;
+    }
+    return true;
+  };
+
+  // An address is written with its length, which the room given at the
+  // entry may not hold
+  auto add_address = [this, &add](std::uint64_t address,
+                                  std::uint64_t length_address) {
+    socklen_t length = 0;
+    if (m_address_length == 0 ||
+        !read_memory_block(m_pid, length_address, &length, sizeof(length))) {
+      return true;
+    }
+    return add(length_address, sizeof(length)) &&
+           add(address, std::min(length, m_address_length));
+  };
+
+  // A message header reports the lengths the call used, out of those it
+  // held at the entry
+  auto add_message = [&add, &add_vector](const msghdr &before,
+                                         const msghdr &after,
+                                         std::uint64_t size) {
+    return add_vector(reinterpret_cast<std::uint64_t>(before.msg_iov),
+                      before.msg_iovlen, size) &&
+           add(reinterpret_cast<std::uint64_t>(before.msg_name),
+               std::min(after.msg_namelen, before.msg_namelen)) &&
+           add(reinterpret_cast<std::uint64_t>(before.msg_control),
+               std::min(after.msg_controllen, before.msg_controllen));
+  };
+
+  const auto &e = m_entry;
+  auto size = static_cast<std::uint64_t>(result);
+  switch (e.orig_rax) {
+  case SYS_read:
+  case SYS_pread64:
+    return add(e.rsi, size);
+  case SYS_getrandom:
+    return add(e.rdi, size);
+  case SYS_readv:
+  case SYS_preadv:
+    return add_vector(e.rsi, e.rdx, size);
+  case SYS_recvfrom: {
+    // A truncated datagram returns its whole length
+    return add(e.rsi, std::min<std::uint64_t>(size, e.rdx)) &&
+           add_address(e.r8, e.r9);
+  }
+  case SYS_recvmsg: {
+    msghdr after;
+    if (!add(e.rsi, sizeof(after))) {
+      return false;
+    }
+    std::memcpy(&after, m_event.regions.back().bytes.data(), sizeof(after));
+    return add_message(m_header, after, size);
+  }
+  case SYS_recvmmsg: {
+    // The call returns how many messages it received, and the length of
+    // each in its header
+    for (std::uint64_t i = 0; i < size && i < m_messages.size(); ++i) {
+      mmsghdr after;
+      if (!add(e.rsi + i * sizeof(after), sizeof(after))) {
+        return false;
+      }
+      std::memcpy(&after, m_event.regions.back().bytes.data(),
+                  sizeof(after));
+      if (!add_message(m_messages[i].msg_hdr, after.msg_hdr, after.msg_len)) {
+        return false;
+      }
+    }
+    return add(e.r8, sizeof(timespec));
+  }
+  case SYS_accept:
+  case SYS_accept4:
+    return add_address(e.rsi, e.rdx);
+  case SYS_poll:
+  case SYS_ppoll:
+    return add(e.rdi, e.rsi * sizeof(pollfd));
+  case SYS_select: {
+    auto set_size = (e.rdi + 63) / 64 * 8;
+    return add(e.rsi, set_size) && add(e.rdx, set_size) &&
+           add(e.r10, set_size) && add(e.r8, sizeof(timeval));
+  }
+  case SYS_pselect6: {
+    auto set_size = (e.rdi + 63) / 64 * 8;
+    return add(e.rsi, set_size) && add(e.rdx, set_size) &&
+           add(e.r10, set_size) && add(e.r8, sizeof(timespec));
+  }
+  case SYS_epoll_wait:
+  case SYS_epoll_pwait:
+  case SYS_epoll_pwait2:
+    return add(e.rsi, size * sizeof(epoll_event));
+  case SYS_clock_gettime:
+    return add(e.rsi, sizeof(timespec));
+  case SYS_gettimeofday:
+    return add(e.rdi, sizeof(timeval)) && add(e.rsi, sizeof(struct timezone));
+  case SYS_time:
+    return add(e.rdi, sizeof(std::time_t));
+  default:
+    return true;
+  }
+}
+
+auto syscall_recorder::end(const std::string &message) noexcept -> bool {
+  m_message = message;
+  stop();
+  return false;
+}
@@ -0,0 +1,930 @@
+#include "../include/syscall_trace.h"
+#include "../include/memory.h"
+#include "../include/syscall_latency.h"
+
+#include <fcntl.h>
+#include <linux/audit.h>
+#include <linux/seccomp.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Length of the syscall instruction
+constexpr std::uint64_t syscall_length = 2;
+
+// Bytes below the stack pointer the ABI lets leaf functions use
+constexpr std::uint64_t red_zone = 128;
+
+// Calls a filter can test, which conditional jumps of 8 bits can skip
+constexpr std::size_t max_filtered = 250;
+
+// Bytes of strings and buffers shown in arguments
+constexpr std::size_t max_shown = 48;
+
+constexpr std::uint64_t page_size = 4096;
+
+/**
+ * A system call and how to decode its arguments.
+ *
+ * Each character of the arguments stands for one of them: d a signed int,
+ * f a file descriptor, u an unsigned number, x a number in hex, o a mode in
+ * octal, p a pointer, s a string and b a buffer whose size is the next
+ * argument. Calls whose arguments are unknown show six of them in hex.
+ */
+struct syscall_info {
+  long number;      ///< Number of the call
+  const char *name; ///< Name of the call
+  const char *args; ///< How to decode the arguments, or nullptr
+};
+
+const syscall_info syscall_table[] = {
+    {0, "read", "fpu"},
+    {1, "write", "fbu"},
+    {2, "open", "sxo"},
+    {3, "close", "f"},
+    {4, "stat", "sp"},
+    {5, "fstat", "fp"},
+    {6, "lstat", "sp"},
+    {7, "poll", "pud"},
+    {8, "lseek", "fdd"},
+    {9, "mmap", "puxxfx"},
+    {10, "mprotect", "pux"},
+    {11, "munmap", "pu"},
+    {12, "brk", "p"},
+    {13, "rt_sigaction", "dppu"},
+    {14, "rt_sigprocmask", "dppu"},
+    {15, "rt_sigreturn", ""},
+    {16, "ioctl", "fxx"},
+    {17, "pread64", "fpuu"},
+    {18, "pwrite64", "fbuu"},
+    {19, "readv", "fpd"},
+    {20, "writev", "fpd"},
+    {21, "access", "so"},
+    {22, "pipe", "p"},
+    {23, "select", "dpppp"},
+    {24, "sched_yield", ""},
+    {25, "mremap", "puuxp"},
+    {26, "msync", "pux"},
+    {27, "mincore", "pup"},
+    {28, "madvise", "pud"},
+    {29, "shmget", "dux"},
+    {30, "shmat", "dpx"},
+    {31, "shmctl", "ddp"},
+    {32, "dup", "f"},
+    {33, "dup2", "ff"},
+    {34, "pause", ""},
+    {35, "nanosleep", "pp"},
+    {36, "getitimer", "dp"},
+    {37, "alarm", "u"},
+    {38, "setitimer", "dpp"},
+    {39, "getpid", ""},
+    {40, "sendfile", "ffpu"},
+    {41, "socket", "ddd"},
+    {42, "connect", "fpd"},
+    {43, "accept", "fpp"},
+    {44, "sendto", "fbuxpd"},
+    {45, "recvfrom", "fpuxpp"},
+    {46, "sendmsg", "fpx"},
+    {47, "recvmsg", "fpx"},
+    {48, "shutdown", "fd"},
+    {49, "bind", "fpd"},
+    {50, "listen", "fd"},
+    {51, "getsockname", "fpp"},
+    {52, "getpeername", "fpp"},
+    {53, "socketpair", "dddp"},
+    {54, "setsockopt", "fddpd"},
+    {55, "getsockopt", "fddpp"},
+    {56, "clone", "xpppx"},
+    {57, "fork", ""},
+    {58, "vfork", ""},
+    {59, "execve", "spp"},
+    {60, "exit", "d"},
+    {61, "wait4", "dpdp"},
+    {62, "kill", "dd"},
+    {63, "uname", "p"},
+    {64, "semget", nullptr},
+    {65, "semop", nullptr},
+    {66, "semctl", nullptr},
+    {67, "shmdt", nullptr},
+    {68, "msgget", nullptr},
+    {69, "msgsnd", nullptr},
+    {70, "msgrcv", nullptr},
+    {71, "msgctl", nullptr},
+    {72, "fcntl", "fdx"},
+    {73, "flock", "fd"},
+    {74, "fsync", "f"},
+    {75, "fdatasync", "f"},
+    {76, "truncate", "sd"},
+    {77, "ftruncate", "fd"},
+    {78, "getdents", "fpu"},
+    {79, "getcwd", "pu"},
+    {80, "chdir", "s"},
+    {81, "fchdir", "f"},
+    {82, "rename", "ss"},
+    {83, "mkdir", "so"},
+    {84, "rmdir", "s"},
+    {85, "creat", "so"},
+    {86, "link", "ss"},
+    {87, "unlink", "s"},
+    {88, "symlink", "ss"},
+    {89, "readlink", "spu"},
+    {90, "chmod", "so"},
+    {91, "fchmod", "fo"},
+    {92, "chown", "sdd"},
+    {93, "fchown", "fdd"},
+    {94, "lchown", nullptr},
+    {95, "umask", "o"},
+    {96, "gettimeofday", "pp"},
+    {97, "getrlimit", "dp"},
+    {98, "getrusage", "dp"},
+    {99, "sysinfo", "p"},
+    {100, "times", "p"},
+    {101, "ptrace", "ddpp"},
+    {102, "getuid", ""},
+    {103, "syslog", nullptr},
+    {104, "getgid", ""},
+    {105, "setuid", "d"},
+    {106, "setgid", "d"},
+    {107, "geteuid", ""},
+    {108, "getegid", ""},
+    {109, "setpgid", "dd"},
+    {110, "getppid", ""},
+    {111, "getpgrp", ""},
+    {112, "setsid", ""},
+    {113, "setreuid", "dd"},
+    {114, "setregid", "dd"},
+    {115, "getgroups", "dp"},
+    {116, "setgroups", "dp"},
+    {117, "setresuid", "ddd"},
+    {118, "getresuid", "ppp"},
+    {119, "setresgid", "ddd"},
+    {120, "getresgid", "ppp"},
+    {121, "getpgid", "d"},
+    {122, "setfsuid", "d"},
+    {123, "setfsgid", "d"},
+    {124, "getsid", "d"},
+    {125, "capget", "pp"},
+    {126, "capset", "pp"},
+    {127, "rt_sigpending", nullptr},
+    {128, "rt_sigtimedwait", "pppu"},
+    {129, "rt_sigqueueinfo", "ddp"},
+    {130, "rt_sigsuspend", "pu"},
+    {131, "sigaltstack", "pp"},
+    {132, "utime", nullptr},
+    {133, "mknod", nullptr},
+    {134, "uselib", nullptr},
+    {135, "personality", "x"},
+    {136, "ustat", nullptr},
+    {137, "statfs", "sp"},
+    {138, "fstatfs", "fp"},
+    {139, "sysfs", nullptr},
+    {140, "getpriority", "dd"},
+    {141, "setpriority", "ddd"},
+    {142, "sched_setparam", nullptr},
+    {143, "sched_getparam", "dp"},
+    {144, "sched_setscheduler", "ddp"},
+    {145, "sched_getscheduler", "d"},
+    {146, "sched_get_priority_max", "d"},
+    {147, "sched_get_priority_min", "d"},
+    {148, "sched_rr_get_interval", "dp"},
+    {149, "mlock", "pu"},
+    {150, "munlock", "pu"},
+    {151, "mlockall", "x"},
+    {152, "munlockall", ""},
+    {153, "vhangup", ""},
+    {154, "modify_ldt", nullptr},
+    {155, "pivot_root", nullptr},
+    {156, "_sysctl", nullptr},
+    {157, "prctl", "dxxxx"},
+    {158, "arch_prctl", "dx"},
+    {159, "adjtimex", nullptr},
+    {160, "setrlimit", "dp"},
+    {161, "chroot", "s"},
+    {162, "sync", ""},
+    {163, "acct", "s"},
+    {164, "settimeofday", nullptr},
+    {165, "mount", "sssxp"},
+    {166, "umount2", "sx"},
+    {167, "swapon", nullptr},
+    {168, "swapoff", nullptr},
+    {169, "reboot", nullptr},
+    {170, "sethostname", "su"},
+    {171, "setdomainname", nullptr},
+    {172, "iopl", nullptr},
+    {173, "ioperm", nullptr},
+    {174, "create_module", nullptr},
+    {175, "init_module", nullptr},
+    {176, "delete_module", nullptr},
+    {177, "get_kernel_syms", nullptr},
+    {178, "query_module", nullptr},
+    {179, "quotactl", nullptr},
+    {180, "nfsservctl", nullptr},
+    {181, "getpmsg", nullptr},
+    {182, "putpmsg", nullptr},
+    {183, "afs_syscall", nullptr},
+    {184, "tuxcall", nullptr},
+    {185, "security", nullptr},
+    {186, "gettid", ""},
+    {187, "readahead", "fdu"},
+    {188, "setxattr", "sspux"},
+    {189, "lsetxattr", nullptr},
+    {190, "fsetxattr", nullptr},
+    {191, "getxattr", "sspu"},
+    {192, "lgetxattr", "sspu"},
+    {193, "fgetxattr", "fspu"},
+    {194, "listxattr", "spu"},
+    {195, "llistxattr", nullptr},
+    {196, "flistxattr", "fpu"},
+    {197, "removexattr", nullptr},
+    {198, "lremovexattr", nullptr},
+    {199, "fremovexattr", nullptr},
+    {200, "tkill", "dd"},
+    {201, "time", "p"},
+    {202, "futex", "pdupxp"},
+    {203, "sched_setaffinity", "dup"},
+    {204, "sched_getaffinity", "dup"},
+    {205, "set_thread_area", nullptr},
+    {206, "io_setup", nullptr},
+    {207, "io_destroy", nullptr},
+    {208, "io_getevents", nullptr},
+    {209, "io_submit", nullptr},
+    {210, "io_cancel", nullptr},
+    {211, "get_thread_area", nullptr},
+    {212, "lookup_dcookie", nullptr},
+    {213, "epoll_create", "d"},
+    {214, "epoll_ctl_old", nullptr},
+    {215, "epoll_wait_old", nullptr},
+    {216, "remap_file_pages", nullptr},
+    {217, "getdents64", "fpu"},
+    {218, "set_tid_address", "p"},
+    {219, "restart_syscall", nullptr},
+    {220, "semtimedop", nullptr},
+    {221, "fadvise64", "fddd"},
+    {222, "timer_create", "dpp"},
+    {223, "timer_settime", nullptr},
+    {224, "timer_gettime", nullptr},
+    {225, "timer_getoverrun", nullptr},
+    {226, "timer_delete", nullptr},
+    {227, "clock_settime", nullptr},
+    {228, "clock_gettime", "dp"},
+    {229, "clock_getres", "dp"},
+    {230, "clock_nanosleep", "dxpp"},
+    {231, "exit_group", "d"},
+    {232, "epoll_wait", "fpdd"},
+    {233, "epoll_ctl", "fdfp"},
+    {234, "tgkill", "ddd"},
+    {235, "utimes", nullptr},
+    {236, "vserver", nullptr},
+    {237, "mbind", nullptr},
+    {238, "set_mempolicy", nullptr},
+    {239, "get_mempolicy", nullptr},
+    {240, "mq_open", nullptr},
+    {241, "mq_unlink", nullptr},
+    {242, "mq_timedsend", nullptr},
+    {243, "mq_timedreceive", nullptr},
+    {244, "mq_notify", nullptr},
+    {245, "mq_getsetattr", nullptr},
+    {246, "kexec_load", nullptr},
+    {247, "waitid", "ddpdp"},
+    {248, "add_key", nullptr},
+    {249, "request_key", nullptr},
+    {250, "keyctl", nullptr},
+    {251, "ioprio_set", nullptr},
+    {252, "ioprio_get", nullptr},
+    {253, "inotify_init", nullptr},
+    {254, "inotify_add_watch", "fsx"},
+    {255, "inotify_rm_watch", "fd"},
+    {256, "migrate_pages", nullptr},
+    {257, "openat", "fsxo"},
+    {258, "mkdirat", "fso"},
+    {259, "mknodat", "fsox"},
+    {260, "fchownat", "fsddx"},
+    {261, "futimesat", nullptr},
+    {262, "newfstatat", "fspx"},
+    {263, "unlinkat", "fsx"},
+    {264, "renameat", "fsfs"},
+    {265, "linkat", "fsfsx"},
+    {266, "symlinkat", "sfs"},
+    {267, "readlinkat", "fspu"},
+    {268, "fchmodat", "fso"},
+    {269, "faccessat", "fso"},
+    {270, "pselect6", "dppppp"},
+    {271, "ppoll", "pupp"},
+    {272, "unshare", "x"},
+    {273, "set_robust_list", "pu"},
+    {274, "get_robust_list", "dpp"},
+    {275, "splice", "fpfpux"},
+    {276, "tee", "ffux"},
+    {277, "sync_file_range", "fddx"},
+    {278, "vmsplice", nullptr},
+    {279, "move_pages", nullptr},
+    {280, "utimensat", "fspx"},
+    {281, "epoll_pwait", "fpddpu"},
+    {282, "signalfd", nullptr},
+    {283, "timerfd_create", "dx"},
+    {284, "eventfd", "u"},
+    {285, "fallocate", "fddd"},
+    {286, "timerfd_settime", "fxpp"},
+    {287, "timerfd_gettime", nullptr},
+    {288, "accept4", "fppx"},
+    {289, "signalfd4", "fpux"},
+    {290, "eventfd2", "ux"},
+    {291, "epoll_create1", "x"},
+    {292, "dup3", "ffx"},
+    {293, "pipe2", "px"},
+    {294, "inotify_init1", "x"},
+    {295, "preadv", "fpdu"},
+    {296, "pwritev", "fpdu"},
+    {297, "rt_tgsigqueueinfo", nullptr},
+    {298, "perf_event_open", nullptr},
+    {299, "recvmmsg", "fpuxp"},
+    {300, "fanotify_init", nullptr},
+    {301, "fanotify_mark", nullptr},
+    {302, "prlimit64", "ddpp"},
+    {303, "name_to_handle_at", nullptr},
+    {304, "open_by_handle_at", nullptr},
+    {305, "clock_adjtime", nullptr},
+    {306, "syncfs", nullptr},
+    {307, "sendmmsg", "fpux"},
+    {308, "setns", "fd"},
+    {309, "getcpu", "ppp"},
+    {310, "process_vm_readv", "dpupux"},
+    {311, "process_vm_writev", "dpupux"},
+    {312, "kcmp", "dddxx"},
+    {313, "finit_module", nullptr},
+    {314, "sched_setattr", nullptr},
+    {315, "sched_getattr", "dpux"},
+    {316, "renameat2", "fsfsx"},
+    {317, "seccomp", "dxp"},
+    {318, "getrandom", "pux"},
+    {319, "memfd_create", "sx"},
+    {320, "kexec_file_load", nullptr},
+    {321, "bpf", nullptr},
+    {322, "execveat", "fsppx"},
+    {323, "userfaultfd", "x"},
+    {324, "membarrier", "dxd"},
+    {325, "mlock2", "pux"},
+    {326, "copy_file_range", "fpfpux"},
+    {327, "preadv2", nullptr},
+    {328, "pwritev2", nullptr},
+    {329, "pkey_mprotect", "puxd"},
+    {330, "pkey_alloc", nullptr},
+    {331, "pkey_free", nullptr},
+    {332, "statx", "fsxxp"},
+    {333, "io_pgetevents", nullptr},
+    {334, "rseq", "pudx"},
+    {424, "pidfd_send_signal", "fdpx"},
+    {425, "io_uring_setup", "up"},
+    {426, "io_uring_enter", "fuuxpu"},
+    {427, "io_uring_register", "fupu"},
+    {428, "open_tree", nullptr},
+    {429, "move_mount", nullptr},
+    {430, "fsopen", nullptr},
+    {431, "fsconfig", nullptr},
+    {432, "fsmount", nullptr},
+    {433, "fspick", nullptr},
+    {434, "pidfd_open", "dx"},
+    {435, "clone3", "pu"},
+    {436, "close_range", "ffx"},
+    {437, "openat2", "fspu"},
+    {438, "pidfd_getfd", "ffx"},
+    {439, "faccessat2", "fsox"},
+    {440, "process_madvise", nullptr},
+    {441, "epoll_pwait2", nullptr},
+    {442, "mount_setattr", nullptr},
+    {443, "quotactl_fd", nullptr},
+    {444, "landlock_create_ruleset", nullptr},
+    {445, "landlock_add_rule", nullptr},
+    {446, "landlock_restrict_self", nullptr},
+    {447, "memfd_secret", nullptr},
+    {448, "process_mrelease", nullptr},
+    {449, "futex_waitv", nullptr},
+    {450, "set_mempolicy_home_node", nullptr},
+};
+
+auto find_syscall(long number) noexcept -> const syscall_info * {
+  auto end = std::end(syscall_table);
+  auto it = std::lower_bound(
+      std::begin(syscall_table), end, number,
+      [](const syscall_info &s, long n) { return s.number < n; });
+  return it != end && it->number == number ? it : nullptr;
+}
+
+auto quote(const std::uint8_t *bytes, std::size_t size, bool string)
+    -> std::string {
+  std::ostringstream out;
+  out << '"';
+  std::size_t i = 0;
+  for (; i < size && i < max_shown; ++i) {
+    auto c = bytes[i];
+    if (string && c == 0) {
+      break;
+    }
+    switch (c) {
+    case '\n':
+      out << "\\n";
+      break;
+    case '\t':
+      out << "\\t";
+      break;
+    case '"':
+    case '\\':
+      out << '\\' << c;
+      break;
+    default:
+      if (c >= 0x20 && c < 0x7f) {
+        out << c;
+      } else {
+        out << "\\x" << std::hex << std::setw(2) << std::setfill('0')
+            << static_cast<unsigned>(c) << std::dec;
+      }
+    }
+  }
+  out << '"';
+  if (i == max_shown && (i < size || string)) {
+    out << "...";
+  }
+  return out.str();
+}
+
+} // namespace
+
+auto syscall_number(const std::string &name) noexcept -> long {
+  auto it = std::find_if(
+      std::begin(syscall_table), std::end(syscall_table),
+      [&name](const syscall_info &s) { return name == s.name; });
+  return it != std::end(syscall_table) ? it->number : -1;
+}
+
+auto syscall_name(long number) -> std::string {
+  auto info = find_syscall(number);
+  return info != nullptr ? info->name : "syscall_" + std::to_string(number);
+}
+
+auto parse_syscalls(const std::string &list) -> std::vector<long> {
+  std::vector<long> syscalls;
+  if (list == "all") {
+    return syscalls;
+  }
+
+  std::istringstream names{list};
+  std::string name;
+  while (std::getline(names, name, ',')) {
+    auto number = syscall_number(name);
+    if (number == -1 && !name.empty() &&
+        name.find_first_not_of("0123456789") == std::string::npos) {
+      number = std::stol(name);
+    }
+    if (number == -1) {
+      throw std::invalid_argument{"Unknown system call " + name};
+    }
+    syscalls.push_back(number);
+  }
+  if (syscalls.empty()) {
+    throw std::invalid_argument{"No system calls"};
+  }
+  return syscalls;
+}
+
+auto known_syscalls() -> std::vector<long> {
+  std::vector<long> syscalls;
+  for (const auto &s : syscall_table) {
+    syscalls.push_back(s.number);
+  }
+  return syscalls;
+}
+
+auto is_seccomp_stop(int status) noexcept -> bool {
+  return WIFSTOPPED(status) &&
+         status >> 8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP << 8));
+}
+
+auto is_fork_stop(int status) noexcept -> bool {
+  auto event = status >> 16;
+  return WIFSTOPPED(status) &&
+         (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK ||
+          event == PTRACE_EVENT_CLONE);
+}
+
+auto resume_task(pid_t pid, int status, bool first) noexcept -> void {
+  if (!WIFSTOPPED(status)) {
+    return;
+  }
+  auto signal = 0;
+  if (first) {
+    ptrace(PTRACE_SETOPTIONS, pid, nullptr,
+           PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACESECCOMP |
+               PTRACE_O_TRACEEXEC | PTRACE_O_TRACEFORK |
+               PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE);
+  }
+  if (status >> 16 == 0 && WSTOPSIG(status) != (SIGTRAP | 0x80) &&
+      !(first && WSTOPSIG(status) == SIGSTOP)) {
+    signal = WSTOPSIG(status);
+  }
+  ptrace(PTRACE_CONT, pid, nullptr, signal);
+}
+
+auto make_syscall_filter(const std::vector<long> &syscalls,
+                         std::uint64_t untraced_pc)
+    -> std::vector<sock_filter> {
+  if (syscalls.size() > max_filtered) {
+    throw std::invalid_argument{"Too many system calls for a filter"};
+  }
+
+  std::vector<sock_filter> filter = {
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, arch)),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 1, 0),
+      BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW)};
+
+  // The calls the debugger injects are never traced
+  if (untraced_pc != 0) {
+    constexpr std::uint32_t pc = offsetof(seccomp_data, instruction_pointer);
+    filter.insert(
+        filter.end(),
+        {BPF_STMT(BPF_LD | BPF_W | BPF_ABS, pc),
+         BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                  static_cast<std::uint32_t>(untraced_pc), 0, 3),
+         BPF_STMT(BPF_LD | BPF_W | BPF_ABS, pc + 4),
+         BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                  static_cast<std::uint32_t>(untraced_pc >> 32), 0, 1),
+         BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW)});
+  }
+
+  filter.push_back(
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, nr)));
+  if (syscalls.empty()) {
+    filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+    return filter;
+  }
+
+  // Each test jumps over those after it and the final allow
+  for (std::size_t i = 0; i < syscalls.size(); ++i) {
+    filter.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                              static_cast<std::uint32_t>(syscalls[i]),
+                              static_cast<std::uint8_t>(syscalls.size() - i),
+                              0));
+  }
+  filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW));
+  filter.push_back(BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE));
+  return filter;
+}
+
+auto install_syscall_filter(const std::vector<sock_filter> &filter) noexcept
+    -> bool {
+  sock_fprog program{static_cast<unsigned short>(filter.size()),
+                     const_cast<sock_filter *>(filter.data())};
+  return prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0 &&
+         syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, 0, &program) == 0;
+}
+
+auto format_syscall(pid_t pid, const user_regs_struct &regs) -> std::string {
+  auto number = static_cast<long>(regs.orig_rax);
+  const std::uint64_t args[] = {regs.rdi, regs.rsi, regs.rdx,
+                                regs.r10, regs.r8,  regs.r9};
+  auto info = find_syscall(number);
+  std::string kinds = info != nullptr && info->args != nullptr
+                          ? info->args
+                          : "xxxxxx";
+
+  // Strings and buffers are fetched together, strings up to the end of
+  // their page, which is as far as they are known to be mapped
+  std::uint8_t memory[6][max_shown];
+  std::size_t sizes[6] = {};
+  std::vector<memory_range> ranges;
+  for (std::size_t i = 0; i < kinds.size(); ++i) {
+    if (args[i] == 0) {
+      continue;
+    }
+    if (kinds[i] == 's') {
+      sizes[i] = std::min<std::uint64_t>(
+          max_shown, page_size - args[i] % page_size);
+    } else if (kinds[i] == 'b' && i + 1 < kinds.size()) {
+      sizes[i] = std::min<std::uint64_t>(max_shown, args[i + 1]);
+    }
+    if (sizes[i] != 0) {
+      ranges.push_back({args[i], memory[i], sizes[i]});
+    }
+  }
+  auto fetched = read_memory_ranges(pid, ranges);
+
+  std::ostringstream out;
+  out << syscall_name(number) << '(';
+  for (std::size_t i = 0; i < kinds.size(); ++i) {
+    out << (i != 0 ? ", " : "");
+    auto value = args[i];
+    switch (kinds[i]) {
+    case 'd':
+      out << static_cast<int>(value);
+      break;
+    case 'f':
+      if (static_cast<int>(value) == AT_FDCWD) {
+        out << "AT_FDCWD";
+      } else {
+        out << static_cast<int>(value);
+      }
+      break;
+    case 'u':
+      out << value;
+      break;
+    case 'o':
+      out << '0' << std::oct << value << std::dec;
+      break;
+    case 's':
+    case 'b':
+      // A range that cannot be read makes the others read one at a time
+      if (sizes[i] != 0 &&
+          (fetched ||
+           read_memory_block(pid, value, memory[i], sizes[i]))) {
+        out << quote(memory[i], sizes[i], kinds[i] == 's');
+        if (kinds[i] == 'b' && args[i + 1] > sizes[i]) {
+          out << "...";
+        }
+        break;
+      }
+      // fall through
+    case 'p':
+      if (value == 0) {
+        out << "NULL";
+        break;
+      }
+      // fall through
+    default:
+      out << "0x" << std::hex << value << std::dec;
+    }
+  }
+  out << ')';
+  return out.str();
+}
+
+auto format_syscall_result(const user_regs_struct &regs) -> std::string {
+  auto result = static_cast<std::int64_t>(regs.rax);
+  if (result < 0 && result >= -4095) {
+    auto error = static_cast<int>(-result);
+    auto name = strerrorname_np(error);
+    return "-1 " + std::string{name != nullptr ? name : "E?"} + " (" +
+           std::strerror(error) + ')';
+  }
+
+  // Calls returning addresses
+  switch (regs.orig_rax) {
+  case SYS_mmap:
+  case SYS_mremap:
+  case SYS_brk:
+  case SYS_shmat: {
+    std::ostringstream out;
+    out << "0x" << std::hex << regs.rax;
+    return out.str();
+  }
+  default:
+    return std::to_string(result);
+  }
+}
+
+auto restart_syscall(pid_t pid, user_regs_struct regs) noexcept -> bool {
+  // The kernel skips a call whose number is invalid
+  auto skipped = regs;
+  skipped.orig_rax = static_cast<std::uint64_t>(-1);
+  int status;
+  if (ptrace(PTRACE_SETREGS, pid, nullptr, &skipped) == -1 ||
+      ptrace(PTRACE_SYSCALL, pid, nullptr, nullptr) == -1 ||
+      waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status) ||
+      WSTOPSIG(status) != (SIGTRAP | 0x80)) {
+    return false;
+  }
+
+  regs.rip -= syscall_length;
+  regs.rax = regs.orig_rax;
+  return ptrace(PTRACE_SETREGS, pid, nullptr, &regs) != -1;
+}
+
+auto trace_syscalls(pid_t pid, std::ostream &out, syscall_timer *timer)
+    -> int {
+  int status;
+  if (waitpid(pid, &status, 0) == -1 || !WIFSTOPPED(status) ||
+      ptrace(PTRACE_SETOPTIONS, pid, nullptr,
+             PTRACE_O_EXITKILL | PTRACE_O_TRACESECCOMP |
+                 PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEEXEC |
+                 PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK |
+                 PTRACE_O_TRACECLONE) == -1) {
+    throw std::out_of_range{"Cannot trace the program"};
+  }
+
+  // A call is printed or timed once it returns, which a stop of the filter
+  // followed by PTRACE_SYSCALL shows. Tasks make their calls independently
+  struct task {
+    std::string call;                            ///< Call being made
+    long number = -1;                            ///< Its number
+    std::chrono::steady_clock::time_point entry; ///< When it was made
+    bool inside = false;                         ///< Whether it is made
+    bool started = false;                        ///< Whether it stopped yet
+  };
+  std::map<pid_t, task> tasks;
+  tasks[pid].started = true;
+  std::string exit;
+  auto code = 0;
+  ptrace(PTRACE_CONT, pid, nullptr, 0);
+  while (!tasks.empty()) {
+    auto stopped = waitpid(-1, &status, __WALL);
+    if (stopped == -1) {
+      throw std::out_of_range{"Cannot trace the program"};
+    }
+
+    // A task may stop before the event of its parent is seen
+    auto *t = &tasks[stopped];
+    auto prefix =
+        stopped == pid ? "" : "[pid " + std::to_string(stopped) + "] ";
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      if (timer == nullptr && t->inside) {
+        out << prefix << t->call << " = ?\n";
+      }
+      std::ostringstream line;
+      if (WIFEXITED(status)) {
+        line << prefix << "+++ exited with " << WEXITSTATUS(status)
+             << " +++\n";
+      } else {
+        line << prefix << "+++ killed by " << strsignal(WTERMSIG(status))
+             << " +++\n";
+      }
+      if (stopped == pid) {
+        exit = line.str();
+        code = WIFEXITED(status) ? WEXITSTATUS(status)
+                                 : 128 + WTERMSIG(status);
+      } else {
+        out << line.str();
+      }
+      tasks.erase(stopped);
+      continue;
+    }
+
+    user_regs_struct regs;
+    auto signal = 0;
+    auto event = status >> 16;
+    if (is_seccomp_stop(status)) {
+      if (ptrace(PTRACE_GETREGS, stopped, nullptr, &regs) != -1) {
+        t->number = static_cast<long>(regs.orig_rax);
+        if (timer == nullptr) {
+          t->call = prefix + format_syscall(stopped, regs);
+        }
+        t->inside = true;
+        t->entry = std::chrono::steady_clock::now();
+      }
+    } else if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+      if (timer != nullptr) {
+        if (t->inside) {
+          timer->record(
+              t->number,
+              static_cast<std::uint64_t>(
+                  std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - t->entry)
+                      .count()));
+        }
+      } else if (t->inside &&
+                 ptrace(PTRACE_GETREGS, stopped, nullptr, &regs) != -1) {
+        out << t->call << " = " << format_syscall_result(regs) << '\n';
+      }
+      t->inside = false;
+    } else if (is_fork_stop(status)) {
+      unsigned long child;
+      if (ptrace(PTRACE_GETEVENTMSG, stopped, nullptr, &child) != -1) {
+        tasks[static_cast<pid_t>(child)];
+      }
+    } else if (event == PTRACE_EVENT_EXEC) {
+      // A thread other than the leader that calls exec takes over the ID
+      // of the leader, and finishes the call under it
+      unsigned long former;
+      if (ptrace(PTRACE_GETEVENTMSG, stopped, nullptr, &former) != -1 &&
+          static_cast<pid_t>(former) != stopped &&
+          tasks.count(static_cast<pid_t>(former)) != 0) {
+        *t = tasks[static_cast<pid_t>(former)];
+        tasks.erase(static_cast<pid_t>(former));
+      }
+    } else if (event == 0 && !(WSTOPSIG(status) == SIGSTOP && !t->started)) {
+      signal = WSTOPSIG(status);
+      out << prefix << "--- " << strsignal(signal) << " ---\n";
+    }
+    t->started = true;
+    ptrace(t->inside ? PTRACE_SYSCALL : PTRACE_CONT, stopped, nullptr, signal);
+  }
+  if (timer != nullptr) {
+    timer->print(out);
+  }
+  out << exit;
+  return code;
+}
+
+auto syscall_catch_table::add(const std::vector<long> &syscalls)
+    -> const syscall_catchpoint & {
+  trace(syscalls);
+  m_catchpoints.push_back({m_next_number++, syscalls});
+  return m_catchpoints.back();
+}
+
+auto syscall_catch_table::remove(unsigned number) -> bool {
+  auto it = std::find_if(
+      m_catchpoints.begin(), m_catchpoints.end(),
+      [number](const syscall_catchpoint &c) { return c.number == number; });
+  if (it == m_catchpoints.end()) {
+    return false;
+  }
+  m_catchpoints.erase(it);
+  return true;
+}
+
+auto syscall_catch_table::find(long syscall) const noexcept
+    -> const syscall_catchpoint * {
+  for (const auto &c : m_catchpoints) {
+    if (c.syscalls.empty() || std::find(c.syscalls.begin(), c.syscalls.end(),
+                                        syscall) != c.syscalls.end()) {
+      return &c;
+    }
+  }
+  return nullptr;
+}
+
+auto syscall_catch_table::set_pid(pid_t pid) -> void {
+  m_pid = pid;
+  m_traced.clear();
+  m_all_traced = false;
+  m_no_new_privs = false;
+  for (const auto &c : m_catchpoints) {
+    trace(c.syscalls);
+  }
+}
+
+auto syscall_catch_table::trace(const std::vector<long> &syscalls) -> void {
+  std::vector<long> untraced;
+  for (auto s : syscalls) {
+    if (m_traced.count(s) == 0 &&
+        std::find(untraced.begin(), untraced.end(), s) == untraced.end()) {
+      untraced.push_back(s);
+    }
+  }
+  if (m_all_traced || (!syscalls.empty() && untraced.empty())) {
+    return;
+  }
+
+  auto filter = make_syscall_filter(
+      untraced, m_injector.scratch_address() + syscall_length);
+  if (!m_no_new_privs) {
+    if (m_injector.call(SYS_prctl, {PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0}) < 0) {
+      throw std::out_of_range{"Cannot allow seccomp filters"};
+    }
+    m_no_new_privs = true;
+  }
+
+  // The program and its filter are written below the red zone of the
+  // stack for the call, and the stack is restored afterwards
+  user_regs_struct regs;
+  if (ptrace(PTRACE_GETREGS, m_pid, nullptr, &regs) == -1) {
+    throw std::out_of_range{"Cannot read registers"};
+  }
+  auto size = sizeof(sock_fprog) + filter.size() * sizeof(sock_filter);
+  auto address = (regs.rsp - red_zone - size) & ~std::uint64_t{15};
+  std::vector<std::uint8_t> saved(size), written(size);
+  sock_fprog program{
+      static_cast<unsigned short>(filter.size()),
+      reinterpret_cast<sock_filter *>(address + sizeof(sock_fprog))};
+  std::memcpy(written.data(), &program, sizeof(program));
+  std::memcpy(written.data() + sizeof(program), filter.data(),
+              filter.size() * sizeof(sock_filter));
+  if (!read_memory_block(m_pid, address, saved.data(), size) ||
+      !write_memory_block(m_pid, address, written.data(), size)) {
+    throw std::out_of_range{"Cannot access the stack"};
+  }
+
+  std::int64_t result;
+  try {
+    result =
+        m_injector.call(SYS_seccomp, {SECCOMP_SET_MODE_FILTER, 0, address});
+  } catch (std::out_of_range &) {
+    result = -EINTR;
+  }
+  write_memory_block(m_pid, address, saved.data(), size);
+  if (result < 0) {
+    throw std::out_of_range{
+        std::string{"Cannot install the seccomp filter: "} +
+        std::strerror(static_cast<int>(-result))};
+  }
+
+  m_traced.insert(untraced.begin(), untraced.end());
+  m_all_traced = syscalls.empty();
+}
@@ -0,0 +1,75 @@
+#include "../include/tls.h"
+#include "../include/memory.h"
+
+#include <cstdint>
+#include <stdexcept>
+
+namespace {
+
+// Offset of the DTV pointer in the thread control block
+constexpr std::uint64_t tcb_dtv_offset = 8;
+
+// Size of an entry of the DTV
+constexpr std::uint64_t dtv_entry_size = 16;
+
+// Value of the entry of a module whose block is allocated on first use
+constexpr std::uint64_t dtv_unallocated = ~std::uint64_t{0};
+
+} // namespace
+
+auto tls_cache::block_address(std::uint64_t thread_pointer,
+                              std::size_t module) -> std::uint64_t {
+  auto &dtv = m_threads[thread_pointer];
+  if (!dtv.checked) {
+    std::uint64_t address;
+    if (!read_memory_block(m_pid, thread_pointer + tcb_dtv_offset, &address,
+                           sizeof(address))) {
+      throw std::out_of_range{"Cannot read the thread control block"};
+    }
+
+    // The length and the generation are the entries before and at index 0
+    std::uint64_t header[3];
+    if (!read_memory_block(m_pid, address - dtv_entry_size, header,
+                           sizeof(header))) {
+      throw std::out_of_range{"Cannot read the DTV"};
+    }
+
+    // A new DTV or generation may have moved or added blocks
+    if (address != dtv.address || header[2] != dtv.generation) {
+      dtv.address = address;
+      dtv.generation = header[2];
+      dtv.blocks.clear();
+    }
+    dtv.length = header[0];
+    dtv.checked = true;
+  }
+
+  if (module < dtv.blocks.size() && dtv.blocks[module] != 0) {
+    return dtv.blocks[module];
+  }
+  if (module == 0 || module > dtv.length) {
+    throw std::out_of_range{"Module has no thread-local storage"};
+  }
+
+  std::uint64_t block;
+  if (!read_memory_block(m_pid, dtv.address + module * dtv_entry_size, &block,
+                         sizeof(block))) {
+    throw std::out_of_range{"Cannot read the DTV"};
+  }
+  if (block == 0 || block == dtv_unallocated) {
+    throw std::out_of_range{
+        "Thread-local storage is not allocated in this thread"};
+  }
+
+  if (dtv.blocks.size() <= module) {
+    dtv.blocks.resize(module + 1);
+  }
+  dtv.blocks[module] = block;
+  return block;
+}
+
+auto tls_cache::invalidate() noexcept -> void {
+  for (auto &thread : m_threads) {
+    thread.second.checked = false;
+  }
+}
@@ -0,0 +1,109 @@
+#include "../include/trace.h"
+#include "../include/memory.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+auto trace_frame::read(std::uint64_t address, void *buffer,
+                       std::size_t size) const noexcept -> bool {
+  auto out = static_cast<std::uint8_t *>(buffer);
+  std::size_t done = 0;
+  while (done < size) {
+    // Ranges may span blocks, such as members collected one by one
+    auto at = address + done;
+    auto block = std::find_if(
+        blocks.begin(), blocks.end(), [at](const trace_block &b) {
+          return at >= b.address && at - b.address < b.bytes.size();
+        });
+    if (block == blocks.end()) {
+      return false;
+    }
+    auto offset = at - block->address;
+    auto n = std::min(size - done, block->bytes.size() - offset);
+    std::memcpy(out + done, block->bytes.data() + offset, n);
+    done += n;
+  }
+  return true;
+}
+
+auto make_trace_frame(const agent_record &record, const agent_site &site,
+                      unsigned tracepoint) -> trace_frame {
+  trace_frame frame;
+  frame.tracepoint = tracepoint;
+  auto saved = reinterpret_cast<const std::uint64_t *>(&record.regs);
+  auto value = [&](std::int32_t index) {
+    return index == agent_base_rsp ? record.rsp : saved[index];
+  };
+  for (unsigned r = 0; r < sizeof(agent_dwarf_registers) /
+                               sizeof(agent_dwarf_registers[0]);
+       ++r) {
+    frame.regs.set(r, value(agent_dwarf_registers[r]));
+  }
+  frame.regs.set(dwarf_return_address_register, record.rip);
+  frame.eflags = record.regs.eflags;
+
+  std::size_t offset = 0;
+  for (std::uint32_t i = 0; i < site.collects && offset < record.size; ++i) {
+    const auto &range = site.collect[i];
+    trace_block block;
+    block.address = static_cast<std::uint64_t>(range.offset);
+    if (range.base >= 0) {
+      block.address += value(range.base);
+    }
+    auto size = std::min<std::size_t>(range.size, record.size - offset);
+    block.bytes.assign(record.data + offset, record.data + offset + size);
+    offset += size;
+    if ((record.unreadable & (1u << i)) == 0) {
+      frame.blocks.push_back(std::move(block));
+    }
+  }
+  return frame;
+}
+
+auto trace_buffer::add(trace_frame frame) -> const trace_frame & {
+  frame.number = m_next++;
+  if (m_frames.size() < m_capacity) {
+    m_frames.push_back(std::move(frame));
+    return m_frames.back();
+  }
+
+  auto &slot = m_frames[frame.number % m_capacity];
+  slot = std::move(frame);
+  ++m_first;
+  return slot;
+}
+
+auto trace_buffer::find(std::uint64_t number) const noexcept
+    -> const trace_frame * {
+  if (number < m_first || number >= m_next) {
+    return nullptr;
+  }
+  return &m_frames[number % m_capacity];
+}
+
+auto trace_buffer::clear() noexcept -> void {
+  m_frames.clear();
+  m_first = 0;
+  m_next = 0;
+}
+
+auto trace_frame_context::read_memory(std::uint64_t address, void *buffer,
+                                      std::size_t size) -> void {
+  if (!m_frame.read(address, buffer, size)) {
+    throw std::out_of_range{"Memory was not collected"};
+  }
+}
+
+auto trace_recorder::read_memory(std::uint64_t address, void *buffer,
+                                 std::size_t size) -> void {
+  frame_context::read_memory(address, buffer, size);
+  auto bytes = static_cast<const std::uint8_t *>(buffer);
+  trace_block block;
+  block.address = address;
+  block.bytes.assign(bytes, bytes + size);
+  m_frame.blocks.push_back(std::move(block));
+}
@@ -0,0 +1,475 @@
+#include "../include/types.h"
+#include "../include/dwarf_expr.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <ios>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Elements of an array printed before the rest are elided
+constexpr std::uint64_t max_printed_elements = 200;
+
+/**
+ * Context for the expressions of DW_AT_data_member_location, which only
+ * ever compute an offset from the address pushed before evaluation.
+ */
+class offset_context : public dwarf_expr_context {
+public:
+  auto reg(unsigned) -> std::uint64_t override {
+    throw std::out_of_range{"No registers in a member offset"};
+  }
+
+  auto read_memory(std::uint64_t, void *, std::size_t) -> void override {
+    throw std::out_of_range{"No memory in a member offset"};
+  }
+};
+
+auto get_name(const dwarf::die &die) -> std::string {
+  return die.has(dwarf::DW_AT::name) ? dwarf::at_name(die) : "";
+}
+
+auto get_uconstant(const dwarf::die &die, dwarf::DW_AT attr,
+                   std::uint64_t fallback) -> std::uint64_t {
+  return die.has(attr) ? die[attr].as_uconstant() : fallback;
+}
+
+auto get_member_offset(const dwarf::die &member) -> std::uint64_t {
+  if (!member.has(dwarf::DW_AT::data_member_location)) {
+    return 0;
+  }
+
+  // DWARF 2 describes offsets with an expression applied to the address of
+  // the structure, in practice a lone DW_OP_plus_uconst
+  auto location = member[dwarf::DW_AT::data_member_location];
+  if (location.get_type() == dwarf::value::type::block ||
+      location.get_type() == dwarf::value::type::exprloc) {
+    std::size_t size;
+    auto expr = static_cast<const std::uint8_t *>(location.as_block(&size));
+    offset_context context;
+    std::uint64_t base = 0;
+    return evaluate_value(dwarf_program{expr, size}, context, &base);
+  }
+  return location.as_uconstant();
+}
+
+auto read_unsigned(const std::uint8_t *data, std::size_t size)
+    -> std::uint64_t {
+  std::uint64_t value = 0;
+  std::memcpy(&value, data, std::min(size, sizeof(value)));
+  return value;
+}
+
+auto read_signed(const std::uint8_t *data, std::size_t size) -> std::int64_t {
+  auto value = read_unsigned(data, size);
+  if (size > 0 && size < 8 && ((value >> (size * 8 - 1)) & 1)) {
+    value |= ~0ull << (size * 8);
+  }
+  return static_cast<std::int64_t>(value);
+}
+
+auto print_char(std::uint64_t c, char quote, std::ostream &out) -> void {
+  switch (c) {
+  case '\n':
+    out << "\\n";
+    break;
+  case '\t':
+    out << "\\t";
+    break;
+  case '\\':
+    out << "\\\\";
+    break;
+  default:
+    if (c == static_cast<std::uint64_t>(quote)) {
+      out << '\\' << quote;
+    } else if (c >= 0x20 && c < 0x7f) {
+      out << static_cast<char>(c);
+    } else {
+      out << '\\' << std::oct << c << std::dec;
+    }
+  }
+}
+
+auto format_base(const type_desc &type, const std::uint8_t *data,
+                 std::ostream &out) -> void {
+  switch (type.encoding) {
+  case dwarf::DW_ATE::boolean:
+    out << (read_unsigned(data, type.size) ? "true" : "false");
+    break;
+  case dwarf::DW_ATE::float_:
+    if (type.size == sizeof(float)) {
+      float f;
+      std::memcpy(&f, data, sizeof(f));
+      out << f;
+    } else if (type.size == sizeof(double)) {
+      double d;
+      std::memcpy(&d, data, sizeof(d));
+      out << d;
+    } else {
+      long double ld = 0;
+      std::memcpy(&ld, data, std::min<std::size_t>(type.size, sizeof(ld)));
+      out << ld;
+    }
+    break;
+  case dwarf::DW_ATE::signed_char:
+  case dwarf::DW_ATE::unsigned_char: {
+    auto c = read_unsigned(data, 1);
+    if (type.encoding == dwarf::DW_ATE::signed_char) {
+      out << read_signed(data, 1);
+    } else {
+      out << c;
+    }
+    out << " '";
+    print_char(c, '\'', out);
+    out << '\'';
+    break;
+  }
+  case dwarf::DW_ATE::signed_:
+    out << read_signed(data, type.size);
+    break;
+  case dwarf::DW_ATE::address:
+    out << "0x" << std::hex << read_unsigned(data, type.size) << std::dec;
+    break;
+  default:
+    out << read_unsigned(data, type.size);
+    break;
+  }
+}
+
+auto is_char(const type_desc &type) noexcept -> bool {
+  return type.kind == type_kind::base && type.size == 1 &&
+         (type.encoding == dwarf::DW_ATE::signed_char ||
+          type.encoding == dwarf::DW_ATE::unsigned_char);
+}
+
+auto format_array(const type_desc &type, std::size_t dimension,
+                  const std::uint8_t *data, std::ostream &out,
+                  value_formatter *custom) -> void {
+  auto count = type.dimensions[dimension];
+
+  // Each element of an outer dimension is an array of the inner ones
+  auto element_size = type.target->size;
+  for (auto d = dimension + 1; d < type.dimensions.size(); ++d) {
+    element_size *= type.dimensions[d];
+  }
+
+  if (dimension + 1 == type.dimensions.size() && is_char(*type.target)) {
+    auto length = static_cast<std::uint64_t>(
+        std::find(data, data + count, 0) - data);
+    format_string(data, std::min(length, max_printed_elements),
+                  length > max_printed_elements, out);
+    return;
+  }
+
+  out << '{';
+  for (std::uint64_t i = 0; i < count; ++i) {
+    if (i == max_printed_elements) {
+      out << "...";
+      break;
+    }
+    if (i != 0) {
+      out << ", ";
+    }
+    if (dimension + 1 < type.dimensions.size()) {
+      format_array(type, dimension + 1, data + i * element_size, out,
+                   custom);
+    } else {
+      format_value(*type.target, data + i * element_size, out, custom);
+    }
+  }
+  out << '}';
+}
+
+auto format_member(const type_member &member, const std::uint8_t *data,
+                   std::ostream &out, value_formatter *custom) -> void {
+  if (member.bit_size == 0) {
+    format_value(*member.type, data + member.offset, out, custom);
+    return;
+  }
+
+  // Bitfields are widened into a local integer of the member's type
+  std::uint64_t bits = 0;
+  auto n_bytes = (member.bit_offset + member.bit_size + 7) / 8;
+  std::uint8_t storage[16] = {};
+  std::memcpy(storage, data + member.offset,
+              std::min<std::uint64_t>(n_bytes, sizeof(storage)));
+  for (std::uint64_t b = 0; b < member.bit_size && b < 64; ++b) {
+    auto src = member.bit_offset + b;
+    bits |= static_cast<std::uint64_t>((storage[src / 8] >> (src % 8)) & 1)
+            << b;
+  }
+
+  auto is_signed = member.type->kind == type_kind::base &&
+                   (member.type->encoding == dwarf::DW_ATE::signed_ ||
+                    member.type->encoding == dwarf::DW_ATE::signed_char);
+  if (is_signed && member.bit_size < 64 &&
+      ((bits >> (member.bit_size - 1)) & 1)) {
+    bits |= ~0ull << member.bit_size;
+  }
+
+  std::uint8_t widened[sizeof(bits)];
+  std::memcpy(widened, &bits, sizeof(bits));
+  auto type = *member.type;
+  type.size = std::min<std::uint64_t>(type.size, sizeof(bits));
+  format_value(type, widened, out);
+}
+
+} // namespace
+
+auto type_index::get(const dwarf::die &die) -> const type_desc & {
+  auto offset = die.get_section_offset();
+  auto cached = m_types.find(offset);
+  if (cached != m_types.end()) {
+    return *cached->second;
+  }
+
+  // Typedefs and qualifiers share the description of the type they name
+  switch (die.tag) {
+  case dwarf::DW_TAG::typedef_:
+  case dwarf::DW_TAG::const_type:
+  case dwarf::DW_TAG::volatile_type:
+  case dwarf::DW_TAG::restrict_type:
+  case dwarf::DW_TAG::packed_type: {
+    const auto &type = get_type_of(die);
+    m_types.emplace(offset, &type);
+    return type;
+  }
+  default:
+    break;
+  }
+
+  // The description is cached before it is built, so that self-referencing
+  // types resolve to it
+  m_storage.emplace_back(new type_desc);
+  auto &type = *m_storage.back();
+  m_types.emplace(offset, &type);
+  build(die, type);
+  return type;
+}
+
+auto type_index::get_type_of(const dwarf::die &die) -> const type_desc & {
+  // Out-of-line definitions leave the type to their declaration
+  if (!die.has(dwarf::DW_AT::type) && die.has(dwarf::DW_AT::specification)) {
+    return get_type_of(die[dwarf::DW_AT::specification].as_reference());
+  }
+  if (!die.has(dwarf::DW_AT::type)) {
+    return m_void;
+  }
+  return get(die[dwarf::DW_AT::type].as_reference());
+}
+
+auto type_index::build(const dwarf::die &die, type_desc &type) -> void {
+  type.name = get_name(die);
+  type.size = get_uconstant(die, dwarf::DW_AT::byte_size, 0);
+
+  switch (die.tag) {
+  case dwarf::DW_TAG::base_type:
+    type.kind = type_kind::base;
+    type.encoding = static_cast<dwarf::DW_ATE>(
+        get_uconstant(die, dwarf::DW_AT::encoding, 0));
+    break;
+
+  case dwarf::DW_TAG::pointer_type:
+  case dwarf::DW_TAG::ptr_to_member_type:
+  case dwarf::DW_TAG::reference_type:
+  case dwarf::DW_TAG::rvalue_reference_type: {
+    type.kind = die.tag == dwarf::DW_TAG::reference_type ||
+                        die.tag == dwarf::DW_TAG::rvalue_reference_type
+                    ? type_kind::reference
+                    : type_kind::pointer;
+    if (type.size == 0) {
+      type.size = sizeof(std::uint64_t);
+    }
+    type.target = &get_type_of(die);
+    auto suffix = type.kind == type_kind::pointer ? "*" : "&";
+    type.name = type.target->kind == type_kind::function
+                    ? type.target->name + " (" + suffix + ")()"
+                    : type.target->name + " " + suffix;
+    break;
+  }
+
+  case dwarf::DW_TAG::structure_type:
+  case dwarf::DW_TAG::class_type:
+  case dwarf::DW_TAG::union_type:
+    type.kind = type_kind::structure;
+    type.is_union = die.tag == dwarf::DW_TAG::union_type;
+    if (type.name.empty()) {
+      type.name = type.is_union ? "<anonymous union>" : "<anonymous struct>";
+    }
+    for (const auto &child : die) {
+      if (child.tag == dwarf::DW_TAG::template_type_parameter) {
+        type.template_args.push_back(&get_type_of(child));
+        continue;
+      }
+      if (child.tag != dwarf::DW_TAG::member &&
+          child.tag != dwarf::DW_TAG::inheritance) {
+        continue;
+      }
+      // Static members are declarations without storage in the object
+      if (child.has(dwarf::DW_AT::declaration) ||
+          child.has(dwarf::DW_AT::external)) {
+        continue;
+      }
+
+      type_member member;
+      member.name = get_name(child);
+      member.type = &get_type_of(child);
+      member.offset = get_member_offset(child);
+      member.is_base_class = child.tag == dwarf::DW_TAG::inheritance;
+      member.bit_size = get_uconstant(child, dwarf::DW_AT::bit_size, 0);
+      if (child.has(dwarf::DW_AT::data_bit_offset)) {
+        auto bit = child[dwarf::DW_AT::data_bit_offset].as_uconstant();
+        member.offset = bit / 8;
+        member.bit_offset = bit % 8;
+      } else if (child.has(dwarf::DW_AT::bit_offset)) {
+        // DWARF 2 and 3 count from the most significant bit of the storage
+        // unit
+        auto unit_bits =
+            get_uconstant(child, dwarf::DW_AT::byte_size, member.type->size) *
+            8;
+        member.bit_offset = unit_bits -
+                            child[dwarf::DW_AT::bit_offset].as_uconstant() -
+                            member.bit_size;
+      }
+      type.members.push_back(std::move(member));
+    }
+    break;
+
+  case dwarf::DW_TAG::array_type: {
+    type.kind = type_kind::array;
+    type.target = &get_type_of(die);
+    std::uint64_t count = 1;
+    for (const auto &child : die) {
+      if (child.tag != dwarf::DW_TAG::subrange_type) {
+        continue;
+      }
+      std::uint64_t n = 0;
+      if (child.has(dwarf::DW_AT::count)) {
+        n = child[dwarf::DW_AT::count].as_uconstant();
+      } else if (child.has(dwarf::DW_AT::upper_bound)) {
+        n = child[dwarf::DW_AT::upper_bound].as_uconstant() + 1 -
+            get_uconstant(child, dwarf::DW_AT::lower_bound, 0);
+      }
+      type.dimensions.push_back(n);
+      count *= n;
+    }
+    if (type.dimensions.empty()) {
+      type.dimensions.push_back(0);
+    }
+    type.size = count * type.target->size;
+    type.name = type.target->name;
+    for (auto n : type.dimensions) {
+      type.name += "[" + std::to_string(n) + "]";
+    }
+    break;
+  }
+
+  case dwarf::DW_TAG::enumeration_type:
+    type.kind = type_kind::enumeration;
+    for (const auto &child : die) {
+      if (child.tag != dwarf::DW_TAG::enumerator ||
+          !child.has(dwarf::DW_AT::const_value)) {
+        continue;
+      }
+      auto value = child[dwarf::DW_AT::const_value];
+      auto n = value.get_type() == dwarf::value::type::sconstant
+                   ? value.as_sconstant()
+                   : static_cast<std::int64_t>(value.as_uconstant());
+      type.enumerators.emplace_back(get_name(child), n);
+    }
+    break;
+
+  case dwarf::DW_TAG::subroutine_type:
+    type.kind = type_kind::function;
+    type.name = get_type_of(die).name;
+    break;
+
+  default:
+    type.kind = type_kind::unknown;
+    if (type.name.empty()) {
+      type.name = "void";
+    }
+    break;
+  }
+}
+
+type_index::type_index() { m_void.name = "void"; }
+
+auto format_string(const std::uint8_t *data, std::size_t size, bool truncated,
+                   std::ostream &out) -> void {
+  out << '"';
+  for (std::size_t i = 0; i < size; ++i) {
+    print_char(data[i], '"', out);
+  }
+  out << (truncated ? "\"..." : "\"");
+}
+
+auto format_value(const type_desc &type, const std::uint8_t *data,
+                  std::ostream &out, value_formatter *custom) -> void {
+  if (custom != nullptr && custom->format(type, data, out)) {
+    return;
+  }
+
+  switch (type.kind) {
+  case type_kind::base:
+    out << std::dec;
+    format_base(type, data, out);
+    break;
+
+  case type_kind::pointer:
+    out << "0x" << std::hex << read_unsigned(data, type.size) << std::dec;
+    break;
+
+  case type_kind::reference:
+    out << "@0x" << std::hex << read_unsigned(data, type.size) << std::dec;
+    break;
+
+  case type_kind::structure: {
+    out << '{';
+    auto first = true;
+    for (const auto &member : type.members) {
+      if (!first) {
+        out << ", ";
+      }
+      first = false;
+      if (member.is_base_class) {
+        out << '<' << member.type->name << "> = ";
+      } else if (!member.name.empty()) {
+        out << member.name << " = ";
+      }
+      format_member(member, data, out, custom);
+    }
+    out << '}';
+    break;
+  }
+
+  case type_kind::array:
+    format_array(type, 0, data, out, custom);
+    break;
+
+  case type_kind::enumeration: {
+    out << std::dec;
+    auto value = read_signed(data, type.size);
+    for (const auto &e : type.enumerators) {
+      if (e.second == value) {
+        out << e.first;
+        return;
+      }
+    }
+    out << value;
+    break;
+  }
+
+  case type_kind::function:
+  case type_kind::unknown:
+    out << "<unknown type>";
+    break;
+  }
+}
@@ -0,0 +1,476 @@
+#include "../include/unwinder.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/ucontext.h>
+#include <vector>
+
+namespace {
+
+// How much stack to capture when the stack mapping is unknown
+constexpr std::uint64_t default_stack_window = 64 * 1024;
+
+// DWARF register numbers of the frame and stack pointers
+constexpr unsigned dwarf_rbp = 6;
+constexpr unsigned dwarf_rsp = 7;
+
+// Instruction encodings recognised in function prologues and epilogues
+constexpr std::uint8_t endbr64[] = {0xf3, 0x0f, 0x1e, 0xfa};
+constexpr std::uint8_t push_rbp = 0x55;
+constexpr std::uint8_t mov_rsp_rbp[] = {0x48, 0x89, 0xe5};
+constexpr std::uint8_t mov_rsp_rbp_alt[] = {0x48, 0x8b, 0xec};
+constexpr std::uint8_t pop_rbp = 0x5d;
+constexpr std::uint8_t leave = 0xc9;
+constexpr std::uint8_t ret = 0xc3;
+
+// mov $15, %rax; syscall, the body of the rt_sigreturn trampoline
+constexpr std::uint8_t rt_sigreturn[] = {0x48, 0xc7, 0xc0, 0x0f, 0x00,
+                                         0x00, 0x00, 0x0f, 0x05};
+
+// Slots of the DWARF registers in the general registers of a ucontext_t
+constexpr int signal_frame_registers[] = {
+    REG_RAX, REG_RDX, REG_RCX, REG_RBX, REG_RSI, REG_RDI,
+    REG_RBP, REG_RSP, REG_R8,  REG_R9,  REG_R10, REG_R11,
+    REG_R12, REG_R13, REG_R14, REG_R15, REG_RIP};
+static_assert(sizeof(signal_frame_registers) / sizeof(int) ==
+                  n_dwarf_registers,
+              "Every DWARF register must have a ucontext_t slot");
+
+/**
+ * The state CFI expressions are evaluated against: the registers of the
+ * frame being unwound and the captured stack.
+ */
+template <typename Reader> class cfi_expr_context : public dwarf_expr_context {
+public:
+  cfi_expr_context(const dwarf_register_set &regs, Reader &stack) noexcept
+      : m_regs{regs}, m_stack{stack} {}
+
+  auto reg(unsigned regnum) -> std::uint64_t override {
+    if (!m_regs.has(regnum)) {
+      throw std::out_of_range{"Register not recovered"};
+    }
+    return m_regs.values[regnum];
+  }
+
+  auto read_memory(std::uint64_t address, void *buffer, std::size_t size)
+      -> void override {
+    std::uint64_t value;
+    if (size > sizeof(value) || !m_stack.read(address, value)) {
+      throw std::out_of_range{"Address is outside the captured stack"};
+    }
+    std::memcpy(buffer, &value, size);
+  }
+
+private:
+  const dwarf_register_set &m_regs;
+  Reader &m_stack;
+};
+
+} // namespace
+
+auto unwinder::unwind(const dwarf_register_set &regs, std::size_t max_frames,
+                      unwind_mode mode) -> std::vector<frame> {
+  std::vector<frame> frames;
+  if (!regs.has(dwarf_return_address_register) || !regs.has(dwarf_rsp)) {
+    return frames;
+  }
+
+  // Frames unwound in another mode recovered a different set of registers
+  if (mode != m_cache_mode) {
+    m_cache.clear();
+    m_cache_mode = mode;
+  }
+
+  auto stack = capture_stack(regs.values[dwarf_rsp]);
+  std::vector<memory_slot> reads;
+  std::vector<std::size_t> read_offsets;
+
+  frame current;
+  current.pc = regs.values[dwarf_return_address_register];
+  current.regs = regs;
+  current.interrupted = true;
+
+  while (frames.size() < max_frames) {
+    frame caller;
+    stack_reader reader{stack, reads};
+    read_offsets.push_back(reads.size());
+
+    // A return address points after the call, which may be the start of the
+    // next function, so look up the call instruction instead
+    auto lookup_pc = current.interrupted ? current.pc : current.pc - 1;
+    auto module = find_module(lookup_pc);
+
+    bool ok;
+    if (is_signal_trampoline(current.pc)) {
+      current.signal_trampoline = true;
+      ok = step_signal_frame(current, reader, caller);
+    } else if (mode == unwind_mode::full) {
+      // Frame pointers do not say where the other callee-saved registers are
+      ok = step_cfi(module, current, reader, caller) ||
+           (has_frame_pointer(module, lookup_pc, current.interrupted) &&
+            step_frame_pointer(current, reader, caller));
+    } else {
+      // Only fall back to CFI when rbp is not a usable frame pointer
+      ok = has_frame_pointer(module, lookup_pc, current.interrupted) &&
+           step_frame_pointer(current, reader, caller);
+      if (!ok) {
+        ok = step_cfi(module, current, reader, caller);
+      }
+    }
+    frames.push_back(current);
+
+    // Stop at the outermost frame, or if the stack does not grow upwards.
+    // Signal handlers may run on an alternate stack, so allow the stack
+    // pointer to move anywhere across a signal frame
+    if (!ok || caller.pc == 0 ||
+        (!current.signal_trampoline &&
+         caller.regs.values[dwarf_rsp] <= current.regs.values[dwarf_rsp])) {
+      break;
+    }
+
+    // The rest of the stack may be unchanged since the previous backtrace
+    auto reused = find_reusable_suffix(caller, stack);
+    if (reused < m_cache.size() && frames.size() < max_frames) {
+      frames.push_back(caller);
+      frames.back().cfa = m_cache[reused].cfa;
+      read_offsets.push_back(reads.size());
+      auto first_read = m_cache_read_offsets[reused];
+      for (auto i = reused + 1;
+           i < m_cache.size() && frames.size() < max_frames; ++i) {
+        frames.push_back(m_cache[i]);
+        read_offsets.push_back(reads.size() +
+                               (m_cache_read_offsets[i] - first_read));
+      }
+      reads.insert(reads.end(), m_cache_reads.begin() + first_read,
+                   m_cache_reads.end());
+      break;
+    }
+
+    current = caller;
+  }
+
+  m_cache = frames;
+  m_cache_reads = std::move(reads);
+  m_cache_read_offsets = std::move(read_offsets);
+
+  return frames;
+}
+
+auto unwinder::find_reusable_suffix(const frame &caller,
+                                    const memory_snapshot &stack) const
+    -> std::size_t {
+  // Cached frames are ordered by increasing stack pointer
+  auto sp = caller.regs.values[dwarf_rsp];
+  auto it = std::lower_bound(m_cache.begin(), m_cache.end(), sp,
+                             [](const frame &f, std::uint64_t value) {
+                               return f.regs.values[dwarf_rsp] < value;
+                             });
+  if (it == m_cache.end() || it->pc != caller.pc ||
+      it->regs.valid != caller.regs.valid ||
+      it->regs.values != caller.regs.values) {
+    return m_cache.size();
+  }
+
+  // The outer frames only depend on the registers of this frame and on the
+  // stack, so they are unchanged if every stack slot they were unwound from is
+  auto index = static_cast<std::size_t>(it - m_cache.begin());
+  for (auto i = m_cache_read_offsets[index]; i < m_cache_reads.size(); ++i) {
+    std::uint64_t value;
+    if (!stack.read(m_cache_reads[i].addr, value) ||
+        value != m_cache_reads[i].value) {
+      return m_cache.size();
+    }
+  }
+
+  return index;
+}
+
+auto unwinder::find_symbol(std::uint64_t pc) const noexcept
+    -> const symbol * {
+  auto module = find_module(pc);
+  return module.symbols->find(pc - module.bias);
+}
+
+auto unwinder::find_module(std::uint64_t pc) const noexcept -> code_module {
+  for (const auto &module : m_modules) {
+    if (pc >= module.low && pc < module.high) {
+      return module;
+    }
+  }
+
+  code_module program;
+  program.bias = m_load_address;
+  program.cfi = &m_cfi;
+  program.symbols = &m_symbols;
+  program.text = m_text;
+  return program;
+}
+
+auto unwinder::has_frame_pointer(const code_module &module,
+                                 std::uint64_t runtime_pc,
+                                 bool is_interrupted) -> bool {
+  auto pc = runtime_pc - module.bias;
+  std::uint64_t start;
+  auto sym = module.symbols->find(pc);
+  if (sym != nullptr) {
+    start = sym->addr;
+  } else if (!module.cfi->find_function_start(pc, start)) {
+    return false;
+  }
+
+  const auto &text = module.text;
+  auto text_low = text.addr;
+  auto text_high = text.addr + text.size;
+  if (start < text_low || start >= text_high || pc >= text_high) {
+    return false;
+  }
+
+  auto cached = m_prologues.find(start + module.bias);
+  if (cached == m_prologues.end()) {
+    prologue_info info;
+    auto code = text.data + (start - text_low);
+    auto end = text.data + text.size;
+    auto matches = [&code, end](const std::uint8_t *insn, std::size_t size) {
+      if (static_cast<std::size_t>(end - code) < size ||
+          !std::equal(insn, insn + size, code)) {
+        return false;
+      }
+      code += size;
+      return true;
+    };
+
+    matches(endbr64, sizeof(endbr64));
+    if (matches(&push_rbp, 1) &&
+        (matches(mov_rsp_rbp, sizeof(mov_rsp_rbp)) ||
+         matches(mov_rsp_rbp_alt, sizeof(mov_rsp_rbp_alt)))) {
+      info.sets_frame_pointer = true;
+      info.established = text_low + (code - text.data);
+    }
+    cached = m_prologues.emplace(start + module.bias, info).first;
+  }
+
+  const auto &info = cached->second;
+  if (!info.sets_frame_pointer || pc < info.established) {
+    return false;
+  }
+
+  if (!is_interrupted) {
+    return true;
+  }
+
+  // Once pop %rbp or leave has run the caller's rbp is back, whether a ret
+  // or the jmp of a tail call follows, so leave those pcs to CFI
+  auto offset = pc - text_low;
+  auto previous = text.data[offset - 1];
+  return text.data[offset] != ret && previous != pop_rbp && previous != leave;
+}
+
+auto unwinder::step_frame_pointer(frame &current, stack_reader &stack,
+                                  frame &caller) -> bool {
+  if (!current.regs.has(dwarf_rbp)) {
+    return false;
+  }
+
+  // rbp points at the saved rbp, which is followed by the return address
+  auto fp = current.regs.values[dwarf_rbp];
+  std::uint64_t saved_fp, ra;
+  if (!stack.read(fp, saved_fp) || !stack.read(fp + 8, ra)) {
+    return false;
+  }
+
+  current.cfa = fp + 16;
+
+  caller = frame{};
+  caller.pc = ra;
+  caller.regs.set(dwarf_rbp, saved_fp);
+  caller.regs.set(dwarf_rsp, current.cfa);
+  caller.regs.set(dwarf_return_address_register, ra);
+
+  return true;
+}
+
+auto unwinder::evaluate_cfi_expression(const std::uint8_t *expr,
+                                       std::size_t size,
+                                       const dwarf_register_set &regs,
+                                       stack_reader &stack,
+                                       const std::uint64_t *initial,
+                                       std::uint64_t &result) -> bool {
+  try {
+    auto program = m_cfi_programs.find(expr);
+    if (program == m_cfi_programs.end()) {
+      program = m_cfi_programs.emplace(expr, dwarf_program{expr, size}).first;
+    }
+
+    cfi_expr_context<stack_reader> context{regs, stack};
+    result = evaluate_value(program->second, context, initial);
+  } catch (std::exception &) {
+    return false;
+  }
+  return true;
+}
+
+auto unwinder::step_cfi(const code_module &module, frame &current,
+                        stack_reader &stack, frame &caller) -> bool {
+  auto lookup_pc = current.interrupted ? current.pc : current.pc - 1;
+  auto row = module.cfi->find_row(lookup_pc - module.bias);
+  if (row == nullptr) {
+    return false;
+  }
+
+  const auto &regs = current.regs;
+  std::uint64_t cfa;
+  if (row->cfa_expr != nullptr) {
+    if (!evaluate_cfi_expression(row->cfa_expr, row->cfa_expr_size, regs,
+                                 stack, nullptr, cfa)) {
+      return false;
+    }
+  } else {
+    if (!regs.has(row->cfa_reg)) {
+      return false;
+    }
+    cfa = regs.values[row->cfa_reg] + row->cfa_offset;
+  }
+  current.cfa = cfa;
+
+  caller = frame{};
+  for (unsigned r = 0; r < n_dwarf_registers; ++r) {
+    const auto &rule = row->regs[r];
+    std::uint64_t value;
+
+    switch (rule.rule) {
+    case register_rule::kind::undefined:
+      break;
+    case register_rule::kind::same_value:
+      if (regs.has(r)) {
+        caller.regs.set(r, regs.values[r]);
+      }
+      break;
+    case register_rule::kind::offset:
+      if (stack.read(cfa + rule.offset, value)) {
+        caller.regs.set(r, value);
+      }
+      break;
+    case register_rule::kind::val_offset:
+      caller.regs.set(r, cfa + rule.offset);
+      break;
+    case register_rule::kind::reg:
+      if (regs.has(rule.reg)) {
+        caller.regs.set(r, regs.values[rule.reg]);
+      }
+      break;
+    case register_rule::kind::expression:
+      if (evaluate_cfi_expression(rule.expr, rule.expr_size, regs, stack, &cfa,
+                                  value) &&
+          stack.read(value, value)) {
+        caller.regs.set(r, value);
+      }
+      break;
+    case register_rule::kind::val_expression:
+      if (evaluate_cfi_expression(rule.expr, rule.expr_size, regs, stack, &cfa,
+                                  value)) {
+        caller.regs.set(r, value);
+      }
+      break;
+    }
+  }
+
+  // The caller's stack pointer is the CFA by definition
+  caller.regs.set(dwarf_rsp, cfa);
+
+  auto ra = row->return_address_register;
+  if (!caller.regs.has(ra)) {
+    return false;
+  }
+  caller.pc = caller.regs.values[ra];
+  caller.regs.set(dwarf_return_address_register, caller.pc);
+
+  // The caller of a frame marked as a signal frame was interrupted rather
+  // than making a call
+  caller.interrupted = row->signal_frame;
+
+  return true;
+}
+
+auto unwinder::is_signal_trampoline(std::uint64_t pc) -> bool {
+  auto cached = m_trampolines.find(pc);
+  if (cached != m_trampolines.end()) {
+    return cached->second;
+  }
+
+  std::uint8_t code[sizeof(rt_sigreturn)];
+  auto is_trampoline =
+      read_memory_block(m_pid, pc, code, sizeof(code)) &&
+      std::equal(rt_sigreturn, rt_sigreturn + sizeof(rt_sigreturn), code);
+  m_trampolines.emplace(pc, is_trampoline);
+  return is_trampoline;
+}
+
+auto unwinder::step_signal_frame(frame &current, stack_reader &stack,
+                                 frame &caller) -> bool {
+  if (!current.regs.has(dwarf_rsp)) {
+    return false;
+  }
+
+  // Returning from the handler popped the return address of the
+  // rt_sigframe, so the stack pointer now points at its ucontext_t
+  auto gregs = current.regs.values[dwarf_rsp] +
+               offsetof(ucontext_t, uc_mcontext) + offsetof(mcontext_t, gregs);
+
+  caller = frame{};
+  for (unsigned r = 0; r < n_dwarf_registers; ++r) {
+    std::uint64_t value;
+    if (!stack.read(gregs + 8 * signal_frame_registers[r], value)) {
+      return false;
+    }
+    caller.regs.set(r, value);
+  }
+
+  caller.pc = caller.regs.values[dwarf_return_address_register];
+  caller.interrupted = true;
+  current.cfa = caller.regs.values[dwarf_rsp];
+
+  return true;
+}
+
+auto unwinder::stack_reader::read(std::uint64_t address,
+                                  std::uint64_t &value) -> bool {
+  if (!m_stack.read(address, value)) {
+    return false;
+  }
+  m_log.push_back({address, value});
+  return true;
+}
+
+auto unwinder::capture_stack(std::uint64_t sp) -> memory_snapshot {
+  // Re-read the mapping on first use and whenever the stack has grown
+  if (m_stack_high == 0 || sp < m_stack_low) {
+    std::ifstream maps("/proc/" + std::to_string(m_pid) + "/maps");
+    std::string line;
+    while (std::getline(maps, line)) {
+      if (line.find("[stack]") != std::string::npos) {
+        std::istringstream range{line};
+        std::string low, high;
+        std::getline(range, low, '-');
+        std::getline(range, high, ' ');
+        m_stack_low = std::stoull(low, nullptr, 16);
+        m_stack_high = std::stoull(high, nullptr, 16);
+        break;
+      }
+    }
+  }
+
+  // The stack only grows down, so the region above sp is still mapped
+  auto high = sp + default_stack_window;
+  if (sp >= m_stack_low && sp < m_stack_high) {
+    high = m_stack_high;
+  }
+
+  return memory_snapshot{m_pid, sp, high};
+}
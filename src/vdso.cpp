@@ -0,0 +1,171 @@
+#include "../include/vdso.h"
+#include "../include/memory.h"
+
+#include <sys/syscall.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+/**
+ * An elf::loader over an ELF image that has been copied into memory.
+ */
+class image_loader : public elf::loader {
+public:
+  explicit image_loader(std::vector<std::uint8_t> image)
+      : m_image{std::move(image)} {}
+
+  auto load(off_t offset, size_t size) -> const void * override {
+    if (offset < 0 ||
+        static_cast<std::size_t>(offset) + size > m_image.size()) {
+      throw std::range_error{"Offset exceeds vDSO image size"};
+    }
+    return m_image.data() + offset;
+  }
+
+private:
+  std::vector<std::uint8_t> m_image;
+};
+
+auto get_section_view(const elf::elf &f, const std::string &name)
+    -> section_view {
+  section_view v;
+  const auto &sec = f.get_section(name);
+  if (sec.valid()) {
+    v.data = static_cast<const std::uint8_t *>(sec.data());
+    v.size = sec.size();
+    v.addr = sec.get_hdr().addr;
+  }
+  return v;
+}
+
+} // namespace
+
+auto vdso::load(pid_t pid) -> bool {
+  std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+  std::string line;
+  std::uint64_t low = 0, high = 0;
+  while (std::getline(maps, line)) {
+    if (line.find("[vdso]") != std::string::npos) {
+      std::istringstream range{line};
+      std::string start, end;
+      std::getline(range, start, '-');
+      std::getline(range, end, ' ');
+      low = std::stoull(start, nullptr, 16);
+      high = std::stoull(end, nullptr, 16);
+      break;
+    }
+  }
+  if (high <= low) {
+    return false;
+  }
+
+  // The whole object, section headers included, lies inside the mapping
+  std::vector<std::uint8_t> image(high - low);
+  if (!read_memory_block(pid, low, image.data(), image.size())) {
+    return false;
+  }
+
+  try {
+    m_elf = elf::elf{std::make_shared<image_loader>(std::move(image))};
+
+    std::uint64_t bias = low;
+    for (const auto &seg : m_elf.segments()) {
+      const auto &hdr = seg.get_hdr();
+      if (hdr.type == elf::pt::load && hdr.offset == 0) {
+        bias = low - hdr.vaddr;
+        break;
+      }
+    }
+
+    m_cfi = cfi_table{get_section_view(m_elf, ".eh_frame_hdr"),
+                      get_section_view(m_elf, ".eh_frame"),
+                      get_section_view(m_elf, ".debug_frame")};
+    m_symbols = symbol_index{m_elf};
+    m_text = get_section_view(m_elf, ".text");
+    m_bias = bias;
+  } catch (std::exception &) {
+    return false;
+  }
+
+  m_low = low;
+  m_high = high;
+  return true;
+}
+
+auto vdso::module() noexcept -> code_module {
+  code_module m;
+  m.low = m_low;
+  m.high = m_high;
+  m.bias = m_bias;
+  m.cfi = &m_cfi;
+  m.symbols = &m_symbols;
+  m.text = m_text;
+  return m;
+}
+
+auto vdso::redirect_clock(pid_t pid) -> void {
+  if (!m_replaced.empty()) {
+    return;
+  }
+
+  const std::pair<const char *, std::uint32_t> functions[] = {
+      {"__vdso_clock_gettime", SYS_clock_gettime},
+      {"__vdso_gettimeofday", SYS_gettimeofday},
+      {"__vdso_time", SYS_time}};
+
+  for (const auto &f : functions) {
+    // mov eax, number; syscall; ret, which takes the arguments as they are
+    std::uint8_t stub[] = {0xb8, 0, 0, 0, 0, 0x0f, 0x05, 0xc3};
+    auto sym = m_symbols.find_by_name(f.first);
+    if (sym == nullptr) {
+      continue;
+    }
+
+    // Some functions only jump to where they are implemented
+    auto address = sym->addr;
+    auto offset = address - m_text.addr;
+    if (sym->size != 0 && sym->size < sizeof(stub)) {
+      std::int32_t distance;
+      if (address < m_text.addr || offset + 5 > m_text.size ||
+          m_text.data[offset] != 0xe9) {
+        continue;
+      }
+      std::memcpy(&distance, m_text.data + offset + 1, sizeof(distance));
+      address += 5 + distance;
+    }
+
+    std::vector<std::uint8_t> code(sizeof(stub));
+    if (!read_memory_block(pid, address + m_bias, code.data(), code.size())) {
+      restore_clock(pid);
+      throw std::out_of_range{"Cannot read the code of " +
+                              std::string{f.first}};
+    }
+    std::memcpy(stub + 1, &f.second, sizeof(f.second));
+    try {
+      write_text(pid, address + m_bias, stub, sizeof(stub));
+    } catch (std::out_of_range &) {
+      restore_clock(pid);
+      throw;
+    }
+    m_replaced.emplace_back(address + m_bias, std::move(code));
+  }
+}
+
+auto vdso::restore_clock(pid_t pid) noexcept -> void {
+  for (const auto &r : m_replaced) {
+    try {
+      write_text(pid, r.first, r.second.data(), r.second.size());
+    } catch (std::out_of_range &) {
+    }
+  }
+  m_replaced.clear();
+}
@@ -0,0 +1,341 @@
+#include "../include/watchpoint.h"
+#include "../include/inject.h"
+#include "../include/memory.h"
+
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+constexpr std::uint64_t page_size = 4096;
+
+// Index of the debug status and control registers
+constexpr unsigned debug_status = 6;
+constexpr unsigned debug_control = 7;
+
+auto page_of(std::uint64_t address) noexcept -> std::uint64_t {
+  return address & ~(page_size - 1);
+}
+
+auto debug_register_offset(unsigned index) noexcept -> std::size_t {
+  return offsetof(user, u_debugreg) + index * sizeof(user::u_debugreg[0]);
+}
+
+// Calls mprotect in the process
+auto inject_mprotect(syscall_injector &injector, std::uint64_t address,
+                     std::uint64_t size, int protection) -> void {
+  auto result = injector.call(
+      SYS_mprotect, {address, size, static_cast<std::uint64_t>(protection)});
+  if (result < 0) {
+    throw std::out_of_range{"Cannot change the protection of watched pages"};
+  }
+}
+
+// Protects runs of adjacent pages, sorted by address, with one call each
+auto protect_pages(syscall_injector &injector,
+                   const std::vector<std::pair<std::uint64_t, int>> &pages)
+    -> void {
+  for (std::size_t i = 0; i < pages.size();) {
+    auto j = i + 1;
+    while (j < pages.size() &&
+           pages[j].first == pages[j - 1].first + page_size &&
+           pages[j].second == pages[i].second) {
+      ++j;
+    }
+    inject_mprotect(injector, pages[i].first, (j - i) * page_size,
+                    pages[i].second);
+    i = j;
+  }
+}
+
+// Gets the protection of the mapping containing an address
+auto mapping_protection(pid_t pid, std::uint64_t address) -> int {
+  std::ifstream maps{"/proc/" + std::to_string(pid) + "/maps"};
+  std::string line;
+  while (std::getline(maps, line)) {
+    std::istringstream in{line};
+    std::uint64_t start, end;
+    char dash;
+    std::string perms;
+    in >> std::hex >> start >> dash >> end >> perms;
+    if (address >= start && address < end && perms.size() >= 3) {
+      return (perms[0] == 'r' ? PROT_READ : 0) |
+             (perms[1] == 'w' ? PROT_WRITE : 0) |
+             (perms[2] == 'x' ? PROT_EXEC : 0);
+    }
+  }
+  throw std::out_of_range{"Address is not mapped"};
+}
+
+} // namespace
+
+auto watchpoint_table::add(std::uint64_t address, std::size_t size)
+    -> const watchpoint & {
+  watchpoint w;
+  w.number = m_next_number;
+  w.address = address;
+  w.size = size;
+  w.value.resize(size);
+  if (size == 0 || !read_memory_block(m_pid, address, w.value.data(), size)) {
+    throw std::out_of_range{"Cannot access memory of the watched object"};
+  }
+
+  auto slot = std::find(m_slots.begin(), m_slots.end(), false);
+  if (!uses_pages(address, size)) {
+    w.kind = watch_kind::hardware;
+    w.slot = static_cast<unsigned>(slot - m_slots.begin());
+    if (ptrace(PTRACE_POKEUSER, m_pid, debug_register_offset(w.slot),
+               address) == -1) {
+      throw std::out_of_range{"Cannot set debug registers"};
+    }
+    m_watchpoints.push_back(std::move(w));
+    try {
+      update_debug_control();
+    } catch (std::out_of_range &) {
+      m_watchpoints.pop_back();
+      throw;
+    }
+    *slot = true;
+  } else {
+    w.kind = watch_kind::page;
+    protect(w);
+    m_watchpoints.push_back(std::move(w));
+  }
+
+  ++m_next_number;
+  return m_watchpoints.back();
+}
+
+auto watchpoint_table::uses_pages(std::uint64_t address,
+                                  std::size_t size) const noexcept -> bool {
+  auto aligned =
+      (size == 1 || size == 2 || size == 4 || size == 8) && address % size == 0;
+  return !aligned ||
+         std::find(m_slots.begin(), m_slots.end(), false) == m_slots.end();
+}
+
+auto watchpoint_table::remove(unsigned number) -> bool {
+  auto it = std::find_if(
+      m_watchpoints.begin(), m_watchpoints.end(),
+      [number](const watchpoint &w) { return w.number == number; });
+  if (it == m_watchpoints.end()) {
+    return false;
+  }
+
+  auto removed = std::move(*it);
+  m_watchpoints.erase(it);
+  if (removed.kind == watch_kind::hardware) {
+    m_slots[removed.slot] = false;
+    update_debug_control();
+  } else {
+    unprotect(removed);
+  }
+  return true;
+}
+
+auto watchpoint_table::check_stop(int signal, std::uint64_t fault_address,
+                                  std::vector<watch_hit> &hits) -> bool {
+  std::vector<std::size_t> watched;
+  auto trapped = false;
+  if (signal == SIGSEGV) {
+    if (m_pages.count(page_of(fault_address)) == 0) {
+      return false;
+    }
+
+    auto opened = step_faulting_instruction(fault_address, trapped);
+    for (std::size_t i = 0; i < m_watchpoints.size(); ++i) {
+      const auto &w = m_watchpoints[i];
+      auto first = page_of(w.address);
+      auto last = page_of(w.address + w.size - 1);
+      if (w.kind == watch_kind::page &&
+          std::any_of(opened.begin(), opened.end(),
+                      [first, last](std::uint64_t page) {
+                        return page >= first && page <= last;
+                      })) {
+        watched.push_back(i);
+      }
+    }
+  } else if (signal == SIGTRAP) {
+    trapped = hardware_triggered();
+    if (!trapped) {
+      return false;
+    }
+  } else {
+    return false;
+  }
+
+  // All of the hardware watchpoints are compared rather than those in the
+  // status, which also catches traps whose status a later step overwrote
+  if (trapped) {
+    for (std::size_t i = 0; i < m_watchpoints.size(); ++i) {
+      if (m_watchpoints[i].kind == watch_kind::hardware) {
+        watched.push_back(i);
+      }
+    }
+  }
+
+  compare(watched, hits);
+  return true;
+}
+
+auto watchpoint_table::hardware_triggered() -> bool {
+  if (std::find(m_slots.begin(), m_slots.end(), true) == m_slots.end()) {
+    return false;
+  }
+
+  errno = 0;
+  auto status = ptrace(PTRACE_PEEKUSER, m_pid,
+                       debug_register_offset(debug_status), nullptr);
+  if (errno != 0 || (status & 0xf) == 0) {
+    return false;
+  }
+  ptrace(PTRACE_POKEUSER, m_pid, debug_register_offset(debug_status), 0);
+  return true;
+}
+
+auto watchpoint_table::protect(const watchpoint &w) -> void {
+  std::vector<std::pair<std::uint64_t, int>> fresh;
+  for (auto page = page_of(w.address); page <= page_of(w.address + w.size - 1);
+       page += page_size) {
+    if (m_pages.count(page) == 0) {
+      fresh.emplace_back(page, mapping_protection(m_pid, page));
+    }
+  }
+
+  auto readonly = fresh;
+  for (auto &page : readonly) {
+    page.second &= ~PROT_WRITE;
+  }
+  protect_pages(m_injector, readonly);
+
+  for (const auto &page : fresh) {
+    m_pages[page.first].protection = page.second;
+  }
+  for (auto page = page_of(w.address); page <= page_of(w.address + w.size - 1);
+       page += page_size) {
+    ++m_pages[page].users;
+  }
+}
+
+auto watchpoint_table::unprotect(const watchpoint &w) -> void {
+  std::vector<std::pair<std::uint64_t, int>> released;
+  for (auto page = page_of(w.address); page <= page_of(w.address + w.size - 1);
+       page += page_size) {
+    auto it = m_pages.find(page);
+    if (it != m_pages.end() && --it->second.users == 0) {
+      released.emplace_back(page, it->second.protection);
+      m_pages.erase(it);
+    }
+  }
+  protect_pages(m_injector, released);
+}
+
+auto watchpoint_table::step_faulting_instruction(std::uint64_t fault_address,
+                                                 bool &trapped)
+    -> std::vector<std::uint64_t> {
+  // An instruction may write across two protected pages, faulting again on
+  // the second once the first is writable
+  std::vector<std::uint64_t> opened;
+  auto page = page_of(fault_address);
+  while (true) {
+    inject_mprotect(m_injector, page, page_size, m_pages[page].protection);
+    opened.push_back(page);
+
+    ptrace(PTRACE_SINGLESTEP, m_pid, nullptr, nullptr);
+    int status;
+    waitpid(m_pid, &status, 0);
+
+    // The debug status only describes the last trap, so it is checked
+    // before the injected calls trap again
+    trapped = hardware_triggered() || trapped;
+
+    siginfo_t info;
+    if (ptrace(PTRACE_GETSIGINFO, m_pid, nullptr, &info) == -1 ||
+        info.si_signo != SIGSEGV) {
+      break;
+    }
+    page = page_of(reinterpret_cast<std::uint64_t>(info.si_addr));
+    if (m_pages.count(page) == 0 ||
+        std::find(opened.begin(), opened.end(), page) != opened.end()) {
+      break;
+    }
+  }
+
+  for (auto p : opened) {
+    inject_mprotect(m_injector, p, page_size,
+                    m_pages[p].protection & ~PROT_WRITE);
+  }
+  return opened;
+}
+
+auto watchpoint_table::compare(const std::vector<std::size_t> &watched,
+                               std::vector<watch_hit> &hits) -> void {
+  std::vector<std::vector<std::uint8_t>> values(watched.size());
+  std::vector<memory_range> ranges;
+  ranges.reserve(watched.size());
+  for (std::size_t k = 0; k < watched.size(); ++k) {
+    const auto &w = m_watchpoints[watched[k]];
+    values[k].resize(w.size);
+    ranges.push_back({w.address, values[k].data(), w.size});
+  }
+  if (!read_memory_ranges(m_pid, ranges)) {
+    throw std::out_of_range{"Cannot access memory of a watched object"};
+  }
+
+  for (std::size_t k = 0; k < watched.size(); ++k) {
+    auto &w = m_watchpoints[watched[k]];
+    if (values[k] != w.value) {
+      hits.push_back({w.number, w.value, values[k]});
+      w.value = std::move(values[k]);
+    }
+  }
+}
+
+auto watchpoint_table::set_pid(pid_t pid) -> void {
+  m_pid = pid;
+  for (auto &w : m_watchpoints) {
+    read_memory_block(m_pid, w.address, w.value.data(), w.size);
+    if (w.kind == watch_kind::hardware &&
+        ptrace(PTRACE_POKEUSER, m_pid, debug_register_offset(w.slot),
+               w.address) == -1) {
+      throw std::out_of_range{"Cannot set debug registers"};
+    }
+  }
+  update_debug_control();
+}
+
+auto watchpoint_table::update_debug_control() -> void {
+  std::uint64_t control = 0;
+  for (const auto &w : m_watchpoints) {
+    if (w.kind != watch_kind::hardware) {
+      continue;
+    }
+
+    // Lengths of 1, 2 and 4 bytes are encoded as the size minus one, and 8
+    // bytes as 2
+    std::uint64_t length = w.size == 8 ? 2 : w.size - 1;
+    control |= std::uint64_t{1} << (w.slot * 2);
+    control |= std::uint64_t{1} << (16 + w.slot * 4);
+    control |= length << (18 + w.slot * 4);
+  }
+
+  if (ptrace(PTRACE_POKEUSER, m_pid, debug_register_offset(debug_control),
+             control) == -1) {
+    throw std::out_of_range{"Cannot set debug registers"};
+  }
+}
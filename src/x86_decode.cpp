@@ -0,0 +1,449 @@
+#include "../include/x86_decode.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// Size of the immediate of an opcode
+enum immediate : std::uint8_t {
+  none,
+  byte,  // imm8 or rel8
+  word,  // imm16
+  full,  // imm32, or imm16 with an operand size prefix
+  enter, // imm16 followed by imm8
+  moffs, // 64-bit address, or 32-bit with an address size prefix
+  mov64  // imm32, or imm64 with REX.W
+};
+
+// Layout of an opcode
+struct opcode_layout {
+  bool valid;
+  bool modrm;
+  immediate imm;
+  bool relative;
+};
+
+constexpr opcode_layout invalid{false, false, none, false};
+
+auto one_byte_layout(std::uint8_t op) noexcept -> opcode_layout {
+  if (op < 0x40) {
+    switch (op & 7) {
+    case 0:
+    case 1:
+    case 2:
+    case 3:
+      return {true, true, none, false};
+    case 4:
+      return {true, false, byte, false};
+    case 5:
+      return {true, false, full, false};
+    default:
+      // push/pop of segment registers and BCD adjustments
+      return invalid;
+    }
+  }
+  if (op >= 0x50 && op <= 0x5f) {
+    return {true, false, none, false};
+  }
+  if (op >= 0x70 && op <= 0x7f) {
+    return {true, false, byte, true};
+  }
+  if (op >= 0x84 && op <= 0x8f) {
+    return {true, true, none, false};
+  }
+  if ((op >= 0x90 && op <= 0x99) || (op >= 0x9b && op <= 0x9f) ||
+      (op >= 0xa4 && op <= 0xa7) || (op >= 0xaa && op <= 0xaf)) {
+    return {true, false, none, false};
+  }
+  if (op >= 0xb0 && op <= 0xb7) {
+    return {true, false, byte, false};
+  }
+  if (op >= 0xb8 && op <= 0xbf) {
+    return {true, false, mov64, false};
+  }
+  if (op >= 0xd8 && op <= 0xdf) {
+    return {true, true, none, false};
+  }
+  if (op >= 0xe0 && op <= 0xe3) {
+    return {true, false, byte, true};
+  }
+
+  switch (op) {
+  case 0x63:
+  case 0xd0:
+  case 0xd1:
+  case 0xd2:
+  case 0xd3:
+  case 0xfe:
+  case 0xff:
+    return {true, true, none, false};
+  case 0x68:
+    return {true, false, full, false};
+  case 0x69:
+  case 0x81:
+  case 0xc7:
+    return {true, true, full, false};
+  case 0x6a:
+  case 0xa8:
+  case 0xcd:
+  case 0xe4:
+  case 0xe5:
+  case 0xe6:
+  case 0xe7:
+    return {true, false, byte, false};
+  case 0x6b:
+  case 0x80:
+  case 0x83:
+  case 0xc0:
+  case 0xc1:
+  case 0xc6:
+    return {true, true, byte, false};
+  case 0x6c:
+  case 0x6d:
+  case 0x6e:
+  case 0x6f:
+  case 0xc3:
+  case 0xc9:
+  case 0xcb:
+  case 0xcc:
+  case 0xcf:
+  case 0xd7:
+  case 0xec:
+  case 0xed:
+  case 0xee:
+  case 0xef:
+  case 0xf1:
+  case 0xf4:
+  case 0xf5:
+  case 0xf8:
+  case 0xf9:
+  case 0xfa:
+  case 0xfb:
+  case 0xfc:
+  case 0xfd:
+    return {true, false, none, false};
+  case 0xa0:
+  case 0xa1:
+  case 0xa2:
+  case 0xa3:
+    return {true, false, moffs, false};
+  case 0xa9:
+    return {true, false, full, false};
+  case 0xc2:
+  case 0xca:
+    return {true, false, word, false};
+  case 0xc8:
+    return {true, false, enter, false};
+  case 0xe8:
+  case 0xe9:
+    return {true, false, full, true};
+  case 0xeb:
+    return {true, false, byte, true};
+  case 0xf6:
+  case 0xf7:
+    // The immediate of test depends on the ModRM byte
+    return {true, true, none, false};
+  default:
+    return invalid;
+  }
+}
+
+auto two_byte_layout(std::uint8_t op) noexcept -> opcode_layout {
+  if (op >= 0x80 && op <= 0x8f) {
+    return {true, false, full, true};
+  }
+  if ((op >= 0x30 && op <= 0x37) || (op >= 0xc8 && op <= 0xcf)) {
+    return {true, false, none, false};
+  }
+  if ((op >= 0x70 && op <= 0x73) || op == 0xa4 || op == 0xac ||
+      op == 0xba || op == 0xc2 || (op >= 0xc4 && op <= 0xc6)) {
+    return {true, true, byte, false};
+  }
+
+  switch (op) {
+  case 0x05:
+  case 0x06:
+  case 0x07:
+  case 0x08:
+  case 0x09:
+  case 0x0b:
+  case 0x0e:
+  case 0x77:
+  case 0xa0:
+  case 0xa1:
+  case 0xa2:
+  case 0xa8:
+  case 0xa9:
+  case 0xaa:
+    return {true, false, none, false};
+  case 0x04:
+  case 0x0a:
+  case 0x0c:
+  case 0x0f:
+  case 0x24:
+  case 0x25:
+  case 0x26:
+  case 0x27:
+  case 0x36:
+  case 0x7a:
+  case 0x7b:
+  case 0xb9:
+  case 0xff:
+    return invalid;
+  default:
+    return {true, true, none, false};
+  }
+}
+
+// Layout of an opcode of a VEX or EVEX map
+auto vex_layout(unsigned map, std::uint8_t op) noexcept -> opcode_layout {
+  switch (map) {
+  case 1:
+    if (op == 0x77) {
+      return {true, false, none, false};
+    }
+    if ((op >= 0x70 && op <= 0x73) || op == 0xc2 ||
+        (op >= 0xc4 && op <= 0xc6)) {
+      return {true, true, byte, false};
+    }
+    return {true, true, none, false};
+  case 2:
+    return {true, true, none, false};
+  case 3:
+    return {true, true, byte, false};
+  default:
+    return invalid;
+  }
+}
+
+} // namespace
+
+auto decode_x86_instruction(const std::uint8_t *code, std::size_t size,
+                            x86_instruction &insn) noexcept -> bool {
+  std::size_t i = 0;
+  auto operand_size = false;
+  auto address_size = false;
+  auto rex_w = false;
+  auto rex_x = 0;
+  auto rex_b = 0;
+  std::uint8_t segment = 0;
+
+  // Legacy prefixes, then REX, which must come last
+  while (i < size) {
+    auto b = code[i];
+    if (b == 0x66) {
+      operand_size = true;
+    } else if (b == 0x67) {
+      address_size = true;
+    } else if (b == 0x64 || b == 0x65) {
+      segment = b;
+    } else if (b != 0xf0 && b != 0xf2 && b != 0xf3 && b != 0x2e &&
+               b != 0x36 && b != 0x3e && b != 0x26 && b != 0x64 &&
+               b != 0x65) {
+      break;
+    }
+    ++i;
+  }
+  if (i < size && (code[i] & 0xf0) == 0x40) {
+    rex_w = (code[i] & 8) != 0;
+    rex_x = (code[i] >> 1) & 1;
+    rex_b = code[i] & 1;
+    ++i;
+  }
+  if (i >= size) {
+    return false;
+  }
+
+  opcode_layout layout;
+  auto map = 0u;
+  auto op = code[i++];
+  if (op == 0x0f) {
+    if (i >= size) {
+      return false;
+    }
+    op = code[i++];
+    map = 1;
+    if (op == 0x38 || op == 0x3a) {
+      if (i >= size) {
+        return false;
+      }
+      map = op == 0x38 ? 2 : 3;
+      layout = vex_layout(map, code[i++]);
+    } else {
+      layout = two_byte_layout(op);
+    }
+  } else if (op == 0xc4 || op == 0xc5 || op == 0x62) {
+    // VEX and EVEX prefixes carry the opcode map in their payload
+    std::size_t payload = op == 0xc5 ? 1 : op == 0xc4 ? 2 : 3;
+    if (i + payload >= size) {
+      return false;
+    }
+    map = op == 0xc5 ? 1u : code[i] & (op == 0xc4 ? 0x1fu : 0x07u);
+    if (op != 0xc5) {
+      // The payload holds the complements of REX.X and REX.B
+      rex_x = (~code[i] >> 6) & 1;
+      rex_b = (~code[i] >> 5) & 1;
+    }
+    i += payload;
+    layout = vex_layout(map, code[i++]);
+  } else {
+    layout = one_byte_layout(op);
+    if ((op == 0xf6 || op == 0xf7) && i < size && (code[i] & 0x38) < 0x10) {
+      layout.imm = op == 0xf6 ? byte : full;
+    }
+  }
+  if (!layout.valid) {
+    return false;
+  }
+
+  insn = x86_instruction{};
+  insn.segment = segment;
+  insn.address_size = address_size;
+  if (layout.modrm) {
+    if (i >= size) {
+      return false;
+    }
+    auto modrm = code[i++];
+    auto mod = modrm >> 6;
+    auto rm = modrm & 7;
+    if (mod != 3) {
+      insn.memory = true;
+      auto disp32 = mod == 2;
+      if (rm == 4) {
+        if (i >= size) {
+          return false;
+        }
+        auto sib = code[i++];
+        auto index = ((sib >> 3) & 7) | (rex_x << 3);
+        insn.scale = static_cast<std::uint8_t>(1 << (sib >> 6));
+        insn.index = static_cast<std::int8_t>(index == 4 ? -1 : index);
+        if (mod == 0 && (sib & 7) == 5) {
+          disp32 = true;
+        } else {
+          insn.base = static_cast<std::int8_t>((sib & 7) | (rex_b << 3));
+        }
+      } else if (mod == 0 && rm == 5) {
+        insn.rip_displacement = i;
+        disp32 = true;
+      } else {
+        insn.base = static_cast<std::int8_t>(rm | (rex_b << 3));
+      }
+
+      if (disp32 && i + 4 <= size) {
+        std::int32_t displacement;
+        std::memcpy(&displacement, code + i, sizeof(displacement));
+        insn.displacement = displacement;
+      } else if (mod == 1 && i < size) {
+        insn.displacement = static_cast<std::int8_t>(code[i]);
+      }
+      i += disp32 ? 4 : mod == 1 ? 1 : 0;
+    }
+
+    // Calls and pushes through ModRM are ff /2, /3 and /6
+    auto reg = (modrm >> 3) & 7;
+    insn.pushes = map == 0 && op == 0xff && (reg == 2 || reg == 3 || reg == 6);
+  }
+
+  if (map == 0 && layout.imm == moffs) {
+    // The operand of these forms of mov is an absolute address
+    insn.memory = true;
+    if (address_size && i + 4 <= size) {
+      std::uint32_t address;
+      std::memcpy(&address, code + i, sizeof(address));
+      insn.displacement = address;
+    } else if (i + 8 <= size) {
+      std::memcpy(&insn.displacement, code + i, sizeof(insn.displacement));
+    }
+  }
+  if (map == 0) {
+    insn.pushes = insn.pushes || (op >= 0x50 && op <= 0x57) || op == 0x68 ||
+                  op == 0x6a || op == 0x9c || op == 0xc8 || op == 0xe8;
+    insn.stores_string =
+        op == 0xa4 || op == 0xa5 || op == 0xaa || op == 0xab;
+  } else if (map == 1) {
+    insn.pushes = op == 0xa0 || op == 0xa8;
+  }
+
+  switch (layout.imm) {
+  case none:
+    break;
+  case byte:
+    i += 1;
+    break;
+  case word:
+    i += 2;
+    break;
+  case full:
+    i += operand_size && !layout.relative ? 2 : 4;
+    break;
+  case enter:
+    i += 3;
+    break;
+  case moffs:
+    i += address_size ? 4 : 8;
+    break;
+  case mov64:
+    i += rex_w ? 8 : operand_size ? 2 : 4;
+    break;
+  }
+  if (i > size || i > 15) {
+    return false;
+  }
+
+  insn.length = i;
+  insn.relative_branch = layout.relative;
+  return true;
+}
+
+auto relocate_x86_instruction(const x86_instruction &insn,
+                              const std::uint8_t *code, std::uint64_t from,
+                              std::uint64_t to, std::uint8_t *out) noexcept
+    -> bool {
+  if (insn.relative_branch) {
+    return false;
+  }
+
+  std::memcpy(out, code, insn.length);
+  if (insn.rip_displacement != 0) {
+    std::int32_t displacement;
+    std::memcpy(&displacement, code + insn.rip_displacement,
+                sizeof(displacement));
+    auto target = static_cast<std::int64_t>(from) + displacement;
+    auto moved = target - static_cast<std::int64_t>(to);
+    if (moved < std::numeric_limits<std::int32_t>::min() ||
+        moved > std::numeric_limits<std::int32_t>::max()) {
+      return false;
+    }
+    displacement = static_cast<std::int32_t>(moved);
+    std::memcpy(out + insn.rip_displacement, &displacement,
+                sizeof(displacement));
+  }
+  return true;
+}
+
+auto x86_memory_address(const x86_instruction &insn, std::uint64_t address,
+                        const std::uint64_t *registers, std::uint64_t fs_base,
+                        std::uint64_t gs_base) noexcept -> std::uint64_t {
+  auto result = static_cast<std::uint64_t>(insn.displacement);
+  if (insn.rip_displacement != 0) {
+    result += address + insn.length;
+  }
+  if (insn.base >= 0) {
+    result += registers[insn.base];
+  }
+  if (insn.index >= 0) {
+    result += registers[insn.index] * insn.scale;
+  }
+  if (insn.address_size) {
+    result &= 0xffffffff;
+  }
+  if (insn.segment == 0x64) {
+    result += fs_base;
+  } else if (insn.segment == 0x65) {
+    result += gs_base;
+  }
+  return result;
+}